@@ -4,15 +4,22 @@
 #include "FormulaLexer.h"
 #include "FormulaParser.h"
 
+#include <algorithm>
 #include <cassert>
+#include <climits>
 #include <cmath>
+#include <cstdlib>
+#include <iterator>
 #include <memory>
 #include <optional>
 #include <sstream>
+#include <string_view>
+#include <vector>
 
 namespace ASTImpl {
 
 enum ExprPrecedence {
+    EP_COMPARE,
     EP_ADD,
     EP_SUB,
     EP_MUL,
@@ -58,26 +65,33 @@ enum PrecedenceRule {
 //     (currently in the table we're always putting in the parentheses)
 // +(A * B) - always okay (the resulting binary op has the highest grammatic precedence)
 // +(A / B) - always okay (the resulting binary op has the highest grammatic precedence)
+// Comparisons have the lowest grammatic precedence and are left-associative:
+// A < (B < C) - never okay, (A < B) + C - never okay
 constexpr PrecedenceRule PRECEDENCE_RULES[EP_END][EP_END] = {
-    /* EP_ADD */ {PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE},
-    /* EP_SUB */ {PR_RIGHT, PR_RIGHT, PR_NONE, PR_NONE, PR_NONE, PR_NONE},
-    /* EP_MUL */ {PR_BOTH, PR_BOTH, PR_NONE, PR_NONE, PR_NONE, PR_NONE},
-    /* EP_DIV */ {PR_BOTH, PR_BOTH, PR_RIGHT, PR_RIGHT, PR_NONE, PR_NONE},
-    /* EP_UNARY */ {PR_BOTH, PR_BOTH, PR_NONE, PR_NONE, PR_NONE, PR_NONE},
-    /* EP_ATOM */ {PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE},
+    /* EP_COMPARE */ {PR_RIGHT, PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE},
+    /* EP_ADD */ {PR_BOTH, PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE},
+    /* EP_SUB */ {PR_BOTH, PR_RIGHT, PR_RIGHT, PR_NONE, PR_NONE, PR_NONE, PR_NONE},
+    /* EP_MUL */ {PR_BOTH, PR_BOTH, PR_BOTH, PR_NONE, PR_NONE, PR_NONE, PR_NONE},
+    /* EP_DIV */ {PR_BOTH, PR_BOTH, PR_BOTH, PR_RIGHT, PR_RIGHT, PR_NONE, PR_NONE},
+    /* EP_UNARY */ {PR_BOTH, PR_BOTH, PR_BOTH, PR_NONE, PR_NONE, PR_NONE, PR_NONE},
+    /* EP_ATOM */ {PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE},
 };
 
 class Expr {
 public:
     virtual ~Expr() = default;
     virtual void Print(std::ostream& out) const = 0;
-    virtual void DoPrintFormula(std::ostream& out, ExprPrecedence precedence) const = 0;
-    virtual double Evaluate(const SheetInterface& sheet) const = 0;
+    virtual void DoPrintFormula(std::ostream& out, ExprPrecedence precedence, Position shift) const = 0;
+    // Ошибки вычисления возвращаются как значение, без исключений
+    virtual Bytecode::FormulaResult Evaluate(const SheetInterface& sheet) const = 0;
+    // Дописывает в программу инструкции, вычисляющие данный узел
+    virtual void Compile(Bytecode::Program& program) const = 0;
 
     // higher is tighter
     virtual ExprPrecedence GetPrecedence() const = 0;
 
-    void PrintFormula(std::ostream& out, ExprPrecedence parent_precedence,
+    // shift - сдвиг ссылок на ячейки (см. FormulaAST::PrintFormula)
+    void PrintFormula(std::ostream& out, ExprPrecedence parent_precedence, Position shift,
                       bool right_child = false) const {
         auto precedence = GetPrecedence();
         auto mask = right_child ? PR_RIGHT : PR_LEFT;
@@ -86,7 +100,7 @@ public:
             out << '(';
         }
 
-        DoPrintFormula(out, precedence);
+        DoPrintFormula(out, precedence, shift);
 
         if (parens_needed) {
             out << ')';
@@ -120,10 +134,10 @@ public:
         out << ')';
     }
 
-    void DoPrintFormula(std::ostream& out, ExprPrecedence precedence) const override {
-        lhs_->PrintFormula(out, precedence);
+    void DoPrintFormula(std::ostream& out, ExprPrecedence precedence, Position shift) const override {
+        lhs_->PrintFormula(out, precedence, shift);
         out << static_cast<char>(type_);
-        rhs_->PrintFormula(out, precedence, /* right_child = */ true);
+        rhs_->PrintFormula(out, precedence, shift, /* right_child = */ true);
     }
 
     ExprPrecedence GetPrecedence() const override {
@@ -144,54 +158,69 @@ public:
     }
 
 // Реализуйте метод Evaluate() для бинарных операций.
-// При делении на 0 выбрасывайте ошибку вычисления FormulaError
-    double Evaluate(const SheetInterface& sheet) const override {
-        double res;
-        double left;
-        double right;
-
-        left = lhs_->Evaluate(sheet);  // м.б. исключения
-        right = rhs_->Evaluate(sheet);  // м.б. исключения
-        
-        // сюда пришли если левый и правый опреанды вычислены правильно
+// При делении на 0 возвращается ошибка вычисления FormulaError
+    Bytecode::FormulaResult Evaluate(const SheetInterface& sheet) const override {
+        const Bytecode::FormulaResult left = lhs_->Evaluate(sheet);
+        if (left.HasError()) {
+            return left;
+        }
+        const Bytecode::FormulaResult right = rhs_->Evaluate(sheet);
+        if (right.HasError()) {
+            return right;
+        }
+
+        // сюда пришли если левый и правый операнды вычислены правильно
+        double res = 0;
         switch (type_) {
             case Add:
-                if (!std::isfinite( res = left + right )) {
-                    throw FormulaError(FormulaError::Category::Arithmetic);
-                }
+                res = left.GetValue() + right.GetValue();
                 break;
-            
             case Subtract:
-                if (!std::isfinite( res = left - right )) {
-                    throw FormulaError(FormulaError::Category::Arithmetic);
-                }
+                res = left.GetValue() - right.GetValue();
                 break;
-            
             case Multiply:
-                if (!std::isfinite( res = left * right )) {
-                    throw FormulaError(FormulaError::Category::Arithmetic);
-                }
+                res = left.GetValue() * right.GetValue();
                 break;
-
-            case Divide: {
-                double divider = right;
-                if (divider == 0) {
-                    throw FormulaError(FormulaError::Category::Arithmetic);
-                }
-                if (! std::isfinite(res = lhs_->Evaluate(sheet) / divider)) {
-                    throw FormulaError(FormulaError::Category::Arithmetic);
+            case Divide:
+                if (right.GetValue() == 0) {
+                    return FormulaError(FormulaError::Category::Arithmetic);
                 }
+                res = left.GetValue() / right.GetValue();
                 break;
-            }
             default:
                 // have to do this because VC++ has a buggy warning
                 assert(false);
                 break;
         }
 
+        if (!std::isfinite(res)) {
+            return FormulaError(FormulaError::Category::Arithmetic);
+        }
         return res;
     }
 
+    void Compile(Bytecode::Program& program) const override {
+        lhs_->Compile(program);
+        rhs_->Compile(program);
+        switch (type_) {
+            case Add:
+                program.EmitOperation(Bytecode::OpCode::Add);
+                break;
+            case Subtract:
+                program.EmitOperation(Bytecode::OpCode::Subtract);
+                break;
+            case Multiply:
+                program.EmitOperation(Bytecode::OpCode::Multiply);
+                break;
+            case Divide:
+                program.EmitOperation(Bytecode::OpCode::Divide);
+                break;
+            default:
+                assert(false);
+                break;
+        }
+    }
+
 private:
     Type type_;
     std::unique_ptr<Expr> lhs_;
@@ -199,6 +228,128 @@ private:
 };
 
 
+// Сравнение двух выражений: 1, если условие выполнено, иначе 0
+class ComparisonExpr final : public Expr {
+public:
+    enum Type {
+        Less,
+        LessOrEqual,
+        Greater,
+        GreaterOrEqual,
+        Equal,
+        NotEqual,
+    };
+
+public:
+    explicit ComparisonExpr(Type type, std::unique_ptr<Expr> lhs, std::unique_ptr<Expr> rhs)
+        : type_(type)
+        , lhs_(std::move(lhs))
+        , rhs_(std::move(rhs)) {
+    }
+
+    void Print(std::ostream& out) const override {
+        out << '(' << GetSymbol() << ' ';
+        lhs_->Print(out);
+        out << ' ';
+        rhs_->Print(out);
+        out << ')';
+    }
+
+    void DoPrintFormula(std::ostream& out, ExprPrecedence precedence, Position shift) const override {
+        lhs_->PrintFormula(out, precedence, shift);
+        out << GetSymbol();
+        rhs_->PrintFormula(out, precedence, shift, /* right_child = */ true);
+    }
+
+    ExprPrecedence GetPrecedence() const override {
+        return EP_COMPARE;
+    }
+
+    Bytecode::FormulaResult Evaluate(const SheetInterface& sheet) const override {
+        const Bytecode::FormulaResult left = lhs_->Evaluate(sheet);
+        if (left.HasError()) {
+            return left;
+        }
+        const Bytecode::FormulaResult right = rhs_->Evaluate(sheet);
+        if (right.HasError()) {
+            return right;
+        }
+
+        bool res = false;
+        switch (type_) {
+            case Less:
+                res = left.GetValue() < right.GetValue();
+                break;
+            case LessOrEqual:
+                res = left.GetValue() <= right.GetValue();
+                break;
+            case Greater:
+                res = left.GetValue() > right.GetValue();
+                break;
+            case GreaterOrEqual:
+                res = left.GetValue() >= right.GetValue();
+                break;
+            case Equal:
+                res = left.GetValue() == right.GetValue();
+                break;
+            case NotEqual:
+                res = left.GetValue() != right.GetValue();
+                break;
+        }
+        return res ? 1. : 0.;
+    }
+
+    void Compile(Bytecode::Program& program) const override {
+        lhs_->Compile(program);
+        rhs_->Compile(program);
+        switch (type_) {
+            case Less:
+                program.EmitOperation(Bytecode::OpCode::Less);
+                break;
+            case LessOrEqual:
+                program.EmitOperation(Bytecode::OpCode::LessOrEqual);
+                break;
+            case Greater:
+                program.EmitOperation(Bytecode::OpCode::Greater);
+                break;
+            case GreaterOrEqual:
+                program.EmitOperation(Bytecode::OpCode::GreaterOrEqual);
+                break;
+            case Equal:
+                program.EmitOperation(Bytecode::OpCode::Equal);
+                break;
+            case NotEqual:
+                program.EmitOperation(Bytecode::OpCode::NotEqual);
+                break;
+        }
+    }
+
+private:
+    Type type_;
+    std::unique_ptr<Expr> lhs_;
+    std::unique_ptr<Expr> rhs_;
+
+    std::string_view GetSymbol() const {
+        switch (type_) {
+            case Less:
+                return "<";
+            case LessOrEqual:
+                return "<=";
+            case Greater:
+                return ">";
+            case GreaterOrEqual:
+                return ">=";
+            case Equal:
+                return "=";
+            case NotEqual:
+                return "<>";
+        }
+        assert(false);
+        return {};
+    }
+};
+
+
 class UnaryOpExpr final : public Expr {
 public:
     enum Type : char {
@@ -218,9 +369,9 @@ public:
         out << ')';
     }
 
-    void DoPrintFormula(std::ostream& out, ExprPrecedence precedence) const override {
+    void DoPrintFormula(std::ostream& out, ExprPrecedence precedence, Position shift) const override {
         out << static_cast<char>(type_);
-        operand_->PrintFormula(out, precedence);
+        operand_->PrintFormula(out, precedence, shift);
     }
 
     ExprPrecedence GetPrecedence() const override {
@@ -228,20 +379,28 @@ public:
     }
 
 // Реализуйте метод Evaluate() для унарных операций.
-    double Evaluate(const SheetInterface& sheet) const override {
-        double res = 0;
+    Bytecode::FormulaResult Evaluate(const SheetInterface& sheet) const override {
+        Bytecode::FormulaResult res = operand_->Evaluate(sheet);
+        if (res.HasError()) {
+            return res;
+        }
         switch (type_) {
             case UnaryPlus:
-                res = operand_->Evaluate(sheet);
-                break;
+                return res;
             case UnaryMinus:
-                res = (-1)*operand_->Evaluate(sheet);
-                break;
+                return -res.GetValue();
             default:
                 assert(false);
-                break;
+                return res;
+        }
+    }
+
+    void Compile(Bytecode::Program& program) const override {
+        operand_->Compile(program);
+        // унарный плюс значение не меняет
+        if (type_ == UnaryMinus) {
+            program.EmitOperation(Bytecode::OpCode::Negate);
         }
-        return res;
     }
 
 private:
@@ -264,8 +423,12 @@ public:
         }
     }
 
-    void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */) const override {
-        Print(out);
+    void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */, Position shift) const override {
+        if (!cell_pos_->IsValid()) {
+            out << FormulaError::Category::Ref;
+        } else {
+            out << Bytecode::ShiftPosition(*cell_pos_, shift).ToString();
+        }
     }
 
     ExprPrecedence GetPrecedence() const override {
@@ -273,66 +436,420 @@ public:
     }
 
 
-    // Получить значение ячейки на позиции cell_. 
-    // Вернет double, если в ячейке число или текст, который может быть 
-    // преобразован в число (пустая ячека -> 0). В противном случае выбрасывает исключения: 
-    // - FormulaError::Category::Ref - позиция ячейки не помещается в таблицу
-    // - FormulaError::Category::Value - в ячейке текст, который не может быть преобразован в число 
-    double Evaluate(const SheetInterface& sheet) const override {
-        // проверяем, что позиция ячейки не выходит за границы таблицы
-        if (!cell_pos_->IsValid()) {
-            throw FormulaError(FormulaError::Category::Ref);
+    // Получить значение ячейки на позиции cell_ (см. Bytecode::LoadCellValue).
+    Bytecode::FormulaResult Evaluate(const SheetInterface& sheet) const override {
+        return Bytecode::LoadCellValue(sheet, *cell_pos_);
+    }
+
+    void Compile(Bytecode::Program& program) const override {
+        program.EmitCell(*cell_pos_);
+    }
+
+private:
+    const Position* cell_pos_;
+};
+
+
+// Область ячеек. Встречается только как аргумент функции (см. FunctionExpr)
+class RangeExpr final : public Expr {
+public:
+    explicit RangeExpr(Range range)
+        : range_(range) {
+    }
+
+    Range GetRange() const {
+        return range_;
+    }
+
+    void Print(std::ostream& out) const override {
+        out << range_.ToString();
+    }
+
+    void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */, Position shift) const override {
+        out << Bytecode::ShiftRange(range_, shift).ToString();
+    }
+
+    ExprPrecedence GetPrecedence() const override {
+        return EP_ATOM;
+    }
+
+    // Область сама по себе не имеет числового значения
+    Bytecode::FormulaResult Evaluate(const SheetInterface&) const override {
+        return FormulaError(FormulaError::Category::Value);
+    }
+
+    // Область компилирует вызывающая её функция (см. FunctionExpr::Compile)
+    void Compile(Bytecode::Program&) const override {
+        assert(false);
+    }
+
+private:
+    Range range_;
+};
+
+
+struct FunctionName {
+    std::string_view name;
+    Bytecode::Function function;
+};
+
+constexpr FunctionName FUNCTION_NAMES[] = {
+    {"SUM", Bytecode::Function::Sum},
+    {"AVERAGE", Bytecode::Function::Average},
+    {"MIN", Bytecode::Function::Min},
+    {"MAX", Bytecode::Function::Max},
+    {"COUNT", Bytecode::Function::Count},
+};
+
+std::optional<Bytecode::Function> FindFunction(std::string_view name) {
+    for (const FunctionName& function_name : FUNCTION_NAMES) {
+        if (function_name.name == name) {
+            return function_name.function;
+        }
+    }
+    return std::nullopt;
+}
+
+std::string_view GetFunctionName(Bytecode::Function function) {
+    for (const FunctionName& function_name : FUNCTION_NAMES) {
+        if (function_name.function == function) {
+            return function_name.name;
         }
+    }
+    assert(false);
+    return {};
+}
 
-        double res = 0;
-        CellInterface::Value val;
-
-        // получаем указатель на ячейку, если его нет, pyfxbn? tcxtqrb ytn => 0:
-        const CellInterface* cell_interf = sheet.GetCell(*cell_pos_);
-        if (cell_interf == nullptr) {
-            return 0;
-        }
-        
-        // тут может выскочить исключение FormulaError любой категории и оно пробросится дальше
-        val = cell_interf->GetValue();
-        
-        // Если исключение не выбросилось, значит строка или число
-        if (std::holds_alternative<std::string>(val)) {
-
-            std::string str_val = std::get<std::string>(val);
-            if (str_val.empty()) {
-                return 0;
+struct LookupName {
+    std::string_view name;
+    Bytecode::Lookup function;
+};
+
+constexpr LookupName LOOKUP_NAMES[] = {
+    {"MATCH", Bytecode::Lookup::Match},
+    {"VLOOKUP", Bytecode::Lookup::VLookup},
+    {"XLOOKUP", Bytecode::Lookup::XLookup},
+};
+
+std::optional<Bytecode::Lookup> FindLookup(std::string_view name) {
+    for (const LookupName& lookup_name : LOOKUP_NAMES) {
+        if (lookup_name.name == name) {
+            return lookup_name.function;
+        }
+    }
+    return std::nullopt;
+}
+
+std::string_view GetLookupName(Bytecode::Lookup function) {
+    for (const LookupName& lookup_name : LOOKUP_NAMES) {
+        if (lookup_name.function == function) {
+            return lookup_name.name;
+        }
+    }
+    assert(false);
+    return {};
+}
+
+// Печать вызова функции для Expr::Print: (NAME arg1 arg2)
+void PrintCall(std::ostream& out, std::string_view name, const std::vector<std::unique_ptr<Expr>>& args) {
+    out << '(' << name;
+    for (const auto& arg : args) {
+        out << ' ';
+        arg->Print(out);
+    }
+    out << ')';
+}
+
+// Печать вызова функции в тексте формулы: NAME(arg1,arg2)
+void PrintCallFormula(std::ostream& out, std::string_view name, const std::vector<std::unique_ptr<Expr>>& args,
+                      Position shift) {
+    out << name << '(';
+    bool is_first = true;
+    for (const auto& arg : args) {
+        if (!is_first) {
+            out << ',';
+        }
+        is_first = false;
+        // аргументы разделены запятыми, скобки вокруг них не нужны
+        arg->PrintFormula(out, EP_COMPARE, shift);
+    }
+    out << ')';
+}
+
+
+// Вызов агрегатной функции: SUM(A1:B3,C5,2). Аргумент - выражение или область
+class FunctionExpr final : public Expr {
+public:
+    explicit FunctionExpr(Bytecode::Function function, std::vector<std::unique_ptr<Expr>> args)
+        : function_(function)
+        , args_(std::move(args)) {
+    }
+
+    void Print(std::ostream& out) const override {
+        PrintCall(out, GetFunctionName(function_), args_);
+    }
+
+    void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */, Position shift) const override {
+        PrintCallFormula(out, GetFunctionName(function_), args_, shift);
+    }
+
+    ExprPrecedence GetPrecedence() const override {
+        return EP_ATOM;
+    }
+
+    Bytecode::FormulaResult Evaluate(const SheetInterface& sheet) const override {
+        Bytecode::Aggregate aggregate(function_);
+        const Bytecode::RangeAggregator* aggregator = Bytecode::GetRangeAggregator(sheet);
+        for (const auto& arg : args_) {
+            if (const auto* range = dynamic_cast<const RangeExpr*>(arg.get())) {
+                // область сворачивается отдельно и вливается целиком - как в байткоде
+                Bytecode::Aggregate range_aggregate(function_);
+                if (std::optional<FormulaError> error = Bytecode::AggregateRange(sheet, aggregator, range->GetRange(), range_aggregate)) {
+                    return *error;
+                }
+                aggregate.Merge(range_aggregate.GetValue(), range_aggregate.GetCount());
+                continue;
             }
-            // Попытка вытащить число из строки
-            std::size_t num_of_converted_char = 0;
-            try {
-                res = std::stod(str_val, &num_of_converted_char);  // исключение invalid_argument если не удалось преобразовать строку в число
-            } catch(const std::invalid_argument& err) {
-                throw FormulaError(FormulaError::Category::Value);
+
+            Bytecode::FormulaResult value = arg->Evaluate(sheet);
+            if (value.HasError()) {
+                return value;
             }
+            aggregate.Add(value.GetValue());
+        }
+        return aggregate.GetResult();
+    }
 
-            // проверка правильной конвертации (должны быть сконвертированы все символы => p будет равно размеру строки)
-            if (num_of_converted_char < str_val.size() && num_of_converted_char > 0) {
-                throw FormulaError(FormulaError::Category::Value);
+    void Compile(Bytecode::Program& program) const override {
+        for (const auto& arg : args_) {
+            if (const auto* range = dynamic_cast<const RangeExpr*>(arg.get())) {
+                program.EmitRange(range->GetRange(), function_);
+            } else {
+                arg->Compile(program);
+                program.EmitNumber(1);
             }
-            
-        } 
-        else if (std::holds_alternative<double>(val)) {
-            res = std::get<double>(val);
-        } 
-        else if (std::holds_alternative<FormulaError>(val)) {
-            FormulaError fe = std::get<FormulaError>(val);
-            throw FormulaError(fe.GetCategory());
         }
+        program.EmitCall(function_, static_cast<uint32_t>(args_.size()));
+    }
 
-        return res;
+private:
+    Bytecode::Function function_;
+    std::vector<std::unique_ptr<Expr>> args_;
+};
+
+
+// Вызов функции поиска: VLOOKUP(A1,C1:E9,2). Первый аргумент - ключ, затем
+// область поиска; у VLOOKUP третий аргумент - номер столбца, у XLOOKUP - область
+// результатов. Области функции - только эти, других аргументов-областей нет
+class LookupExpr final : public Expr {
+public:
+    explicit LookupExpr(Bytecode::LookupCall call, std::vector<std::unique_ptr<Expr>> args)
+        : call_(call)
+        , args_(std::move(args)) {
+    }
+
+    void Print(std::ostream& out) const override {
+        PrintCall(out, GetLookupName(call_.function), args_);
+    }
+
+    void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */, Position shift) const override {
+        PrintCallFormula(out, GetLookupName(call_.function), args_, shift);
+    }
+
+    ExprPrecedence GetPrecedence() const override {
+        return EP_ATOM;
+    }
+
+    Bytecode::FormulaResult Evaluate(const SheetInterface& sheet) const override {
+        Bytecode::FormulaResult key = args_[0]->Evaluate(sheet);
+        if (key.HasError()) {
+            return key;
+        }
+        double column = 0;
+        if (call_.function == Bytecode::Lookup::VLookup) {
+            Bytecode::FormulaResult column_value = args_[2]->Evaluate(sheet);
+            if (column_value.HasError()) {
+                return column_value;
+            }
+            column = column_value.GetValue();
+        }
+        return Bytecode::RunLookup(sheet, Bytecode::GetRangeAggregator(sheet), call_, key.GetValue(), column);
+    }
+
+    void Compile(Bytecode::Program& program) const override {
+        args_[0]->Compile(program);
+        if (call_.function == Bytecode::Lookup::VLookup) {
+            args_[2]->Compile(program);
+        }
+        program.EmitLookup(call_);
     }
 
 private:
-    const Position* cell_pos_;
+    Bytecode::LookupCall call_;
+    std::vector<std::unique_ptr<Expr>> args_;
+};
+
+
+// Условие: IF(cond,then,else). Выполняется только выбранная ветвь;
+// без третьего аргумента при ложном условии значение - 0
+class IfExpr final : public Expr {
+public:
+    explicit IfExpr(std::vector<std::unique_ptr<Expr>> args)
+        : args_(std::move(args)) {
+    }
+
+    void Print(std::ostream& out) const override {
+        PrintCall(out, "IF", args_);
+    }
+
+    void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */, Position shift) const override {
+        PrintCallFormula(out, "IF", args_, shift);
+    }
+
+    ExprPrecedence GetPrecedence() const override {
+        return EP_ATOM;
+    }
+
+    Bytecode::FormulaResult Evaluate(const SheetInterface& sheet) const override {
+        Bytecode::FormulaResult condition = args_[0]->Evaluate(sheet);
+        if (condition.HasError()) {
+            return condition;
+        }
+        if (condition.GetValue() != 0) {
+            return args_[1]->Evaluate(sheet);
+        }
+        return args_.size() == 3 ? args_[2]->Evaluate(sheet) : 0.;
+    }
+
+    void Compile(Bytecode::Program& program) const override {
+        args_[0]->Compile(program);
+        const size_t to_else = program.EmitJump(Bytecode::OpCode::JumpIfFalse);
+        args_[1]->Compile(program);
+        const size_t to_end = program.EmitJump(Bytecode::OpCode::Jump);
+        program.SetJumpTarget(to_else);
+        if (args_.size() == 3) {
+            args_[2]->Compile(program);
+        } else {
+            program.EmitNumber(0);
+        }
+        program.SetJumpTarget(to_end);
+    }
+
+private:
+    std::vector<std::unique_ptr<Expr>> args_;
+};
+
+
+// AND(a,b,...) и OR(a,b,...): 1 или 0. Аргументы вычисляются по порядку,
+// пока результат не станет известен
+class LogicalExpr final : public Expr {
+public:
+    enum Type {
+        And,
+        Or,
+    };
+
+public:
+    explicit LogicalExpr(Type type, std::vector<std::unique_ptr<Expr>> args)
+        : type_(type)
+        , args_(std::move(args)) {
+    }
+
+    void Print(std::ostream& out) const override {
+        PrintCall(out, GetName(), args_);
+    }
+
+    void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */, Position shift) const override {
+        PrintCallFormula(out, GetName(), args_, shift);
+    }
+
+    ExprPrecedence GetPrecedence() const override {
+        return EP_ATOM;
+    }
+
+    Bytecode::FormulaResult Evaluate(const SheetInterface& sheet) const override {
+        // значение аргумента, на котором вычисление останавливается
+        const bool stop_value = type_ == Or;
+        for (const auto& arg : args_) {
+            Bytecode::FormulaResult value = arg->Evaluate(sheet);
+            if (value.HasError()) {
+                return value;
+            }
+            if ((value.GetValue() != 0) == stop_value) {
+                return stop_value ? 1. : 0.;
+            }
+        }
+        return stop_value ? 0. : 1.;
+    }
+
+    void Compile(Bytecode::Program& program) const override {
+        const Bytecode::OpCode stop_jump = type_ == And ? Bytecode::OpCode::JumpIfFalse : Bytecode::OpCode::JumpIfTrue;
+        std::vector<size_t> to_stop;
+        for (const auto& arg : args_) {
+            arg->Compile(program);
+            to_stop.push_back(program.EmitJump(stop_jump));
+        }
+        program.EmitNumber(type_ == And ? 1 : 0);
+        const size_t to_end = program.EmitJump(Bytecode::OpCode::Jump);
+        for (size_t jump : to_stop) {
+            program.SetJumpTarget(jump);
+        }
+        program.EmitNumber(type_ == And ? 0 : 1);
+        program.SetJumpTarget(to_end);
+    }
+
+private:
+    Type type_;
+    std::vector<std::unique_ptr<Expr>> args_;
+
+    std::string_view GetName() const {
+        return type_ == And ? "AND" : "OR";
+    }
 };
 
 
+// Создаёт узел вызова функции name. У функций поиска и условных функций
+// проверяет, какие аргументы - области (для агрегатных функций годится любой)
+std::unique_ptr<Expr> MakeFunctionExpr(std::string_view name, std::vector<std::unique_ptr<Expr>> args) {
+    if (std::optional<Bytecode::Function> function = FindFunction(name)) {
+        return std::make_unique<FunctionExpr>(*function, std::move(args));
+    }
+    if (name == "IF" || name == "AND" || name == "OR") {
+        const bool has_range = std::any_of(args.begin(), args.end(), [](const std::unique_ptr<Expr>& arg) {
+            return dynamic_cast<const RangeExpr*>(arg.get()) != nullptr;
+        });
+        if (has_range || args.empty() || (name == "IF" && args.size() != 2 && args.size() != 3)) {
+            throw ParsingError("Invalid arguments of function " + std::string(name));
+        }
+        if (name == "IF") {
+            return std::make_unique<IfExpr>(std::move(args));
+        }
+        return std::make_unique<LogicalExpr>(name == "AND" ? LogicalExpr::And : LogicalExpr::Or, std::move(args));
+    }
+    std::optional<Bytecode::Lookup> lookup = FindLookup(name);
+    if (!lookup.has_value()) {
+        throw ParsingError("Unknown function: " + std::string(name));
+    }
+
+    auto get_range = [&args](size_t i) -> std::optional<Range> {
+        if (const auto* range = dynamic_cast<const RangeExpr*>(args[i].get())) {
+            return range->GetRange();
+        }
+        return std::nullopt;
+    };
+    const bool is_xlookup = *lookup == Bytecode::Lookup::XLookup;
+    const size_t args_count = *lookup == Bytecode::Lookup::Match ? 2 : 3;
+    if (args.size() != args_count || get_range(0).has_value() || !get_range(1).has_value()
+        || (args_count == 3 && get_range(2).has_value() != is_xlookup)) {
+        throw ParsingError("Invalid arguments of function " + std::string(name));
+    }
+
+    const Range range = *get_range(1);
+    const Bytecode::LookupCall call{*lookup, range, is_xlookup ? *get_range(2) : range};
+    return std::make_unique<LookupExpr>(call, std::move(args));
+}
+
+
 class NumberExpr final : public Expr {
 public:
     explicit NumberExpr(double value)
@@ -343,7 +860,7 @@ public:
         out << value_;
     }
 
-    void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */) const override {
+    void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */, Position /* shift */) const override {
         out << value_;
     }
 
@@ -352,15 +869,411 @@ public:
     }
 
     // Для чисел метод возвращает значение числа.
-    double Evaluate(const SheetInterface&) const override {
+    Bytecode::FormulaResult Evaluate(const SheetInterface&) const override {
         return value_;
     }
 
+    void Compile(Bytecode::Program& program) const override {
+        program.EmitNumber(value_);
+    }
+
 private:
     double value_;
 };
 
 
+// Рукописный разбор формулы без ANTLR: лексер и парсер Пратта.
+// Принимает ровно язык Formula.g4. Лексер выдаёт токены как string_view
+// на исходный текст, поэтому сам разбор память не выделяет (кроме узлов дерева).
+class Tokenizer {
+public:
+    enum class TokenType {
+        Number,
+        Cell,
+        Add,
+        Sub,
+        Mul,
+        Div,
+        Less,
+        LessOrEqual,
+        Greater,
+        GreaterOrEqual,
+        Equal,
+        NotEqual,
+        LeftParen,
+        RightParen,
+        Comma,
+        Colon,
+        Name,
+        End,
+    };
+
+    struct Token {
+        TokenType type = TokenType::End;
+        std::string_view text;
+    };
+
+    explicit Tokenizer(std::string_view text)
+        : text_(text) {
+        Advance();
+    }
+
+    const Token& Peek() const {
+        return current_;
+    }
+
+    Token Take() {
+        Token token = current_;
+        Advance();
+        return token;
+    }
+
+private:
+    std::string_view text_;
+    size_t pos_ = 0;
+    Token current_;
+
+    static bool IsDigit(char ch) {
+        return ch >= '0' && ch <= '9';
+    }
+
+    static bool IsUpper(char ch) {
+        return ch >= 'A' && ch <= 'Z';
+    }
+
+    // Возвращает позицию первого символа после цифр, начиная с from
+    size_t SkipDigits(size_t from) const {
+        while (from < text_.size() && IsDigit(text_[from])) {
+            ++from;
+        }
+        return from;
+    }
+
+    void SetToken(TokenType type, size_t end) {
+        current_ = {type, text_.substr(pos_, end - pos_)};
+        pos_ = end;
+    }
+
+    void Advance() {
+        // WS: [ \t\n\r]+ -> skip
+        while (pos_ < text_.size()
+               && (text_[pos_] == ' ' || text_[pos_] == '\t' || text_[pos_] == '\n' || text_[pos_] == '\r')) {
+            ++pos_;
+        }
+        if (pos_ == text_.size()) {
+            SetToken(TokenType::End, pos_);
+            return;
+        }
+
+        char ch = text_[pos_];
+        switch (ch) {
+            case '+':
+                SetToken(TokenType::Add, pos_ + 1);
+                return;
+            case '-':
+                SetToken(TokenType::Sub, pos_ + 1);
+                return;
+            case '*':
+                SetToken(TokenType::Mul, pos_ + 1);
+                return;
+            case '/':
+                SetToken(TokenType::Div, pos_ + 1);
+                return;
+            case '(':
+                SetToken(TokenType::LeftParen, pos_ + 1);
+                return;
+            case ')':
+                SetToken(TokenType::RightParen, pos_ + 1);
+                return;
+            case ',':
+                SetToken(TokenType::Comma, pos_ + 1);
+                return;
+            case ':':
+                SetToken(TokenType::Colon, pos_ + 1);
+                return;
+            case '=':
+                SetToken(TokenType::Equal, pos_ + 1);
+                return;
+            case '<':
+                // LE: '<=', NE: '<>' - самый длинный токен
+                if (pos_ + 1 < text_.size() && text_[pos_ + 1] == '=') {
+                    SetToken(TokenType::LessOrEqual, pos_ + 2);
+                } else if (pos_ + 1 < text_.size() && text_[pos_ + 1] == '>') {
+                    SetToken(TokenType::NotEqual, pos_ + 2);
+                } else {
+                    SetToken(TokenType::Less, pos_ + 1);
+                }
+                return;
+            case '>':
+                if (pos_ + 1 < text_.size() && text_[pos_ + 1] == '=') {
+                    SetToken(TokenType::GreaterOrEqual, pos_ + 2);
+                } else {
+                    SetToken(TokenType::Greater, pos_ + 1);
+                }
+                return;
+            default:
+                break;
+        }
+
+        if (IsDigit(ch) || ch == '.') {
+            AdvanceNumber();
+        } else if (IsUpper(ch)) {
+            AdvanceCellOrName();
+        } else {
+            throw ParsingError("Error when lexing: unexpected character '" + std::string(1, ch) + "'");
+        }
+    }
+
+    // NUMBER: UINT EXPONENT? | UINT? '.' UINT EXPONENT?
+    void AdvanceNumber() {
+        size_t end = SkipDigits(pos_);
+        bool has_integer_part = end > pos_;
+
+        if (end + 1 < text_.size() && text_[end] == '.' && IsDigit(text_[end + 1])) {
+            end = SkipDigits(end + 1);
+        } else if (!has_integer_part) {
+            throw ParsingError("Error when lexing: unexpected character '.'");
+        }
+
+        // EXPONENT: [eE] [-+]? UINT
+        if (end < text_.size() && (text_[end] == 'e' || text_[end] == 'E')) {
+            size_t exponent = end + 1;
+            if (exponent < text_.size() && (text_[exponent] == '+' || text_[exponent] == '-')) {
+                ++exponent;
+            }
+            size_t exponent_end = SkipDigits(exponent);
+            if (exponent_end > exponent) {
+                end = exponent_end;
+            }
+        }
+
+        SetToken(TokenType::Number, end);
+    }
+
+    // CELL: [A-Z]+[0-9]+
+    // NAME: [A-Z]+
+    void AdvanceCellOrName() {
+        size_t end = pos_;
+        while (end < text_.size() && IsUpper(text_[end])) {
+            ++end;
+        }
+        size_t digits_end = SkipDigits(end);
+        if (digits_end == end) {
+            SetToken(TokenType::Name, end);
+        } else {
+            SetToken(TokenType::Cell, digits_end);
+        }
+    }
+};
+
+
+class FastParser {
+public:
+    explicit FastParser(std::string_view text)
+        : tokens_(text) {
+    }
+
+    FormulaAST Parse() {
+        // main: expr EOF
+        auto root = ParseExpr(0);
+        ExpectToken(Tokenizer::TokenType::End);
+        return FormulaAST(std::move(root), std::move(cells_));
+    }
+
+private:
+    using TokenType = Tokenizer::TokenType;
+
+    // Сила связывания операций: чем больше, тем теснее.
+    // Бинарные операции левоассоциативны, унарные связываются теснее всех
+    // (как в Formula.g4, где UnaryOp стоит раньше BinaryOp), сравнения - слабее всех
+    static constexpr int BP_COMPARE = 1;
+    static constexpr int BP_ADD = 3;
+    static constexpr int BP_MUL = 5;
+    static constexpr int BP_UNARY = 7;
+
+    Tokenizer tokens_;
+    std::forward_list<Position> cells_;
+
+    void ExpectToken(TokenType type) {
+        if (tokens_.Peek().type != type) {
+            throw ParsingError("Error when parsing: unexpected token '" + std::string(tokens_.Peek().text) + "'");
+        }
+        tokens_.Take();
+    }
+
+    bool TryTakeToken(TokenType type) {
+        if (tokens_.Peek().type != type) {
+            return false;
+        }
+        tokens_.Take();
+        return true;
+    }
+
+    std::unique_ptr<Expr> ParseExpr(int min_binding_power) {
+        return ParseInfix(ParsePrefix(), min_binding_power);
+    }
+
+    // Продолжает разбор выражения, первый операнд которого уже разобран
+    std::unique_ptr<Expr> ParseInfix(std::unique_ptr<Expr> lhs, int min_binding_power) {
+        while (true) {
+            if (std::optional<ComparisonExpr::Type> comparison = GetComparison(tokens_.Peek().type)) {
+                if (BP_COMPARE < min_binding_power) {
+                    return lhs;
+                }
+                tokens_.Take();
+                auto rhs = ParseExpr(BP_COMPARE + 1);
+                lhs = std::make_unique<ComparisonExpr>(*comparison, std::move(lhs), std::move(rhs));
+                continue;
+            }
+
+            int binding_power = 0;
+            BinaryOpExpr::Type type;
+            switch (tokens_.Peek().type) {
+                case TokenType::Add:
+                    binding_power = BP_ADD;
+                    type = BinaryOpExpr::Add;
+                    break;
+                case TokenType::Sub:
+                    binding_power = BP_ADD;
+                    type = BinaryOpExpr::Subtract;
+                    break;
+                case TokenType::Mul:
+                    binding_power = BP_MUL;
+                    type = BinaryOpExpr::Multiply;
+                    break;
+                case TokenType::Div:
+                    binding_power = BP_MUL;
+                    type = BinaryOpExpr::Divide;
+                    break;
+                default:
+                    return lhs;
+            }
+
+            if (binding_power < min_binding_power) {
+                return lhs;
+            }
+            tokens_.Take();
+
+            // правый операнд связывается теснее - левая ассоциативность
+            auto rhs = ParseExpr(binding_power + 1);
+            lhs = std::make_unique<BinaryOpExpr>(type, std::move(lhs), std::move(rhs));
+        }
+    }
+
+    static std::optional<ComparisonExpr::Type> GetComparison(TokenType type) {
+        switch (type) {
+            case TokenType::Less:
+                return ComparisonExpr::Less;
+            case TokenType::LessOrEqual:
+                return ComparisonExpr::LessOrEqual;
+            case TokenType::Greater:
+                return ComparisonExpr::Greater;
+            case TokenType::GreaterOrEqual:
+                return ComparisonExpr::GreaterOrEqual;
+            case TokenType::Equal:
+                return ComparisonExpr::Equal;
+            case TokenType::NotEqual:
+                return ComparisonExpr::NotEqual;
+            default:
+                return std::nullopt;
+        }
+    }
+
+    std::unique_ptr<Expr> ParsePrefix() {
+        Tokenizer::Token token = tokens_.Take();
+        switch (token.type) {
+            case TokenType::Number:
+                return std::make_unique<NumberExpr>(ParseNumber(token.text));
+
+            case TokenType::Cell:
+                return MakeCellExpr(token.text);
+
+            case TokenType::Name:
+                return ParseFunction(token.text);
+
+            case TokenType::LeftParen: {
+                auto expr = ParseExpr(0);
+                ExpectToken(TokenType::RightParen);
+                return expr;
+            }
+
+            case TokenType::Add:
+                return std::make_unique<UnaryOpExpr>(UnaryOpExpr::UnaryPlus, ParseExpr(BP_UNARY));
+
+            case TokenType::Sub:
+                return std::make_unique<UnaryOpExpr>(UnaryOpExpr::UnaryMinus, ParseExpr(BP_UNARY));
+
+            default:
+                throw ParsingError("Error when parsing: unexpected token '" + std::string(token.text) + "'");
+        }
+    }
+
+    std::unique_ptr<Expr> MakeCellExpr(std::string_view text) {
+        auto value = ParsePosition(text);
+        cells_.push_front(value);
+        return std::make_unique<CellExpr>(&cells_.front());
+    }
+
+    static Position ParsePosition(std::string_view text) {
+        auto value = Position::FromString(text);
+        if (!value.IsValid()) {
+            throw FormulaException("Invalid position: " + std::string(text));
+        }
+        return value;
+    }
+
+    // NAME '(' arg (',' arg)* ')'
+    std::unique_ptr<Expr> ParseFunction(std::string_view name) {
+        ExpectToken(TokenType::LeftParen);
+        std::vector<std::unique_ptr<Expr>> args;
+        do {
+            args.push_back(ParseArgument());
+        } while (TryTakeToken(TokenType::Comma));
+        ExpectToken(TokenType::RightParen);
+        return MakeFunctionExpr(name, std::move(args));
+    }
+
+    // arg: CELL ':' CELL | expr
+    std::unique_ptr<Expr> ParseArgument() {
+        if (tokens_.Peek().type != TokenType::Cell) {
+            return ParseExpr(0);
+        }
+        Tokenizer::Token first = tokens_.Take();
+        if (!TryTakeToken(TokenType::Colon)) {
+            return ParseInfix(MakeCellExpr(first.text), 0);
+        }
+        Tokenizer::Token second = tokens_.Take();
+        if (second.type != TokenType::Cell) {
+            throw ParsingError("Error when parsing: unexpected token '" + std::string(second.text) + "'");
+        }
+        return std::make_unique<RangeExpr>(Range::FromCorners(ParsePosition(first.text), ParsePosition(second.text)));
+    }
+
+    // Преобразует текст литерала в число так же, как ParseASTListener
+    // (переполнение - ошибка разбора)
+    static double ParseNumber(std::string_view text) {
+        constexpr size_t BUFFER_SIZE = 64;
+        char buffer[BUFFER_SIZE];
+        std::string long_text;
+        const char* begin = buffer;
+        if (text.size() < BUFFER_SIZE) {
+            text.copy(buffer, text.size());
+            buffer[text.size()] = '\0';
+        } else {
+            long_text = std::string(text);
+            begin = long_text.c_str();
+        }
+
+        char* end = nullptr;
+        double value = std::strtod(begin, &end);
+        if (end != begin + text.size() || std::isinf(value)) {
+            throw ParsingError("Invalid number: " + std::string(text));
+        }
+        return value;
+    }
+};
+
+
 class ParseASTListener final : public FormulaBaseListener {
 public:
     std::unique_ptr<Expr> MoveRoot() {
@@ -418,6 +1331,34 @@ public:
         args_.push_back(std::move(node));
     }
 
+    void exitRangeArg(FormulaParser::RangeArgContext* ctx) override {
+        Position corners[2];
+        for (size_t i = 0; i < 2; ++i) {
+            auto value_str = ctx->CELL(i)->getSymbol()->getText();
+            corners[i] = Position::FromString(value_str);
+            if (!corners[i].IsValid()) {
+                throw FormulaException("Invalid position: " + value_str);
+            }
+        }
+
+        auto node = std::make_unique<RangeExpr>(Range::FromCorners(corners[0], corners[1]));
+        args_.push_back(std::move(node));
+    }
+
+    void exitFunction(FormulaParser::FunctionContext* ctx) override {
+        auto name = ctx->NAME()->getSymbol()->getText();
+
+        // аргументы функции - последние ctx->arg().size() элементов стека
+        const size_t args_count = ctx->arg().size();
+        assert(args_.size() >= args_count);
+        auto args_begin = args_.end() - static_cast<std::ptrdiff_t>(args_count);
+        std::vector<std::unique_ptr<Expr>> args(std::make_move_iterator(args_begin), std::make_move_iterator(args_.end()));
+        args_.erase(args_begin, args_.end());
+
+        auto node = MakeFunctionExpr(name, std::move(args));
+        args_.push_back(std::move(node));
+    }
+
     void exitBinaryOp(FormulaParser::BinaryOpContext* ctx) override {
         assert(args_.size() >= 2);
 
@@ -442,6 +1383,34 @@ public:
         args_.back() = std::move(node);
     }
 
+    void exitComparison(FormulaParser::ComparisonContext* ctx) override {
+        assert(args_.size() >= 2);
+
+        auto rhs = std::move(args_.back());
+        args_.pop_back();
+
+        auto lhs = std::move(args_.back());
+
+        ComparisonExpr::Type type;
+        if (ctx->LT()) {
+            type = ComparisonExpr::Less;
+        } else if (ctx->LE()) {
+            type = ComparisonExpr::LessOrEqual;
+        } else if (ctx->GT()) {
+            type = ComparisonExpr::Greater;
+        } else if (ctx->GE()) {
+            type = ComparisonExpr::GreaterOrEqual;
+        } else if (ctx->EQ()) {
+            type = ComparisonExpr::Equal;
+        } else {
+            assert(ctx->NE() != nullptr);
+            type = ComparisonExpr::NotEqual;
+        }
+
+        auto node = std::make_unique<ComparisonExpr>(type, std::move(lhs), std::move(rhs));
+        args_.back() = std::move(node);
+    }
+
     void visitErrorNode(antlr4::tree::ErrorNode* node) override {
         throw ParsingError("Error when parsing: " + node->getSymbol()->getText());
     }
@@ -466,10 +1435,10 @@ public:
 }  // namespace ASTImpl
 
 
-FormulaAST ParseFormulaAST(std::istream& in) {
-    using namespace antlr4;
+namespace {
 
-    ANTLRInputStream input(in);
+FormulaAST ParseWithAntlr(antlr4::ANTLRInputStream& input) {
+    using namespace antlr4;
 
     FormulaLexer lexer(&input);
     ASTImpl::BailErrorListener error_listener;
@@ -490,10 +1459,60 @@ FormulaAST ParseFormulaAST(std::istream& in) {
     return FormulaAST(listener.MoveRoot(), listener.MoveCells());
 }
 
+}  // namespace
+
+
+FormulaAST ParseFormulaAST(std::istream& in) {
+    antlr4::ANTLRInputStream input(in);
+    return ParseWithAntlr(input);
+}
+
+
+FormulaAST ParseFormulaAST(std::string_view in) {
+#ifdef SPREADSHEET_FAST_PARSER
+    return ParseFormulaASTFast(in);
+#else
+    return ParseFormulaASTAntlr(in);
+#endif
+}
+
+
+FormulaAST ParseFormulaASTFast(std::string_view in) {
+    return ASTImpl::FastParser(in).Parse();
+}
+
 
-FormulaAST ParseFormulaAST(const std::string& in_str) {
-    std::istringstream in(in_str);
-    return ParseFormulaAST(in);
+FormulaAST ParseFormulaASTAntlr(std::string_view in) {
+    antlr4::ANTLRInputStream input(std::string{in});
+    return ParseWithAntlr(input);
+}
+
+
+std::string GetRelativeFormulaKey(std::string_view expression, Position pos) {
+    using TokenType = ASTImpl::Tokenizer::TokenType;
+
+    std::string key;
+    key.reserve(expression.size() + 8);
+    ASTImpl::Tokenizer tokens(expression);
+    for (ASTImpl::Tokenizer::Token token = tokens.Take(); token.type != TokenType::End; token = tokens.Take()) {
+        if (!key.empty()) {
+            // без разделителя "1 2" совпало бы с "12"
+            key += ' ';
+        }
+        const Position cell = token.type == TokenType::Cell ? Position::FromString(token.text) : Position::NONE;
+        if (!cell.IsValid()) {
+            // неверная ссылка остаётся как есть: такую формулу не разобрать
+            key += token.text;
+            continue;
+        }
+        // в лексемах нет квадратных скобок, так что сдвиг не спутать с другой лексемой
+        key += '[';
+        key += std::to_string(cell.row - pos.row);
+        key += ',';
+        key += std::to_string(cell.col - pos.col);
+        key += ']';
+    }
+    return key;
 }
 
 
@@ -509,20 +1528,32 @@ void FormulaAST::Print(std::ostream& out) const {
 }
 
 
-void FormulaAST::PrintFormula(std::ostream& out) const {
-    root_expr_->PrintFormula(out, ASTImpl::EP_ATOM);
+void FormulaAST::PrintFormula(std::ostream& out, Position shift) const {
+    root_expr_->PrintFormula(out, ASTImpl::EP_ATOM, shift);
 }
 
-// Может выбросить исключения:
+// Возвращает число или ошибку:
 /*
 - FormulaError::Category::Ref - позиция ячейки не помещается в таблицу
 - FormulaError::Category::Value -в ячейке текст, который не может быть преобразован в число 
 - FormulaError::Category::Arithmetic
 */
-double FormulaAST::Execute(const SheetInterface& sheet) const {
-    // double res;
-    // res = root_expr_->Evaluate(sheet);  // может выскочить исключение FormulaError
-    return root_expr_->Evaluate(sheet);  // может выскочить исключение FormulaError;
+Bytecode::FormulaResult FormulaAST::Execute(const SheetInterface& sheet, const Bytecode::Placement& placement) const {
+    return program_.Execute(sheet, placement);
+}
+
+std::optional<Bytecode::FormulaResult> FormulaAST::Execute(const SheetInterface& sheet, const Bytecode::Placement& placement,
+                                                           Bytecode::InputGate& gate) const {
+    return program_.Execute(sheet, placement, gate);
+}
+
+std::vector<Bytecode::FormulaResult> FormulaAST::ExecuteBatch(const SheetInterface& sheet,
+                                                              const std::vector<Bytecode::Placement>& placements) const {
+    return program_.ExecuteBatch(sheet, placements);
+}
+
+Bytecode::FormulaResult FormulaAST::ExecuteByTree(const SheetInterface& sheet) const {
+    return root_expr_->Evaluate(sheet);
 }
 
 
@@ -530,6 +1561,8 @@ FormulaAST::FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr, std::forward_li
     : root_expr_(std::move(root_expr))
     , cells_(std::move(cells)) {
     cells_.sort();  // to avoid sorting in GetReferencedCells
+    root_expr_->Compile(program_);
+    program_.Finalize();
 }
 
 FormulaAST::~FormulaAST() = default;
\ No newline at end of file
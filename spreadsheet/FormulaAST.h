@@ -1,11 +1,12 @@
 #pragma once
 
-#include "FormulaLexer.h"
+#include "FormulaBytecode.h"
 #include "common.h"
 
 #include <forward_list>
 #include <functional>
 #include <stdexcept>
+#include <string_view>
 
 namespace ASTImpl {
 // Узел дерева
@@ -24,10 +25,22 @@ public:
     FormulaAST& operator=(FormulaAST&&) = default;
     ~FormulaAST();
 
-    double Execute(const SheetInterface& sheet) const;
+    // Вычисляет формулу, выполняя скомпилированный байткод. Ссылки
+    // сдвигаются на placement.shift (см. Bytecode::Placement)
+    Bytecode::FormulaResult Execute(const SheetInterface& sheet, const Bytecode::Placement& placement = {}) const;
+    // То же, но чтения ячеек и областей проходят через gate (см. Bytecode::Program::Execute)
+    std::optional<Bytecode::FormulaResult> Execute(const SheetInterface& sheet, const Bytecode::Placement& placement,
+                                                   Bytecode::InputGate& gate) const;
+    // Вычисляет формулу для каждого размещения из placements за один проход
+    // байткода по всем сразу (см. Bytecode::Program::ExecuteBatch)
+    std::vector<Bytecode::FormulaResult> ExecuteBatch(const SheetInterface& sheet,
+                                                      const std::vector<Bytecode::Placement>& placements) const;
+    // Вычисляет формулу рекурсивным обходом дерева (для сравнения с байткодом)
+    Bytecode::FormulaResult ExecuteByTree(const SheetInterface& sheet) const;
     void PrintCells(std::ostream& out) const;
     void Print(std::ostream& out) const;
-    void PrintFormula(std::ostream& out) const;
+    // Печатает формулу со ссылками, сдвинутыми на shift
+    void PrintFormula(std::ostream& out, Position shift = {0, 0}) const;
 
     std::forward_list<Position>& GetCells() {
         return cells_;
@@ -37,9 +50,33 @@ public:
         return cells_;
     }
 
+    // Упорядоченный список ячеек формулы без повторов
+    const std::vector<Position>& GetReferencedCells() const {
+        return program_.GetCells();
+    }
+
+    // Упорядоченный список областей формулы без повторов (аргументы функций)
+    const std::vector<Range>& GetReferencedRanges() const {
+        return program_.GetRanges();
+    }
+
+    // Есть ли в формуле ветвления (IF, AND, OR): тогда вычисление
+    // читает не все ячейки и области формулы
+    bool HasBranches() const {
+        return program_.HasBranches();
+    }
+
+    // Выполняет ли ExecuteBatch формулу пачкой (см. Bytecode::Program::IsBatchable)
+    bool IsBatchable() const {
+        return program_.IsBatchable();
+    }
+
 private:
     std::unique_ptr<ASTImpl::Expr> root_expr_;
 
+    // дерево, скомпилированное в линейную программу для стековой машины
+    Bytecode::Program program_;
+
     // physically stores cells so that they can be
     // efficiently traversed without going through
     // the whole AST
@@ -54,4 +91,17 @@ Cоздаёт дерево из текста формулы.
 */
 // Этот метод поменяется, будет возвращать ещё список других ячеек, содержащихся в формуле 
 FormulaAST ParseFormulaAST(std::istream& in);
-FormulaAST ParseFormulaAST(const std::string& in_str);
+// Разбирает формулу парсером, выбранным при сборке: рукописным, если задан
+// SPREADSHEET_FAST_PARSER, иначе через ANTLR
+FormulaAST ParseFormulaAST(std::string_view in);
+
+// Рукописный лексер и парсер Пратта, работающие прямо по string_view (без ANTLR)
+FormulaAST ParseFormulaASTFast(std::string_view in);
+// Разбор через ANTLR. Остаётся эталоном для сравнения с рукописным парсером
+FormulaAST ParseFormulaASTAntlr(std::string_view in);
+
+// Запись формулы, не зависящая от её ячейки pos: лексемы через пробел,
+// ссылки на ячейки - сдвиги относительно pos (как в R1C1). Формулы с одинаковой
+// записью разбираются в одно и то же дерево с точностью до сдвига ссылок.
+// Бросает ParsingError, если текст не разбивается на лексемы
+std::string GetRelativeFormulaKey(std::string_view expression, Position pos);
@@ -0,0 +1,826 @@
+#include "FormulaBytecode.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <variant>
+
+namespace Bytecode {
+
+namespace {
+
+// Для большинства формул стек помещается в массив на стеке вызова
+constexpr int LOCAL_STACK_SIZE = 64;
+
+// Порядок "сначала строка, затем столбец". Согласован с Position::operator<:
+// если a < b, то и здесь a раньше b
+bool PositionLess(Position lhs, Position rhs) {
+    return lhs.row < rhs.row || (lhs.row == rhs.row && lhs.col < rhs.col);
+}
+
+bool RangeLess(Range lhs, Range rhs) {
+    if (!(lhs.from == rhs.from)) {
+        return PositionLess(lhs.from, rhs.from);
+    }
+    return PositionLess(lhs.to, rhs.to);
+}
+
+// Сколько формул выполняется за один проход программы (см. Program::ExecuteBatch)
+constexpr size_t BATCH_SIZE = 64;
+// Программы короче выполняются по одной формуле: у пачки есть постоянные
+// расходы на формулу (сбор значений ячеек, проверка кешей), и короткая
+// арифметика их не окупает. Порог - точка безубыточности BenchBatchEvaluation
+constexpr size_t MIN_BATCH_INSTRUCTIONS = 40;
+
+// Ошибки формул пачки хранятся байтами: 0 - ошибки нет, иначе категория + 1
+uint8_t ToErrorCode(FormulaError::Category category) {
+    return static_cast<uint8_t>(category) + 1;
+}
+
+FormulaError FromErrorCode(uint8_t code) {
+    return FormulaError(static_cast<FormulaError::Category>(code - 1));
+}
+
+// Запоминает арифметическую ошибку у формул пачки, значение которых
+// не конечно, если у них ещё нет ошибки (действует первая ошибка, как в Run)
+void CheckFinite(const double* values, uint8_t* errors) {
+    const uint8_t arithmetic = ToErrorCode(FormulaError::Category::Arithmetic);
+    for (size_t lane = 0; lane < BATCH_SIZE; ++lane) {
+        // в отличие от std::isfinite сравнение векторизуется
+        const bool is_finite = std::abs(values[lane]) <= std::numeric_limits<double>::max();
+        errors[lane] = (errors[lane] != 0 || is_finite) ? errors[lane] : arithmetic;
+    }
+}
+
+// Бинарная операция над пачкой: left[i] = operation(left[i], right[i])
+template <typename Operation>
+void ApplyToBatch(double* left, const double* right, Operation operation) {
+    for (size_t lane = 0; lane < BATCH_SIZE; ++lane) {
+        left[lane] = operation(left[lane], right[lane]);
+    }
+}
+
+// Сколько значений области собирается в массив перед свёрткой
+constexpr size_t RANGE_CHUNK_SIZE = 256;
+
+/*
+Ядра свёртки непрерывного массива чисел. Несколько независимых накопителей
+разрывают цепочку зависимостей между соседними операциями, поэтому компилятор
+векторизует внутренний цикл (SSE2/AVX), а результат не зависит от того,
+векторизован цикл или нет
+*/
+constexpr size_t KERNEL_LANES = 4;
+
+double SumValues(const double* values, size_t count) {
+    double lanes[KERNEL_LANES] = {0, 0, 0, 0};
+    size_t i = 0;
+    for (; i + KERNEL_LANES <= count; i += KERNEL_LANES) {
+        for (size_t lane = 0; lane < KERNEL_LANES; ++lane) {
+            lanes[lane] += values[i + lane];
+        }
+    }
+    double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < count; ++i) {
+        sum += values[i];
+    }
+    return sum;
+}
+
+double MinValues(const double* values, size_t count, double init) {
+    double lanes[KERNEL_LANES] = {init, init, init, init};
+    size_t i = 0;
+    for (; i + KERNEL_LANES <= count; i += KERNEL_LANES) {
+        for (size_t lane = 0; lane < KERNEL_LANES; ++lane) {
+            lanes[lane] = values[i + lane] < lanes[lane] ? values[i + lane] : lanes[lane];
+        }
+    }
+    double min = std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+    for (; i < count; ++i) {
+        min = std::min(min, values[i]);
+    }
+    return min;
+}
+
+double MaxValues(const double* values, size_t count, double init) {
+    double lanes[KERNEL_LANES] = {init, init, init, init};
+    size_t i = 0;
+    for (; i + KERNEL_LANES <= count; i += KERNEL_LANES) {
+        for (size_t lane = 0; lane < KERNEL_LANES; ++lane) {
+            lanes[lane] = values[i + lane] > lanes[lane] ? values[i + lane] : lanes[lane];
+        }
+    }
+    double max = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+    for (; i < count; ++i) {
+        max = std::max(max, values[i]);
+    }
+    return max;
+}
+
+bool IsVector(Range range) {
+    return range.from.row == range.to.row || range.from.col == range.to.col;
+}
+
+int GetCellsCount(Range range) {
+    return (range.to.row - range.from.row + 1) * (range.to.col - range.from.col + 1);
+}
+
+// Ячейка номер offset строки или столбца range
+Position GetVectorCell(Range range, int offset) {
+    if (range.from.col == range.to.col) {
+        return Position{range.from.row + offset, range.from.col};
+    }
+    return Position{range.from.row, range.from.col + offset};
+}
+
+// Номер первой ячейки строки или столбца range с числом key. Столбец ищется
+// по индексу таблицы, если он есть, иначе ячейки перебираются по порядку
+std::optional<int> FindInVector(const SheetInterface& sheet, const RangeAggregator* aggregator, Range range, double key) {
+    if (range.from.col == range.to.col) {
+        if (aggregator != nullptr) {
+            std::optional<int> row;
+            if (aggregator->FindInColumn(range, key, row)) {
+                return row.has_value() ? std::optional<int>(*row - range.from.row) : std::nullopt;
+            }
+        }
+    }
+
+    const int cells_count = GetCellsCount(range);
+    for (int offset = 0; offset < cells_count; ++offset) {
+        const CellInterface* cell = sheet.GetCell(GetVectorCell(range, offset));
+        if (cell == nullptr) {
+            continue;
+        }
+        std::optional<CellInterface::NumericValue> value = cell->GetRangeValue();
+        if (value.has_value()) {
+            const double* number = std::get_if<double>(&*value);
+            if (number != nullptr && *number == key) {
+                return offset;
+            }
+        }
+    }
+    return std::nullopt;
+}
+
+}  // namespace
+
+
+Aggregate::Aggregate(Function function)
+    : function_(function) {
+    switch (function_) {
+        case Function::Min:
+            value_ = std::numeric_limits<double>::infinity();
+            break;
+        case Function::Max:
+            value_ = -std::numeric_limits<double>::infinity();
+            break;
+        default:
+            value_ = 0;
+            break;
+    }
+}
+
+void Aggregate::Add(double value) {
+    Merge(value, 1);
+}
+
+void Aggregate::AddValues(const double* values, size_t count) {
+    switch (function_) {
+        case Function::Min:
+            value_ = MinValues(values, count, value_);
+            break;
+        case Function::Max:
+            value_ = MaxValues(values, count, value_);
+            break;
+        case Function::Count:
+            break;
+        default:
+            value_ += SumValues(values, count);
+            break;
+    }
+    count_ += static_cast<double>(count);
+}
+
+void Aggregate::Merge(double value, double count) {
+    // NaN не теряется, как и в свёртках RangeAggregates (std::min и std::max
+    // возвращают первый аргумент, если второй - NaN)
+    switch (function_) {
+        case Function::Min:
+            value_ = std::isnan(value) ? value : std::min(value_, value);
+            break;
+        case Function::Max:
+            value_ = std::isnan(value) ? value : std::max(value_, value);
+            break;
+        case Function::Count:
+            break;
+        default:
+            value_ += value;
+            break;
+    }
+    count_ += count;
+}
+
+FormulaResult Aggregate::GetResult() const {
+    double result = 0;
+    switch (function_) {
+        case Function::Sum:
+            result = value_;
+            break;
+        case Function::Average:
+            if (count_ == 0) {
+                return FormulaError(FormulaError::Category::Arithmetic);
+            }
+            result = value_ / count_;
+            break;
+        case Function::Min:
+        case Function::Max:
+            result = count_ == 0 ? 0 : value_;
+            break;
+        case Function::Count:
+            result = count_;
+            break;
+    }
+    if (!std::isfinite(result)) {
+        return FormulaError(FormulaError::Category::Arithmetic);
+    }
+    return result;
+}
+
+
+void Program::Push(Instruction instruction, int depth_change) {
+    code_.push_back(instruction);
+    depth_ += depth_change;
+    max_depth_ = std::max(max_depth_, depth_);
+}
+
+void Program::EmitNumber(double value) {
+    constants_.push_back(value);
+    Push({OpCode::PushNumber, static_cast<uint32_t>(constants_.size() - 1)}, 1);
+}
+
+void Program::EmitCell(Position pos) {
+    cells_.push_back(pos);
+    Push({OpCode::LoadCell, static_cast<uint32_t>(cells_.size() - 1)}, 1);
+}
+
+void Program::EmitOperation(OpCode op) {
+    assert(op != OpCode::PushNumber && op != OpCode::LoadCell && op != OpCode::LoadRange && op != OpCode::Call
+           && op != OpCode::Lookup && op != OpCode::Jump && op != OpCode::JumpIfFalse && op != OpCode::JumpIfTrue);
+    Push({op}, op == OpCode::Negate ? 0 : -1);
+}
+
+void Program::EmitRange(Range range, Function function) {
+    range_arguments_.push_back({range, function});
+    Push({OpCode::LoadRange, static_cast<uint32_t>(range_arguments_.size() - 1)}, 2);
+}
+
+void Program::EmitCall(Function function, uint32_t arguments_count) {
+    calls_.push_back({function, arguments_count});
+    Push({OpCode::Call, static_cast<uint32_t>(calls_.size() - 1)}, 1 - 2 * static_cast<int>(arguments_count));
+}
+
+void Program::EmitLookup(const LookupCall& call) {
+    lookups_.push_back(call);
+    Push({OpCode::Lookup, static_cast<uint32_t>(lookups_.size() - 1)}, call.function == Lookup::VLookup ? -1 : 0);
+}
+
+size_t Program::EmitJump(OpCode op) {
+    assert(op == OpCode::Jump || op == OpCode::JumpIfFalse || op == OpCode::JumpIfTrue);
+    has_branches_ = true;
+    Push({op}, -1);
+    return code_.size() - 1;
+}
+
+void Program::SetJumpTarget(size_t jump) {
+    code_[jump].arg = static_cast<uint32_t>(code_.size());
+}
+
+
+bool Program::IsBatchable() const {
+    return range_arguments_.empty() && calls_.empty() && lookups_.empty() && !has_branches_
+           && code_.size() >= MIN_BATCH_INSTRUCTIONS;
+}
+
+
+void Program::Finalize() {
+    std::vector<Position> positions = cells_;
+    std::sort(positions.begin(), positions.end(), PositionLess);
+    positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+
+    // перенумеровываем ссылки на ячейки в инструкциях
+    for (Instruction& instruction : code_) {
+        if (instruction.op == OpCode::LoadCell) {
+            Position pos = cells_[instruction.arg];
+            auto it = std::lower_bound(positions.begin(), positions.end(), pos, PositionLess);
+            instruction.arg = static_cast<uint32_t>(it - positions.begin());
+        }
+    }
+    cells_ = std::move(positions);
+
+    ranges_.clear();
+    for (const RangeArgument& argument : range_arguments_) {
+        ranges_.push_back(argument.range);
+    }
+    for (const LookupCall& call : lookups_) {
+        ranges_.push_back(call.range);
+        if (call.function == Lookup::XLookup) {
+            ranges_.push_back(call.result_range);
+        }
+    }
+    std::sort(ranges_.begin(), ranges_.end(), RangeLess);
+    ranges_.erase(std::unique(ranges_.begin(), ranges_.end()), ranges_.end());
+}
+
+
+FormulaResult Program::Execute(const SheetInterface& sheet, const Placement& placement) const {
+    assert(depth_ == 1);
+    if (max_depth_ <= LOCAL_STACK_SIZE) {
+        std::array<double, LOCAL_STACK_SIZE> stack;
+        return *Run(sheet, placement, stack.data(), nullptr);
+    }
+    std::vector<double> stack(max_depth_);
+    return *Run(sheet, placement, stack.data(), nullptr);
+}
+
+
+std::optional<FormulaResult> Program::Execute(const SheetInterface& sheet, const Placement& placement,
+                                              InputGate& gate) const {
+    assert(depth_ == 1);
+    if (max_depth_ <= LOCAL_STACK_SIZE) {
+        std::array<double, LOCAL_STACK_SIZE> stack;
+        return Run(sheet, placement, stack.data(), &gate);
+    }
+    std::vector<double> stack(max_depth_);
+    return Run(sheet, placement, stack.data(), &gate);
+}
+
+
+std::optional<FormulaResult> Program::Run(const SheetInterface& sheet, const Placement& placement, double* stack,
+                                          InputGate* gate) const {
+    // top указывает на первую свободную позицию стека
+    double* top = stack;
+    const FormulaError arithmetic_error(FormulaError::Category::Arithmetic);
+    // свёртки и индексы таблицы нужны только формулам с областями
+    const RangeAggregator* aggregator = range_arguments_.empty() && lookups_.empty() ? nullptr : GetRangeAggregator(sheet);
+
+    const Instruction* next = code_.data();
+    const Instruction* const end = next + code_.size();
+    while (next != end) {
+        const Instruction& instruction = *next++;
+        switch (instruction.op) {
+            case OpCode::PushNumber:
+                *top++ = constants_[instruction.arg];
+                break;
+
+            case OpCode::LoadCell: {
+                const Position pos = ShiftPosition(cells_[instruction.arg], placement.shift);
+                if (gate != nullptr && !gate->Admit(pos)) {
+                    return std::nullopt;
+                }
+                FormulaResult cell_value = placement.bound_cells == nullptr
+                    ? LoadCellValue(sheet, pos)
+                    : LoadCellValue(placement.bound_cells[instruction.arg]);
+                if (cell_value.HasError()) {
+                    return cell_value;
+                }
+                *top++ = cell_value.GetValue();
+                break;
+            }
+
+            case OpCode::Add: {
+                double right = *--top;
+                if (!std::isfinite(top[-1] += right)) {
+                    return arithmetic_error;
+                }
+                break;
+            }
+
+            case OpCode::Subtract: {
+                double right = *--top;
+                if (!std::isfinite(top[-1] -= right)) {
+                    return arithmetic_error;
+                }
+                break;
+            }
+
+            case OpCode::Multiply: {
+                double right = *--top;
+                if (!std::isfinite(top[-1] *= right)) {
+                    return arithmetic_error;
+                }
+                break;
+            }
+
+            case OpCode::Divide: {
+                double divider = *--top;
+                if (divider == 0 || !std::isfinite(top[-1] /= divider)) {
+                    return arithmetic_error;
+                }
+                break;
+            }
+
+            case OpCode::Negate:
+                top[-1] = -top[-1];
+                break;
+
+            case OpCode::LoadRange: {
+                const RangeArgument& argument = range_arguments_[instruction.arg];
+                const Range range = ShiftRange(argument.range, placement.shift);
+                if (gate != nullptr && !gate->Admit(range)) {
+                    return std::nullopt;
+                }
+                Aggregate aggregate(argument.function);
+                if (std::optional<FormulaError> error = AggregateRange(sheet, aggregator, range, aggregate)) {
+                    return *error;
+                }
+                *top++ = aggregate.GetValue();
+                *top++ = aggregate.GetCount();
+                break;
+            }
+
+            case OpCode::Call: {
+                const FunctionCall& call = calls_[instruction.arg];
+                top -= 2 * call.arguments_count;
+                Aggregate aggregate(call.function);
+                for (uint32_t i = 0; i < call.arguments_count; ++i) {
+                    aggregate.Merge(top[2 * i], top[2 * i + 1]);
+                }
+                FormulaResult result = aggregate.GetResult();
+                if (result.HasError()) {
+                    return result;
+                }
+                *top++ = result.GetValue();
+                break;
+            }
+
+            case OpCode::Lookup: {
+                LookupCall call = lookups_[instruction.arg];
+                call.range = ShiftRange(call.range, placement.shift);
+                call.result_range = ShiftRange(call.result_range, placement.shift);
+                if (gate != nullptr
+                    && (!gate->Admit(call.range) || (call.function == Lookup::XLookup && !gate->Admit(call.result_range)))) {
+                    return std::nullopt;
+                }
+                double column = 0;
+                if (call.function == Lookup::VLookup) {
+                    column = *--top;
+                }
+                FormulaResult result = RunLookup(sheet, aggregator, call, top[-1], column);
+                if (result.HasError()) {
+                    return result;
+                }
+                top[-1] = result.GetValue();
+                break;
+            }
+
+            case OpCode::Less: {
+                double right = *--top;
+                top[-1] = top[-1] < right ? 1 : 0;
+                break;
+            }
+
+            case OpCode::LessOrEqual: {
+                double right = *--top;
+                top[-1] = top[-1] <= right ? 1 : 0;
+                break;
+            }
+
+            case OpCode::Greater: {
+                double right = *--top;
+                top[-1] = top[-1] > right ? 1 : 0;
+                break;
+            }
+
+            case OpCode::GreaterOrEqual: {
+                double right = *--top;
+                top[-1] = top[-1] >= right ? 1 : 0;
+                break;
+            }
+
+            case OpCode::Equal: {
+                double right = *--top;
+                top[-1] = top[-1] == right ? 1 : 0;
+                break;
+            }
+
+            case OpCode::NotEqual: {
+                double right = *--top;
+                top[-1] = top[-1] != right ? 1 : 0;
+                break;
+            }
+
+            case OpCode::Jump:
+                next = code_.data() + instruction.arg;
+                break;
+
+            case OpCode::JumpIfFalse:
+                if (*--top == 0) {
+                    next = code_.data() + instruction.arg;
+                }
+                break;
+
+            case OpCode::JumpIfTrue:
+                if (*--top != 0) {
+                    next = code_.data() + instruction.arg;
+                }
+                break;
+        }
+    }
+
+    return stack[0];
+}
+
+
+std::vector<FormulaResult> Program::ExecuteBatch(const SheetInterface& sheet, const std::vector<Placement>& placements) const {
+    std::vector<FormulaResult> results;
+    results.reserve(placements.size());
+    if (!IsBatchable()) {
+        for (const Placement& placement : placements) {
+            results.push_back(Execute(sheet, placement));
+        }
+        return results;
+    }
+
+    assert(depth_ == 1);
+    BatchBuffers buffers;
+    buffers.stack.resize(static_cast<size_t>(max_depth_) * BATCH_SIZE);
+    buffers.cell_values.resize(cells_.size() * BATCH_SIZE);
+    buffers.cell_errors.resize(cells_.size() * BATCH_SIZE);
+    for (size_t first = 0; first < placements.size(); first += BATCH_SIZE) {
+        const size_t count = std::min(BATCH_SIZE, placements.size() - first);
+        RunBatch(sheet, placements.data() + first, count, buffers, results);
+    }
+    return results;
+}
+
+
+void Program::RunBatch(const SheetInterface& sheet, const Placement* placements, size_t count, BatchBuffers& buffers,
+                       std::vector<FormulaResult>& results) const {
+    // Сначала значения ячеек собираются в непрерывные строки: строка на
+    // ячейку из cells_, в ней по числу на формулу пачки. Каждая ячейка
+    // читается один раз, сколько бы раз она ни встречалась в формуле
+    double* const cell_values = buffers.cell_values.data();
+    uint8_t* const cell_errors = buffers.cell_errors.data();
+    for (size_t lane = 0; lane < count; ++lane) {
+        const Placement& placement = placements[lane];
+        for (size_t i = 0; i < cells_.size(); ++i) {
+            FormulaResult cell_value = placement.bound_cells == nullptr
+                ? LoadCellValue(sheet, ShiftPosition(cells_[i], placement.shift))
+                : LoadCellValue(placement.bound_cells[i]);
+            const bool has_error = cell_value.HasError();
+            cell_values[i * BATCH_SIZE + lane] = has_error ? 0 : cell_value.GetValue();
+            cell_errors[i * BATCH_SIZE + lane] = has_error ? ToErrorCode(cell_value.GetError().GetCategory()) : 0;
+        }
+    }
+    for (size_t i = 0; i < cells_.size(); ++i) {
+        std::fill(cell_values + i * BATCH_SIZE + count, cell_values + (i + 1) * BATCH_SIZE, 0.);
+        std::fill(cell_errors + i * BATCH_SIZE + count, cell_errors + (i + 1) * BATCH_SIZE, 0);
+    }
+
+    // Элемент стека - строка из BATCH_SIZE чисел, по одному на формулу пачки.
+    // Строки заполняются целиком: лишние формулы считаются над нулями, их
+    // результаты не используются. top указывает на первую свободную строку
+    double* const stack = buffers.stack.data();
+    double* top = stack;
+    std::array<uint8_t, BATCH_SIZE> errors{};
+
+    // переходов в программе нет (см. IsBatchable) - инструкции выполняются подряд
+    for (const Instruction& instruction : code_) {
+        switch (instruction.op) {
+            case OpCode::PushNumber:
+                std::fill_n(top, BATCH_SIZE, constants_[instruction.arg]);
+                top += BATCH_SIZE;
+                break;
+
+            case OpCode::LoadCell: {
+                // ошибка ячейки действует, если раньше ошибок не было (как в Run)
+                const double* values = cell_values + instruction.arg * BATCH_SIZE;
+                const uint8_t* value_errors = cell_errors + instruction.arg * BATCH_SIZE;
+                for (size_t lane = 0; lane < BATCH_SIZE; ++lane) {
+                    top[lane] = values[lane];
+                    errors[lane] = errors[lane] != 0 ? errors[lane] : value_errors[lane];
+                }
+                top += BATCH_SIZE;
+                break;
+            }
+
+            case OpCode::Add:
+                top -= BATCH_SIZE;
+                ApplyToBatch(top - BATCH_SIZE, top, [](double lhs, double rhs) {
+                    return lhs + rhs;
+                });
+                CheckFinite(top - BATCH_SIZE, errors.data());
+                break;
+
+            case OpCode::Subtract:
+                top -= BATCH_SIZE;
+                ApplyToBatch(top - BATCH_SIZE, top, [](double lhs, double rhs) {
+                    return lhs - rhs;
+                });
+                CheckFinite(top - BATCH_SIZE, errors.data());
+                break;
+
+            case OpCode::Multiply:
+                top -= BATCH_SIZE;
+                ApplyToBatch(top - BATCH_SIZE, top, [](double lhs, double rhs) {
+                    return lhs * rhs;
+                });
+                CheckFinite(top - BATCH_SIZE, errors.data());
+                break;
+
+            case OpCode::Divide:
+                // делимое конечно, так что деление на 0 даёт бесконечность
+                // или NaN - ошибку находит та же проверка
+                top -= BATCH_SIZE;
+                ApplyToBatch(top - BATCH_SIZE, top, [](double lhs, double rhs) {
+                    return lhs / rhs;
+                });
+                CheckFinite(top - BATCH_SIZE, errors.data());
+                break;
+
+            case OpCode::Negate: {
+                double* operand = top - BATCH_SIZE;
+                for (size_t lane = 0; lane < BATCH_SIZE; ++lane) {
+                    operand[lane] = -operand[lane];
+                }
+                break;
+            }
+
+            case OpCode::Less:
+                top -= BATCH_SIZE;
+                ApplyToBatch(top - BATCH_SIZE, top, [](double lhs, double rhs) {
+                    return lhs < rhs ? 1. : 0.;
+                });
+                break;
+
+            case OpCode::LessOrEqual:
+                top -= BATCH_SIZE;
+                ApplyToBatch(top - BATCH_SIZE, top, [](double lhs, double rhs) {
+                    return lhs <= rhs ? 1. : 0.;
+                });
+                break;
+
+            case OpCode::Greater:
+                top -= BATCH_SIZE;
+                ApplyToBatch(top - BATCH_SIZE, top, [](double lhs, double rhs) {
+                    return lhs > rhs ? 1. : 0.;
+                });
+                break;
+
+            case OpCode::GreaterOrEqual:
+                top -= BATCH_SIZE;
+                ApplyToBatch(top - BATCH_SIZE, top, [](double lhs, double rhs) {
+                    return lhs >= rhs ? 1. : 0.;
+                });
+                break;
+
+            case OpCode::Equal:
+                top -= BATCH_SIZE;
+                ApplyToBatch(top - BATCH_SIZE, top, [](double lhs, double rhs) {
+                    return lhs == rhs ? 1. : 0.;
+                });
+                break;
+
+            case OpCode::NotEqual:
+                top -= BATCH_SIZE;
+                ApplyToBatch(top - BATCH_SIZE, top, [](double lhs, double rhs) {
+                    return lhs != rhs ? 1. : 0.;
+                });
+                break;
+
+            case OpCode::LoadRange:
+            case OpCode::Call:
+            case OpCode::Lookup:
+            case OpCode::Jump:
+            case OpCode::JumpIfFalse:
+            case OpCode::JumpIfTrue:
+                assert(false);
+                break;
+        }
+    }
+
+    for (size_t lane = 0; lane < count; ++lane) {
+        if (errors[lane] != 0) {
+            results.emplace_back(FromErrorCode(errors[lane]));
+        } else {
+            results.emplace_back(stack[lane]);
+        }
+    }
+}
+
+
+FormulaResult LoadCellValue(const SheetInterface& sheet, Position pos) {
+    // проверяем, что позиция ячейки не выходит за границы таблицы
+    if (!pos.IsValid()) {
+        return FormulaError(FormulaError::Category::Ref);
+    }
+
+    return LoadCellValue(sheet.GetCell(pos));
+}
+
+
+FormulaResult LoadCellValue(const CellInterface* cell_interf) {
+    // если указателя нет, значит ячейки нет => 0:
+    if (cell_interf == nullptr) {
+        return 0.;
+    }
+
+    // число (в том числе заранее разобранный текст) или ошибка
+    CellInterface::NumericValue val = cell_interf->GetNumericValue();
+    if (std::holds_alternative<double>(val)) {
+        return std::get<double>(val);
+    }
+    return std::get<FormulaError>(val);
+}
+
+
+const RangeAggregator* GetRangeAggregator(const SheetInterface& sheet) {
+    return dynamic_cast<const RangeAggregator*>(&sheet);
+}
+
+
+std::optional<FormulaError> AggregateRange(const SheetInterface& sheet, const RangeAggregator* aggregator, Range range,
+                                           Aggregate& aggregate) {
+    if (aggregator != nullptr && aggregator->MergeRangeAggregate(range, aggregate)) {
+        return std::nullopt;
+    }
+
+    std::array<double, RANGE_CHUNK_SIZE> chunk;
+    size_t chunk_size = 0;
+    for (int row = range.from.row; row <= range.to.row; ++row) {
+        for (int col = range.from.col; col <= range.to.col; ++col) {
+            const CellInterface* cell = sheet.GetCell(Position{row, col});
+            if (cell == nullptr) {
+                continue;
+            }
+            std::optional<CellInterface::NumericValue> value = cell->GetRangeValue();
+            if (!value.has_value()) {
+                continue;
+            }
+            if (const FormulaError* error = std::get_if<FormulaError>(&*value)) {
+                return *error;
+            }
+            chunk[chunk_size++] = std::get<double>(*value);
+            if (chunk_size == chunk.size()) {
+                aggregate.AddValues(chunk.data(), chunk_size);
+                chunk_size = 0;
+            }
+        }
+    }
+    aggregate.AddValues(chunk.data(), chunk_size);
+    return std::nullopt;
+}
+
+
+FormulaResult RunLookup(const SheetInterface& sheet, const RangeAggregator* aggregator, const LookupCall& call, double key,
+                        double column) {
+    const FormulaError not_available(FormulaError::Category::NotAvailable);
+
+    switch (call.function) {
+        case Lookup::Match: {
+            if (!IsVector(call.range)) {
+                return FormulaError(FormulaError::Category::Value);
+            }
+            std::optional<int> offset = FindInVector(sheet, aggregator, call.range, key);
+            if (!offset.has_value()) {
+                return not_available;
+            }
+            return *offset + 1.;
+        }
+
+        case Lookup::VLookup: {
+            const Range& table = call.range;
+            column = std::trunc(column);
+            if (column < 1) {
+                return FormulaError(FormulaError::Category::Value);
+            }
+            if (column > table.to.col - table.from.col + 1) {
+                return FormulaError(FormulaError::Category::Ref);
+            }
+            const Range keys{table.from, Position{table.to.row, table.from.col}};
+            std::optional<int> offset = FindInVector(sheet, aggregator, keys, key);
+            if (!offset.has_value()) {
+                return not_available;
+            }
+            return LoadCellValue(sheet, Position{table.from.row + *offset, table.from.col + static_cast<int>(column) - 1});
+        }
+
+        case Lookup::XLookup: {
+            if (!IsVector(call.range) || !IsVector(call.result_range)
+                || GetCellsCount(call.range) != GetCellsCount(call.result_range)) {
+                return FormulaError(FormulaError::Category::Value);
+            }
+            std::optional<int> offset = FindInVector(sheet, aggregator, call.range, key);
+            if (!offset.has_value()) {
+                return not_available;
+            }
+            return LoadCellValue(sheet, GetVectorCell(call.result_range, *offset));
+        }
+    }
+
+    assert(false);
+    return not_available;
+}
+
+}  // namespace Bytecode
@@ -0,0 +1,326 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+/*
+Байткод формулы.
+Дерево выражения один раз компилируется в линейную программу для стековой
+машины (обратная польская запись). Выполнение программы - простой цикл без
+виртуальных вызовов и рекурсии: операнды кладутся на стек, операции снимают
+их со стека и кладут результат. Ветвления (IF, AND, OR) - переходы вперёд,
+так что невыбранная ветвь не выполняется и её ячейки не читаются.
+*/
+namespace Bytecode {
+
+// Результат вычисления формулы или её части: число либо ошибка.
+// Ошибка передаётся как значение, поэтому её распространение по зависимым
+// формулам стоит столько же, сколько вычисление без ошибок
+class FormulaResult {
+public:
+    FormulaResult(double value)
+        : value_(value) {
+    }
+
+    FormulaResult(FormulaError error)
+        : error_category_(error.GetCategory())
+        , has_error_(true) {
+    }
+
+    bool HasError() const {
+        return has_error_;
+    }
+
+    double GetValue() const {
+        return value_;
+    }
+
+    FormulaError GetError() const {
+        return FormulaError(error_category_);
+    }
+
+private:
+    double value_ = 0;
+    FormulaError::Category error_category_ = FormulaError::Category::Value;
+    bool has_error_ = false;
+};
+
+// Агрегатные функции формул
+enum class Function : uint8_t {
+    Sum,
+    Average,
+    Min,
+    Max,
+    Count,
+};
+
+/*
+Свёртка аргументов агрегатной функции. Аргумент - число или область ячеек.
+Числа области сворачиваются пачками: значения ячеек собираются в непрерывный
+массив, который обрабатывается векторизуемым циклом (см. AggregateRange).
+Свёртку части аргументов можно влить в другую (Merge) - так байткод и обход
+дерева складывают числа в одном и том же порядке
+*/
+class Aggregate {
+public:
+    explicit Aggregate(Function function);
+
+    void Add(double value);
+    void AddValues(const double* values, size_t count);
+    // Вливает свёртку другой части аргументов той же функции
+    void Merge(double value, double count);
+
+    // Сумма (Sum, Average, Count), минимум (Min) или максимум (Max)
+    double GetValue() const {
+        return value_;
+    }
+    // Количество учтённых чисел
+    double GetCount() const {
+        return count_;
+    }
+
+    // Значение функции: среднее пустого списка - ошибка, минимум
+    // и максимум пустого списка - 0
+    FormulaResult GetResult() const;
+
+    Function GetFunction() const {
+        return function_;
+    }
+
+private:
+    Function function_;
+    double value_;
+    double count_ = 0;
+};
+
+// Функции поиска. Ищется первая ячейка, число которой равно ключу
+// (см. CellInterface::GetRangeValue). Если такой нет - ошибка #N/A
+enum class Lookup : uint8_t {
+    Match,    // MATCH(ключ, строка или столбец): номер найденной ячейки, начиная с 1
+    VLookup,  // VLOOKUP(ключ, таблица, номер столбца): ключ ищется в первом столбце таблицы
+    XLookup,  // XLOOKUP(ключ, строка или столбец, строка или столбец): ячейка на том же месте второй области
+};
+
+// Вызов функции поиска. result_range нужна только XLOOKUP
+struct LookupCall {
+    Lookup function;
+    Range range;
+    Range result_range;
+};
+
+enum class OpCode : uint8_t {
+    PushNumber,  // положить на стек константу constants_[arg]
+    LoadCell,    // положить на стек значение ячейки cells_[arg] (или привязанной, см. Placement)
+    Add,
+    Subtract,
+    Multiply,
+    Divide,
+    Negate,      // унарный минус
+    LoadRange,   // положить на стек свёртку области range_arguments_[arg]: значение и количество чисел
+    Call,        // снять со стека свёртки аргументов функции calls_[arg] и положить её значение
+    Lookup,      // снять со стека ключ (у VLOOKUP затем номер столбца) и положить результат поиска lookups_[arg]
+    Less,        // сравнения: снять два значения и положить 1, если условие выполнено, иначе 0
+    LessOrEqual,
+    Greater,
+    GreaterOrEqual,
+    Equal,
+    NotEqual,
+    Jump,         // перейти к инструкции code_[arg]
+    JumpIfFalse,  // снять значение со стека и перейти к code_[arg], если оно 0
+    JumpIfTrue,   // снять значение со стека и перейти к code_[arg], если оно не 0
+};
+
+struct Instruction {
+    OpCode op;
+    uint32_t arg = 0;
+};
+
+// Пропускает чтения формулы с ветвлениями (см. Program::Execute). Так можно
+// узнать, какие входы формула прочитала на самом деле, и не вычислять заранее
+// входы ветвей, которые не выполнятся
+class InputGate {
+public:
+    // Вызывается перед чтением ячейки или области. false - вход ещё не готов,
+    // вычисление прерывается
+    virtual bool Admit(Position pos) = 0;
+    virtual bool Admit(Range range) = 0;
+
+protected:
+    ~InputGate() = default;
+};
+
+// Где выполняется программа. Одну программу делят формулы, одинаковые
+// в относительной записи (см. FormulaTemplates), поэтому все ссылки
+// программы сдвигаются на shift
+struct Placement {
+    Position shift = {0, 0};
+    // bound_cells[i] - ячейка на позиции GetCells()[i] со сдвигом (nullptr,
+    // если ячейки нет): значения читаются напрямую, без поиска в таблице.
+    // nullptr вместо массива - ячейки ищутся в таблице
+    const CellInterface* const* bound_cells = nullptr;
+};
+
+inline Position ShiftPosition(Position pos, Position shift) {
+    return {pos.row + shift.row, pos.col + shift.col};
+}
+
+inline Range ShiftRange(Range range, Position shift) {
+    return {ShiftPosition(range.from, shift), ShiftPosition(range.to, shift)};
+}
+
+class Program {
+public:
+    void EmitNumber(double value);
+    void EmitCell(Position pos);
+    // Бинарные операции, сравнения и унарный минус
+    void EmitOperation(OpCode op);
+    // Аргумент функции - область ячеек. Скалярный аргумент кладётся
+    // на стек как свёртка из одного числа: значение и количество 1
+    void EmitRange(Range range, Function function);
+    // Вызов функции, свёртки всех аргументов которой уже на стеке
+    void EmitCall(Function function, uint32_t arguments_count);
+    // Вызов функции поиска, ключ (и номер столбца VLOOKUP) которой уже на стеке
+    void EmitLookup(const LookupCall& call);
+    // Переход вперёд (Jump, JumpIfFalse или JumpIfTrue). Возвращает номер
+    // инструкции: адрес перехода задаёт SetJumpTarget, когда он станет известен.
+    // После Jump выполнение продолжается в другой ветви, поэтому для подсчёта
+    // глубины стека значение пройденной ветви считается снятым
+    size_t EmitJump(OpCode op);
+    // Направляет переход jump на следующую инструкцию
+    void SetJumpTarget(size_t jump);
+
+    // Завершает компиляцию: упорядочивает таблицу ячеек по возрастанию
+    // и убирает из неё повторы
+    void Finalize();
+
+    // Выполняет программу. Возвращает первую ошибку, возникшую при вычислении
+    // (в том же порядке, что и обход дерева)
+    FormulaResult Execute(const SheetInterface& sheet, const Placement& placement = {}) const;
+    // То же, но каждое чтение ячейки или области (уже со сдвигом) сначала
+    // проходит через gate. Возвращает nullopt, если gate прервал вычисление
+    std::optional<FormulaResult> Execute(const SheetInterface& sheet, const Placement& placement, InputGate& gate) const;
+
+    /*
+    Выполняет программу для нескольких формул одного шаблона сразу:
+    results[i] - результат для placements[i]. Каждая инструкция обрабатывает
+    пачку формул: значения ячеек собираются в непрерывные массивы, операции -
+    векторизуемые циклы по формулам пачки. Ошибка запоминается отдельно для
+    каждой формулы, результаты те же, что у Execute. Программы, которые нельзя
+    выполнять пачкой (см. IsBatchable), выполняются по одной формуле
+    */
+    std::vector<FormulaResult> ExecuteBatch(const SheetInterface& sheet, const std::vector<Placement>& placements) const;
+
+    // Упорядоченные позиции ячеек, на которые ссылается формула (без повторов)
+    const std::vector<Position>& GetCells() const {
+        return cells_;
+    }
+
+    // Упорядоченные области, на которые ссылается формула (без повторов)
+    const std::vector<Range>& GetRanges() const {
+        return ranges_;
+    }
+
+    size_t GetInstructionsCount() const {
+        return code_.size();
+    }
+
+    // Есть ли в программе переходы: тогда при вычислении читаются не все ячейки из GetCells()
+    bool HasBranches() const {
+        return has_branches_;
+    }
+
+    // В программе только числа, ссылки на ячейки, арифметика и сравнения,
+    // и она достаточно длинная, чтобы пачка окупилась: такую программу
+    // ExecuteBatch выполняет пачкой
+    bool IsBatchable() const;
+
+private:
+    struct RangeArgument {
+        Range range;
+        Function function;
+    };
+
+    struct FunctionCall {
+        Function function;
+        uint32_t arguments_count;
+    };
+
+    std::vector<Instruction> code_;
+    std::vector<double> constants_;
+    std::vector<Position> cells_;
+    std::vector<RangeArgument> range_arguments_;
+    std::vector<FunctionCall> calls_;
+    std::vector<LookupCall> lookups_;
+    std::vector<Range> ranges_;
+
+    int depth_ = 0;  // глубина стека после последней инструкции
+    int max_depth_ = 0;
+    bool has_branches_ = false;
+
+    void Push(Instruction instruction, int depth_change);
+
+    // gate может быть nullptr. nullopt - gate прервал вычисление
+    std::optional<FormulaResult> Run(const SheetInterface& sheet, const Placement& placement, double* stack,
+                                     InputGate* gate) const;
+
+    // Память для выполнения пачки, общая для всех пачек одного вызова ExecuteBatch
+    struct BatchBuffers {
+        std::vector<double> stack;        // max_depth_ строк
+        std::vector<double> cell_values;  // строка на ячейку из cells_
+        std::vector<uint8_t> cell_errors;
+    };
+
+    // Выполняет программу для count <= BATCH_SIZE формул (см. ExecuteBatch)
+    // и дописывает их результаты в results
+    void RunBatch(const SheetInterface& sheet, const Placement* placements, size_t count, BatchBuffers& buffers,
+                  std::vector<FormulaResult>& results) const;
+};
+
+// Получить значение ячейки на позиции pos для подстановки в формулу.
+// Вернет число, если в ячейке число или текст, который может быть
+// преобразован в число (пустая ячейка -> 0). В противном случае вернет ошибку:
+// - FormulaError::Category::Ref - позиция ячейки не помещается в таблицу
+// - FormulaError::Category::Value - в ячейке текст, который не может быть преобразован в число
+// - ошибку, которая записана в ячейке с формулой
+FormulaResult LoadCellValue(const SheetInterface& sheet, Position pos);
+// То же для уже найденной ячейки (nullptr - ячейки нет => 0)
+FormulaResult LoadCellValue(const CellInterface* cell);
+
+// Таблица, которая сама поддерживает свёртки областей (см. RangeAggregates)
+// и индексы поиска по столбцам (см. LookupIndex)
+class RangeAggregator {
+public:
+    // Вливает в aggregate свёртку области. Возвращает false, если готовой
+    // свёртки нет - тогда aggregate не меняется
+    virtual bool MergeRangeAggregate(Range range, Aggregate& aggregate) const = 0;
+    // Ищет в области-столбце первую сверху ячейку с числом key и записывает
+    // её строку в row (nullopt - не найдена). Возвращает false, если индекса
+    // нет - тогда область надо перебрать по ячейкам
+    virtual bool FindInColumn(Range range, double key, std::optional<int>& row) const = 0;
+
+protected:
+    ~RangeAggregator() = default;
+};
+
+// Таблица как RangeAggregator или nullptr. Определяется один раз на вычисление
+// формулы, а не на каждую область
+const RangeAggregator* GetRangeAggregator(const SheetInterface& sheet);
+
+// Добавляет в свёртку числа области range (см. CellInterface::GetRangeValue).
+// Берёт готовую свёртку aggregator (таблицы sheet), если она есть, иначе обходит
+// область по строкам. Возвращает первую встреченную ошибку
+std::optional<FormulaError> AggregateRange(const SheetInterface& sheet, const RangeAggregator* aggregator, Range range,
+                                           Aggregate& aggregate);
+
+// Выполняет поиск call по ключу key (column - номер столбца VLOOKUP). Столбцы
+// ищутся по индексу aggregator, если он есть (см. RangeAggregator::FindInColumn).
+// Ошибки в ячейках, среди которых идёт поиск, не распространяются: такие ячейки
+// просто не совпадают с ключом. Область поиска MATCH и XLOOKUP - одна строка
+// или один столбец, у XLOOKUP области одного размера, иначе ошибка #VALUE!
+FormulaResult RunLookup(const SheetInterface& sheet, const RangeAggregator* aggregator, const LookupCall& call, double key,
+                        double column);
+
+}  // namespace Bytecode
@@ -0,0 +1,104 @@
+#include "bench_runner_p.h"
+#include "benchmarks.h"
+#include "sheet.h"
+
+#include <chrono>
+#include <functional>
+#include <string>
+
+namespace {
+
+const int ROWS = Position::MAX_ROWS;
+const int COLS = 8;
+const int EDITS = 10;
+
+// Текст формулы столбца col по номеру строки r
+using FormulaText = std::function<std::string(const std::string& r, int col)>;
+
+std::string ShortFormula(const std::string& r, int col) {
+    return "=(A" + r + "+" + std::to_string(col) + ")*B" + r + "-A" + r + "/(B" + r + "+1)";
+}
+
+std::string LongFormula(const std::string& r, int col) {
+    const std::string a = "A" + r;
+    const std::string b = "B" + r;
+    const std::string c = std::to_string(col);
+    return "=((" + a + "+" + c + ")*" + b + "-" + a + "/(" + b + "+1))*(" + a + "-" + b + ")+(" + a + "*" + a + "-"
+           + b + "*" + b + ")/(" + a + "+" + b + "+1)-(" + a + "-" + c + ")*(" + b + "-" + c + ")/(" + a + "*" + b
+           + "+1)";
+}
+
+// В столбцах A и B числа, в следующих COLS столбцах - заполненные вниз формулы от ячеек своей строки
+void FillSheet(Sheet& sheet, const FormulaText& formula) {
+    for (int row = 0; row < ROWS; ++row) {
+        const std::string r = std::to_string(row + 1);
+        sheet.SetCell(Position{row, 0}, r);
+        sheet.SetCell(Position{row, 1}, std::to_string(row % 10));
+        for (int col = 0; col < COLS; ++col) {
+            sheet.SetCell(Position{row, col + 2}, formula(r, col));
+        }
+    }
+}
+
+double SumFormulas(const Sheet& sheet) {
+    double checksum = 0;
+    for (int row = 0; row < ROWS; ++row) {
+        for (int col = 0; col < COLS; ++col) {
+            checksum += std::get<double>(sheet.GetCell(Position{row, col + 2})->GetValue());
+        }
+    }
+    return checksum;
+}
+
+// Изменяет все числа столбца B: после этого все формулы нужно вычислить заново
+void EditColumn(Sheet& sheet, int edit) {
+    std::vector<CellEdit> edits;
+    edits.reserve(ROWS);
+    for (int row = 0; row < ROWS; ++row) {
+        edits.push_back({Position{row, 1}, std::to_string((row + edit) % 10)});
+    }
+    sheet.SetCells(std::move(edits));
+}
+
+// Суммарное время EDITS правок столбца B с чтением всех формул: по одной и через EvaluateRange
+void CompareEvaluation(const std::string& name, const FormulaText& formula) {
+    const Range area{Position{0, 0}, Position{ROWS - 1, COLS + 1}};
+
+    Sheet sheet;
+    FillSheet(sheet, formula);
+    Sheet batch_sheet;
+    FillSheet(batch_sheet, formula);
+
+    double checksum = 0;
+    double batch_checksum = 0;
+    double seconds = 0;
+    double batch_seconds = 0;
+    for (int edit = 1; edit <= EDITS; ++edit) {
+        EditColumn(sheet, edit);
+        EditColumn(batch_sheet, edit);
+        auto start = LogDuration::Clock::now();
+        checksum += SumFormulas(sheet);
+        seconds += std::chrono::duration<double>(LogDuration::Clock::now() - start).count();
+
+        start = LogDuration::Clock::now();
+        batch_sheet.EvaluateRange(area);
+        batch_checksum += SumFormulas(batch_sheet);
+        batch_seconds += std::chrono::duration<double>(LogDuration::Clock::now() - start).count();
+    }
+    std::cerr << "    " << name << ", read formulas one by one: " << seconds * 1000 / EDITS << " ms per edit" << std::endl;
+    std::cerr << "    " << name << ", EvaluateRange and read formulas: " << batch_seconds * 1000 / EDITS << " ms per edit"
+              << std::endl;
+    if (checksum != batch_checksum) {
+        std::cerr << "    checksums differ: " << checksum << " != " << batch_checksum << std::endl;
+    }
+    DoNotOptimize(checksum);
+    DoNotOptimize(batch_checksum);
+}
+
+}  // namespace
+
+void BenchBatchEvaluation() {
+    std::cerr << "  " << ROWS << " rows x " << COLS << " filled down formula columns" << std::endl;
+    CompareEvaluation("short formulas", ShortFormula);
+    CompareEvaluation("long formulas", LongFormula);
+}
@@ -0,0 +1,49 @@
+#include "bench_runner_p.h"
+#include "benchmarks.h"
+#include "sheet.h"
+
+#include <string>
+#include <vector>
+
+namespace {
+
+const int ROWS = Position::MAX_ROWS;
+const int COLS = 16;  // 16 * 16384 > 250k ячеек
+
+// Столбец A - числа, остальные формулы ссылаются на две ячейки левее и выше
+std::vector<CellEdit> MakeEdits() {
+    std::vector<CellEdit> edits;
+    edits.reserve(ROWS * COLS);
+    for (int row = 0; row < ROWS; ++row) {
+        edits.push_back({Position{row, 0}, std::to_string(row % 100)});
+        for (int col = 1; col < COLS; ++col) {
+            std::string left = Position{row, col - 1}.ToString();
+            std::string up = Position{row > 0 ? row - 1 : row, col - 1}.ToString();
+            edits.push_back({Position{row, col}, "=" + left + "+" + up + "/2"});
+        }
+    }
+    return edits;
+}
+
+}  // namespace
+
+void BenchBatchLoad() {
+    const std::vector<CellEdit> edits = MakeEdits();
+    std::cerr << "  " << edits.size() << " cells" << std::endl;
+
+    {
+        Sheet sheet;
+        LOG_DURATION("SetCell one by one");
+        for (const CellEdit& edit : edits) {
+            sheet.SetCell(edit.pos, edit.text);
+        }
+        DoNotOptimize(sheet.GetPrintableSize());
+    }
+
+    {
+        Sheet sheet;
+        LOG_DURATION("SetCells batch");
+        sheet.SetCells(edits);
+        DoNotOptimize(sheet.GetPrintableSize());
+    }
+}
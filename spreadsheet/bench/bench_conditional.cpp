@@ -0,0 +1,61 @@
+#include "bench_runner_p.h"
+#include "benchmarks.h"
+#include "sheet.h"
+
+#include <string>
+
+namespace {
+
+const int CHAIN = 16000;
+const int EDITS = 200;
+
+// D1..Dn - цепочка Di=D(i-1)+1, A1 - условие, B1 - дешёвая ветвь, C1 - проверяемая формула
+void FillChain(Sheet& sheet, const std::string& formula) {
+    sheet.SetCell(Position::FromString("A1"), "1");
+    sheet.SetCell(Position::FromString("B1"), "=A1*2");
+    sheet.SetCell(Position{0, 3}, "0");
+    for (int row = 1; row < CHAIN; ++row) {
+        sheet.SetCell(Position{row, 3}, "=" + Position{row - 1, 3}.ToString() + "+1");
+    }
+    sheet.SetCell(Position::FromString("C1"), formula);
+    sheet.GetCell(Position::FromString("C1"))->GetValue();
+}
+
+// Изменяет начало цепочки и читает C1
+double EditAndRead(Sheet& sheet) {
+    double total = 0;
+    for (int i = 0; i < EDITS; ++i) {
+        sheet.SetCell(Position{0, 3}, std::to_string(i));
+        total += std::get<double>(sheet.GetCell(Position::FromString("C1"))->GetValue());
+    }
+    return total;
+}
+
+}  // namespace
+
+void BenchConditional() {
+    const std::string chain_end = Position{CHAIN - 1, 3}.ToString();
+    std::cerr << "  chain of " << CHAIN << " formulas, Lazy mode" << std::endl;
+
+    Sheet branch_sheet;
+    FillChain(branch_sheet, "=IF(A1>0,B1,B1+" + chain_end + ")");
+    {
+        LOG_DURATION("edit chain start + read IF with the chain in the branch not taken x" + std::to_string(EDITS));
+        DoNotOptimize(EditAndRead(branch_sheet));
+    }
+
+    // для сравнения - та же зависимость без ветвления: каждое чтение проверяет цепочку
+    Sheet plain_sheet;
+    FillChain(plain_sheet, "=B1+0*" + chain_end);
+    {
+        LOG_DURATION("edit chain start + read formula depending on the chain x" + std::to_string(EDITS));
+        DoNotOptimize(EditAndRead(plain_sheet));
+    }
+
+    // ветвь сменилась: цепочка вычисляется один раз
+    {
+        LOG_DURATION("switch IF to the chain branch + read");
+        branch_sheet.SetCell(Position::FromString("A1"), "0");
+        DoNotOptimize(branch_sheet.GetCell(Position::FromString("C1"))->GetValue());
+    }
+}
@@ -0,0 +1,59 @@
+#include "bench_runner_p.h"
+#include "benchmarks.h"
+#include "sheet.h"
+
+#include <string>
+
+namespace {
+
+const int ROWS = Position::MAX_ROWS;
+const int COLS = 8;
+const int EDITS = 100;
+
+// Значение B1 не зависит от значения A1,
+// от B1 зависят цепочки формул во всех строках
+void FillCutoffSheet(Sheet& sheet) {
+    sheet.SetCell(Position{0, 0}, "1");
+    sheet.SetCell(Position{0, 1}, "=A1*0+1");
+    for (int row = 1; row < ROWS; ++row) {
+        sheet.SetCell(Position{row, 1}, "=B1+" + std::to_string(row));
+        for (int col = 2; col <= COLS; ++col) {
+            sheet.SetCell(Position{row, col}, "=" + Position{row, col - 1}.ToString() + "*2");
+        }
+    }
+}
+
+void PrintStats(const RecalculationStats& stats) {
+    std::cerr << "    recomputed " << stats.recomputed_cells << ", skipped " << stats.skipped_cells << std::endl;
+}
+
+}  // namespace
+
+void BenchEarlyCutoff() {
+    Sheet sheet;
+    FillCutoffSheet(sheet);
+    sheet.SetRecalculationMode(RecalculationMode::Eager);
+    std::cerr << "  " << (ROWS - 1) * COLS << " formulas depend on B1 = A1*0+1" << std::endl;
+
+    {
+        LOG_DURATION("edit A1 (B1 unchanged) x" + std::to_string(EDITS));
+        for (int i = 0; i < EDITS; ++i) {
+            sheet.SetCell(Position{0, 0}, std::to_string(i + 2));
+        }
+    }
+    PrintStats(sheet.GetLastRecalculationStats());
+    {
+        LOG_DURATION("retype A1 in another format x" + std::to_string(EDITS));
+        for (int i = 0; i < EDITS; ++i) {
+            sheet.SetCell(Position{0, 0}, i % 2 == 0 ? "5.0" : "5");
+        }
+    }
+    PrintStats(sheet.GetLastRecalculationStats());
+    {
+        LOG_DURATION("edit B1 (value changes) x10");
+        for (int i = 0; i < 10; ++i) {
+            sheet.SetCell(Position{0, 1}, "=A1*0+" + std::to_string(i + 2));
+        }
+    }
+    PrintStats(sheet.GetLastRecalculationStats());
+}
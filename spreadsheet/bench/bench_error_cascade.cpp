@@ -0,0 +1,54 @@
+#include "bench_runner_p.h"
+#include "benchmarks.h"
+#include "common.h"
+
+#include <string>
+
+namespace {
+
+const int ROWS = Position::MAX_ROWS;
+const int LAYERS = 7;  // 7 * 16384 > 100k формул
+
+// Столбец A - источник, в каждом следующем столбце формула ссылается
+// на ячейку левее: ошибка из A расходится по ~100k зависимых ячеек
+std::unique_ptr<SheetInterface> MakeCascadeSheet() {
+    auto sheet = CreateSheet();
+    for (int row = 0; row < ROWS; ++row) {
+        sheet->SetCell(Position{row, 0}, "1");
+        for (int col = 1; col <= LAYERS; ++col) {
+            sheet->SetCell(Position{row, col}, "=" + Position{row, col - 1}.ToString() + "*2+1");
+        }
+    }
+    return sheet;
+}
+
+double RecalculateCascade(SheetInterface& sheet, const std::string& source_text, const std::string& name) {
+    for (int row = 0; row < ROWS; ++row) {
+        sheet.SetCell(Position{row, 0}, source_text);
+    }
+
+    double checksum = 0;
+    LOG_DURATION(name);
+    for (int row = 0; row < ROWS; ++row) {
+        for (int col = 1; col <= LAYERS; ++col) {
+            CellInterface::Value value = sheet.GetCell(Position{row, col})->GetValue();
+            if (std::holds_alternative<double>(value)) {
+                checksum += std::get<double>(value);
+            } else {
+                checksum += 1;
+            }
+        }
+    }
+    return checksum;
+}
+
+}  // namespace
+
+void BenchErrorCascade() {
+    auto sheet = MakeCascadeSheet();
+    std::cerr << "  " << ROWS * LAYERS << " dependent formulas" << std::endl;
+
+    DoNotOptimize(RecalculateCascade(*sheet, "2", "happy path (numbers)"));
+    DoNotOptimize(RecalculateCascade(*sheet, "text", "#VALUE! cascade"));
+    DoNotOptimize(RecalculateCascade(*sheet, "=1/0", "#ARITHM! cascade"));
+}
@@ -0,0 +1,99 @@
+#include "bench_runner_p.h"
+#include "benchmarks.h"
+#include "sheet.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <variant>
+#include <vector>
+
+namespace {
+
+const int ROWS = Position::MAX_ROWS;
+const int COLS = 16;
+const int REPEATS = 5;
+const char* const EXPORT_PATH = "bench_export.tsv";
+
+// Числа, текст, экранированный текст и формулы с дробными значениями
+std::vector<CellEdit> MakeEdits() {
+    std::vector<CellEdit> edits;
+    edits.reserve(ROWS * COLS);
+    for (int row = 0; row < ROWS; ++row) {
+        const std::string r = std::to_string(row + 1);
+        edits.push_back({Position{row, 0}, std::to_string(row * 7 % 1000)});
+        edits.push_back({Position{row, 1}, "item " + r});
+        edits.push_back({Position{row, 2}, "'=note " + r});
+        for (int col = 3; col < COLS; ++col) {
+            edits.push_back({Position{row, col}, "=A" + r + "/" + std::to_string(col) + "+" + Position{row, col - 1}.ToString()
+                                                     + "*0.5"});
+        }
+    }
+    return edits;
+}
+
+// Как печатала таблица раньше: каждая позиция через GetCell, значения - через operator<<
+void PrintEach(const Sheet& sheet, std::ostream& output, bool print_values) {
+    const Size size = sheet.GetPrintableSize();
+    for (int row = 0; row < size.rows; ++row) {
+        for (int col = 0; col < size.cols; ++col) {
+            if (col > 0) {
+                output << "\t";
+            }
+            if (const CellInterface* cell = sheet.GetCell(Position{row, col})) {
+                if (print_values) {
+                    std::visit([&output](const auto& value) {
+                        output << value;
+                    }, cell->GetValue());
+                } else {
+                    output << cell->GetText();
+                }
+            }
+        }
+        output << "\n";
+    }
+}
+
+// Среднее время записи таблицы в файл и скорость в МБ/с
+template <typename Print>
+void MeasureExport(const std::string& name, Print print) {
+    double seconds = 0;
+    size_t bytes = 0;
+    for (int repeat = 0; repeat < REPEATS; ++repeat) {
+        std::ofstream output(EXPORT_PATH, std::ios::binary | std::ios::trunc);
+        const auto start = LogDuration::Clock::now();
+        print(output);
+        output.flush();
+        seconds += std::chrono::duration<double>(LogDuration::Clock::now() - start).count();
+        bytes = static_cast<size_t>(output.tellp());
+    }
+    std::cerr << "    " << name << ": " << seconds * 1000 / REPEATS << " ms, "
+              << bytes * REPEATS / seconds / (1 << 20) << " MB/s" << std::endl;
+}
+
+}  // namespace
+
+void BenchExport() {
+    Sheet sheet;
+    sheet.SetCells(MakeEdits());
+    // значения вычисляются заранее: сравнивается только запись
+    std::ostringstream warm_up;
+    sheet.PrintValues(warm_up);
+    std::cerr << "  " << ROWS << " x " << COLS << " cells, values " << warm_up.str().size() / (1 << 20) << " MiB" << std::endl;
+
+    MeasureExport("values, GetCell and operator<< per cell", [&sheet](std::ostream& output) {
+        PrintEach(sheet, output, true);
+    });
+    MeasureExport("PrintValues", [&sheet](std::ostream& output) {
+        sheet.PrintValues(output);
+    });
+    MeasureExport("texts, GetCell and GetText per cell", [&sheet](std::ostream& output) {
+        PrintEach(sheet, output, false);
+    });
+    MeasureExport("PrintTexts", [&sheet](std::ostream& output) {
+        sheet.PrintTexts(output);
+    });
+    std::remove(EXPORT_PATH);
+}
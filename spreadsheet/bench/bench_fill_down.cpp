@@ -0,0 +1,60 @@
+#include "bench_runner_p.h"
+#include "benchmarks.h"
+#include "sheet.h"
+
+#include <string>
+
+namespace {
+
+const int ROWS = Position::MAX_ROWS;
+const int COLS = 8;
+
+// В столбцах A и B числа, в следующих COLS столбцах - формулы от ячеек своей строки.
+// is_unique - в каждую формулу добавляется номер строки, так что одинаковых формул нет
+void FillDown(Sheet& sheet, bool is_unique) {
+    for (int row = 0; row < ROWS; ++row) {
+        const std::string r = std::to_string(row + 1);
+        sheet.SetCell(Position{row, 0}, r);
+        sheet.SetCell(Position{row, 1}, "2");
+        for (int col = 0; col < COLS; ++col) {
+            std::string text = "=(A" + r + "+" + std::to_string(col) + ")*B" + r + "-A" + r + "/(B" + r + "+1)";
+            if (is_unique) {
+                text += "+" + r;
+            }
+            sheet.SetCell(Position{row, col + 2}, text);
+        }
+    }
+}
+
+void BenchFill(const std::string& name, bool is_unique) {
+    const size_t memory_before = GetMemoryUsage();
+    Sheet sheet;
+    {
+        LOG_DURATION(name + ": fill");
+        FillDown(sheet, is_unique);
+    }
+    const size_t memory_after = GetMemoryUsage();
+    if (memory_before != 0) {
+        std::cerr << "    memory: " << (memory_after - memory_before) / (ROWS * (COLS + 2)) << " bytes per cell" << std::endl;
+    }
+    std::cerr << "    templates: " << sheet.GetFormulaTemplates().GetTemplatesCount() << std::endl;
+
+    double checksum = 0;
+    {
+        LOG_DURATION(name + ": evaluate");
+        for (int row = 0; row < ROWS; ++row) {
+            checksum += std::get<double>(sheet.GetCell(Position{row, COLS + 1})->GetValue());
+        }
+    }
+    DoNotOptimize(checksum);
+}
+
+}  // namespace
+
+void BenchFillDown() {
+    std::cerr << "  " << ROWS << " rows x " << COLS << " formula columns" << std::endl;
+    // память процесса после освобождения листа не возвращается, поэтому
+    // меньший по памяти вариант измеряется первым
+    BenchFill("filled down formulas", false);
+    BenchFill("unique formulas", true);
+}
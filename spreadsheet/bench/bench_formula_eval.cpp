@@ -0,0 +1,55 @@
+#include "FormulaAST.h"
+#include "bench_runner_p.h"
+#include "benchmarks.h"
+#include "common.h"
+
+#include <string>
+#include <vector>
+
+namespace {
+
+const int ITERATIONS = 1'000'000;
+
+const std::vector<std::string> FORMULAS = {
+    "1+2*3-4/5",
+    "A1+A2+A3+A4+A5+A6+A7+A8",
+    "(A1*B1-A2*B2)/(A3+B3)+-(A4-B4)*(A5+B5)",
+    "((((A1+1)*2-3)/4+5)*6-7)/8+((B1+2)*(B2-3))",
+};
+
+}  // namespace
+
+void BenchFormulaBytecodeVsTree() {
+    auto sheet = CreateSheet();
+    for (int row = 0; row < 5; ++row) {
+        sheet->SetCell(Position{row, 0}, std::to_string(row + 1));
+        sheet->SetCell(Position{row, 1}, "=" + std::to_string(row + 2) + "*A" + std::to_string(row + 1));
+    }
+
+    for (const std::string& formula : FORMULAS) {
+        FormulaAST ast = ParseFormulaAST(formula);
+        std::cerr << "  " << formula << std::endl;
+
+        double sum_tree = 0;
+        {
+            LOG_DURATION("tree walker x" + std::to_string(ITERATIONS));
+            for (int i = 0; i < ITERATIONS; ++i) {
+                sum_tree += ast.ExecuteByTree(*sheet).GetValue();
+            }
+        }
+
+        double sum_bytecode = 0;
+        {
+            LOG_DURATION("bytecode VM x" + std::to_string(ITERATIONS));
+            for (int i = 0; i < ITERATIONS; ++i) {
+                sum_bytecode += ast.Execute(*sheet).GetValue();
+            }
+        }
+
+        DoNotOptimize(sum_tree);
+        DoNotOptimize(sum_bytecode);
+        if (sum_tree != sum_bytecode) {
+            std::cerr << "    results differ: " << sum_tree << " != " << sum_bytecode << std::endl;
+        }
+    }
+}
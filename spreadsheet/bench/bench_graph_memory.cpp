@@ -0,0 +1,72 @@
+#include "bench_runner_p.h"
+#include "benchmarks.h"
+#include "sheet.h"
+
+#include <string>
+#include <vector>
+
+namespace {
+
+const int ROWS = Position::MAX_ROWS;
+const int COLS = 16;
+
+// Каждая формула ссылается на три ячейки строкой выше: у большинства ячеек
+// по 3 входа и 3 зависимых
+void FillWideDag(Sheet& sheet) {
+    for (int col = 0; col < COLS; ++col) {
+        sheet.SetCell(Position{0, col}, std::to_string(col));
+    }
+    for (int row = 1; row < ROWS; ++row) {
+        for (int col = 0; col < COLS; ++col) {
+            std::string text = "=0";
+            for (int delta = -1; delta <= 1; ++delta) {
+                text += "+" + Position{row - 1, (col + delta + COLS) % COLS}.ToString();
+            }
+            sheet.SetCell(Position{row, col}, text);
+        }
+    }
+}
+
+// Проходит по входам и зависимым всех ячеек графа
+size_t VisitAllLinks(const std::vector<const Cell*>& cells) {
+    size_t checksum = 0;
+    for (const Cell* cell : cells) {
+        for (const Cell* input : cell->GetCellsContainedInThis()) {
+            checksum += input->GetOrderIndex();
+        }
+        for (const Cell* dependent : cell->GetCellsReferencingToThis()) {
+            checksum += dependent->GetOrderIndex();
+        }
+    }
+    return checksum;
+}
+
+}  // namespace
+
+void BenchGraphMemory() {
+    std::cerr << "  wide DAG " << ROWS << "x" << COLS << ", sizeof(Cell) = " << sizeof(Cell) << std::endl;
+
+    const size_t memory_before = GetMemoryUsage();
+    Sheet sheet;
+    FillWideDag(sheet);
+    const size_t memory_after = GetMemoryUsage();
+    if (memory_before != 0) {
+        std::cerr << "    memory: " << (memory_after - memory_before) / (ROWS * COLS) << " bytes per cell" << std::endl;
+    }
+
+    std::vector<const Cell*> cells;
+    for (int row = 0; row < ROWS; ++row) {
+        for (int col = 0; col < COLS; ++col) {
+            cells.push_back(sheet.GetConcreteCell(Position{row, col}));
+        }
+    }
+
+    size_t checksum = 0;
+    {
+        LOG_DURATION("visit inputs and dependents of all cells x10");
+        for (int i = 0; i < 10; ++i) {
+            checksum += VisitAllLinks(cells);
+        }
+    }
+    DoNotOptimize(checksum);
+}
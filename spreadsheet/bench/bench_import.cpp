@@ -0,0 +1,97 @@
+#include "bench_runner_p.h"
+#include "benchmarks.h"
+#include "importer.h"
+#include "sheet.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+namespace {
+
+const int ROWS = Position::MAX_ROWS;
+const int COLS = 64;  // 16384 * 64 = 1M ячеек
+const char* const TSV_PATH = "bench_import.tsv";
+
+// Таблица в формате PrintTexts: числа, текст и заполненные вниз формулы
+void WriteTsv(std::ostream& output) {
+    for (int row = 0; row < ROWS; ++row) {
+        const std::string r = std::to_string(row + 1);
+        for (int col = 0; col < COLS; ++col) {
+            if (col > 0) {
+                output << '\t';
+            }
+            switch (col % 4) {
+                case 0:
+                    output << row * 7 % 1000;
+                    break;
+                case 1:
+                    output << "item " << row;
+                    break;
+                case 2:
+                    output << '=' << Position{row, col - 2}.ToString() << "*2+1";
+                    break;
+                default:
+                    output << "=SUM(" << Position{row, col - 3}.ToString() << ':' << Position{row, col - 1}.ToString() << ")/3";
+            }
+        }
+        output << '\n';
+    }
+}
+
+void PrintThroughput(const std::string& name, LogDuration::Clock::time_point start, size_t bytes, size_t cells) {
+    const double seconds = std::chrono::duration<double>(LogDuration::Clock::now() - start).count();
+    std::cerr << "    " << name << ": " << seconds * 1000 << " ms, " << bytes / seconds / (1 << 20) << " MB/s, "
+              << cells / seconds / 1e6 << " M cells/s" << std::endl;
+}
+
+}  // namespace
+
+void BenchImport() {
+    {
+        std::ofstream output(TSV_PATH, std::ios::binary);
+        WriteTsv(output);
+    }
+    std::ifstream size_input(TSV_PATH, std::ios::binary | std::ios::ate);
+    const size_t bytes = static_cast<size_t>(size_input.tellg());
+    std::cerr << "  " << ROWS << " x " << COLS << " TSV, " << bytes / (1 << 20) << " MiB" << std::endl;
+
+    // как сейчас: строки делятся на поля, каждое поле - SetCell
+    {
+        Sheet sheet;
+        const auto start = LogDuration::Clock::now();
+        std::ifstream input(TSV_PATH, std::ios::binary);
+        std::string line;
+        size_t cells = 0;
+        for (int row = 0; std::getline(input, line); ++row) {
+            std::istringstream fields(line);
+            std::string field;
+            for (int col = 0; std::getline(fields, field, '\t'); ++col) {
+                if (!field.empty()) {
+                    sheet.SetCell(Position{row, col}, field);
+                    ++cells;
+                }
+            }
+        }
+        PrintThroughput("SetCell per field", start, bytes, cells);
+    }
+
+    const size_t hardware_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    for (size_t threads_count : {size_t{1}, hardware_threads}) {
+        Sheet sheet;
+        const auto start = LogDuration::Clock::now();
+        std::ifstream input(TSV_PATH, std::ios::binary);
+        ImportOptions options;
+        options.threads_count = threads_count;
+        const ImportStats stats = ImportTable(sheet, input, options);
+        PrintThroughput("ImportTable, " + std::to_string(threads_count) + " threads", start, stats.bytes, stats.cells);
+        if (threads_count == hardware_threads) {
+            break;
+        }
+    }
+    std::remove(TSV_PATH);
+}
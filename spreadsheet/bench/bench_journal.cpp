@@ -0,0 +1,102 @@
+#include "bench_runner_p.h"
+#include "benchmarks.h"
+#include "journal.h"
+#include "sheet.h"
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace {
+
+const int ROWS = 1024;
+const int COLS = 16;
+const int EDITS = 200000;
+const int SYNCED_EDITS = 2000;  // каждая правка ждёт fsync
+const char* const JOURNAL_PATH = "bench_journal.bin";
+
+// Правки по кругу: в столбце A числа, в каждом 4-м столбце текст, в остальных формулы от своей строки
+CellEdit MakeEdit(int edit) {
+    const int row = edit % ROWS;
+    const int col = edit / ROWS % COLS;
+    const std::string r = std::to_string(row + 1);
+    if (col == 0) {
+        return {Position{row, col}, std::to_string(edit % 1000)};
+    }
+    if (col % 4 == 0) {
+        return {Position{row, col}, "note " + std::to_string(edit)};
+    }
+    return {Position{row, col}, "=A" + r + "*" + std::to_string(col) + "+" + std::to_string(edit % 7)};
+}
+
+// Правки в секунду для count правок через apply; finish входит во время (например, Sync)
+double MeasureEdits(const std::string& name, int count, const std::function<void(CellEdit)>& apply,
+                    const std::function<void()>& finish = {}) {
+    std::vector<CellEdit> edits;
+    edits.reserve(count);
+    for (int edit = 0; edit < count; ++edit) {
+        edits.push_back(MakeEdit(edit));
+    }
+    const auto start = LogDuration::Clock::now();
+    for (CellEdit& edit : edits) {
+        apply(std::move(edit));
+    }
+    if (finish) {
+        finish();
+    }
+    const double seconds = std::chrono::duration<double>(LogDuration::Clock::now() - start).count();
+    const double rate = count / seconds;
+    std::cerr << "    " << name << ": " << count << " edits, " << seconds * 1000 << " ms, " << rate / 1000
+              << " k edits/s" << std::endl;
+    return seconds;
+}
+
+}  // namespace
+
+void BenchJournal() {
+    std::cerr << "  " << ROWS << " x " << COLS << " cells, edits of numbers, texts and formulas" << std::endl;
+    std::remove(JOURNAL_PATH);
+
+    Sheet plain;
+    MeasureEdits("SetCell without journal", EDITS, [&plain](CellEdit edit) {
+        plain.SetCell(edit.pos, std::move(edit.text));
+    });
+
+    Sheet journaled;
+    {
+        SheetJournal journal(journaled, JOURNAL_PATH, JournalOptions{std::chrono::milliseconds(10)});
+        MeasureEdits(
+            "SheetJournal, group commit every 10 ms", EDITS,
+            [&journal](CellEdit edit) {
+                journal.SetCell(edit.pos, std::move(edit.text));
+            },
+            [&journal] {
+                journal.Sync();
+            });
+        const JournalStats stats = journal.GetStats();
+        std::cerr << "    " << stats.groups << " groups, " << stats.bytes / 1024 << " KiB" << std::endl;
+    }
+    {
+        Sheet replayed;
+        const auto start = LogDuration::Clock::now();
+        const ReplayStats stats = ReplayJournalFile(replayed, JOURNAL_PATH);
+        const double seconds = std::chrono::duration<double>(LogDuration::Clock::now() - start).count();
+        std::cerr << "    ReplayJournalFile: " << stats.operations << " edits, " << seconds * 1000 << " ms, "
+                  << stats.operations / seconds / 1000 << " k edits/s" << std::endl;
+        DoNotOptimize(replayed.GetPrintableSize());
+    }
+    std::remove(JOURNAL_PATH);
+
+    Sheet synced;
+    {
+        SheetJournal journal(synced, JOURNAL_PATH, JournalOptions{std::chrono::milliseconds(0)});
+        MeasureEdits("SheetJournal, fsync per edit", SYNCED_EDITS, [&journal](CellEdit edit) {
+            journal.SetCell(edit.pos, std::move(edit.text));
+        });
+    }
+    std::remove(JOURNAL_PATH);
+    DoNotOptimize(plain.GetPrintableSize());
+    DoNotOptimize(journaled.GetPrintableSize());
+}
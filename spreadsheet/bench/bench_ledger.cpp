@@ -0,0 +1,60 @@
+#include "bench_runner_p.h"
+#include "benchmarks.h"
+#include "sheet.h"
+
+#include <string>
+
+namespace {
+
+// в запросе - 1M строк, но в таблице их не больше Position::MAX_ROWS
+const int ROWS = Position::MAX_ROWS;
+const int EDITS = 1000;
+
+// A - суммы операций, B - нарастающий итог SUM(A1:Ai), C1 - общий итог
+void FillLedger(Sheet& sheet) {
+    for (int row = 0; row < ROWS; ++row) {
+        sheet.SetCell(Position{row, 0}, std::to_string(row % 100 - 50));
+        sheet.SetCell(Position{row, 1}, "=SUM(A1:" + Position{row, 0}.ToString() + ")");
+    }
+    sheet.SetCell(Position{0, 2}, "=SUM(A1:" + Position{ROWS - 1, 0}.ToString() + ")");
+}
+
+}  // namespace
+
+void BenchLedger() {
+    Sheet sheet;
+    std::cerr << "  " << ROWS << " rows, running total in every row" << std::endl;
+    {
+        LOG_DURATION("fill ledger");
+        FillLedger(sheet);
+    }
+    {
+        LOG_DURATION("edit amount + read total x" + std::to_string(EDITS));
+        double total = 0;
+        for (int i = 0; i < EDITS; ++i) {
+            sheet.SetCell(Position{(i * 7919) % ROWS, 0}, std::to_string(i % 100));
+            total += std::get<double>(sheet.GetCell(Position{0, 2})->GetValue());
+        }
+        DoNotOptimize(total);
+    }
+    {
+        LOG_DURATION("edit amount + read last running total x" + std::to_string(EDITS));
+        double total = 0;
+        for (int i = 0; i < EDITS; ++i) {
+            sheet.SetCell(Position{(i * 7919) % ROWS, 0}, std::to_string(i % 100 + 100));
+            total += std::get<double>(sheet.GetCell(Position{ROWS - 1, 1})->GetValue());
+        }
+        DoNotOptimize(total);
+    }
+    {
+        LOG_DURATION("switch to Eager (all running totals)");
+        sheet.SetRecalculationMode(RecalculationMode::Eager);
+    }
+    {
+        LOG_DURATION("edit amount in the middle x10 (Eager)");
+        for (int i = 0; i < 10; ++i) {
+            sheet.SetCell(Position{ROWS / 2, 0}, std::to_string(i));
+        }
+    }
+    std::cerr << "    recomputed " << sheet.GetLastRecalculationStats().recomputed_cells << " formulas per edit" << std::endl;
+}
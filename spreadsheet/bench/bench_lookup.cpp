@@ -0,0 +1,82 @@
+#include "bench_runner_p.h"
+#include "benchmarks.h"
+#include "sheet.h"
+
+#include <string>
+
+namespace {
+
+const int ROWS = 16384;
+// поиск в строке идёт перебором ячеек (индексы строятся только по столбцам)
+const int SCAN_CELLS = 4096;
+const int EDITS = 1000;
+
+// Ключ строки row: перестановка 0..rows-1
+int GetKey(int row, int rows) {
+    return static_cast<int>((int64_t{row} * 7919) % rows);
+}
+
+// A - ключи, B - значения, C - VLOOKUP по каждому ключу
+void FillJoin(Sheet& sheet, int rows) {
+    const std::string table = "A1:" + Position{rows - 1, 1}.ToString();
+    for (int row = 0; row < rows; ++row) {
+        sheet.SetCell(Position{row, 0}, std::to_string(GetKey(row, rows)));
+        sheet.SetCell(Position{row, 1}, std::to_string(row));
+    }
+    for (int row = 0; row < rows; ++row) {
+        sheet.SetCell(Position{row, 2}, "=VLOOKUP(" + std::to_string(row) + "," + table + ",2)");
+    }
+}
+
+double SumColumn(const Sheet& sheet, int col, int rows, int first_row = 0) {
+    double sum = 0;
+    for (int row = first_row; row < first_row + rows; ++row) {
+        sum += std::get<double>(sheet.GetCell(Position{row, col})->GetValue());
+    }
+    return sum;
+}
+
+}  // namespace
+
+void BenchLookup() {
+    Sheet sheet;
+    std::cerr << "  " << ROWS << " rows, VLOOKUP of every key" << std::endl;
+    {
+        LOG_DURATION("fill table + lookups");
+        FillJoin(sheet, ROWS);
+    }
+    {
+        LOG_DURATION("read all lookups (column index)");
+        DoNotOptimize(SumColumn(sheet, 2, ROWS));
+    }
+    {
+        LOG_DURATION("swap two keys + read a lookup x" + std::to_string(EDITS));
+        double total = 0;
+        for (int i = 0; i < EDITS; ++i) {
+            const Position lhs{(i * 7919) % ROWS, 0};
+            const Position rhs{(i * 104729 + 1) % ROWS, 0};
+            const std::string lhs_key = sheet.GetCell(lhs)->GetText();
+            sheet.SetCell(lhs, sheet.GetCell(rhs)->GetText());
+            sheet.SetCell(rhs, lhs_key);
+            total += std::get<double>(sheet.GetCell(Position{std::stoi(lhs_key), 2})->GetValue());
+        }
+        DoNotOptimize(total);
+    }
+
+    // для сравнения - тот же поиск по строке, где индекса нет: O(ячеек) на поиск
+    Sheet row_sheet;
+    std::cerr << "  " << SCAN_CELLS << " keys in a row, XLOOKUP of every key" << std::endl;
+    const std::string keys = "A1:" + Position{0, SCAN_CELLS - 1}.ToString();
+    const std::string values = "A2:" + Position{1, SCAN_CELLS - 1}.ToString();
+    for (int col = 0; col < SCAN_CELLS; ++col) {
+        row_sheet.SetCell(Position{0, col}, std::to_string(GetKey(col, SCAN_CELLS)));
+        row_sheet.SetCell(Position{1, col}, std::to_string(col));
+    }
+    for (int row = 2; row < SCAN_CELLS + 2; ++row) {
+        row_sheet.SetCell(Position{row, 0}, "=XLOOKUP(" + std::to_string(row - 2) + "," + keys + "," + values + ")");
+    }
+    {
+        LOG_DURATION("read all lookups (scan)");
+        DoNotOptimize(SumColumn(row_sheet, 0, SCAN_CELLS, 2));
+    }
+}
@@ -0,0 +1,58 @@
+#include "bench_runner_p.h"
+#include "benchmarks.h"
+#include "sheet.h"
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const int ROWS = Position::MAX_ROWS;
+const int CHAIN_LENGTH = 16;  // 16 * 16384 > 250k формул
+
+// В каждой строке независимая цепочка формул: ячейка ссылается на соседнюю слева
+void FillIndependentChains(Sheet& sheet) {
+    for (int row = 0; row < ROWS; ++row) {
+        sheet.SetCell(Position{row, 0}, std::to_string(row % 100));
+        for (int col = 1; col <= CHAIN_LENGTH; ++col) {
+            std::string prev = Position{row, col - 1}.ToString();
+            sheet.SetCell(Position{row, col}, "=(" + prev + "*3+1)/2-" + prev + "/7");
+        }
+    }
+}
+
+// 1, 2, 4, ... и число ядер процессора
+std::vector<size_t> ThreadCounts() {
+    size_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+    std::vector<size_t> counts;
+    for (size_t threads = 1; threads < cores; threads *= 2) {
+        counts.push_back(threads);
+    }
+    counts.push_back(cores);
+    return counts;
+}
+
+}  // namespace
+
+void BenchParallelRecalculation() {
+    Sheet sheet;
+    FillIndependentChains(sheet);
+    std::cerr << "  " << ROWS << " independent chains x " << CHAIN_LENGTH << " formulas" << std::endl;
+
+    double single_thread_seconds = 0;
+    for (size_t threads : ThreadCounts()) {
+        double seconds = 0;
+        {
+            LogDuration timer("RecalculateAll(" + std::to_string(threads) + ")");
+            DoNotOptimize(sheet.RecalculateAll(threads));
+            seconds = timer.GetSeconds();
+        }
+        if (threads == 1) {
+            single_thread_seconds = seconds;
+        } else {
+            std::cerr << "    speedup x" << single_thread_seconds / seconds << std::endl;
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#include "bench_runner_p.h"
+#include "benchmarks.h"
+#include "sheet.h"
+
+#include <string>
+
+namespace {
+
+const int ROWS = Position::MAX_ROWS;
+const int EDITS = 1000;
+
+void FillColumn(Sheet& sheet) {
+    for (int row = 0; row < ROWS; ++row) {
+        sheet.SetCell(Position{row, 0}, std::to_string(row % 100));
+    }
+}
+
+// Изменяет ячейки столбца A и после каждого изменения читает формулу из B1
+void EditAndRead(Sheet& sheet, const std::string& name) {
+    LOG_DURATION(name + ": edit + read x" + std::to_string(EDITS));
+    double total = 0;
+    for (int i = 0; i < EDITS; ++i) {
+        sheet.SetCell(Position{(i * 7919) % ROWS, 0}, std::to_string(i));
+        total += std::get<double>(sheet.GetCell(Position{0, 1})->GetValue());
+    }
+    DoNotOptimize(total);
+}
+
+}  // namespace
+
+void BenchRangeAggregates() {
+    std::cerr << "  " << ROWS << " numbers in column A" << std::endl;
+
+    {
+        Sheet sheet;
+        FillColumn(sheet);
+        {
+            LOG_DURATION("set =SUM(A1:A" + std::to_string(ROWS) + ")");
+            sheet.SetCell(Position{0, 1}, "=SUM(A1:A" + std::to_string(ROWS) + ")");
+        }
+        EditAndRead(sheet, "SUM over range");
+    }
+
+    {
+        Sheet sheet;
+        FillColumn(sheet);
+        std::string formula = "=A1";
+        for (int row = 1; row < ROWS; ++row) {
+            formula += "+" + Position{row, 0}.ToString();
+        }
+        {
+            LOG_DURATION("set =A1+A2+...+A" + std::to_string(ROWS));
+            sheet.SetCell(Position{0, 1}, formula);
+        }
+        EditAndRead(sheet, "chain of references");
+    }
+}
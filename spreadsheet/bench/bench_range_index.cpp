@@ -0,0 +1,46 @@
+#include "bench_runner_p.h"
+#include "benchmarks.h"
+#include "sheet.h"
+
+#include <string>
+
+namespace {
+
+const int ROWS = Position::MAX_ROWS;
+const int WINDOW = 100;
+const int EDITS = 1000;
+
+}  // namespace
+
+void BenchRangeIndex() {
+    Sheet sheet;
+    std::cerr << "  " << ROWS << " formulas =SUM over a window of " << WINDOW << " cells of column A" << std::endl;
+
+    {
+        LOG_DURATION("set formulas");
+        for (int row = 0; row < ROWS; ++row) {
+            const int last_row = std::min(row + WINDOW, ROWS) - 1;
+            sheet.SetCell(Position{row, 1}, "=SUM(" + Position{row, 0}.ToString() + ":" + Position{last_row, 0}.ToString() + ")");
+        }
+    }
+    {
+        LOG_DURATION("fill column A");
+        for (int row = 0; row < ROWS; ++row) {
+            sheet.SetCell(Position{row, 0}, std::to_string(row % 10));
+        }
+    }
+    sheet.SetRecalculationMode(RecalculationMode::Eager);
+    {
+        LOG_DURATION("edit column A x" + std::to_string(EDITS) + " (Eager)");
+        for (int i = 0; i < EDITS; ++i) {
+            sheet.SetCell(Position{(i * 7919) % ROWS, 0}, std::to_string(i));
+        }
+    }
+    std::cerr << "    recomputed " << sheet.GetLastRecalculationStats().recomputed_cells << " formulas per edit" << std::endl;
+    {
+        LOG_DURATION("clear column A x" + std::to_string(EDITS) + " (Eager)");
+        for (int i = 0; i < EDITS; ++i) {
+            sheet.ClearCell(Position{(i * 7919) % ROWS, 0});
+        }
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+// Замер времени работы блока кода. Результат выводится в std::cerr при выходе из блока
+class LogDuration {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit LogDuration(std::string name)
+        : name_(std::move(name)) {
+    }
+
+    double GetSeconds() const {
+        return std::chrono::duration<double>(Clock::now() - start_).count();
+    }
+
+    ~LogDuration() {
+        std::cerr << "    " << name_ << ": " << GetSeconds() * 1000 << " ms" << std::endl;
+    }
+
+private:
+    std::string name_;
+    Clock::time_point start_ = Clock::now();
+};
+
+// Не даёт компилятору выбросить вычисления, результат которых не используется
+template <typename T>
+void DoNotOptimize(const T& value) {
+#if defined(_MSC_VER)
+    static volatile const T* sink;
+    sink = &value;
+#else
+    asm volatile("" : : "r,m"(value) : "memory");
+#endif
+}
+
+// Объём занятой процессом памяти (resident set) в байтах; 0, если узнать нельзя
+inline size_t GetMemoryUsage() {
+#if defined(__linux__)
+    std::ifstream statm("/proc/self/statm");
+    size_t total_pages = 0;
+    size_t resident_pages = 0;
+    if (statm >> total_pages >> resident_pages) {
+        return resident_pages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    }
+#endif
+    return 0;
+}
+
+class BenchRunner {
+public:
+    // filter - подстрока имени бенчмарка; пустая строка - запускать все
+    explicit BenchRunner(std::string filter)
+        : filter_(std::move(filter)) {
+    }
+
+    template <class BenchFunc>
+    void RunBench(BenchFunc func, const std::string& bench_name) {
+        if (!filter_.empty() && bench_name.find(filter_) == std::string::npos) {
+            return;
+        }
+        std::cerr << bench_name << std::endl;
+        try {
+            func();
+        } catch (std::exception& e) {
+            std::cerr << bench_name << " fail: " << e.what() << std::endl;
+        }
+    }
+
+private:
+    std::string filter_;
+};
+
+#define LOG_DURATION_CONCAT_INTERNAL(X, Y) X##Y
+#define LOG_DURATION_CONCAT(X, Y) LOG_DURATION_CONCAT_INTERNAL(X, Y)
+#define LOG_DURATION(name) LogDuration LOG_DURATION_CONCAT(log_duration_, __LINE__)(name)
+
+#define RUN_BENCH(br, func) br.RunBench(func, #func)
@@ -0,0 +1,91 @@
+#include "bench_runner_p.h"
+#include "benchmarks.h"
+#include "sheet.h"
+#include "snapshot.h"
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+const int ROWS = Position::MAX_ROWS;
+const int COLS = 16;  // 16 * 16384 > 250k ячеек
+const int FIRST_FORMULA_COL = 2;
+const int LAST_FORMULA_COL = COLS - 2;
+const char* const SNAPSHOT_PATH = "bench_snapshot.bin";
+
+// Все разделы снимка: столбец A - числа, B и последний - тексты, между ними
+// заполненные вниз формулы: ссылки на ячейки левее и выше и суммы областей строки
+std::vector<CellEdit> MakeEdits() {
+    std::vector<CellEdit> edits;
+    edits.reserve(ROWS * COLS);
+    for (int row = 0; row < ROWS; ++row) {
+        const std::string r = std::to_string(row + 1);
+        edits.push_back({Position{row, 0}, std::to_string(row % 100)});
+        edits.push_back({Position{row, 1}, "item " + r});
+        edits.push_back({Position{row, FIRST_FORMULA_COL}, "=A" + r + "*2+1"});
+        for (int col = FIRST_FORMULA_COL + 1; col <= LAST_FORMULA_COL; ++col) {
+            std::string text;
+            if (col % 4 == 3) {
+                text = "=SUM(" + Position{row, col - 3}.ToString() + ":" + Position{row, col - 1}.ToString() + ")";
+            } else {
+                std::string left = Position{row, col - 1}.ToString();
+                std::string up = Position{row > 0 ? row - 1 : row, col - 1}.ToString();
+                text = "=" + left + "+" + up + "/2";
+            }
+            edits.push_back({Position{row, col}, std::move(text)});
+        }
+        edits.push_back({Position{row, COLS - 1}, "'=note " + r});
+    }
+    return edits;
+}
+
+double SumValues(const Sheet& sheet) {
+    double sum = 0;
+    for (int row = 0; row < ROWS; ++row) {
+        for (int col = FIRST_FORMULA_COL; col <= LAST_FORMULA_COL; ++col) {
+            sum += std::get<double>(sheet.GetCell(Position{row, col})->GetValue());
+        }
+    }
+    return sum;
+}
+
+}  // namespace
+
+void BenchSnapshot() {
+    const std::vector<CellEdit> edits = MakeEdits();
+    std::cerr << "  " << edits.size() << " cells" << std::endl;
+
+    Sheet sheet;
+    {
+        LOG_DURATION("restart by SetCells from texts");
+        sheet.SetCells(edits);
+    }
+    {
+        LOG_DURATION("read all formulas after SetCells");
+        DoNotOptimize(SumValues(sheet));
+    }
+
+    {
+        LOG_DURATION("SaveSnapshot to file");
+        std::ofstream file(SNAPSHOT_PATH, std::ios::binary);
+        SaveSnapshot(sheet, file);
+    }
+    {
+        std::ifstream file(SNAPSHOT_PATH, std::ios::binary | std::ios::ate);
+        std::cerr << "    snapshot size: " << file.tellg() / (1024 * 1024) << " MiB" << std::endl;
+    }
+
+    std::unique_ptr<Sheet> loaded;
+    {
+        LOG_DURATION("LoadSnapshotFile");
+        loaded = LoadSnapshotFile(SNAPSHOT_PATH);
+    }
+    {
+        LOG_DURATION("read all formulas after LoadSnapshotFile (restored cache)");
+        DoNotOptimize(SumValues(*loaded));
+    }
+    std::remove(SNAPSHOT_PATH);
+}
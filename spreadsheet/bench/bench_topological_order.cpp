@@ -0,0 +1,108 @@
+#include "bench_runner_p.h"
+#include "benchmarks.h"
+#include "sheet.h"
+
+#include <string>
+
+namespace {
+
+const int CHAIN_LENGTH = 1 << 20;  // 64 столбца по 16384 строки
+const int EDITS = 10'000;
+
+Position ChainPosition(int index) {
+    return Position{index % Position::MAX_ROWS, index / Position::MAX_ROWS};
+}
+
+std::string ChainFormula(int index) {
+    return "=" + ChainPosition(index - 1).ToString() + "+1";
+}
+
+void BenchChain() {
+    std::cerr << "  chain of " << CHAIN_LENGTH << " formulas" << std::endl;
+    Sheet sheet;
+    {
+        // каждая новая ячейка ссылается на предыдущую: ссылка не нарушает порядок
+        LOG_DURATION("build chain head to tail");
+        sheet.SetCell(ChainPosition(0), "1");
+        for (int i = 1; i < CHAIN_LENGTH; ++i) {
+            sheet.SetCell(ChainPosition(i), ChainFormula(i));
+        }
+    }
+    {
+        // изменение конца цепочки: раньше - обход всех 1M входов
+        LOG_DURATION("edit chain tail x" + std::to_string(EDITS));
+        const Position tail = ChainPosition(CHAIN_LENGTH - 1);
+        const std::string tail_input = ChainPosition(CHAIN_LENGTH - 2).ToString();
+        for (int i = 0; i < EDITS; ++i) {
+            sheet.SetCell(tail, "=" + tail_input + "+" + std::to_string(i % 2));
+        }
+    }
+    {
+        // новая ячейка ссылается на себя через всю цепочку - цикл
+        LOG_DURATION("reject cycle through the chain");
+        try {
+            sheet.SetCell(ChainPosition(0), "=" + ChainPosition(CHAIN_LENGTH - 1).ToString());
+        } catch (const CircularDependencyException&) {
+        }
+    }
+    {
+        // начало цепочки ссылается на ячейку, созданную позже всех: переупорядочивается вся цепочка
+        LOG_DURATION("edge against the order (whole chain reordered)");
+        const Position new_input{0, Position::MAX_COLS - 1};
+        sheet.SetCell(new_input, "1");
+        sheet.SetCell(ChainPosition(0), "=" + new_input.ToString());
+    }
+}
+
+void BenchChainBuiltBackwards() {
+    Sheet sheet;
+    // каждая ячейка ссылается на ещё не созданную следующую
+    LOG_DURATION("build chain tail to head");
+    for (int i = CHAIN_LENGTH - 2; i >= 0; --i) {
+        sheet.SetCell(ChainPosition(i), "=" + ChainPosition(i + 1).ToString() + "+1");
+    }
+}
+
+void BenchWideDag() {
+    const int rows = Position::MAX_ROWS;
+    const int cols = 16;
+    std::cerr << "  wide DAG " << rows << "x" << cols << ", each cell depends on 3 cells above" << std::endl;
+
+    auto formula = [cols](int row, int col, int shift) {
+        std::string text = "=" + std::to_string(shift);
+        for (int delta = -1; delta <= 1; ++delta) {
+            int input_col = (col + delta + cols) % cols;
+            text += "+" + Position{row - 1, input_col}.ToString() + "/3";
+        }
+        return text;
+    };
+
+    Sheet sheet;
+    {
+        LOG_DURATION("build");
+        for (int col = 0; col < cols; ++col) {
+            sheet.SetCell(Position{0, col}, std::to_string(col));
+        }
+        for (int row = 1; row < rows; ++row) {
+            for (int col = 0; col < cols; ++col) {
+                sheet.SetCell(Position{row, col}, formula(row, col, 0));
+            }
+        }
+    }
+    {
+        LOG_DURATION("edit cells in the middle x" + std::to_string(EDITS));
+        for (int i = 0; i < EDITS; ++i) {
+            int row = rows / 2 + i % 1000;
+            int col = i % cols;
+            sheet.SetCell(Position{row, col}, formula(row, col, i % 2 + 1));
+        }
+    }
+}
+
+}  // namespace
+
+void BenchTopologicalOrder() {
+    BenchChain();
+    BenchChainBuiltBackwards();
+    BenchWideDag();
+}
@@ -0,0 +1,111 @@
+#include "bench_runner_p.h"
+#include "benchmarks.h"
+#include "sheet.h"
+
+#include <chrono>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+const int ROWS = 4096;
+const int COLS = 256;
+const int VIEWPORT_ROWS = 50;
+const int VIEWPORT_COLS = 200;
+const int SCROLL_STEP = 25;
+
+// В столбце A числа, в каждом 8-м столбце текст, в остальных - заполненные вниз формулы
+std::vector<CellEdit> MakeEdits() {
+    std::vector<CellEdit> edits;
+    edits.reserve(ROWS * COLS);
+    for (int row = 0; row < ROWS; ++row) {
+        const std::string r = std::to_string(row + 1);
+        edits.push_back({Position{row, 0}, r});
+        for (int col = 1; col < COLS; ++col) {
+            if (col % 8 == 0) {
+                edits.push_back({Position{row, col}, "row " + r});
+            } else {
+                edits.push_back({Position{row, col}, "=A" + r + "*" + std::to_string(col) + "+1"});
+            }
+        }
+    }
+    return edits;
+}
+
+// Меняет все числа столбца A: после этого ни одна формула не вычислена
+void EditInputs(Sheet& sheet, int edit) {
+    std::vector<CellEdit> edits;
+    edits.reserve(ROWS);
+    for (int row = 0; row < ROWS; ++row) {
+        edits.push_back({Position{row, 0}, std::to_string(row + edit)});
+    }
+    sheet.SetCells(std::move(edits));
+}
+
+// Среднее время кадра в мкс при прокрутке видимой области сверху вниз
+double ScrollFrameTime(const std::function<void(Range)>& draw) {
+    double seconds = 0;
+    int frames = 0;
+    for (int first_row = 0; first_row + VIEWPORT_ROWS <= ROWS; first_row += SCROLL_STEP) {
+        const Range viewport{Position{first_row, 0}, Position{first_row + VIEWPORT_ROWS - 1, VIEWPORT_COLS - 1}};
+        const auto start = LogDuration::Clock::now();
+        draw(viewport);
+        seconds += std::chrono::duration<double>(LogDuration::Clock::now() - start).count();
+        ++frames;
+    }
+    return seconds * 1e6 / frames;
+}
+
+// Прокрутка после правки входов (видимые формулы вычисляются) и повторная (значения в кеше)
+void MeasureScroll(Sheet& sheet, int edit, const std::string& name, const std::function<void(Range)>& draw) {
+    EditInputs(sheet, edit);
+    const double after_edit = ScrollFrameTime(draw);
+    const double cached = ScrollFrameTime(draw);
+    std::cerr << "    " << name << ": " << after_edit << " us per frame after an edit, " << cached << " us cached"
+              << std::endl;
+}
+
+}  // namespace
+
+void BenchViewport() {
+    Sheet sheet;
+    sheet.SetCells(MakeEdits());
+    std::cerr << "  " << ROWS << " x " << COLS << " cells, viewport " << VIEWPORT_ROWS << " x " << VIEWPORT_COLS
+              << ", scroll by " << SCROLL_STEP << " rows" << std::endl;
+
+    std::vector<CellInterface::Value> buffer(VIEWPORT_ROWS * VIEWPORT_COLS);
+    double checksum = 0;
+    MeasureScroll(sheet, 1, "GetCell and GetValue per position", [&](Range viewport) {
+        size_t i = 0;
+        for (int row = viewport.from.row; row <= viewport.to.row; ++row) {
+            for (int col = viewport.from.col; col <= viewport.to.col; ++col) {
+                if (const CellInterface* cell = sheet.GetCell(Position{row, col})) {
+                    buffer[i] = cell->GetValue();
+                } else {
+                    buffer[i] = std::string();
+                }
+                ++i;
+            }
+        }
+        checksum += std::get<double>(buffer[1]);
+    });
+    MeasureScroll(sheet, 2, "GetValues", [&](Range viewport) {
+        sheet.GetValues(viewport, buffer.data());
+        checksum += std::get<double>(buffer[1]);
+    });
+    std::ostringstream output;
+    MeasureScroll(sheet, 3, "PrintValues of viewport", [&](Range viewport) {
+        output.str({});
+        sheet.PrintValues(output, viewport);
+        checksum += static_cast<double>(output.tellp());
+    });
+    {
+        EditInputs(sheet, 4);
+        output.str({});
+        LOG_DURATION("    whole PrintValues after an edit");
+        sheet.PrintValues(output);
+    }
+    DoNotOptimize(checksum);
+}
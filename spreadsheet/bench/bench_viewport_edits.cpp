@@ -0,0 +1,65 @@
+#include "bench_runner_p.h"
+#include "benchmarks.h"
+#include "sheet.h"
+
+#include <string>
+
+namespace {
+
+const int ROWS = Position::MAX_ROWS;
+const int COLS = 8;
+const int VIEWPORT_ROWS = 50;
+const int EDITS = 1000;
+
+// Все строки зависят от A1: первая формула строки ссылается на A1, остальные - на соседнюю слева
+void FillHotInputSheet(Sheet& sheet) {
+    sheet.SetCell(Position{0, 0}, "1");
+    for (int row = 1; row < ROWS; ++row) {
+        sheet.SetCell(Position{row, 1}, "=A1+" + std::to_string(row));
+        for (int col = 2; col <= COLS; ++col) {
+            sheet.SetCell(Position{row, col}, "=" + Position{row, col - 1}.ToString() + "*2");
+        }
+    }
+}
+
+double ReadValues(const Sheet& sheet, int rows) {
+    double checksum = 0;
+    for (int row = 1; row <= rows; ++row) {
+        for (int col = 1; col <= COLS; ++col) {
+            CellInterface::Value value = sheet.GetCell(Position{row, col})->GetValue();
+            if (std::holds_alternative<double>(value)) {
+                checksum += std::get<double>(value);
+            }
+        }
+    }
+    return checksum;
+}
+
+}  // namespace
+
+void BenchViewportEdits() {
+    Sheet sheet;
+    FillHotInputSheet(sheet);
+    std::cerr << "  " << (ROWS - 1) * COLS << " formulas depend on A1, viewport " << VIEWPORT_ROWS << "x" << COLS << std::endl;
+
+    double checksum = 0;
+    {
+        LOG_DURATION("read all formulas");
+        checksum += ReadValues(sheet, ROWS - 1);
+    }
+    {
+        LOG_DURATION("edit A1 + read viewport x" + std::to_string(EDITS));
+        for (int i = 0; i < EDITS; ++i) {
+            sheet.SetCell(Position{0, 0}, std::to_string(i));
+            checksum += ReadValues(sheet, VIEWPORT_ROWS);
+        }
+    }
+    {
+        LOG_DURATION("edit A1 + read all formulas x10");
+        for (int i = 0; i < 10; ++i) {
+            sheet.SetCell(Position{0, 0}, std::to_string(i + 1));
+            checksum += ReadValues(sheet, ROWS - 1);
+        }
+    }
+    DoNotOptimize(checksum);
+}
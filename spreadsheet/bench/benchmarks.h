@@ -0,0 +1,63 @@
+#pragma once
+
+// Бенчмарки. Каждый выводит в std::cerr время работы своих этапов
+
+// Байткод против рекурсивного обхода дерева формулы
+void BenchFormulaBytecodeVsTree();
+
+// Распространение ошибки #VALUE!/#ARITHM! по 100k зависимых ячеек
+void BenchErrorCascade();
+
+// Параллельный пересчёт независимых цепочек формул на 1..N потоках
+void BenchParallelRecalculation();
+
+// Загрузка 250k ячеек по одной через SetCell и одним пакетом SetCells
+void BenchBatchLoad();
+
+// Проверка циклов с поддержкой топологического порядка: цепочка из 1M формул и широкий граф
+void BenchTopologicalOrder();
+
+// Память графа зависимостей и скорость обхода связей ячеек
+void BenchGraphMemory();
+
+// Частые изменения ячейки, от которой зависят 130k формул, и чтение небольшой области
+void BenchViewportEdits();
+
+// Изменения, после которых значения формул не меняются: ранний останов пересчёта
+void BenchEarlyCutoff();
+
+// Сумма столбца из 16384 чисел: SUM по области против формулы со ссылкой на каждую ячейку
+void BenchRangeAggregates();
+
+// Поиск формул, в области которых попала изменённая ячейка: 16384 формул со скользящим окном
+void BenchRangeIndex();
+
+// Журнал операций с нарастающим итогом SUM(A1:Ai) в каждой строке: изменение одной суммы
+void BenchLedger();
+
+// Соединение таблиц функцией VLOOKUP: 16384 поисков по индексу столбца против перебора строки
+void BenchLookup();
+
+// IF, невыбранная ветвь которого зависит от длинной цепочки формул: в режиме Lazy цепочка не проверяется
+void BenchConditional();
+
+// Заполнение вниз 16384 строк формулами: общие шаблоны против уникальных формул, время и память
+void BenchFillDown();
+
+// Чтение 16384 x 8 заполненных вниз формул после изменения их входов: по одной и пачками через EvaluateRange
+void BenchBatchEvaluation();
+
+// Перезапуск с 262k ячеек: повторное задание текстов через SetCells против загрузки двоичного снимка
+void BenchSnapshot();
+
+// Импорт TSV в формате PrintTexts (1M ячеек): SetCell по полю против ImportTable на 1 и всех ядрах
+void BenchImport();
+
+// Выгрузка 16384 x 16 ячеек в файл: печать по ячейке через GetCell и operator<< против PrintValues и PrintTexts
+void BenchExport();
+
+// Прокрутка окна 50 x 200 по таблице 4096 x 256 после правки входов: GetCell по позиции против GetValues и PrintValues области
+void BenchViewport();
+
+// Поток правок 1024 x 16 ячеек: SetCell без журнала против SheetJournal с групповой записью и fsync на каждую правку, восстановление из журнала
+void BenchJournal();
@@ -0,0 +1,27 @@
+#include "bench_runner_p.h"
+#include "benchmarks.h"
+
+// Запуск: spreadsheet_bench [подстрока имени бенчмарка]
+int main(int argc, char* argv[]) {
+    BenchRunner br(argc > 1 ? argv[1] : "");
+    RUN_BENCH(br, BenchFormulaBytecodeVsTree);
+    RUN_BENCH(br, BenchErrorCascade);
+    RUN_BENCH(br, BenchParallelRecalculation);
+    RUN_BENCH(br, BenchBatchLoad);
+    RUN_BENCH(br, BenchTopologicalOrder);
+    RUN_BENCH(br, BenchGraphMemory);
+    RUN_BENCH(br, BenchViewportEdits);
+    RUN_BENCH(br, BenchEarlyCutoff);
+    RUN_BENCH(br, BenchRangeAggregates);
+    RUN_BENCH(br, BenchRangeIndex);
+    RUN_BENCH(br, BenchLedger);
+    RUN_BENCH(br, BenchLookup);
+    RUN_BENCH(br, BenchConditional);
+    RUN_BENCH(br, BenchFillDown);
+    RUN_BENCH(br, BenchBatchEvaluation);
+    RUN_BENCH(br, BenchSnapshot);
+    RUN_BENCH(br, BenchImport);
+    RUN_BENCH(br, BenchExport);
+    RUN_BENCH(br, BenchViewport);
+    RUN_BENCH(br, BenchJournal);
+}
@@ -2,12 +2,47 @@
 #include "sheet.h"  // включили сюда класс Sheet, чтобы были доступны его методы. Иначе Cell ничего не знает про Sheet
 
 #include <cassert>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <optional>
 #include <queue>
 
 
+namespace {
+
+// Значения совпадают для формул, которые их читают. -0 и 0 различаются:
+// они по-разному печатаются
+bool IsSameValue(const CellInterface::NumericValue& lhs, const CellInterface::NumericValue& rhs) {
+    if (std::holds_alternative<double>(lhs) && std::holds_alternative<double>(rhs)) {
+        const double lhs_value = std::get<double>(lhs);
+        const double rhs_value = std::get<double>(rhs);
+        return lhs_value == rhs_value && std::signbit(lhs_value) == std::signbit(rhs_value);
+    }
+    return lhs == rhs;
+}
+
+// В кеше формулы всегда число или ошибка
+CellInterface::NumericValue ToNumericValue(const CellInterface::Value& value) {
+    if (const double* number = std::get_if<double>(&value)) {
+        return *number;
+    }
+    return std::get<FormulaError>(value);
+}
+
+CellInterface::Value ToValue(const CellInterface::NumericValue& value) {
+    if (const double* number = std::get_if<double>(&value)) {
+        return *number;
+    }
+    return std::get<FormulaError>(value);
+}
+
+}  // namespace
+
+
 class Cell::Impl {
 public:
     Impl() = default;
@@ -17,14 +52,44 @@ public:
     virtual void Clear() = 0;
 
     virtual Value GetValue(const SheetInterface& sheet) const = 0;
+    // Значение формулы, чтения которой проходят через gate (nullopt - gate
+    // прервал вычисление). У текста и пустой ячейки gate не нужен
+    virtual std::optional<Value> GetGatedValue(const SheetInterface& sheet, Bytecode::InputGate& /* gate */) const {
+        return GetValue(sheet);
+    }
     virtual std::string GetText() const = 0;
+    // Хранимый текст без копирования (у формулы текст не хранится - пустой)
+    virtual std::string_view GetStoredText() const {
+        return {};
+    }
+    virtual NumericValue GetNumericValue(const SheetInterface& sheet) const = 0;
+    // см. CellInterface::GetRangeValue
+    virtual std::optional<NumericValue> GetRangeValue(const SheetInterface& sheet) const = 0;
 
     virtual bool IsFormulaInCell() const = 0;
 
     virtual bool IsEmptyCell() const = 0;
 
+    // Читает ли формула не все свои входы (см. FormulaInterface::HasBranches)
+    virtual bool HasBranches() const {
+        return false;
+    }
+
     virtual std::vector<Position> GetReferencedCells() const = 0;
 
+    virtual const std::vector<Range>& GetReferencedRanges() const {
+        static const std::vector<Range> no_ranges;
+        return no_ranges;
+    }
+
+    // Привязывает ссылки к ячейкам (cells[i] - ячейка на позиции GetReferencedCells()[i])
+    virtual void BindReferencedCells(std::vector<const CellInterface*> cells) = 0;
+
+    // Формула ячейки (nullptr, если в ячейке не формула)
+    virtual const FormulaInterface* GetFormula() const {
+        return nullptr;
+    }
+
 };
 
 
@@ -50,6 +115,15 @@ public:
         return std::string();
     }
 
+    // пустая ячейка в формуле - это 0, а в области она пропускается
+    std::optional<NumericValue> GetRangeValue(const SheetInterface& /* sheet is not used */) const override {
+        return std::nullopt;
+    }
+
+    NumericValue GetNumericValue(const SheetInterface& /* sheet is not used */) const override {
+        return 0.;
+    }
+
     virtual bool IsFormulaInCell() const override {
         return false;
     }
@@ -58,6 +132,11 @@ public:
         return {};
     }
 
+    // ссылок нет - не делает ничего
+    void BindReferencedCells(std::vector<const CellInterface*> /* cells */) override {
+        return;
+    }
+
     bool IsEmptyCell() const override {
         return true;
     }
@@ -71,36 +150,28 @@ class Cell::TextImpl final : public Cell::Impl {
 public:
     TextImpl() = default;
 
-    TextImpl(std::string text) 
-    : text_(text) {}
-
-    TextImpl(const TextImpl& other) 
-    : text_(other.GetText()) {}
-
-    TextImpl(TextImpl&& other) {
-        text_ = std::move(other.GetText());
-    }
-
-    TextImpl& operator=(const TextImpl& other) {
-        text_ = other.GetText();
-        return *this;
+    TextImpl(std::string text) {
+        Set(std::move(text));
     }
 
-    TextImpl& operator=(TextImpl&& other) {
-        text_ = std::move(other.GetText());
-        return *this;
-    }
-    
+    TextImpl(const TextImpl& other) = default;
+    TextImpl(TextImpl&& other) = default;
+    TextImpl& operator=(const TextImpl& other) = default;
+    TextImpl& operator=(TextImpl&& other) = default;
 
     ~TextImpl() = default;
 
-    // 
+    // Запоминает текст и сразу определяет, является ли его значение числом,
+    // чтобы формулы не разбирали текст при каждом вычислении
     void Set(std::string text) override {
-        text_ = text;
+        text_ = std::move(text);
+        ClassifyNumber();
     }
 
     void Clear() override {
         text_.clear();
+        number_kind_ = NumberKind::Empty;
+        number_ = 0;
     } 
 
     Value GetValue(const SheetInterface& /* sheet is not used */) const override {
@@ -114,6 +185,30 @@ public:
         return text_;
     } 
 
+    std::string_view GetStoredText() const override {
+        return text_;
+    }
+
+    NumericValue GetNumericValue(const SheetInterface& /* sheet is not used */) const override {
+        switch (number_kind_) {
+            case NumberKind::Number:
+                return number_;
+            case NumberKind::Empty:
+                return 0.;
+            case NumberKind::NotNumber:
+            default:
+                return FormulaError(FormulaError::Category::Value);
+        }
+    }
+
+    // в области учитывается только текст-число
+    std::optional<NumericValue> GetRangeValue(const SheetInterface& /* sheet is not used */) const override {
+        if (number_kind_ == NumberKind::Number) {
+            return number_;
+        }
+        return std::nullopt;
+    }
+
     virtual bool IsFormulaInCell() const override {
         return false;
     } 
@@ -122,18 +217,54 @@ public:
         return {};
     }
 
+    // ссылок нет - не делает ничего
+    void BindReferencedCells(std::vector<const CellInterface*> /* cells */) override {
+        return;
+    }
+
     bool IsEmptyCell() const override {
         return false;
     }
 
 private:
+    // чем является значение текста с точки зрения формул
+    enum class NumberKind {
+        Number,     // число, хранится в number_
+        NotNumber,  // текст, который нельзя преобразовать в число
+        Empty,      // пустое значение (например, только апостроф) - 0
+    };
+
     std::string text_;
+    NumberKind number_kind_ = NumberKind::Empty;
+    double number_ = 0;
 
     bool IsFormulaInText() const {
         // подразумевается, что ячейка с текстом не может быть пустой, 
         // для пустых есть EmptyImpl
         return (text_.at(0) == ESCAPE_SIGN);
     }
+
+    // Разбирает значение текста как число по правилам std::stod: ведущие
+    // пробелы допускаются, после числа других символов быть не должно
+    void ClassifyNumber() {
+        number_ = 0;
+        const size_t value_start = (!text_.empty() && IsFormulaInText()) ? 1 : 0;
+        if (value_start == text_.size()) {
+            number_kind_ = NumberKind::Empty;
+            return;
+        }
+
+        const char* begin = text_.c_str() + value_start;
+        char* end = nullptr;
+        errno = 0;
+        double res = std::strtod(begin, &end);
+        if (end == begin || end != text_.c_str() + text_.size() || errno == ERANGE) {
+            number_kind_ = NumberKind::NotNumber;
+            return;
+        }
+        number_kind_ = NumberKind::Number;
+        number_ = res;
+    }
 };
 
 
@@ -141,6 +272,10 @@ class Cell::FormulaImpl final : public Cell::Impl {
 public:
     FormulaImpl() = default;
 
+    explicit FormulaImpl(std::unique_ptr<FormulaInterface> formula)
+        : formula_interf_(std::move(formula)) {
+    }
+
     FormulaImpl(std::string expression) {
         try {
             formula_interf_ = ParseFormula(expression);
@@ -186,10 +321,29 @@ public:
         
     }
 
+    std::optional<Value> GetGatedValue(const SheetInterface& sheet, Bytecode::InputGate& gate) const override {
+        std::optional<FormulaInterface::Value> value = formula_interf_->Evaluate(sheet, gate);
+        if (!value.has_value()) {
+            return std::nullopt;
+        }
+        if (const double* number = std::get_if<double>(&*value)) {
+            return *number;
+        }
+        return std::get<FormulaError>(*value);
+    }
+
     std::string GetText() const override {
         return ("=" + formula_interf_->GetExpression());
     }
 
+    NumericValue GetNumericValue(const SheetInterface& sheet) const override {
+        return formula_interf_->Evaluate(sheet);
+    }
+
+    std::optional<NumericValue> GetRangeValue(const SheetInterface& sheet) const override {
+        return GetNumericValue(sheet);
+    }
+
     virtual bool IsFormulaInCell() const override {
         return true;
     }
@@ -198,22 +352,98 @@ public:
         return formula_interf_->GetReferencedCells();
     }
 
+    const std::vector<Range>& GetReferencedRanges() const override {
+        return formula_interf_->GetReferencedRanges();
+    }
+
+    void BindReferencedCells(std::vector<const CellInterface*> cells) override {
+        formula_interf_->BindReferencedCells(std::move(cells));
+    }
+
 
     bool IsEmptyCell() const override {
         return false;
     }
+
+    bool HasBranches() const override {
+        return formula_interf_->HasBranches();
+    }
+
+    const FormulaInterface* GetFormula() const override {
+        return formula_interf_.get();
+    }
     
 
 private:
     std::unique_ptr<FormulaInterface> formula_interf_;
 
 };
+
+
+class Cell::InputRecorder final : public Bytecode::InputGate {
+public:
+    // pending - куда дописывать непроверенные формулы; nullptr - входы уже
+    // вычислены (режим Eager, пересчёт в топологическом порядке)
+    InputRecorder(const Sheet& sheet, uint64_t revision, std::vector<const Cell*>* pending)
+        : sheet_(sheet)
+        , revision_(revision)
+        , pending_(pending) {
+    }
+
+    bool Admit(Position pos) override {
+        // за пределами таблицы читать нечего - формула получит #REF!
+        if (!pos.IsValid()) {
+            return true;
+        }
+        const Cell* cell = sheet_.GetConcreteCell(pos);
+        if (pending_ != nullptr && cell->IsFormulaInCell() && cell->verified_at_ != revision_) {
+            pending_->push_back(cell);
+            return false;
+        }
+        inputs_.cells.push_back(cell);
+        return true;
+    }
+
+    bool Admit(Range range) override {
+        if (pending_ != nullptr) {
+            const size_t pending_count = pending_->size();
+            sheet_.ForEachFormulaInRange(range, [this](const Cell* cell) {
+                if (cell->verified_at_ != revision_) {
+                    pending_->push_back(cell);
+                }
+            });
+            if (pending_->size() > pending_count) {
+                return false;
+            }
+        }
+        // областей у формулы немного - повторы проще отсечь сразу
+        if (std::find(inputs_.ranges.begin(), inputs_.ranges.end(), range) == inputs_.ranges.end()) {
+            inputs_.ranges.push_back(range);
+        }
+        return true;
+    }
+
+    // Прочитанные входы без повторов
+    std::unique_ptr<ReadInputs> Release() {
+        std::sort(inputs_.cells.begin(), inputs_.cells.end());
+        inputs_.cells.erase(std::unique(inputs_.cells.begin(), inputs_.cells.end()), inputs_.cells.end());
+        return std::make_unique<ReadInputs>(std::move(inputs_));
+    }
+
+private:
+    const Sheet& sheet_;
+    uint64_t revision_;
+    std::vector<const Cell*>* pending_;
+    ReadInputs inputs_;
+};
     
 
 // Конструктор создает пустую ячейку 
-Cell::Cell(Sheet& sheet) 
+Cell::Cell(Sheet& sheet, Position pos) 
 : impl_(std::make_unique<EmptyImpl>())
-, sheet_(sheet) {}
+, sheet_(sheet)
+, position_(pos)
+, order_index_(sheet.GetTopologicalOrder().NextTop()) {}
 
 
 Cell::~Cell() {
@@ -221,7 +451,28 @@ Cell::~Cell() {
 }
 
 
-void Cell::Set(std::string text) {
+Cell::Content::Content(std::unique_ptr<Impl> impl)
+    : impl_(std::move(impl)) {
+}
+
+Cell::Content::Content(Content&& other) noexcept = default;
+Cell::Content& Cell::Content::operator=(Content&& other) noexcept = default;
+Cell::Content::~Content() = default;
+
+std::vector<Position> Cell::Content::GetReferencedCells() const {
+    return impl_->GetReferencedCells();
+}
+
+const std::vector<Range>& Cell::Content::GetReferencedRanges() const {
+    return impl_->GetReferencedRanges();
+}
+
+const FormulaInterface* Cell::Content::GetFormula() const {
+    return impl_->GetFormula();
+}
+
+
+Cell::Content Cell::ParseContent(std::string text, Position pos, FormulaTemplates& templates) {
     std::unique_ptr<Impl> new_impl;
     // в зависимости от содержимого, определяем тип ячейки
     
@@ -232,14 +483,9 @@ void Cell::Set(std::string text) {
     // Случай 2 - формула
     // символ '=' и наличие содержательной части после '=' как признак формулы 
     else if (text.size() > 1 && text.at(0) == FORMULA_SIGN) {
-        new_impl = std::make_unique<FormulaImpl>();
-        // записываем формулу без знака =
-        new_impl->Set(text.substr(1, text.size() - 1));
-        
-        // проверяем на циклические зависимости:
-        if (CheckExistingDependenciesOnThisCell(new_impl->GetReferencedCells())) {
-            throw CircularDependencyException("Found circular dependency");
-        }
+        // разбираем формулу без знака =; одинаковые относительно своих ячеек
+        // формулы делят один шаблон
+        new_impl = std::make_unique<FormulaImpl>(templates.ParseFormula(std::string_view(text).substr(1), pos));
     }
     // Случай 3 - текст (в том числе текст с формулой если он начинается на ')
     else {
@@ -247,24 +493,114 @@ void Cell::Set(std::string text) {
         new_impl->Set(text);
     }
 
-    // Так как содержимое изменилось - надо очистить кэш в зависимых ячейках
-    ClearCacheOfDependentCells();
+    return Content(std::move(new_impl));
+}
+
+
+Cell::Content Cell::MakeFormulaContent(std::unique_ptr<FormulaInterface> formula) {
+    return Content(std::make_unique<FormulaImpl>(std::move(formula)));
+}
+
+
+void Cell::Set(std::string text) {
+    Content content = ParseContent(std::move(text), position_, sheet_.GetFormulaTemplates());
+
+    if (!content.impl_->IsFormulaInCell()) {
+        SetContent(std::move(content));
+        return;
+    }
+
+    // проверяем на циклические зависимости, заодно поддерживая топологический порядок.
+    // Несуществующие ячейки будут созданы пустыми в начале порядка - цикла через них нет
+    const std::vector<Position> referenced_cells = content.GetReferencedCells();
+    const std::vector<Range>& referenced_ranges = content.GetReferencedRanges();
+    const bool is_self_referenced = std::find(referenced_cells.begin(), referenced_cells.end(), position_) != referenced_cells.end()
+        || std::any_of(referenced_ranges.begin(), referenced_ranges.end(), [this](Range range) {
+               return range.Contains(position_);
+           });
+    if (is_self_referenced) {
+        throw CircularDependencyException("Found circular dependency");
+    }
+
+    if (cells_referencing_to_this_.empty() && GetRangeDependents().empty()) {
+        // от ячейки ничего не зависит - цикла быть не может, а в конце порядка
+        // она окажется после любых своих входов
+        order_index_ = sheet_.GetTopologicalOrder().NextTop();
+    } else {
+        for (const Position& pos : referenced_cells) {
+            Cell* input = sheet_.GetConcreteCell(pos);
+            if (input != nullptr && !sheet_.GetTopologicalOrder().AddDependency(input, this)) {
+                throw CircularDependencyException("Found circular dependency");
+            }
+        }
+        // пустые позиции области ячейками не становятся - проверяются только существующие
+        for (const Range& range : referenced_ranges) {
+            for (Cell* input : sheet_.GetCellsInRange(range)) {
+                if (!sheet_.GetTopologicalOrder().AddDependency(input, this)) {
+                    throw CircularDependencyException("Found circular dependency");
+                }
+            }
+        }
+    }
+
+    SetContent(std::move(content));
+}
+
+
+void Cell::SetContent(Content content) {
+    // значение, которое последним видели зависимые формулы
+    const std::optional<NumericValue> old_value = GetLastSeenValue();
+    // для функций над областями пустая ячейка и 0 различаются
+    const bool was_counted_in_ranges = IsCountedInRanges();
+
     // Удаляем связи с данной ячейкой в ячейках, на которые ранее она ссылалась
     DeleteConnections();
     // очищаем информацию о содержащихся ссылках
-    cells_contained_in_this_.clear();
+    cells_contained_in_this_.Clear();
     // записываем новые данные в ячейку
-    impl_ = std::move(new_impl);
+    impl_ = std::move(content.impl_);
+    has_branches_ = impl_->HasBranches();
+    const FormulaInterface* formula = impl_->GetFormula();
+    const bool was_batchable = batch_template_ != nullptr;
+    batch_template_ = formula != nullptr && formula->IsBatchable() ? formula->GetTemplate() : nullptr;
+    if (was_batchable != (batch_template_ != nullptr)) {
+        sheet_.CountBatchFormula(position_.col, batch_template_ != nullptr);
+    }
+    read_inputs_.reset();
 
     // обновляем граф: добавляем связи с данной ячейкой (при необходимости создаются новые ячейки)
     AddConnections();
 
-    // сбрасываем кэш
-    ClearCache();
+    // Кеш зависимых ячеек не трогаем: увидев, что ячейка изменилась позже,
+    // чем они были проверены, они пересчитаются при чтении.
+    // Если значение для формул не изменилось (например, "1" заменили на "1.0"),
+    // ячейка не считается изменённой и зависимые не пересчитываются
+    const uint64_t revision = sheet_.AdvanceRevision();
+    if (IsFormulaInCell()) {
+        // прежнее значение остаётся в кеше, чтобы сравнить с ним результат формулы
+        if (old_value.has_value() && was_counted_in_ranges) {
+            cache_ = ToValue(*old_value);
+        } else {
+            cache_.reset();
+        }
+        is_cache_outdated_ = true;
+    } else {
+        ClearCache();
+        if (!old_value.has_value() || !IsSameValue(*old_value, impl_->GetNumericValue(sheet_))
+            || was_counted_in_ranges != IsCountedInRanges()) {
+            changed_at_ = revision;
+        }
+    }
     
     // после обновления графа уверены, что все ячейки, 
     // на которые ссылается данная, существуют, можно их добавить в словарь 
     SetCellsContainedInThis(GetReferencedCells());
+    sheet_.UpdateCellIndexes(*this);
+}
+
+void Cell::DetachFromInputs() {
+    DeleteConnections();
+    cells_contained_in_this_.Clear();
 }
 
 // Cовсем удаляет содержимое ячейки, 
@@ -283,9 +619,7 @@ CellInterface::Value Cell::GetValue() const {
     CellInterface::Value res;
     // для формул вычисляем кеш при необходимости
     if (IsFormulaInCell()) {
-        if (!HasCache()) {
-            cache_ = impl_->GetValue(sheet_);  // исключения тоже записываются в кеш
-        } 
+        UpdateCache();
         res = cache_.value();
     } else { // для текста берем просто GetValue()
         res = impl_->GetValue(sheet_);
@@ -300,66 +634,93 @@ std::string Cell::GetText() const {
 }
 
 
+std::string_view Cell::GetStoredText() const {
+    return impl_->GetStoredText();
+}
+
+
+CellInterface::NumericValue Cell::GetNumericValue() const {
+    // для формул значение берём из кеша (вычисляем при необходимости)
+    if (IsFormulaInCell()) {
+        UpdateCache();
+        if (const double* value = std::get_if<double>(&*cache_)) {
+            return *value;
+        }
+        return std::get<FormulaError>(*cache_);
+    }
+    // у текста число определено заранее, при задании текста
+    return impl_->GetNumericValue(sheet_);
+}
+
+
+std::optional<CellInterface::NumericValue> Cell::GetRangeValue() const {
+    if (IsFormulaInCell()) {
+        return GetNumericValue();
+    }
+    return impl_->GetRangeValue(sheet_);
+}
+
+std::optional<CellInterface::NumericValue> Cell::GetLastSeenRangeValue() const {
+    if (IsFormulaInCell()) {
+        return GetLastSeenValue();
+    }
+    return impl_->GetRangeValue(sheet_);
+}
+
+
 bool Cell::IsFormulaInCell() const {
     return impl_->IsFormulaInCell();
 }
 
 
+const FormulaInterface* Cell::GetFormula() const {
+    return impl_->GetFormula();
+}
+
+
 // Возвращает список указателей на ячейки, которые содержатся в данной ячейке
-std::unordered_set<Cell*> Cell::GetCellsContainedInThis() const {
+const CellLinks& Cell::GetCellsContainedInThis() const {
     return cells_contained_in_this_;
 }
 
 
 // Возвращает список указателей на ячейки, которые ссылаются на данную ячейку
-std::unordered_set<Cell*> Cell::GetCellsReferencingToThis() const {
+const CellLinks& Cell::GetCellsReferencingToThis() const {
     return cells_referencing_to_this_;
 }
 
 
 void Cell::SetCellsContainedInThis(const std::vector<Position>& referencies_inside) {
-    cells_contained_in_this_.clear();
+    cells_contained_in_this_.Clear();
     for (const Position pos : referencies_inside) {
-        cells_contained_in_this_.insert(sheet_.GetConcreteCell(pos));
+        cells_contained_in_this_.Insert(sheet_.GetConcreteCell(pos));
     }
 }
 
-void Cell::SetCellsContainedInThis(const std::unordered_set<Cell*>& referencies_inside) {
-    cells_contained_in_this_.clear();
-    cells_contained_in_this_ = referencies_inside;
-}
-
 
 void Cell::SetCellsReferencingToThis(const std::vector<Position>& referencies_to) {
-    cells_referencing_to_this_.clear();
+    cells_referencing_to_this_.Clear();
     for (const Position pos : referencies_to) {
-        cells_referencing_to_this_.insert(sheet_.GetConcreteCell(pos));
+        cells_referencing_to_this_.Insert(sheet_.GetConcreteCell(pos));
     }
 }
 
-void Cell::SetCellsReferencingToThis(const std::unordered_set<Cell*>& referencies_to) {
-    cells_referencing_to_this_.clear();
-    cells_referencing_to_this_ = referencies_to;
-}
-
 
 // Добавляет одну новую ячейку в список ячеек, на которые ссылается данная
 void Cell::AddNewCellContainedInThis(Cell* cell) {
-    cells_contained_in_this_.insert(cell);
+    cells_contained_in_this_.Insert(cell);
 }
 
 
 // Добавляет одну новую ячейку в список ячеек, которые ссылаются на данную
 void Cell::AddNewCellReferencedToThis(Cell* link_from) {
-    cells_referencing_to_this_.insert(link_from);
+    cells_referencing_to_this_.Insert(link_from);
 }
 
 
 // удаляет ячейку из списка ссылающихся на данную
 void Cell::DeleteReferenceToThis(Cell* link_from) {
-    if (cells_referencing_to_this_.count(link_from)) {
-        cells_referencing_to_this_.erase(link_from);
-    }
+    cells_referencing_to_this_.Erase(link_from);
     
 }
 
@@ -374,116 +735,314 @@ bool Cell::IsEmptyCell() const {
 }
 
 
-/*
-Проверяет, есть ли у ячеек на позициях new_refs, связь с данной ячейкой (this)
-имеет вызвать до помещения новых данных в impl_, например, CheckExistingDependenciesOnThisCell(new_impl->GetReferencedCells()) 
-=> true - есть зависимость => есть цикличность
-*/
-bool Cell::CheckExistingDependenciesOnThisCell(std::vector<Position> new_refs_pos) const {
-    // Случай 1 - данная ячейка ни от кого не зависит
-    if (new_refs_pos.empty()) {
-        return false;     
+// Возвращает список ячеек, которые непосредственно задействованы в данной
+// формуле. Список отсортирован по возрастанию и не содержит повторяющихся
+// ячеек. В случае текстовой ячейки список пуст.
+std::vector<Position> Cell::GetReferencedCells() const {
+    return impl_->GetReferencedCells();
+}
+
+
+const std::vector<Range>& Cell::GetReferencedRanges() const {
+    return impl_->GetReferencedRanges();
+}
+
+
+void Cell::ForEachRangeInput(const std::function<void(Cell*)>& func) const {
+    for (const Range& range : GetReferencedRanges()) {
+        sheet_.ForEachCellInRange(range, func);
     }
+}
 
-    // Случай 2 - связи есть - инициируем обход графа
-    std::unordered_set<Cell*> visited_cells;
-    std::queue<Cell*> cells_to_visit;
-    
-    // Добавляем ячейки в очередь просмотра
-    for (const Position& pos : new_refs_pos) {
-        Cell* cell_tmp = sheet_.GetConcreteCell(pos);
 
-        // Проверяем, что в данной ячейке нет ссылки на саму себя
-        if (cell_tmp == this) {
-            return true;
+std::vector<Cell*> Cell::GetRangeDependents() const {
+    return sheet_.GetRangeDependents(position_);
+}
+
+
+bool Cell::IsCountedInRanges() const {
+    return IsFormulaInCell() || impl_->GetRangeValue(sheet_).has_value();
+}
+
+
+bool Cell::HasCache() const {
+    return cache_.has_value() && !is_cache_outdated_ && IsCacheVerified();
+}
+
+
+bool Cell::IsCacheVerified() const {
+    // в режиме Eager все зависимые формулы пересчитываются сразу после изменения
+    return verified_at_ == sheet_.GetRevision() || sheet_.GetRecalculationMode() == RecalculationMode::Eager;
+}
+
+
+void Cell::UpdateCache() const {
+    if (HasCache()) {
+        return;
+    }
+    const uint64_t revision = sheet_.GetRevision();
+
+    // Обход входов в глубину без рекурсии. Ячейка проверяется, когда проверены
+    // все её входы (см. RecalculateIfOutdated)
+    struct Frame {
+        const Cell* cell;
+        size_t next_input;
+        bool are_range_inputs_pushed;
+    };
+    std::vector<Frame> stack = {{this, 0, false}};
+    std::vector<const Cell*> pending;
+    while (!stack.empty()) {
+        const Cell* cell = stack.back().cell;
+        const CellLinks& inputs = cell->cells_contained_in_this_;
+
+        // у формулы с ветвлениями проверяются только входы, прочитанные при
+        // прошлом вычислении: они кладутся в стек все сразу, как формулы областей
+        if (!cell->has_branches_ && stack.back().next_input < inputs.size()) {
+            const Cell* input = inputs.begin()[stack.back().next_input++];
+            if (input->IsFormulaInCell() && input->verified_at_ != revision) {
+                stack.push_back({input, 0, false});
+            }
+            continue;
         }
 
-        // добавляем только существующие ячейки
-        if (cell_tmp != nullptr) {
-            cells_to_visit.push(cell_tmp);
+        if (cell->has_branches_ && !stack.back().are_range_inputs_pushed) {
+            stack.back().are_range_inputs_pushed = true;
+            if (cell->read_inputs_) {
+                for (const Cell* input : cell->read_inputs_->cells) {
+                    if (input->IsFormulaInCell() && input->verified_at_ != revision) {
+                        stack.push_back({input, 0, false});
+                    }
+                }
+                for (const Range& range : cell->read_inputs_->ranges) {
+                    sheet_.ForEachFormulaInRange(range, [&stack, revision](const Cell* input) {
+                        if (input->verified_at_ != revision) {
+                            stack.push_back({input, 0, false});
+                        }
+                    });
+                }
+            }
+            continue;
         }
+
+        // формулы областей кладутся в стек все сразу
+        if (cell->has_range_inputs_ && !stack.back().are_range_inputs_pushed) {
+            stack.back().are_range_inputs_pushed = true;
+            for (const Range& range : cell->GetReferencedRanges()) {
+                sheet_.ForEachFormulaInRange(range, [&stack, revision](const Cell* input) {
+                    if (input->verified_at_ != revision) {
+                        stack.push_back({input, 0, false});
+                    }
+                });
+            }
+            continue;
+        }
+
+        // ячейка могла попасть в стек дважды (через разные ссылки или области)
+        if (cell != this && cell->verified_at_ == revision) {
+            stack.pop_back();
+            continue;
+        }
+
+        pending.clear();
+        const bool is_recalculated = cell->RecalculateIfOutdated(&pending);
+        if (!pending.empty()) {
+            // выбранная ветвь читает ещё не проверенные формулы: проверяем
+            // их, затем вычисляем ячейку заново
+            for (const Cell* input : pending) {
+                stack.push_back({input, 0, false});
+            }
+            continue;
+        }
+        sheet_.CountLazyRecalculation(is_recalculated);
+        stack.pop_back();
     }
-    
-    while (!cells_to_visit.empty()) {
-        // берем первую (очередную) ячейку из очереди
-        Cell* cell_cur = cells_to_visit.front();
-        // Проверяем только ранее не посещенные ячейки
-        if (!visited_cells.count(cell_cur)) {
-            // пополняем список посещенных ячеек
-            visited_cells.insert(cell_cur);
-            // проверяем, что нет ссылки на саму себя
-            if (cell_cur == this) {
-                return true; 
+}
+
+
+std::optional<CellInterface::NumericValue> Cell::GetLastSeenValue() const {
+    if (!IsFormulaInCell()) {
+        return impl_->GetNumericValue(sheet_);
+    }
+    // кеш формулы, даже устаревший, - это последнее значение, которое
+    // могли прочитать зависимые: чтение всегда сначала обновляет кеш
+    if (cache_.has_value()) {
+        return ToNumericValue(*cache_);
+    }
+    return std::nullopt;
+}
+
+
+bool Cell::IsOutdated() const {
+    bool is_outdated = is_cache_outdated_ || !cache_.has_value();
+    if (has_branches_) {
+        is_outdated = is_outdated || !read_inputs_;
+        if (!is_outdated) {
+            for (const Cell* input : read_inputs_->cells) {
+                is_outdated = is_outdated || input->changed_at_ > verified_at_;
             }
-            // Добавляем в очередь ячейки, на которые ссылается cell_cur
-            for (Cell* cell_tmp : cell_cur->GetCellsContainedInThis()) {
-                cells_to_visit.push(cell_tmp);
+            for (const Range& range : read_inputs_->ranges) {
+                is_outdated = is_outdated || sheet_.GetRangeChangedAt(range) > verified_at_;
+            }
+        }
+    } else {
+        for (const Cell* input : cells_contained_in_this_) {
+            is_outdated = is_outdated || input->changed_at_ > verified_at_;
+        }
+        // по областям - последнее изменение их ячеек (см. RangeAggregates)
+        if (has_range_inputs_) {
+            for (const Range& range : GetReferencedRanges()) {
+                is_outdated = is_outdated || sheet_.GetRangeChangedAt(range) > verified_at_;
             }
         }
-        // удаляем посещенную ячейку!!
-        cells_to_visit.pop();
     }
-    
-    return false;
+    return is_outdated;
 }
 
 
-// Возвращает список ячеек, которые непосредственно задействованы в данной
-// формуле. Список отсортирован по возрастанию и не содержит повторяющихся
-// ячеек. В случае текстовой ячейки список пуст.
-std::vector<Position> Cell::GetReferencedCells() const {
-    return impl_->GetReferencedCells();
+bool Cell::RecalculateIfOutdated(std::vector<const Cell*>* pending) const {
+    if (!IsOutdated()) {
+        verified_at_ = sheet_.GetRevision();
+        return false;
+    }
+    return Recalculate(pending);
 }
 
 
-bool Cell::HasCache() const {
-    return (cache_.has_value());
+bool Cell::Recalculate(std::vector<const Cell*>* pending) const {
+    const uint64_t revision = sheet_.GetRevision();
+    Value value;  // ошибки тоже записываются в кеш
+    if (has_branches_) {
+        InputRecorder recorder(sheet_, revision, pending);
+        std::optional<Value> gated_value = impl_->GetGatedValue(sheet_, recorder);
+        if (!gated_value.has_value()) {
+            return false;
+        }
+        value = std::move(*gated_value);
+        read_inputs_ = recorder.Release();
+    } else {
+        value = impl_->GetValue(sheet_);
+    }
+    StoreValue(std::move(value), revision);
+    return true;
+}
+
+void Cell::StoreValue(Value value, uint64_t revision) const {
+    // ранний останов: если значение не изменилось, зависимые формулы
+    // не будут вычисляться заново
+    if (!cache_.has_value() || !IsSameValue(ToNumericValue(*cache_), ToNumericValue(value))) {
+        changed_at_ = revision;
+    }
+    cache_ = std::move(value);
+    is_cache_outdated_ = false;
+    verified_at_ = revision;
+    sheet_.UpdateCellIndexes(*this);
 }
 
 void Cell::ClearCache() {
     cache_.reset();
 }
 
-// Очистить кэш у ячеек, зависящих от ДАННОЙ ячейки 
-// Необходимо вызвать после валидного изменения 
-void Cell::ClearCacheOfDependentCells() {
 
-    // Случай 1 - зависимый ячеек нет
-    if (cells_referencing_to_this_.empty()) {
-        return;
+void Cell::RestoreCache(Value value) {
+    assert(IsFormulaInCell());
+    cache_ = std::move(value);
+    is_cache_outdated_ = false;
+    verified_at_ = sheet_.GetRevision();
+    sheet_.UpdateCellIndexes(*this);
+}
+
+void Cell::InvalidateCache() {
+    if (IsFormulaInCell()) {
+        is_cache_outdated_ = true;
     }
+}
 
-    // Случай 2 - зависимые есть - обход графа в ширину
-    std::queue<Cell*> cells_to_visit;
-    
-    // Добавляем ячейки в очередь просмотра
-    for (Cell* cell : cells_referencing_to_this_) {
-        cells_to_visit.push(cell);
+bool Cell::RecalculateCache() {
+    if (!IsFormulaInCell()) {
+        return false;
     }
-    
-    while (!cells_to_visit.empty()) {
-        // берем первую (очередную) ячейку из очереди
-        Cell* cell_cur = cells_to_visit.front();
-
-        // Очищаем кэш только у ячеек, где он есть
-        if (cell_cur->HasCache()) {
-            // очищаем кеш
-            cell_cur->ClearCache();
-
-            // Добавляем в очередь ячейки, которые ссылаются на cell_cur
-            for (Cell* cell_dependent_on_cur : cell_cur->GetCellsReferencingToThis()) {
-                cells_to_visit.push(cell_dependent_on_cur);
+    Recalculate();
+    return true;
+}
+
+
+Cell::RecalculationResult Cell::RevalidateCache() {
+    if (!IsFormulaInCell()) {
+        return RecalculationResult::NotFormula;
+    }
+    return RecalculateIfOutdated() ? RecalculationResult::Recalculated : RecalculationResult::Skipped;
+}
+
+void Cell::UpdateCaches(const std::vector<const Cell*>& cells) {
+    if (cells.empty()) {
+        return;
+    }
+    Sheet& sheet = cells.front()->sheet_;
+    const uint64_t revision = sheet.GetRevision();
+
+    // формулы, которые будут вычислены следующей пачкой
+    std::vector<const Cell*> batch;
+    auto evaluate_batch = [&batch, &sheet, revision] {
+        std::vector<const FormulaInterface*> formulas;
+        formulas.reserve(batch.size());
+        for (const Cell* cell : batch) {
+            formulas.push_back(cell->impl_->GetFormula());
+        }
+        std::vector<FormulaInterface::Value> values = EvaluateBatch(sheet, formulas);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            batch[i]->StoreValue(ToValue(values[i]), revision);
+            sheet.CountLazyRecalculation(true);
+        }
+        batch.clear();
+    };
+
+    [[maybe_unused]] const FormulaTemplate* formula_template = cells.front()->GetBatchTemplate();
+    for (const Cell* cell : cells) {
+        assert(cell->GetBatchTemplate() == formula_template);
+        if (cell->HasCache()) {
+            continue;
+        }
+
+        // Непроверенный вход-формула может оказаться формулой пачки (например,
+        // в нарастающем итоге =C1+A2) - тогда пачка вычисляется раньше.
+        // Остальные непроверенные входы проверяются заранее, чтобы пачка
+        // вычислялась без рекурсии
+        const CellLinks& inputs = cell->cells_contained_in_this_;
+        const bool has_unverified_inputs = std::any_of(inputs.begin(), inputs.end(), [revision](const Cell* input) {
+            return input->IsFormulaInCell() && input->verified_at_ != revision;
+        });
+        if (has_unverified_inputs) {
+            if (!batch.empty()) {
+                evaluate_batch();
+            }
+            for (const Cell* input : inputs) {
+                if (input->IsFormulaInCell() && input->verified_at_ != revision) {
+                    input->UpdateCache();
+                }
             }
         }
 
-        // удаляем обработанную ячейку!!
-        cells_to_visit.pop();
+        if (!cell->IsOutdated()) {
+            cell->verified_at_ = revision;
+            sheet.CountLazyRecalculation(false);
+            continue;
+        }
+        batch.push_back(cell);
+    }
+    if (!batch.empty()) {
+        evaluate_batch();
     }
-    
-    return;
 }
 
+
 void Cell::DeleteConnections() {
+    if (has_range_inputs_) {
+        for (const Range& range : GetReferencedRanges()) {
+            sheet_.RemoveRangeDependent(range, this);
+        }
+        has_range_inputs_ = false;
+    }
+
      // Случай 1 - ссылок нет
     if (cells_contained_in_this_.empty()) {
         return;
@@ -498,6 +1057,12 @@ void Cell::DeleteConnections() {
 
 // Обновляет граф при изменении заданной ячейки pos
 void Cell::AddConnections() {
+    // области - одна связь на область, ячейки областей не создаются
+    for (const Range& range : GetReferencedRanges()) {
+        sheet_.AddRangeDependent(range, this);
+        has_range_inputs_ = true;
+    }
+
     std::vector<Position> ref_list = GetReferencedCells();
 
     // Случай 1 - ссылок нет => в таблице ничего изменять не надо
@@ -507,6 +1072,8 @@ void Cell::AddConnections() {
 
     // Случай 2 - ссылки есть 
     // => получаем/создаем ячейки на указанных позициях и добавляем каждой связь с текущей
+    std::vector<const CellInterface*> bound_cells;
+    bound_cells.reserve(ref_list.size());
     for (const Position& pos : ref_list) {
         Cell* cell_tmp = sheet_.GetConcreteCell(pos);
 
@@ -517,7 +1084,12 @@ void Cell::AddConnections() {
 
         // для существующих ячеек добавляем связь с данной
         cell_tmp->AddNewCellReferencedToThis(this);
+        bound_cells.push_back(cell_tmp);
     }
 
+    // Ячейки, на которые ссылается формула, не удаляются, пока на них есть ссылки,
+    // поэтому формула может читать их напрямую, без поиска в таблице
+    impl_->BindReferencedCells(std::move(bound_cells));
+
     return;
 } 
\ No newline at end of file
@@ -1,10 +1,12 @@
 #pragma once
 
+#include "cell_links.h"
 #include "common.h"
 #include "formula.h"
 
+#include <functional>
 #include <optional>
-#include <unordered_set>
+#include <string_view>
 
 class Sheet; // возможно, заглушка. Но если добавлять #include "sheet.h",  то будут перекрестные ссылки - не скомпилируется
 /* 
@@ -17,8 +19,8 @@ class Sheet; // возможно, заглушка. Но если добавля
 
 class Cell : public CellInterface {
 public:
-    // Конструктор создает пустую ячейку 
-    explicit Cell(Sheet& sheet);
+    // Конструктор создает пустую ячейку на позиции pos
+    Cell(Sheet& sheet, Position pos);
 
     ~Cell();
 
@@ -29,6 +31,25 @@ public:
     */
     void Set(std::string text);
 
+    // Разобранный, но ещё не записанный в ячейку текст
+    class Content;
+
+    // Разбирает текст ячейки, ничего не меняя в таблице.
+    // Формула разбирается для ячейки pos через таблицу шаблонов templates.
+    // Возможно исключение FormulaException
+    static Content ParseContent(std::string text, Position pos, FormulaTemplates& templates);
+
+    // Содержимое с уже готовой формулой (например, см. FormulaInterface::CopyTo)
+    static Content MakeFormulaContent(std::unique_ptr<FormulaInterface> formula);
+
+    // Записывает разобранный текст и обновляет связи в графе. В отличие от Set
+    // не проверяет циклические зависимости - это делает вызывающий (см. Sheet::SetCells)
+    void SetContent(Content content);
+
+    // Снимает связи с ячейками, на которые ссылается формула, не меняя текст
+    // и значение. Вызывается перед SetContent при пакетном изменении
+    void DetachFromInputs();
+
     // Совсем удаляет содержимое ячейки 
     void DeleteCell();
 
@@ -37,29 +58,47 @@ public:
 
     Value GetValue() const override;
     std::string GetText() const override;
+    // Текст текстовой ячейки без копирования (как GetText). У формулы и пустой
+    // ячейки - пустая строка: выражение формулы печатает сама формула (см. GetFormula)
+    std::string_view GetStoredText() const;
+    NumericValue GetNumericValue() const override;
+    std::optional<NumericValue> GetRangeValue() const override;
+
+    Position GetPosition() const {
+        return position_;
+    }
+
+    // Значение для функций над областями без вычисления формулы: у формулы -
+    // значение из кеша (nullopt, если кеша нет)
+    std::optional<NumericValue> GetLastSeenRangeValue() const;
 
     // Возвращает список ячеек, которые непосредственно задействованы в данной
     // формуле. Список отсортирован по возрастанию и не содержит повторяющихся
     // ячеек. В случае текстовой ячейки список пуст.
     std::vector<Position> GetReferencedCells() const override;
 
+    // Области, на которые ссылается формула. Ячейки областей не связываются
+    // с формулой по отдельности: область - одна связь (см. Sheet::GetRangeDependents)
+    const std::vector<Range>& GetReferencedRanges() const;
+
     bool IsFormulaInCell() const;
 
+    // Формула ячейки (nullptr, если в ячейке не формула)
+    const FormulaInterface* GetFormula() const;
+
 
     // Возвращает список указателей на ячейки, которые содержатся в данной ячейке
-    std::unordered_set<Cell*> GetCellsContainedInThis() const;
+    const CellLinks& GetCellsContainedInThis() const;
     
     // Возвращает список указателей на ячейки, которые ссылаются на данную ячейку
-    std::unordered_set<Cell*> GetCellsReferencingToThis() const;
+    const CellLinks& GetCellsReferencingToThis() const;
     
     // Записывает в перечень содержащихся ссылок новые данные  
     // Предыдущие данные очищаются
     void SetCellsContainedInThis(const std::vector<Position>& referencies_inside);
-    void SetCellsContainedInThis(const std::unordered_set<Cell*>& referencies_inside);
     // Записывает в перечень ячеек, ссылающихся на текущую ячейку, новые данные
     // Предварительно имеющиеся данные очищаются
     void SetCellsReferencingToThis(const std::vector<Position>& referencies_to);
-    void SetCellsReferencingToThis(const std::unordered_set<Cell*>& referencies_to);
 
     // Добавляет одну новую ячейку в список ячеек, на которые ссылается данная
     void AddNewCellContainedInThis(Cell* ref);
@@ -72,21 +111,89 @@ public:
     // проверяет, есть ли зависимые ячейки
     bool HasAnyCellsReferencedToThis();
 
+    // Вызывает func(Cell*) для каждой ячейки, значение которой читает формула:
+    // по ссылкам и для существующих ячеек её областей. Если области
+    // пересекаются, ячейка может встретиться несколько раз
+    template <typename Func>
+    void ForEachInput(Func&& func) const {
+        for (Cell* input : cells_contained_in_this_) {
+            func(input);
+        }
+        if (has_range_inputs_) {
+            ForEachRangeInput(func);
+        }
+    }
+
+    // Вызывает func(Cell*) для каждой формулы, которая читает значение ячейки:
+    // по ссылкам и через области, в которые входит ячейка
+    template <typename Func>
+    void ForEachDependent(Func&& func) const {
+        for (Cell* dependent : cells_referencing_to_this_) {
+            func(dependent);
+        }
+        for (Cell* dependent : GetRangeDependents()) {
+            func(dependent);
+        }
+    }
+
     bool IsEmptyCell() const;
 
 
-    // Проверяет, есть ли у ячеек на позициях new_refs, связь с данной ячейкой (this)
-    // имеет вызвать до помещения новых данных в impl_, например, CheckExistingDependenciesOnThisCell(new_impl->GetReferencedCells()) 
-    // => true - есть зависимость => есть цикличность
-    bool CheckExistingDependenciesOnThisCell(std::vector<Position> new_refs) const;
+    // Номер ячейки в топологическом порядке таблицы (см. TopologicalOrder)
+    int64_t GetOrderIndex() const {
+        return order_index_;
+    }
+    void SetOrderIndex(int64_t order_index) {
+        order_index_ = order_index;
+    }
 
+    // Есть ли в кеше значение, проверенное после последнего изменения таблицы
     bool HasCache() const;
 
+    // Изменялось ли значение ячейки после изменения таблицы с номером revision
+    bool HasChangedSince(uint64_t revision) const {
+        return changed_at_ > revision;
+    }
+    uint64_t GetChangedAt() const {
+        return changed_at_;
+    }
+
     void ClearCache();
 
-    // Очистить кэш у ячеек, зависящих от ячейки на заданной позиции pos
-    // Необходимо вызвать после валидного изменения ячейки pos 
-    void ClearCacheOfDependentCells();
+    // Записывает в кеш формулы значение, сохранённое в снимке таблицы
+    // (см. snapshot.h). Кеш считается проверенным в текущей версии таблицы
+    void RestoreCache(Value value);
+
+    // Входы формулы изменились так, что это не видно по версиям её входов
+    // (например, из области удалена ячейка). Формула вычислится заново
+    void InvalidateCache();
+
+    // Заново вычисляет значение формулы и записывает его в кеш.
+    // Значения ячеек, на которые ссылается формула, должны быть уже вычислены,
+    // тогда вычисление не уходит в рекурсию.
+    // Возвращает false, если в ячейке не формула (вычислять нечего)
+    bool RecalculateCache();
+
+    enum class RecalculationResult {
+        NotFormula,
+        Recalculated,
+        Skipped,  // ни один вход формулы не изменился - кеш верен
+    };
+
+    // То же, что RecalculateCache, но формула вычисляется, только если
+    // после прошлой проверки изменился хотя бы один её вход (ранний останов)
+    RecalculationResult RevalidateCache();
+
+    // Шаблон формулы, если её выгодно вычислять пачкой (см. EvaluateBatch), иначе nullptr
+    const FormulaTemplate* GetBatchTemplate() const {
+        return batch_template_;
+    }
+
+    // Проверяет кеш формул cells с одним шаблоном (см. GetBatchTemplate), как
+    // при чтении в режиме Lazy. Сначала проверяются входы формул, затем формулы,
+    // которым нужен пересчёт, вычисляются пачками, и значения записываются в кеш.
+    // Если формула читает другую формулу из cells, та вычисляется раньше
+    static void UpdateCaches(const std::vector<const Cell*>& cells);
 
 private:
 //можете воспользоваться нашей подсказкой, но это необязательно.
@@ -96,14 +203,56 @@ private:
     class TextImpl;
     class FormulaImpl;
 
+    // Записывает входы, прочитанные формулой с ветвлениями (см. Recalculate)
+    class InputRecorder;
+
     std::unique_ptr<Impl> impl_;
 
-    std::unordered_set<Cell*> cells_contained_in_this_;  // ячейки, на которые ссылается данная ячейка
-    std::unordered_set<Cell*> cells_referencing_to_this_;  // ячейки, которые ссылаются на данную ячейку
+    CellLinks cells_contained_in_this_;  // ячейки, на которые ссылается данная ячейка
+    CellLinks cells_referencing_to_this_;  // ячейки, которые ссылаются на данную ячейку
 
     mutable std::optional<CellInterface::Value> cache_;  // храним результат расчета, чтобы не считать лишний раз 
+    // При параллельном пересчёте кеш ячейки пишет ровно один поток, а читают
+    // только потоки, вычисляющие зависимые формулы - после того, как ячейка
+    // отмечена вычисленной (см. parallel_recalculation.h)
+
+    /*
+    Версии ячейки (номера изменений таблицы, см. Sheet::GetRevision):
+    changed_at_ - когда значение ячейки последний раз изменилось,
+    verified_at_ - когда кеш формулы последний раз проверялся.
+    Изменение ячейки не трогает зависимые - это O(1). При чтении формула
+    проверяет свои входы: если ни один не изменился позже verified_at_,
+    кеш верен. Так стоимость переносится на те ячейки, которые читают
+    */
+    mutable uint64_t changed_at_ = 0;
+    mutable uint64_t verified_at_ = 0;
+    // формула изменена: в кеше её прежнее значение, только для сравнения
+    mutable bool is_cache_outdated_ = false;
+    // области формулы зарегистрированы в таблице (см. Sheet::AddRangeDependent)
+    bool has_range_inputs_ = false;
+
+    /*
+    Формула с ветвлениями (IF, AND, OR) при вычислении читает только входы
+    выбранных ветвей. Их список запоминается, и при проверке кеша сравниваются
+    версии только этих входов: пока они не изменились, выбор ветвей тот же.
+    Связи в графе (ForEachInput, топологический порядок) остаются по всем
+    входам формулы - иначе изменение выбора ветви не было бы видно
+    */
+    struct ReadInputs {
+        std::vector<const Cell*> cells;
+        std::vector<Range> ranges;
+    };
+    bool has_branches_ = false;
+    // см. GetBatchTemplate; запоминается при записи содержимого, чтобы обход
+    // области в Sheet::EvaluateRange не читал формулу каждой ячейки
+    const FormulaTemplate* batch_template_ = nullptr;
+    // входы, прочитанные при последнем вычислении (nullptr - ещё не вычислялась)
+    mutable std::unique_ptr<ReadInputs> read_inputs_;
 
     Sheet& sheet_;   // методы Cell могут менять содержимое таблицы
+    Position position_;
+
+    int64_t order_index_ = 0;
 
     // Удаляет связи с данной ячейкой у тех ячеек, которые ранее в ней содержались (согласно списку cells_contained_in_this_)
     // метод надо вызывать после изменения ячейки и до добавления новых связей add_connections 
@@ -112,4 +261,62 @@ private:
     // Обновляет граф при изменении заданной ячейки pos
     void AddConnections();
 
+    bool IsCacheVerified() const;
+
+    // Учитывается ли значение ячейки функциями над областями (см. GetRangeValue)
+    bool IsCountedInRanges() const;
+
+    // Вызывает func для существующих ячеек областей формулы (ячейки не собираются
+    // в список: области бывают большими)
+    void ForEachRangeInput(const std::function<void(Cell*)>& func) const;
+    // Формулы, в области которых входит ячейка (без повторов)
+    std::vector<Cell*> GetRangeDependents() const;
+
+    // Проверяет кеш формулы и её входов, при необходимости вычисляет их заново
+    void UpdateCache() const;
+
+    // Значение ячейки, которое последним могли прочитать зависимые формулы
+    std::optional<NumericValue> GetLastSeenValue() const;
+
+    // Изменился ли хотя бы один вход формулы после прошлой проверки кеша
+    // (или кеша нет). Входы должны быть уже проверены
+    bool IsOutdated() const;
+
+    // Вычисляет формулу, если изменился хотя бы один её вход (входы уже проверены).
+    // Возвращает true, если формула вычислялась.
+    // pending - см. Recalculate
+    bool RecalculateIfOutdated(std::vector<const Cell*>* pending = nullptr) const;
+
+    // Вычисляет формулу. changed_at_ обновляется, только если значение изменилось.
+    // Если задан pending, формула с ветвлениями не читает непроверенные формулы:
+    // вычисление прерывается, они дописываются в pending, кеш не меняется.
+    // Возвращает false, если вычисление прервано
+    bool Recalculate(std::vector<const Cell*>* pending = nullptr) const;
+
+    // Записывает вычисленное значение формулы в кеш. changed_at_ обновляется,
+    // только если значение изменилось
+    void StoreValue(Value value, uint64_t revision) const;
+
+};
+
+
+class Cell::Content {
+public:
+    Content(Content&& other) noexcept;
+    Content& operator=(Content&& other) noexcept;
+    ~Content();
+
+    // Позиции ячеек, на которые будет ссылаться ячейка с этим текстом
+    std::vector<Position> GetReferencedCells() const;
+    // Области, на которые будет ссылаться ячейка с этим текстом
+    const std::vector<Range>& GetReferencedRanges() const;
+    // Формула или nullptr, если это не формула
+    const FormulaInterface* GetFormula() const;
+
+private:
+    friend class Cell;
+
+    explicit Content(std::unique_ptr<Impl> impl);
+
+    std::unique_ptr<Impl> impl_;
 };
\ No newline at end of file
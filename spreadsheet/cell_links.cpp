@@ -0,0 +1,78 @@
+#include "cell_links.h"
+
+#include <algorithm>
+
+CellLinks::~CellLinks() = default;
+
+
+size_t CellLinks::Find(const Cell* cell) const {
+    if (heap_ && !heap_->index.empty()) {
+        auto it = heap_->index.find(cell);
+        return it != heap_->index.end() ? it->second : size();
+    }
+    return std::find(begin(), end(), cell) - begin();
+}
+
+
+bool CellLinks::Contains(const Cell* cell) const {
+    return Find(cell) != size();
+}
+
+
+bool CellLinks::Insert(Cell* cell) {
+    if (Contains(cell)) {
+        return false;
+    }
+
+    if (!heap_) {
+        if (inline_size_ < INLINE_CAPACITY) {
+            inline_cells_[inline_size_++] = cell;
+            return true;
+        }
+        // встроенное место кончилось - переносим связи в вектор
+        heap_ = std::make_unique<Heap>();
+        heap_->cells.assign(inline_cells_.begin(), inline_cells_.end());
+        inline_size_ = 0;
+    }
+
+    std::vector<Cell*>& cells = heap_->cells;
+    cells.push_back(cell);
+    if (!heap_->index.empty()) {
+        heap_->index.emplace(cell, cells.size() - 1);
+    } else if (cells.size() >= INDEX_THRESHOLD) {
+        heap_->index.reserve(cells.size() * 2);
+        for (size_t i = 0; i < cells.size(); ++i) {
+            heap_->index.emplace(cells[i], i);
+        }
+    }
+    return true;
+}
+
+
+bool CellLinks::Erase(const Cell* cell) {
+    const size_t pos = Find(cell);
+    if (pos == size()) {
+        return false;
+    }
+
+    // на место удаляемой ставим последнюю
+    Cell** cells = heap_ ? heap_->cells.data() : inline_cells_.data();
+    const size_t last = size() - 1;
+    cells[pos] = cells[last];
+    if (heap_) {
+        if (!heap_->index.empty()) {
+            heap_->index[cells[pos]] = pos;
+            heap_->index.erase(cell);
+        }
+        heap_->cells.pop_back();
+    } else {
+        --inline_size_;
+    }
+    return true;
+}
+
+
+void CellLinks::Clear() {
+    heap_.reset();
+    inline_size_ = 0;
+}
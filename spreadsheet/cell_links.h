@@ -0,0 +1,64 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+class Cell;
+
+/*
+Набор связей ячейки в графе зависимостей (входы формулы или зависимые ячейки).
+У большинства ячеек связей от 0 до 3, поэтому до INLINE_CAPACITY указателей
+хранятся прямо в объекте, без выделения памяти. Больше - в векторе, а начиная
+с INDEX_THRESHOLD к нему добавляется хеш-индекс, чтобы поиск и удаление
+оставались O(1) у ячеек, на которые ссылаются тысячи формул.
+Связи всегда лежат подряд, поэтому обход - это проход по массиву указателей.
+Порядок обхода не определён.
+*/
+class CellLinks {
+public:
+    static constexpr size_t INLINE_CAPACITY = 3;
+    static constexpr size_t INDEX_THRESHOLD = 32;
+
+    CellLinks() = default;
+    CellLinks(const CellLinks&) = delete;
+    CellLinks& operator=(const CellLinks&) = delete;
+    ~CellLinks();
+
+    Cell* const* begin() const {
+        return heap_ ? heap_->cells.data() : inline_cells_.data();
+    }
+    Cell* const* end() const {
+        return begin() + size();
+    }
+
+    size_t size() const {
+        return heap_ ? heap_->cells.size() : inline_size_;
+    }
+    bool empty() const {
+        return size() == 0;
+    }
+
+    bool Contains(const Cell* cell) const;
+
+    // Возвращают false, если ячейка уже была в наборе (для Insert) или её не было (для Erase)
+    bool Insert(Cell* cell);
+    bool Erase(const Cell* cell);
+
+    void Clear();
+
+private:
+    struct Heap {
+        std::vector<Cell*> cells;
+        std::unordered_map<const Cell*, size_t> index;  // пуст, пока cells.size() < INDEX_THRESHOLD
+    };
+
+    std::array<Cell*, INLINE_CAPACITY> inline_cells_{};
+    uint32_t inline_size_ = 0;
+    std::unique_ptr<Heap> heap_;
+
+    // Позиция ячейки в begin()..end() или size(), если её нет
+    size_t Find(const Cell* cell) const;
+};
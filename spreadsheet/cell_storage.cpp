@@ -0,0 +1,53 @@
+#include "cell_storage.h"
+
+#include <utility>
+
+CellStorage::~CellStorage() = default;
+
+
+Cell* CellStorage::Put(Position pos, std::unique_ptr<Cell> cell) {
+    std::unique_ptr<TileRow>& tile_row = tile_rows_[pos.row >> TILE_SIZE_LOG];
+    if (!tile_row) {
+        tile_row = std::make_unique<TileRow>();
+    }
+
+    std::unique_ptr<Tile>& tile = (*tile_row)[pos.col >> TILE_SIZE_LOG];
+    if (!tile) {
+        tile = std::make_unique<Tile>();
+        ++tiles_count_;
+    }
+
+    std::unique_ptr<Cell>& slot = tile->cells[IndexInTile(pos)];
+    if (!slot) {
+        ++tile->cells_count;
+        ++cells_count_;
+    }
+    slot = std::move(cell);
+    return slot.get();
+}
+
+
+void CellStorage::Erase(Position pos) {
+    TileRow* tile_row = tile_rows_[pos.row >> TILE_SIZE_LOG].get();
+    if (tile_row == nullptr) {
+        return;
+    }
+
+    std::unique_ptr<Tile>& tile = (*tile_row)[pos.col >> TILE_SIZE_LOG];
+    if (!tile) {
+        return;
+    }
+
+    std::unique_ptr<Cell>& slot = tile->cells[IndexInTile(pos)];
+    if (!slot) {
+        return;
+    }
+    slot.reset();
+    --cells_count_;
+
+    // блок без ячеек больше не нужен
+    if (--tile->cells_count == 0) {
+        tile.reset();
+        --tiles_count_;
+    }
+}
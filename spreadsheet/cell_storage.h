@@ -0,0 +1,129 @@
+#pragma once
+
+#include "cell.h"
+#include "common.h"
+
+#include <algorithm>
+#include <array>
+#include <memory>
+
+/*
+Разреженное хранилище ячеек таблицы.
+Таблица разбита на блоки (тайлы) TILE_SIZE x TILE_SIZE ячеек. Блок выделяется
+только при записи в него первой ячейки и освобождается, когда в нём не остаётся
+ни одной ячейки. Каталог блоков двухуровневый: строка блоков тоже создаётся по
+требованию. Поэтому расход памяти зависит от количества заполненных ячеек, а не
+от площади ограничивающего прямоугольника, а доступ к любой позиции - O(1).
+*/
+class CellStorage {
+public:
+    static constexpr int TILE_SIZE_LOG = 6;
+    static constexpr int TILE_SIZE = 1 << TILE_SIZE_LOG;  // 64
+    static constexpr int TILE_ROWS = (Position::MAX_ROWS + TILE_SIZE - 1) / TILE_SIZE;
+    static constexpr int TILE_COLS = (Position::MAX_COLS + TILE_SIZE - 1) / TILE_SIZE;
+
+    CellStorage() = default;
+    CellStorage(const CellStorage&) = delete;
+    CellStorage& operator=(const CellStorage&) = delete;
+    ~CellStorage();
+
+    // Возвращает ячейку на позиции pos или nullptr, если её нет.
+    // Позиция должна быть заранее проверена
+    Cell* Get(Position pos) const {
+        const TileRow* tile_row = tile_rows_[pos.row >> TILE_SIZE_LOG].get();
+        if (tile_row == nullptr) {
+            return nullptr;
+        }
+        const Tile* tile = (*tile_row)[pos.col >> TILE_SIZE_LOG].get();
+        if (tile == nullptr) {
+            return nullptr;
+        }
+        return tile->cells[IndexInTile(pos)].get();
+    }
+
+    // Помещает ячейку на позицию pos (при необходимости выделяет блок).
+    // Если на позиции уже была ячейка, она удаляется
+    Cell* Put(Position pos, std::unique_ptr<Cell> cell);
+
+    // Удаляет ячейку на позиции pos. Пустой блок освобождается
+    void Erase(Position pos);
+
+    // Вызывает func(Position, Cell*) для каждой ячейки хранилища.
+    // Обходит только выделенные блоки
+    template <typename Func>
+    void ForEach(Func&& func) const {
+        for (int tile_row_index = 0; tile_row_index < TILE_ROWS; ++tile_row_index) {
+            const TileRow* tile_row = tile_rows_[tile_row_index].get();
+            if (tile_row == nullptr) {
+                continue;
+            }
+            for (int tile_col_index = 0; tile_col_index < TILE_COLS; ++tile_col_index) {
+                const Tile* tile = (*tile_row)[tile_col_index].get();
+                if (tile == nullptr) {
+                    continue;
+                }
+                for (int i = 0; i < TILE_SIZE * TILE_SIZE; ++i) {
+                    if (Cell* cell = tile->cells[i].get()) {
+                        func(Position{(tile_row_index << TILE_SIZE_LOG) + (i >> TILE_SIZE_LOG),
+                                      (tile_col_index << TILE_SIZE_LOG) + (i & (TILE_SIZE - 1))},
+                             cell);
+                    }
+                }
+            }
+        }
+    }
+
+    // Вызывает func(Position, Cell*) для каждой ячейки области range.
+    // Обходит только выделенные блоки, пересекающиеся с областью
+    template <typename Func>
+    void ForEachInRange(Range range, Func&& func) const {
+        for (int tile_row_index = range.from.row >> TILE_SIZE_LOG; tile_row_index <= range.to.row >> TILE_SIZE_LOG; ++tile_row_index) {
+            const TileRow* tile_row = tile_rows_[tile_row_index].get();
+            if (tile_row == nullptr) {
+                continue;
+            }
+            const int first_row = std::max(range.from.row, tile_row_index << TILE_SIZE_LOG);
+            const int last_row = std::min(range.to.row, ((tile_row_index + 1) << TILE_SIZE_LOG) - 1);
+            for (int tile_col_index = range.from.col >> TILE_SIZE_LOG; tile_col_index <= range.to.col >> TILE_SIZE_LOG; ++tile_col_index) {
+                const Tile* tile = (*tile_row)[tile_col_index].get();
+                if (tile == nullptr) {
+                    continue;
+                }
+                const int first_col = std::max(range.from.col, tile_col_index << TILE_SIZE_LOG);
+                const int last_col = std::min(range.to.col, ((tile_col_index + 1) << TILE_SIZE_LOG) - 1);
+                for (int row = first_row; row <= last_row; ++row) {
+                    for (int col = first_col; col <= last_col; ++col) {
+                        if (Cell* cell = tile->cells[IndexInTile(Position{row, col})].get()) {
+                            func(Position{row, col}, cell);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Количество ячеек в хранилище
+    size_t GetCellsCount() const {
+        return cells_count_;
+    }
+
+    // Количество выделенных блоков
+    size_t GetTilesCount() const {
+        return tiles_count_;
+    }
+
+private:
+    struct Tile {
+        std::array<std::unique_ptr<Cell>, TILE_SIZE * TILE_SIZE> cells;
+        int cells_count = 0;
+    };
+    using TileRow = std::array<std::unique_ptr<Tile>, TILE_COLS>;
+
+    std::array<std::unique_ptr<TileRow>, TILE_ROWS> tile_rows_;
+    size_t cells_count_ = 0;
+    size_t tiles_count_ = 0;
+
+    static int IndexInTile(Position pos) {
+        return ((pos.row & (TILE_SIZE - 1)) << TILE_SIZE_LOG) | (pos.col & (TILE_SIZE - 1));
+    }
+};
@@ -2,6 +2,7 @@
 
 #include <iosfwd>
 #include <memory>
+#include <optional>
 #include <stdexcept>
 #include <string>
 #include <string_view>
@@ -33,6 +34,23 @@ struct Size {
     bool operator==(Size rhs) const;
 };
 
+// Прямоугольная область ячеек, например A1:B3. Обе границы входят в область
+struct Range {
+    Position from;  // левый верхний угол
+    Position to;    // правый нижний угол
+
+    bool operator==(Range rhs) const;
+
+    bool IsValid() const;
+    bool Contains(Position pos) const;
+    std::string ToString() const;
+
+    // Область между двумя противоположными углами, заданными в любом порядке
+    static Range FromCorners(Position first, Position second);
+    // "A1:B3". Для некорректной строки возвращает невалидную область
+    static Range FromString(std::string_view str);
+};
+
 // Описывает ошибки, которые могут возникнуть при вычислении формулы.
 class FormulaError {
 public:
@@ -40,6 +58,7 @@ public:
         Ref,    // ссылка на ячейку с некорректной позицией
         Value,  // ячейка не может быть трактована как число
         Arithmetic,  // некорректная арифметическая операция
+        NotAvailable,  // функция поиска не нашла значение
     };
 
     FormulaError(Category category)
@@ -61,6 +80,8 @@ public:
                 return "#REF!";
             case FormulaError::Category::Value:
                 return "#VALUE!";
+            case FormulaError::Category::NotAvailable:
+                return "#N/A";
         }
 
         return "#UNKNOWN!";
@@ -110,6 +131,8 @@ public:
     // Либо текст ячейки, либо значение формулы, либо сообщение об ошибке из
     // формулы
     using Value = std::variant<std::string, double, FormulaError>;
+    // Значение ячейки для подстановки в формулу: число либо ошибка
+    using NumericValue = std::variant<double, FormulaError>;
 
     virtual ~CellInterface() = default;
 
@@ -123,6 +146,16 @@ public:
     // содержащий экранирующие символы). В случае формулы - её выражение.
     virtual std::string GetText() const = 0;
 
+    // Возвращает значение ячейки в виде числа для подстановки в формулу.
+    // Текст, который можно преобразовать в число, - это число, пустой текст - 0,
+    // другой текст - ошибка #VALUE!. В случае формулы - её значение или ошибка.
+    virtual NumericValue GetNumericValue() const = 0;
+
+    // Возвращает значение ячейки для функций над областью (SUM(A1:B3) и т.п.).
+    // Пустая ячейка и текст, который нельзя преобразовать в число, в области
+    // пропускаются - для них возвращается nullopt. Иначе - как GetNumericValue()
+    virtual std::optional<NumericValue> GetRangeValue() const = 0;
+
     // Возвращает список ячеек, которые непосредственно задействованы в данной
     // формуле. Список отсортирован по возрастанию и не содержит повторяющихся
     // ячеек. В случае текстовой ячейки список пуст.
@@ -0,0 +1,39 @@
+#include "file_header.h"
+
+#include <cassert>
+#include <cctype>
+#include <cstring>
+
+using namespace std::literals;
+
+namespace {
+
+constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+}  // namespace
+
+
+FileHeader MakeFileHeader(const FileFormat& format) {
+    assert(format.signature.size() == sizeof(FileHeader::signature));
+    FileHeader header{};
+    std::memcpy(header.signature, format.signature.data(), sizeof(header.signature));
+    header.version = format.version;
+    header.byte_order = BYTE_ORDER_MARK;
+    return header;
+}
+
+
+std::string CheckFileHeader(const FileHeader& header, const FileFormat& format) {
+    if (std::string_view(header.signature, sizeof(header.signature)) != format.signature) {
+        return "Not a spreadsheet "s + std::string(format.name);
+    }
+    std::string title(format.name);
+    title.front() = static_cast<char>(std::toupper(static_cast<unsigned char>(title.front())));
+    if (header.byte_order != BYTE_ORDER_MARK) {
+        return title + " was written with a different byte order"s;
+    }
+    if (header.version != format.version) {
+        return "Unsupported "s + std::string(format.name) + " version "s + std::to_string(header.version);
+    }
+    return {};
+}
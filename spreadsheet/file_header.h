@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/*
+Общее начало двоичных файлов таблицы (снимок, журнал): сигнатура формата,
+его версия и метка порядка байтов. Метка записывается как число, поэтому
+по ней видно, совпадает ли порядок байтов прочитавшей машины с записавшей.
+*/
+struct FileHeader {
+    char signature[8];
+    uint32_t version;
+    uint32_t byte_order;
+};
+
+static_assert(sizeof(FileHeader) == 16);
+
+// Формат файла: сигнатура (8 символов), версия и название для сообщений об ошибках
+struct FileFormat {
+    std::string_view signature;
+    uint32_t version;
+    std::string_view name;
+};
+
+FileHeader MakeFileHeader(const FileFormat& format);
+
+// Описание ошибки заголовка ("Not a spreadsheet snapshot" и т. п.)
+// или пустая строка, если заголовок записан в формате format
+std::string CheckFileHeader(const FileHeader& header, const FileFormat& format);
@@ -18,65 +18,224 @@ std::ostream& operator<<(std::ostream& output, FormulaException fe) {
 }
 
 
+struct FormulaTemplate {
+    FormulaTemplate(std::string_view expression, Position home)
+        : ast(ParseFormulaAST(expression))
+        , home(home) {
+    }
+
+    FormulaAST ast;
+    Position home;  // ячейка, в которой шаблон разобран: ссылки дерева - как в ней
+};
+
+
 namespace {
 
+// при меньшем размере таблица шаблонов не чистится
+constexpr size_t MIN_CLEANUP_SIZE = 1024;
+
+std::shared_ptr<const FormulaTemplate> MakeTemplate(std::string_view expression, Position home) {
+    // Разбор может выкинуть исключение при вводе лексически некорректной формулы
+    try {
+        return std::make_shared<const FormulaTemplate>(expression, home);
+    } catch (...) {
+        throw FormulaException("Can\'t construct formula"s);
+    }
+}
+
+// Формула ячейки: шаблон и сдвиг ссылок ячейки относительно шаблона
 class Formula : public FormulaInterface {
 public:
-// Реализуйте следующие методы:
-
-    // Конструктор формулы
-    // Может выкинуть исключение при вводе лексически некорректной формулы
-    // Обрабатываем это исключение прямо в списке инициализации (try catch).
-    explicit Formula(std::string expression) try
-        : ast_(ParseFormulaAST(expression)) {}
-    catch(...)
-    {
-        throw FormulaException("Can\'t construct formula"s);
+    Formula(std::shared_ptr<const FormulaTemplate> formula_template, Position pos)
+        : template_(std::move(formula_template))
+        , shift_{pos.row - template_->home.row, pos.col - template_->home.col} {
+        if (IsShifted()) {
+            for (const Range& range : template_->ast.GetReferencedRanges()) {
+                ranges_.push_back(Bytecode::ShiftRange(range, shift_));
+            }
+        }
     }
 
+    // Ошибки вычисления приходят как значение, исключения не используются
     Value Evaluate(const SheetInterface& sheet) const override {
-        double res;
-        try {
-            res = ast_.Execute(sheet);  // тут могут выкинуться исключения FormulaError любой категории
-            return res;
-        } catch (const FormulaError& err) {
-            return FormulaError(err.GetCategory());
+        Bytecode::FormulaResult res = template_->ast.Execute(sheet, GetPlacement());
+        if (res.HasError()) {
+            return res.GetError();
+        }
+        return res.GetValue();
+    }
+
+    std::optional<Value> Evaluate(const SheetInterface& sheet, Bytecode::InputGate& gate) const override {
+        std::optional<Bytecode::FormulaResult> res = template_->ast.Execute(sheet, GetPlacement(), gate);
+        if (!res.has_value()) {
+            return std::nullopt;
         }
+        if (res->HasError()) {
+            return res->GetError();
+        }
+        return res->GetValue();
     }
 
+    bool HasBranches() const override {
+        return template_->ast.HasBranches();
+    }
 
     std::string GetExpression() const override {
-        std::string res_str;
-        std::ostringstream out(res_str);
-        ast_.PrintFormula(out);
-        res_str = out.str();
-        return res_str;
+        std::ostringstream out;
+        PrintExpression(out);
+        return out.str();
+    }
+
+    void PrintExpression(std::ostream& out) const override {
+        template_->ast.PrintFormula(out, shift_);
     }
 
 
     // Возвращает упорядоченный список уникальных ячеек, на которые ссылается данная формула
+    // (упорядочивается один раз при компиляции шаблона, сдвиг порядок не меняет)
     std::vector<Position> GetReferencedCells() const override {
-        const std::forward_list<Position>& cells_list = ast_.GetCells();
-        // переписываем позиции из односвязного списка в вектор
-        std::vector<Position> cells_v(cells_list.begin(), cells_list.end());
-        
-        // Сортируем и оставляем только уникальные 
-        // (сортировка обязательно перед выделением уникальных - см. принцип работы unique)
-        sort(cells_v.begin(), cells_v.end(), [] (const Position& lhs, const Position rhs) {
-                                        return (lhs < rhs); });
-        auto last = std::unique(cells_v.begin(), cells_v.end());
-        // Удаляем неуникальные
-        cells_v.erase(last, cells_v.end());
+        std::vector<Position> cells = template_->ast.GetReferencedCells();
+        if (IsShifted()) {
+            for (Position& cell : cells) {
+                cell = Bytecode::ShiftPosition(cell, shift_);
+            }
+        }
+        return cells;
+    }
 
-        return cells_v;
+    const std::vector<Range>& GetReferencedRanges() const override {
+        return IsShifted() ? ranges_ : template_->ast.GetReferencedRanges();
     }
 
-private:
-    FormulaAST ast_;
+    void BindReferencedCells(std::vector<const CellInterface*> cells) override {
+        assert(cells.empty() || cells.size() == template_->ast.GetReferencedCells().size());
+        bound_cells_ = std::move(cells);
+    }
+
+    const FormulaTemplate* GetTemplate() const override {
+        return template_.get();
+    }
 
+    bool IsBatchable() const override {
+        return template_->ast.IsBatchable();
+    }
+
+    std::unique_ptr<FormulaInterface> CopyTo(Position pos) const override {
+        return std::make_unique<Formula>(template_, pos);
+    }
+
+    Bytecode::Placement GetPlacement() const {
+        return {shift_, bound_cells_.empty() ? nullptr : bound_cells_.data()};
+    }
+
+private:
+    std::shared_ptr<const FormulaTemplate> template_;
+    Position shift_;
+    // области шаблона со сдвигом (только если сдвиг не нулевой)
+    std::vector<Range> ranges_;
+    std::vector<const CellInterface*> bound_cells_;
+
+    bool IsShifted() const {
+        return shift_.row != 0 || shift_.col != 0;
+    }
 };
 }  // namespace
 
 std::unique_ptr<FormulaInterface> ParseFormula(std::string expression) {
-    return std::make_unique<Formula>(std::move(expression));
-}
\ No newline at end of file
+    const Position home{0, 0};
+    return std::make_unique<Formula>(MakeTemplate(expression, home), home);
+}
+
+
+std::vector<FormulaInterface::Value> EvaluateBatch(const SheetInterface& sheet,
+                                                   const std::vector<const FormulaInterface*>& formulas) {
+    if (formulas.empty()) {
+        return {};
+    }
+    const FormulaTemplate* formula_template = formulas.front()->GetTemplate();
+
+    std::vector<Bytecode::Placement> placements;
+    placements.reserve(formulas.size());
+    for (const FormulaInterface* formula : formulas) {
+        assert(formula->GetTemplate() == formula_template);
+        // формулы с шаблоном создаются только в этом файле
+        placements.push_back(static_cast<const Formula*>(formula)->GetPlacement());
+    }
+
+    std::vector<FormulaInterface::Value> values;
+    values.reserve(formulas.size());
+    for (const Bytecode::FormulaResult& result : formula_template->ast.ExecuteBatch(sheet, placements)) {
+        if (result.HasError()) {
+            values.push_back(result.GetError());
+        } else {
+            values.push_back(result.GetValue());
+        }
+    }
+    return values;
+}
+
+
+FormulaTemplates::FormulaTemplates()
+    : cleanup_size_(MIN_CLEANUP_SIZE) {
+}
+
+FormulaTemplates::~FormulaTemplates() = default;
+
+std::unique_ptr<FormulaInterface> FormulaTemplates::ParseFormula(std::string_view expression, Position pos) {
+    std::string key;
+    try {
+        key = GetRelativeFormulaKey(expression, pos);
+    } catch (...) {
+        throw FormulaException("Can\'t construct formula"s);
+    }
+
+    // шаблоны, которые больше не используются, убираются, когда таблица
+    // вырастет вдвое - в среднем O(1) на формулу
+    if (templates_.size() >= cleanup_size_) {
+        for (auto it = templates_.begin(); it != templates_.end();) {
+            it = it->second.expired() ? templates_.erase(it) : std::next(it);
+        }
+        cleanup_size_ = std::max(MIN_CLEANUP_SIZE, 2 * templates_.size());
+    }
+
+    std::weak_ptr<const FormulaTemplate>& entry = templates_[std::move(key)];
+    std::shared_ptr<const FormulaTemplate> formula_template = entry.lock();
+    if (!formula_template) {
+        formula_template = MakeTemplate(expression, pos);
+        entry = formula_template;
+    }
+    return std::make_unique<Formula>(std::move(formula_template), pos);
+}
+
+void FormulaTemplates::Merge(const FormulaTemplates& other, Replacements& replacements) {
+    for (const auto& [key, entry] : other.templates_) {
+        std::shared_ptr<const FormulaTemplate> other_template = entry.lock();
+        if (!other_template) {
+            continue;
+        }
+        std::weak_ptr<const FormulaTemplate>& current = templates_[key];
+        if (std::shared_ptr<const FormulaTemplate> current_template = current.lock()) {
+            if (current_template != other_template) {
+                replacements.emplace(other_template.get(), std::move(current_template));
+            }
+        } else {
+            current = entry;
+        }
+    }
+}
+
+std::unique_ptr<FormulaInterface> FormulaTemplates::Rebind(const FormulaInterface& formula, Position pos,
+                                                           const Replacements& replacements) {
+    const auto it = replacements.find(formula.GetTemplate());
+    if (it == replacements.end()) {
+        return nullptr;
+    }
+    // ключи шаблонов совпадают, поэтому ссылки формулы с новым шаблоном те же
+    return std::make_unique<Formula>(it->second, pos);
+}
+
+size_t FormulaTemplates::GetTemplatesCount() const {
+    return std::count_if(templates_.begin(), templates_.end(), [](const auto& entry) {
+        return !entry.second.expired();
+    });
+}
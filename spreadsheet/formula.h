@@ -5,11 +5,22 @@
 #include "FormulaAST.h"
 
 #include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <unordered_map>
 #include <variant>
 
+// Разобранная формула, общая для всех ячеек с одинаковой относительной записью
+struct FormulaTemplate;
+
 // Формула, позволяющая вычислять и обновлять арифметическое выражение.
 // Поддерживаемые возможности:
 // * Простые бинарные операции и числа, скобки: 1+2*3, 2.5*(2+3.5/7)
+// * Агрегатные функции от чисел и областей ячеек: SUM(A1:B3,C5), AVERAGE, MIN, MAX, COUNT
+// * Функции поиска: MATCH, VLOOKUP, XLOOKUP
+// * Сравнения (1 - истина, 0 - ложь) и условия с вычислением только нужной
+//   ветви: IF(A1>=0,B1,C1), AND(A1<>0,B1/A1>2), OR
 class FormulaInterface {
 public:
     using Value = std::variant<double, FormulaError>;
@@ -23,17 +34,97 @@ public:
     // возвращается именно эта ошибка. Если таких ошибок несколько, возвращается
     // любая.
     virtual Value Evaluate(const SheetInterface& sheet) const = 0;
+    // Вычисляет формулу, пропуская каждое чтение ячейки или области через gate.
+    // Возвращает nullopt, если gate прервал вычисление
+    virtual std::optional<Value> Evaluate(const SheetInterface& sheet, Bytecode::InputGate& gate) const = 0;
+
+    // Есть ли в формуле ветвления: тогда Evaluate() читает не все ячейки
+    // и области формулы, а только входы выбранных ветвей
+    virtual bool HasBranches() const = 0;
 
     // Возвращает выражение, которое описывает формулу.
     // Не содержит пробелов и лишних скобок.
     virtual std::string GetExpression() const = 0;
+    // Печатает то же выражение в out без промежуточной строки
+    virtual void PrintExpression(std::ostream& out) const = 0;
 
     // Возвращает список ячеек, которые непосредственно задействованы в вычислении
     // формулы. Список отсортирован по возрастанию и не содержит повторяющихся
     // ячеек.
     virtual std::vector<Position> GetReferencedCells() const = 0;
+
+    // Возвращает список областей, которые задействованы в вычислении формулы
+    // (аргументы функций). Ячейки областей в GetReferencedCells() не входят.
+    // Список упорядочен и не содержит повторов
+    virtual const std::vector<Range>& GetReferencedRanges() const = 0;
+
+    // Привязывает ссылки формулы к ячейкам таблицы, чтобы Evaluate() читал их
+    // напрямую, без поиска в таблице. cells[i] - ячейка на позиции
+    // GetReferencedCells()[i]. Пустой вектор снимает привязку.
+    // Привязка действительна, пока указанные ячейки существуют
+    virtual void BindReferencedCells(std::vector<const CellInterface*> cells) = 0;
+
+    // Шаблон формулы (см. FormulaTemplates). Формулы одного шаблона можно
+    // вычислить вместе (см. EvaluateBatch)
+    virtual const FormulaTemplate* GetTemplate() const = 0;
+
+    // Выигрывает ли формула от вычисления пачкой: в ней только числа,
+    // ссылки на ячейки, арифметика и сравнения
+    virtual bool IsBatchable() const = 0;
+
+    // Та же формула, скопированная в ячейку pos: ссылки сдвигаются, как при
+    // копировании ячейки. Копия использует тот же шаблон - выражение не разбирается
+    virtual std::unique_ptr<FormulaInterface> CopyTo(Position pos) const = 0;
 };
 
 // Парсит переданное выражение и возвращает объект формулы.
 // Бросает FormulaException в случае, если формула синтаксически некорректна.
-std::unique_ptr<FormulaInterface> ParseFormula(std::string expression);
\ No newline at end of file
+std::unique_ptr<FormulaInterface> ParseFormula(std::string expression);
+
+// Вычисляет формулы одного шаблона (например, столбец, заполненный протяжкой)
+// за один проход байткода по всем сразу. Значения ячеек собираются
+// в непрерывные массивы, операции векторизуются (см. Bytecode::Program::ExecuteBatch).
+// Возвращает значения formulas в том же порядке
+std::vector<FormulaInterface::Value> EvaluateBatch(const SheetInterface& sheet,
+                                                   const std::vector<const FormulaInterface*>& formulas);
+
+/*
+Таблица шаблонов формул листа. Столбец, заполненный протяжкой (=A1*B1,
+=A2*B2, ...), в относительной записи (см. GetRelativeFormulaKey) состоит
+из одной и той же формулы. Она разбирается и компилируется один раз:
+ячейки делят дерево и байткод шаблона и хранят только ссылку на него
+и сдвиг своих ссылок относительно ячейки, где шаблон был разобран.
+Шаблон живёт, пока его используют формулы
+*/
+class FormulaTemplates {
+public:
+    FormulaTemplates();
+    ~FormulaTemplates();
+
+    // Формула expression из ячейки pos. Бросает FormulaException
+    std::unique_ptr<FormulaInterface> ParseFormula(std::string_view expression, Position pos);
+
+    // Сколько шаблонов используется формулами
+    size_t GetTemplatesCount() const;
+
+    // Шаблоны другой таблицы, вместо которых в этой таблице уже есть шаблоны
+    // с тем же ключом: какой шаблон чем заменяется
+    using Replacements = std::unordered_map<const FormulaTemplate*, std::shared_ptr<const FormulaTemplate>>;
+
+    // Добавляет шаблоны other, которых нет в этой таблице. Таблица шаблонов не
+    // потокобезопасна: формулы разбираются параллельно в отдельных таблицах,
+    // которые затем сливаются в таблицу листа. Шаблоны other, ключи которых
+    // в таблице уже есть, записываются в replacements: формулы с ними нужно
+    // перевести на шаблоны таблицы (см. Rebind), чтобы один ключ был одним шаблоном
+    void Merge(const FormulaTemplates& other, Replacements& replacements);
+
+    // Формула formula ячейки pos с шаблоном-заменой из replacements.
+    // nullptr, если шаблон formula не заменяется
+    static std::unique_ptr<FormulaInterface> Rebind(const FormulaInterface& formula, Position pos,
+                                                    const Replacements& replacements);
+
+private:
+    std::unordered_map<std::string, std::weak_ptr<const FormulaTemplate>> templates_;
+    // при таком размере таблицы из неё убираются неиспользуемые шаблоны
+    size_t cleanup_size_;
+};
\ No newline at end of file
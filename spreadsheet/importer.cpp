@@ -0,0 +1,246 @@
+#include "importer.h"
+
+#include "sheet.h"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std::literals;
+
+namespace {
+
+constexpr char QUOTE = '"';
+
+using Contents = std::vector<std::pair<Position, Cell::Content>>;
+
+// Делит начало буфера на строки (без перевода строки и '\r' перед ним).
+// Неполная последняя строка в lines не попадает, если это не конец текста.
+// Возвращает, сколько байт буфера занимают найденные строки
+size_t SplitLines(std::string_view buffer, bool is_last, const ImportOptions& options, std::vector<std::string_view>& lines) {
+    lines.clear();
+    size_t line_start = 0;
+    if (!options.quoted_fields) {
+        const char* const begin = buffer.data();
+        const char* const end = begin + buffer.size();
+        for (const char* it = begin; it != end;) {
+            const char* line_end = static_cast<const char*>(std::memchr(it, '\n', end - it));
+            if (line_end == nullptr) {
+                break;
+            }
+            lines.push_back(buffer.substr(it - begin, line_end - it));
+            it = line_end + 1;
+            line_start = it - begin;
+        }
+    } else {
+        // перевод строки внутри кавычек строку не завершает
+        bool is_quoted = false;
+        for (size_t i = 0; i < buffer.size(); ++i) {
+            if (buffer[i] == QUOTE) {
+                is_quoted = !is_quoted;
+            } else if (buffer[i] == '\n' && !is_quoted) {
+                lines.push_back(buffer.substr(line_start, i - line_start));
+                line_start = i + 1;
+            }
+        }
+    }
+    if (is_last && line_start < buffer.size()) {
+        lines.push_back(buffer.substr(line_start));
+        line_start = buffer.size();
+    }
+    for (std::string_view& line : lines) {
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+    }
+    return line_start;
+}
+
+// Поле в кавычках без внешних кавычек, "" внутри - одна кавычка
+std::string Unquote(std::string_view field) {
+    std::string text;
+    text.reserve(field.size());
+    for (size_t i = 1; i < field.size(); ++i) {
+        if (field[i] == QUOTE) {
+            ++i;
+            if (i == field.size() || field[i] != QUOTE) {
+                break;
+            }
+        }
+        text.push_back(field[i]);
+    }
+    return text;
+}
+
+// Разбирает строки таблицы first_row, first_row + 1, ... в contents
+class LinesParser {
+public:
+    LinesParser(const Sheet& sheet, const ImportOptions& options, FormulaTemplates& templates)
+        : sheet_(sheet)
+        , options_(options)
+        , templates_(templates) {
+    }
+
+    // Возвращает количество непустых полей
+    size_t Parse(const std::string_view* lines, size_t lines_count, int first_row, Contents& contents) const {
+        size_t cells_count = 0;
+        for (size_t i = 0; i < lines_count; ++i) {
+            const int row = first_row + static_cast<int>(i);
+            const std::string_view line = lines[i];
+            int col = 0;
+            for (size_t field_start = 0;; ++col) {
+                const size_t field_end = FindFieldEnd(line, field_start);
+                const std::string_view field = line.substr(field_start, field_end - field_start);
+                if (!field.empty()) {
+                    ++cells_count;
+                    AddCell(Position{row, col}, field, contents);
+                }
+                if (field_end == line.size()) {
+                    break;
+                }
+                field_start = field_end + 1;
+            }
+        }
+        return cells_count;
+    }
+
+private:
+    const Sheet& sheet_;
+    const ImportOptions& options_;
+    FormulaTemplates& templates_;
+
+    size_t FindFieldEnd(std::string_view line, size_t field_start) const {
+        size_t search_start = field_start;
+        if (options_.quoted_fields && field_start < line.size() && line[field_start] == QUOTE) {
+            // разделитель ищется после закрывающей кавычки ("" - не закрывающая)
+            search_start = field_start + 1;
+            while (search_start < line.size()) {
+                if (line[search_start] == QUOTE) {
+                    if (search_start + 1 < line.size() && line[search_start + 1] == QUOTE) {
+                        search_start += 2;
+                        continue;
+                    }
+                    ++search_start;
+                    break;
+                }
+                ++search_start;
+            }
+        }
+        const size_t field_end = line.find(options_.delimiter, search_start);
+        return field_end == std::string_view::npos ? line.size() : field_end;
+    }
+
+    void AddCell(Position pos, std::string_view field, Contents& contents) const {
+        if (!pos.IsValid()) {
+            throw InvalidPositionException("Err in ImportTable: Position is out of acceptable table range ["s
+                                           + std::to_string(pos.row) + ", "s + std::to_string(pos.col) + "]"s);
+        }
+        std::string text = options_.quoted_fields && field.front() == QUOTE ? Unquote(field) : std::string(field);
+        // Если текст ячейки не изменился - ничего делать не надо
+        if (const Cell* cell = sheet_.GetConcreteCell(pos); cell != nullptr && cell->GetText() == text) {
+            return;
+        }
+        contents.emplace_back(pos, Cell::ParseContent(std::move(text), pos, templates_));
+    }
+};
+
+}  // namespace
+
+
+ImportStats ImportTable(Sheet& sheet, std::istream& input, const ImportOptions& options) {
+    size_t threads_count = options.threads_count;
+    if (threads_count == 0) {
+        threads_count = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    const size_t chunk_size = std::max<size_t>(options.chunk_size, 1);
+
+    ImportStats stats;
+    // у каждого потока своя таблица шаблонов: таблица не потокобезопасна
+    std::vector<FormulaTemplates> templates(threads_count);
+    Contents contents;
+    std::string buffer;
+    std::vector<std::string_view> lines;
+    std::vector<Contents> thread_contents(threads_count);
+    std::vector<size_t> thread_cells(threads_count);
+    std::vector<std::exception_ptr> thread_errors(threads_count);
+
+    for (bool is_last = false; !is_last;) {
+        // к недочитанной строке прошлого блока дописывается следующий блок
+        const size_t kept_size = buffer.size();
+        buffer.resize(kept_size + chunk_size);
+        input.read(buffer.data() + kept_size, static_cast<std::streamsize>(chunk_size));
+        const size_t read_size = static_cast<size_t>(input.gcount());
+        buffer.resize(kept_size + read_size);
+        stats.bytes += read_size;
+        is_last = read_size < chunk_size;
+
+        const size_t lines_size = SplitLines(buffer, is_last, options, lines);
+
+        // строки блока поровну делятся между потоками, вызывающий поток - один из них
+        const size_t lines_per_thread = (lines.size() + threads_count - 1) / threads_count;
+        auto parse_part = [&](size_t thread_index) {
+            const size_t first_line = std::min(lines.size(), thread_index * lines_per_thread);
+            const size_t last_line = std::min(lines.size(), first_line + lines_per_thread);
+            try {
+                LinesParser parser(sheet, options, templates[thread_index]);
+                thread_cells[thread_index] = parser.Parse(lines.data() + first_line, last_line - first_line,
+                                                          static_cast<int>(stats.rows + first_line), thread_contents[thread_index]);
+            } catch (...) {
+                thread_errors[thread_index] = std::current_exception();
+            }
+        };
+        std::vector<std::thread> threads;
+        threads.reserve(threads_count - 1);
+        for (size_t i = 1; i < threads_count && i * lines_per_thread < lines.size(); ++i) {
+            threads.emplace_back(parse_part, i);
+        }
+        parse_part(0);
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+
+        for (size_t i = 0; i < threads_count; ++i) {
+            if (thread_errors[i]) {
+                std::rethrow_exception(thread_errors[i]);
+            }
+            stats.cells += thread_cells[i];
+            thread_cells[i] = 0;
+            if (contents.empty()) {
+                // первая часть забирается целиком, без переноса по одной ячейке
+                contents.swap(thread_contents[i]);
+            } else {
+                std::move(thread_contents[i].begin(), thread_contents[i].end(), std::back_inserter(contents));
+                thread_contents[i].clear();
+            }
+        }
+        stats.rows += lines.size();
+        buffer.erase(0, lines_size);
+    }
+
+    // одинаковые формулы, разобранные разными потоками (или уже бывшие в листе),
+    // переводятся на один шаблон: столбец, заполненный протяжкой, - один шаблон
+    FormulaTemplates::Replacements replacements;
+    for (const FormulaTemplates& thread_templates : templates) {
+        sheet.GetFormulaTemplates().Merge(thread_templates, replacements);
+    }
+    if (!replacements.empty()) {
+        for (auto& [pos, content] : contents) {
+            const FormulaInterface* formula = content.GetFormula();
+            if (formula == nullptr) {
+                continue;
+            }
+            if (std::unique_ptr<FormulaInterface> rebound = FormulaTemplates::Rebind(*formula, pos, replacements)) {
+                content = Cell::MakeFormulaContent(std::move(rebound));
+            }
+        }
+    }
+    sheet.SetContents(std::move(contents));
+    return stats;
+}
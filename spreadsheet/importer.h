@@ -0,0 +1,41 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstddef>
+#include <iosfwd>
+
+class Sheet;
+
+/*
+Импорт таблицы из текста в формате PrintTexts (TSV) или CSV.
+Текст читается блоками по chunk_size байт и целиком в памяти не держится.
+Блок делится на строки, строки - поровну между потоками. Поля выделяются без
+копирования (string_view на буфер блока), тексты ячеек разбираются на потоках,
+у каждого своя таблица шаблонов формул (см. FormulaTemplates::Merge).
+Ячейки записываются в таблицу одним пакетом (см. Sheet::SetContents): граф
+зависимостей строится и циклы ищутся один раз на весь импорт.
+Импорт - "всё или ничего": при ошибке таблица остаётся прежней.
+*/
+
+struct ImportOptions {
+    char delimiter = '\t';  // '\t' - как PrintTexts, ',' - CSV
+    // Поля могут быть в кавычках (CSV): "a,b" - одно поле, "" внутри - кавычка,
+    // перевод строки внутри кавычек - часть поля
+    bool quoted_fields = false;
+    size_t threads_count = 1;  // 0 - по числу ядер процессора
+    size_t chunk_size = 16 << 20;  // сколько байт текста читается за раз
+};
+
+// Сколько прочитано при импорте
+struct ImportStats {
+    size_t bytes = 0;
+    size_t rows = 0;
+    size_t cells = 0;  // непустые поля
+};
+
+// Строка текста - строка таблицы начиная с первой, поле - ячейка. Пустые поля
+// ячеек не создают, существующие ячейки на их местах не меняются.
+// Бросает InvalidPositionException (полей или строк больше, чем вмещает таблица),
+// FormulaException, CircularDependencyException
+ImportStats ImportTable(Sheet& sheet, std::istream& input, const ImportOptions& options = {});
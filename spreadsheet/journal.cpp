@@ -0,0 +1,524 @@
+#include "journal.h"
+
+#include "file_header.h"
+#include "sheet.h"
+
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <filesystem>
+#endif
+
+using namespace std::literals;
+
+namespace {
+
+constexpr FileFormat JOURNAL_FORMAT{"SHEETWAL"sv, JOURNAL_VERSION, "journal"sv};
+
+// заголовок журнала - только общий заголовок файлов
+using Header = FileHeader;
+
+struct GroupHeader {
+    uint32_t size;  // байт записей группы после заголовка
+    uint32_t crc;   // CRC-32 записей
+};
+
+static_assert(sizeof(Header) == 16 && sizeof(GroupHeader) == 8);
+static_assert(std::is_trivially_copyable_v<Header> && std::is_trivially_copyable_v<GroupHeader>);
+
+enum class Operation : uint8_t {
+    SetCell = 1,
+    ClearCell = 2,
+};
+
+// тип, строка и столбец
+constexpr size_t OPERATION_SIZE = 5;
+
+// CRC-32 с полиномом 0xEDB88320 (как в zlib), таблица считается при компиляции
+constexpr std::array<uint32_t, 256> MakeCrcTable() {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc & 1) != 0 ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+        }
+        table[i] = crc;
+    }
+    return table;
+}
+
+constexpr std::array<uint32_t, 256> CRC_TABLE = MakeCrcTable();
+
+uint32_t Crc32(std::string_view data) {
+    uint32_t crc = 0xFFFFFFFFu;
+    for (char c : data) {
+        crc = CRC_TABLE[(crc ^ static_cast<uint8_t>(c)) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+std::string MakeHeader() {
+    const Header header = MakeFileHeader(JOURNAL_FORMAT);
+    return std::string(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+void AppendOperation(std::string& record, Operation operation, Position pos) {
+    // позиции таблицы помещаются в 2 байта: MAX_ROWS и MAX_COLS не больше 2^16
+    const uint16_t row = static_cast<uint16_t>(pos.row);
+    const uint16_t col = static_cast<uint16_t>(pos.col);
+    record.push_back(static_cast<char>(operation));
+    record.append(reinterpret_cast<const char*>(&row), sizeof(row));
+    record.append(reinterpret_cast<const char*>(&col), sizeof(col));
+}
+
+void AppendVarint(std::string& record, uint64_t value) {
+    while (value >= 0x80) {
+        record.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    record.push_back(static_cast<char>(value));
+}
+
+// Проверяет заголовок и вызывает func(записи группы) для каждой целой группы.
+// Возвращает размер журнала до первой оборванной или повреждённой группы.
+// Журнал короче заголовка считается пустым: сбой случился при создании файла
+template <typename Func>
+size_t ForEachGroup(std::string_view data, Func&& func) {
+    if (data.size() < sizeof(Header)) {
+        return 0;
+    }
+    Header header;
+    std::memcpy(&header, data.data(), sizeof(header));
+    if (std::string error = CheckFileHeader(header, JOURNAL_FORMAT); !error.empty()) {
+        throw JournalException(error);
+    }
+
+    size_t offset = sizeof(Header);
+    while (data.size() - offset >= sizeof(GroupHeader)) {
+        GroupHeader group_header;
+        std::memcpy(&group_header, data.data() + offset, sizeof(group_header));
+        if (group_header.size > data.size() - offset - sizeof(GroupHeader)) {
+            break;
+        }
+        const std::string_view records = data.substr(offset + sizeof(GroupHeader), group_header.size);
+        if (Crc32(records) != group_header.crc) {
+            break;
+        }
+        func(records);
+        offset += sizeof(GroupHeader) + group_header.size;
+    }
+    return offset;
+}
+
+// Читает записи группы, проверенной по CRC. Некорректная запись в такой группе -
+// не обрыв при сбое, а повреждение журнала
+class RecordsReader {
+public:
+    explicit RecordsReader(std::string_view records)
+        : records_(records) {
+    }
+
+    bool IsEnd() const {
+        return offset_ == records_.size();
+    }
+
+    Operation ReadOperation(Position& pos) {
+        if (records_.size() - offset_ < OPERATION_SIZE) {
+            throw JournalException("Journal is damaged"s);
+        }
+        const auto operation = static_cast<Operation>(records_[offset_]);
+        uint16_t row = 0;
+        uint16_t col = 0;
+        std::memcpy(&row, records_.data() + offset_ + 1, sizeof(row));
+        std::memcpy(&col, records_.data() + offset_ + 3, sizeof(col));
+        offset_ += OPERATION_SIZE;
+        pos = Position{row, col};
+        if ((operation != Operation::SetCell && operation != Operation::ClearCell) || !pos.IsValid()) {
+            throw JournalException("Journal is damaged"s);
+        }
+        return operation;
+    }
+
+    std::string_view ReadText() {
+        uint64_t size = 0;
+        for (int shift = 0;; shift += 7) {
+            if (offset_ == records_.size() || shift > 63) {
+                throw JournalException("Journal is damaged"s);
+            }
+            const auto byte = static_cast<uint8_t>(records_[offset_++]);
+            size |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                break;
+            }
+        }
+        if (size > records_.size() - offset_) {
+            throw JournalException("Journal is damaged"s);
+        }
+        const std::string_view text = records_.substr(offset_, size);
+        offset_ += size;
+        return text;
+    }
+
+private:
+    std::string_view records_;
+    size_t offset_ = 0;
+};
+
+}  // namespace
+
+
+#if defined(__linux__) || defined(__APPLE__)
+
+// Файл журнала: дописывание и сброс на диск вызовами ОС
+class SheetJournal::File {
+public:
+    explicit File(const std::string& path)
+        : path_(path) {
+        fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (fd_ < 0) {
+            throw JournalException("Can't open journal file "s + path);
+        }
+    }
+
+    File(const File&) = delete;
+    File& operator=(const File&) = delete;
+
+    ~File() {
+        close(fd_);
+    }
+
+    std::string ReadAll() const {
+        struct stat file_stat {};
+        if (fstat(fd_, &file_stat) != 0) {
+            Fail("read");
+        }
+        std::string data(static_cast<size_t>(file_stat.st_size), '\0');
+        size_t done = 0;
+        while (done < data.size()) {
+            const ssize_t count = pread(fd_, data.data() + done, data.size() - done, static_cast<off_t>(done));
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                Fail("read");
+            }
+            done += static_cast<size_t>(count);
+        }
+        return data;
+    }
+
+    void Append(std::string_view data) {
+        while (!data.empty()) {
+            const ssize_t count = write(fd_, data.data(), data.size());
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                Fail("write");
+            }
+            data.remove_prefix(static_cast<size_t>(count));
+        }
+    }
+
+    void Sync() {
+#if defined(__linux__)
+        // размер файла и данные; время изменения сбрасывать не нужно
+        const int result = fdatasync(fd_);
+#else
+        const int result = fsync(fd_);
+#endif
+        if (result != 0) {
+            Fail("sync");
+        }
+    }
+
+    void Truncate(size_t size) {
+        if (ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+            Fail("truncate");
+        }
+    }
+
+private:
+    std::string path_;
+    int fd_ = -1;
+
+    [[noreturn]] void Fail(const char* action) const {
+        throw JournalException("Can't "s + action + " journal file "s + path_ + ": "s + std::strerror(errno));
+    }
+};
+
+#else
+
+// Переносимый вариант без fsync: данные доходят только до буферов ОС
+class SheetJournal::File {
+public:
+    explicit File(const std::string& path)
+        : path_(path) {
+        std::ofstream create(path, std::ios::binary | std::ios::app);
+        if (!create) {
+            throw JournalException("Can't open journal file "s + path);
+        }
+        Reopen();
+    }
+
+    std::string ReadAll() const {
+        std::ifstream input(path_, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+    }
+
+    void Append(std::string_view data) {
+        output_.write(data.data(), static_cast<std::streamsize>(data.size()));
+        output_.flush();
+        if (!output_) {
+            throw JournalException("Can't write journal file "s + path_);
+        }
+    }
+
+    void Sync() {
+    }
+
+    void Truncate(size_t size) {
+        output_.close();
+        std::error_code error;
+        std::filesystem::resize_file(path_, size, error);
+        if (error) {
+            throw JournalException("Can't truncate journal file "s + path_);
+        }
+        Reopen();
+    }
+
+private:
+    std::string path_;
+    std::ofstream output_;
+
+    void Reopen() {
+        output_.open(path_, std::ios::binary | std::ios::app);
+        if (!output_) {
+            throw JournalException("Can't open journal file "s + path_);
+        }
+    }
+};
+
+#endif
+
+
+SheetJournal::SheetJournal(Sheet& sheet, const std::string& path, JournalOptions options)
+    : sheet_(sheet)
+    , options_(options)
+    , file_(std::make_unique<File>(path)) {
+    // оборванная последняя группа отрезается, чтобы новые группы шли за целыми
+    const std::string data = file_->ReadAll();
+    size_t valid_size = ForEachGroup(data, [](std::string_view /* records */) {});
+    if (valid_size == 0) {
+        file_->Truncate(0);
+        const std::string header = MakeHeader();
+        file_->Append(header);
+        file_->Sync();
+        valid_size = header.size();
+    } else if (valid_size < data.size()) {
+        file_->Truncate(valid_size);
+        file_->Sync();
+    }
+    stats_.bytes = valid_size;
+
+    if (options_.sync_interval.count() > 0) {
+        writer_ = std::thread([this] {
+            RunWriter();
+        });
+    }
+}
+
+
+SheetJournal::~SheetJournal() {
+    if (writer_.joinable()) {
+        {
+            std::lock_guard lock(mutex_);
+            is_stopped_ = true;
+        }
+        wake_writer_.notify_one();
+        writer_.join();
+    }
+}
+
+
+void SheetJournal::SetCell(Position pos, std::string text) {
+    ThrowIfFailed();
+    record_.clear();
+    AppendOperation(record_, Operation::SetCell, pos);
+    AppendVarint(record_, text.size());
+    record_ += text;
+    sheet_.SetCell(pos, std::move(text));
+    Append();
+}
+
+
+void SheetJournal::ClearCell(Position pos) {
+    ThrowIfFailed();
+    record_.clear();
+    AppendOperation(record_, Operation::ClearCell, pos);
+    sheet_.ClearCell(pos);
+    Append();
+}
+
+
+void SheetJournal::Sync() {
+    std::unique_lock lock(mutex_);
+    if (!writer_.joinable()) {
+        WriteGroup(lock);
+    } else {
+        // ждём и группу, которая уже пишется, и ещё не переданные операции
+        const uint64_t target = accepted_sequence_;
+        is_sync_requested_ = true;
+        wake_writer_.notify_one();
+        group_written_.wait(lock, [this, target] {
+            return durable_sequence_ >= target || error_ != nullptr;
+        });
+    }
+    if (error_) {
+        std::rethrow_exception(error_);
+    }
+}
+
+
+void SheetJournal::Truncate() {
+    std::unique_lock lock(mutex_);
+    // пока mutex_ захвачен, новая запись не начнётся
+    group_written_.wait(lock, [this] {
+        return !is_writing_;
+    });
+    pending_.clear();
+    // отброшенные операции уже в снимке: ждать их записи не нужно
+    durable_sequence_ = accepted_sequence_;
+    file_->Truncate(sizeof(Header));
+    file_->Sync();
+    stats_.bytes = sizeof(Header);
+}
+
+
+JournalStats SheetJournal::GetStats() const {
+    std::lock_guard lock(mutex_);
+    return stats_;
+}
+
+
+void SheetJournal::Append() {
+    std::unique_lock lock(mutex_);
+    pending_ += record_;
+    ++accepted_sequence_;
+    ++stats_.operations;
+    if (!writer_.joinable()) {
+        WriteGroup(lock);
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+    } else if (pending_.size() >= options_.max_group_size) {
+        wake_writer_.notify_one();
+    }
+}
+
+
+void SheetJournal::WriteGroup(std::unique_lock<std::mutex>& lock) {
+    if (pending_.empty() || error_) {
+        return;
+    }
+    // заголовок группы - перед записями, в том же буфере: группа пишется одним вызовом
+    group_.assign(sizeof(GroupHeader), '\0');
+    group_ += pending_;
+    GroupHeader group_header{static_cast<uint32_t>(pending_.size()), Crc32(pending_)};
+    std::memcpy(group_.data(), &group_header, sizeof(group_header));
+    const uint64_t group_sequence = accepted_sequence_;
+    pending_.clear();
+
+    is_writing_ = true;
+    lock.unlock();
+    std::exception_ptr error;
+    try {
+        file_->Append(group_);
+        file_->Sync();
+    } catch (...) {
+        error = std::current_exception();
+    }
+    lock.lock();
+    is_writing_ = false;
+    if (error) {
+        error_ = error;
+    } else {
+        durable_sequence_ = group_sequence;
+        ++stats_.groups;
+        stats_.bytes += group_.size();
+    }
+    group_written_.notify_all();
+}
+
+
+void SheetJournal::RunWriter() {
+    std::unique_lock lock(mutex_);
+    while (!is_stopped_) {
+        wake_writer_.wait_for(lock, options_.sync_interval, [this] {
+            return is_stopped_ || is_sync_requested_ || pending_.size() >= options_.max_group_size;
+        });
+        is_sync_requested_ = false;
+        WriteGroup(lock);
+    }
+    // при остановке записываются оставшиеся операции
+    WriteGroup(lock);
+}
+
+
+void SheetJournal::ThrowIfFailed() const {
+    std::lock_guard lock(mutex_);
+    if (error_) {
+        std::rethrow_exception(error_);
+    }
+}
+
+
+ReplayStats ReplayJournal(Sheet& sheet, std::string_view data) {
+    ReplayStats stats;
+    std::vector<CellEdit> edits;
+    auto apply_edits = [&sheet, &edits] {
+        if (!edits.empty()) {
+            sheet.SetCells(std::move(edits));
+            edits.clear();
+        }
+    };
+
+    stats.valid_size = ForEachGroup(data, [&](std::string_view records) {
+        ++stats.groups;
+        RecordsReader reader(records);
+        while (!reader.IsEnd()) {
+            Position pos;
+            if (reader.ReadOperation(pos) == Operation::SetCell) {
+                edits.push_back({pos, std::string(reader.ReadText())});
+            } else {
+                // очистка разрывает пакет: изменения до неё применяются раньше неё
+                apply_edits();
+                sheet.ClearCell(pos);
+            }
+            ++stats.operations;
+        }
+    });
+    apply_edits();
+    stats.is_tail_dropped = stats.valid_size < data.size();
+    return stats;
+}
+
+
+ReplayStats ReplayJournalFile(Sheet& sheet, const std::string& path) {
+    std::ifstream input(path, std::ios::binary);
+    if (!input) {
+        return {};
+    }
+    const std::string data((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    return ReplayJournal(sheet, data);
+}
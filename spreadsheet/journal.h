@@ -0,0 +1,134 @@
+#pragma once
+
+#include "common.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+
+class Sheet;
+
+/*
+Журнал операций таблицы (write-ahead log). Изменения, сделанные после
+последнего снимка (см. snapshot.h), переживают падение процесса или машины:
+при запуске загружается снимок, затем воспроизводится журнал.
+
+Формат (версия JOURNAL_VERSION, числа в порядке байтов машины, которая
+записала журнал):
+  заголовок: сигнатура, версия, метка порядка байтов;
+  группы: размер содержимого, его CRC-32, затем записи операций подряд:
+    SetCell   - тип (1 байт), строка и столбец (по 2 байта), длина текста (varint), текст;
+    ClearCell - тип, строка и столбец.
+
+Group commit: операция дописывается в буфер в памяти, а фоновый поток раз
+в sync_interval записывает все накопившиеся операции одной группой и
+сбрасывает их на диск (fsync). Один fsync делится на все операции группы;
+при сбое теряются только операции последнего интервала. Группа, оборванная
+сбоем на середине, не проходит проверку CRC и отбрасывается целиком.
+*/
+
+inline constexpr uint32_t JOURNAL_VERSION = 1;
+
+// Исключение, выбрасываемое при ошибке записи журнала или при чтении файла,
+// который не является журналом
+class JournalException : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+struct JournalOptions {
+    // Как часто накопленные операции записываются на диск. При нуле каждая
+    // операция записывается и сбрасывается на диск сразу, без фонового потока
+    std::chrono::milliseconds sync_interval{10};
+    // При таком размере буфера запись начинается, не дожидаясь интервала
+    size_t max_group_size = 1 << 20;
+};
+
+struct JournalStats {
+    size_t operations = 0;  // операций, принятых журналом (в том числе ещё в буфере)
+    size_t groups = 0;      // записанных групп - столько раз вызывался fsync
+    size_t bytes = 0;       // размер файла журнала
+};
+
+// Журнал, через который изменяется таблица
+class SheetJournal {
+public:
+    // Открывает журнал path для дописывания, создаёт его, если файла нет.
+    // Оборванная при сбое последняя группа отрезается. Бросает JournalException
+    SheetJournal(Sheet& sheet, const std::string& path, JournalOptions options = {});
+    SheetJournal(const SheetJournal&) = delete;
+    SheetJournal& operator=(const SheetJournal&) = delete;
+    // Записывает на диск оставшиеся в буфере операции
+    ~SheetJournal();
+
+    // Изменяют таблицу так же, как Sheet::SetCell и Sheet::ClearCell. В журнал
+    // попадают только применённые операции: если таблица бросила исключение,
+    // журнал не меняется. Ошибка фоновой записи бросается отсюда как JournalException
+    void SetCell(Position pos, std::string text);
+    void ClearCell(Position pos);
+
+    // Записывает накопленные операции и дожидается fsync
+    void Sync();
+
+    // Начинает журнал заново, в том числе отбрасывает буфер. Вызывается после
+    // сохранения снимка таблицы: все операции журнала уже в снимке
+    void Truncate();
+
+    JournalStats GetStats() const;
+
+private:
+    class File;
+
+    Sheet& sheet_;
+    const JournalOptions options_;
+    std::unique_ptr<File> file_;
+    // запись текущей операции: собирается до изменения таблицы, в буфер
+    // попадает после
+    std::string record_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable wake_writer_;
+    std::condition_variable group_written_;
+    std::string pending_;  // операции, ещё не переданные на запись
+    std::string group_;    // группа, которая сейчас пишется
+    // номер последней принятой операции и последней сброшенной на диск
+    // (операции нумеруются по порядку, номера только растут)
+    uint64_t accepted_sequence_ = 0;
+    uint64_t durable_sequence_ = 0;
+    bool is_writing_ = false;
+    bool is_sync_requested_ = false;
+    bool is_stopped_ = false;
+    std::exception_ptr error_;
+    JournalStats stats_;
+    std::thread writer_;
+
+    // Добавляет record_ в буфер. Без фонового потока сразу пишет группу
+    void Append();
+    // Записывает буфер одной группой; на время записи mutex_ отпускается
+    void WriteGroup(std::unique_lock<std::mutex>& lock);
+    void RunWriter();
+    void ThrowIfFailed() const;
+};
+
+struct ReplayStats {
+    size_t operations = 0;
+    size_t groups = 0;
+    size_t valid_size = 0;          // байт журнала до оборванной группы
+    bool is_tail_dropped = false;   // в конце журнала была оборванная группа
+};
+
+// Применяет к таблице операции журнала, лежащего в памяти. Таблица должна быть
+// в том состоянии, с которого журнал начинался (пустая или загруженная из снимка).
+// Идущие подряд SetCell применяются пакетами через Sheet::SetCells.
+// Бросает JournalException, если данные - не журнал или он повреждён не в конце
+ReplayStats ReplayJournal(Sheet& sheet, std::string_view data);
+
+// То же для файла журнала. Файла может не быть - тогда воспроизводить нечего
+ReplayStats ReplayJournalFile(Sheet& sheet, const std::string& path);
@@ -0,0 +1,63 @@
+#include "lookup_index.h"
+
+#include <algorithm>
+#include <cassert>
+
+
+void LookupIndex::AddColumn(int col) {
+    assert(!is_suspended_);
+    columns_.try_emplace(col);
+}
+
+
+void LookupIndex::Update(Position pos, std::optional<double> key) {
+    if (!IsIndexed(pos.col)) {
+        return;
+    }
+    Column& column = columns_.at(pos.col);
+
+    auto old_key = column.keys.find(pos.row);
+    if (old_key != column.keys.end()) {
+        if (key.has_value() && *key == old_key->second) {
+            return;
+        }
+        auto rows = column.rows.find(old_key->second);
+        assert(rows != column.rows.end());
+        rows->second.erase(std::lower_bound(rows->second.begin(), rows->second.end(), pos.row));
+        if (rows->second.empty()) {
+            column.rows.erase(rows);
+        }
+        column.keys.erase(old_key);
+    }
+
+    if (key.has_value()) {
+        column.keys.emplace(pos.row, *key);
+        std::vector<int>& rows = column.rows[*key];
+        rows.insert(std::lower_bound(rows.begin(), rows.end(), pos.row), pos.row);
+    }
+}
+
+
+std::optional<int> LookupIndex::Find(int col, int from_row, int to_row, double key) const {
+    const Column& column = columns_.at(col);
+    auto rows = column.rows.find(key);
+    if (rows == column.rows.end()) {
+        return std::nullopt;
+    }
+    auto row = std::lower_bound(rows->second.begin(), rows->second.end(), from_row);
+    if (row == rows->second.end() || *row > to_row) {
+        return std::nullopt;
+    }
+    return *row;
+}
+
+
+void LookupIndex::Suspend() {
+    is_suspended_ = true;
+}
+
+
+void LookupIndex::Resume() {
+    is_suspended_ = false;
+    columns_.clear();
+}
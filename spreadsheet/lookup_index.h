@@ -0,0 +1,49 @@
+#pragma once
+
+#include "common.h"
+
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+/*
+Индексы поиска по столбцам для функций MATCH, VLOOKUP и XLOOKUP.
+Индекс столбца строится при первом поиске в нём: для каждого числа
+(см. CellInterface::GetRangeValue) хранятся упорядоченные строки, где оно
+встречается. Изменение ячейки индексируемого столбца меняет только её
+записи, поэтому поиск в столбце стоит в среднем O(1), а не O(строк).
+*/
+class LookupIndex {
+public:
+    bool IsIndexed(int col) const {
+        return !is_suspended_ && columns_.count(col) > 0;
+    }
+
+    bool IsSuspended() const {
+        return is_suspended_;
+    }
+
+    // Начинает индексировать столбец. Числа его ячеек записываются через Update
+    void AddColumn(int col);
+
+    // Записывает число ячейки pos (nullopt - в ячейке нет числа).
+    // Для неиндексируемого столбца ничего не делает
+    void Update(Position pos, std::optional<double> key);
+
+    // Первая строка из [from_row, to_row] столбца col с числом key
+    std::optional<int> Find(int col, int from_row, int to_row, double key) const;
+
+    // На время параллельного пересчёта индексы не обновляются (это не потокобезопасно).
+    // Resume сбрасывает все индексы - они будут построены заново при поиске
+    void Suspend();
+    void Resume();
+
+private:
+    struct Column {
+        std::unordered_map<double, std::vector<int>> rows;  // число -> строки по возрастанию
+        std::unordered_map<int, double> keys;               // строка -> число
+    };
+
+    std::unordered_map<int, Column> columns_;
+    bool is_suspended_ = false;
+};
@@ -1,7 +1,19 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
 #include <limits>
+#include <map>
+#include <set>
 
 #include "common.h"
 #include "formula.h"
+#include "importer.h"
+#include "journal.h"
+#include "sheet.h"
+#include "snapshot.h"
+#include "table_writer.h"
 #include "test_runner_p.h"
 
 inline std::ostream& operator<<(std::ostream& output, Position pos) {
@@ -434,6 +446,1813 @@ void TestSetGetCellFormulaValid() {
 }
 
 
+void TestSparseFarCornerCell() {
+    auto sheet = CreateSheet();
+    sheet->SetCell("XFD16384"_pos, "far");
+    sheet->SetCell("A1"_pos, "=XFD16384");
+    ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{Position::MAX_ROWS, Position::MAX_COLS}));
+    ASSERT(sheet->GetCell("M500"_pos) == nullptr);
+    ASSERT_EQUAL(sheet->GetCell("XFD16384"_pos)->GetText(), "far");
+
+    sheet->SetCell("A1"_pos, "1");
+    sheet->ClearCell("XFD16384"_pos);
+    ASSERT(sheet->GetCell("XFD16384"_pos) == nullptr);
+    ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{1, 1}));
+
+    // ссылка новой ячейки на саму себя не должна оставлять ячейку в таблице
+    bool caught = false;
+    try {
+        sheet->SetCell("B2"_pos, "=B2");
+    } catch (const CircularDependencyException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+    ASSERT(sheet->GetCell("B2"_pos) == nullptr);
+}
+
+void TestFormulaBytecodeMatchesTree() {
+    auto sheet = CreateSheet();
+    sheet->SetCell("A1"_pos, "2");
+    sheet->SetCell("A2"_pos, "=A1*3");
+    sheet->SetCell("A3"_pos, "text");
+    sheet->SetCell("A4"_pos, "=1/0");
+
+    auto evaluate_both = [&](const std::string& expr) {
+        FormulaAST ast = ParseFormulaAST(expr);
+        Bytecode::FormulaResult tree = ast.ExecuteByTree(*sheet);
+        Bytecode::FormulaResult bytecode = ast.Execute(*sheet);
+        ASSERT_EQUAL(tree.HasError(), bytecode.HasError());
+        if (tree.HasError()) {
+            ASSERT_EQUAL(tree.GetError(), bytecode.GetError());
+        } else {
+            ASSERT_EQUAL(tree.GetValue(), bytecode.GetValue());
+        }
+    };
+
+    evaluate_both("1+2*3-4/5");
+    evaluate_both("-(A1+A2)*+A1/(A2-1)");
+    evaluate_both("((((A1+1)*2-3)/4+5)*6-7)/8");
+    evaluate_both("A1+A3");
+    evaluate_both("A4*A3");
+    evaluate_both("A1/(A1-2)");
+    evaluate_both("1e200*1e200");
+    evaluate_both("SUM(A1:A4)");
+    evaluate_both("SUM(A1:A3,A1*2,B1:C9)");
+    evaluate_both("AVERAGE(A1:A3)+MIN(A1:A2)*MAX(A1,A2,-1)");
+    evaluate_both("COUNT(A1:B9,A3,1)");
+    evaluate_both("AVERAGE(B1:B9)");
+    evaluate_both("MAX(1e308,1e308)+SUM(1e308,1e308)");
+    evaluate_both("MATCH(6,A1:A4)+VLOOKUP(2,A1:B4,1)*XLOOKUP(A2,A1:A4,B1:B4)");
+    evaluate_both("MATCH(7,A1:A4)");
+    evaluate_both("VLOOKUP(2,A1:B4,A1+1)");
+    evaluate_both("IF(A1>1,A2,A4)+IF(A1<1,A4,A1)");
+    evaluate_both("IF(A1=2,1)+IF(A1<>2,1)*(A2>=6)-(A2<=5)");
+    evaluate_both("AND(A1,A4)");
+    evaluate_both("AND(0,A4)+OR(A1,A4)+AND(A1,A2,-1)+OR(0,A1-2)");
+    evaluate_both("OR(A1-2,A3)");
+    evaluate_both("IF(A4,1,2)");
+    evaluate_both("IF(AND(A1<A2,SUM(A1:A2)>7),MATCH(6,A1:A4),SUM(A1:A4))");
+}
+
+void TestFastParserMatchesAntlr() {
+    auto parse = [](FormulaAST (*parser)(std::string_view), std::string_view expr) {
+        try {
+            FormulaAST ast = parser(expr);
+            std::ostringstream out;
+            ast.Print(out);
+            out << " | ";
+            ast.PrintCells(out);
+            return out.str();
+        } catch (const std::exception&) {
+            return "#ERROR"s;
+        }
+    };
+
+    const std::vector<std::string_view> expressions = {
+        "1", "  42  ", "1.5", ".5", "1e3", "1E+3", "2.5e-3", "1e999", "1.", ".", "1e", "1E",
+        "A1", "ZZ99", "A0", "XFD16384", "XFD16385", "A1B2", "a1", "2A1",
+        "1+2*3", "1-2-3", "8/4/2", "-1*2", "--1", "+-+A1", "2*-3", "-(A1+B2)/C3",
+        "((1))", "(1", "1)", "()", "", " ", "1+", "*1", "1 2", "A1 + A2 + A1",
+        "1\t+\r\n2", "1 # 2", "(12+13) * (14+(13-24/(1+1))*55-46)",
+        "SUM(A1:B2)", "SUM(A1:B2,C3,1+2)", "MIN( A1 : A3 , -1 )", "SUM(B2:A1)", "SUM(A1:A1)",
+        "SUM()", "SUM(A1:)", "SUM(:A1)", "SUM(A1:1)", "SUM(A1,)", "SUM(1", "SUM", "A1:B2", "sum(1)",
+        "FOO(1)", "SUM(1)+COUNT(A1:A2)*AVERAGE(A1)", "MAX(MIN(A1:B2),2)", "-SUM(1)",
+        "MATCH(1,A1:A3)", "VLOOKUP(A1+1,A1:B3,2)", "XLOOKUP(1,A1:A3,B1:B3)", "MATCH(A1:A3,1)", "VLOOKUP(1,A1:B3)",
+        "1<2", "A1<=B2", "1>2>=3", "1=2", "1<>2", "1+2<3*4", "-1<2", "1<(2=3)", "1<<2", "1=>2", "1=", "<1",
+        "1 < = 2", "1< >2", "IF(A1>0,B1,C1)", "IF(1,2)", "AND(1,0,A1)", "OR(A1<2)", "IF(A1:A2,1)", "IF(1)",
+        "IF(1,2,3,4)", "AND()", "OR(IF(1,2),AND(3))",
+    };
+
+    for (std::string_view expr : expressions) {
+        ASSERT_EQUAL(parse(ParseFormulaASTFast, expr), parse(ParseFormulaASTAntlr, expr));
+    }
+}
+
+void TestErrorPropagatesThroughDependents() {
+    auto sheet = CreateSheet();
+    sheet->SetCell("A1"_pos, "text");
+    sheet->SetCell("B1"_pos, "=A1+1");
+    sheet->SetCell("C1"_pos, "=B1*2+D1");
+    sheet->SetCell("D1"_pos, "=1/0");
+    ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(FormulaError::Category::Value));
+
+    sheet->SetCell("A1"_pos, "1");
+    ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(FormulaError::Category::Arithmetic));
+
+    // число вне диапазона double в тексте - тоже #VALUE!
+    sheet->SetCell("D1"_pos, "1e999");
+    ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(FormulaError::Category::Value));
+
+    sheet->SetCell("D1"_pos, " 3");
+    ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(7.0));
+}
+
+void TestFormulaBoundCells() {
+    auto sheet = CreateSheet();
+    auto other_sheet = CreateSheet();
+    sheet->SetCell("A1"_pos, "1");
+    other_sheet->SetCell("A1"_pos, "5");
+
+    auto formula = ParseFormula("A1+B2*A1");
+    ASSERT_EQUAL(formula->GetReferencedCells(), (std::vector{"A1"_pos, "B2"_pos}));
+
+    // привязанная формула читает ячейки напрямую, а не через таблицу
+    formula->BindReferencedCells({other_sheet->GetCell("A1"_pos), nullptr});
+    ASSERT_EQUAL(std::get<double>(formula->Evaluate(*sheet)), 5);
+
+    formula->BindReferencedCells({});
+    ASSERT_EQUAL(std::get<double>(formula->Evaluate(*sheet)), 1);
+
+    // привязка в таблице обновляется при изменении связей ячейки
+    sheet->SetCell("C1"_pos, "=A1+B2");
+    sheet->SetCell("B2"_pos, "2");
+    ASSERT_EQUAL(std::get<double>(sheet->GetCell("C1"_pos)->GetValue()), 3);
+    sheet->SetCell("C1"_pos, "=D4*10");
+    sheet->SetCell("D4"_pos, "7");
+    ASSERT_EQUAL(std::get<double>(sheet->GetCell("C1"_pos)->GetValue()), 70);
+    sheet->ClearCell("D4"_pos);
+    ASSERT_EQUAL(std::get<double>(sheet->GetCell("C1"_pos)->GetValue()), 0);
+}
+
+void TestTextCellNumericValue() {
+    auto sheet = CreateSheet();
+    auto numeric = [&](std::string text) {
+        sheet->SetCell("A1"_pos, std::move(text));
+        return sheet->GetCell("A1"_pos)->GetNumericValue();
+    };
+
+    ASSERT(numeric("12.5") == CellInterface::NumericValue(12.5));
+    ASSERT(numeric(" 3") == CellInterface::NumericValue(3.0));
+    ASSERT(numeric("'7") == CellInterface::NumericValue(7.0));
+    ASSERT(numeric("'") == CellInterface::NumericValue(0.0));
+    ASSERT(numeric("3 ") == CellInterface::NumericValue(FormulaError::Category::Value));
+    ASSERT(numeric("meow") == CellInterface::NumericValue(FormulaError::Category::Value));
+    ASSERT(numeric("=2*3") == CellInterface::NumericValue(6.0));
+
+    sheet->SetCell("B1"_pos, "=A1*2");
+    sheet->SetCell("A1"_pos, "'21");
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), CellInterface::Value(42.0));
+}
+
+void TestEagerRecalculation() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "1");
+    sheet.SetCell("B1"_pos, "=A1+1");
+    sheet.SetCell("C1"_pos, "=B1*2");
+    sheet.SetCell("D1"_pos, "=A1+C1");
+    sheet.SetCell("E1"_pos, "=5");
+
+    sheet.SetRecalculationMode(RecalculationMode::Eager);
+    ASSERT_EQUAL(sheet.GetLastRecalculationStats().recomputed_cells, 4u);
+    ASSERT(sheet.GetConcreteCell("D1"_pos)->HasCache());
+
+    // пересчитываются только зависящие от A1 формулы
+    sheet.SetCell("A1"_pos, "10");
+    ASSERT_EQUAL(sheet.GetLastRecalculationStats().recomputed_cells, 3u);
+    ASSERT(sheet.GetConcreteCell("B1"_pos)->HasCache());
+    ASSERT(sheet.GetConcreteCell("C1"_pos)->HasCache());
+    ASSERT(sheet.GetConcreteCell("D1"_pos)->HasCache());
+    ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(32.0));
+
+    sheet.SetCell("C1"_pos, "=B1*3");
+    ASSERT_EQUAL(sheet.GetLastRecalculationStats().recomputed_cells, 2u);
+    ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(43.0));
+
+    sheet.ClearCell("A1"_pos);
+    ASSERT_EQUAL(sheet.GetLastRecalculationStats().recomputed_cells, 3u);
+    ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(3.0));
+}
+
+void TestParallelRecalculation() {
+    // независимые цепочки по строкам и общие ячейки, от которых зависят все строки
+    auto fill = [](Sheet& sheet) {
+        sheet.SetCell("A1"_pos, "2");
+        sheet.SetCell("B1"_pos, "=A1*3");
+        for (int row = 1; row < 200; ++row) {
+            sheet.SetCell(Position{row, 0}, std::to_string(row));
+            for (int col = 1; col < 6; ++col) {
+                sheet.SetCell(Position{row, col}, "=" + Position{row, col - 1}.ToString() + "+B1/" + std::to_string(col));
+            }
+        }
+        sheet.SetCell(Position{0, 6}, "=F2+F200-B1");
+    };
+
+    Sheet lazy_sheet;
+    fill(lazy_sheet);
+    Sheet parallel_sheet;
+    fill(parallel_sheet);
+
+    ASSERT_EQUAL(parallel_sheet.RecalculateAll(4), 1u + 199u * 5u + 1u);
+    ASSERT_EQUAL(parallel_sheet.GetLastRecalculationStats().recomputed_cells, 1u + 199u * 5u + 1u);
+    for (int row = 0; row < 200; ++row) {
+        for (int col = 0; col < 7; ++col) {
+            const Cell* cell = parallel_sheet.GetConcreteCell(Position{row, col});
+            if (cell == nullptr) {
+                continue;
+            }
+            ASSERT(!cell->IsFormulaInCell() || cell->HasCache());
+            ASSERT_EQUAL(cell->GetValue(), lazy_sheet.GetCell(Position{row, col})->GetValue());
+        }
+    }
+
+    // 0 потоков - по числу ядер
+    parallel_sheet.SetCell("A1"_pos, "text");
+    ASSERT_EQUAL(parallel_sheet.RecalculateAll(0), 1u + 199u * 5u + 1u);
+    ASSERT_EQUAL(parallel_sheet.GetCell("G1"_pos)->GetValue(), CellInterface::Value(FormulaError(FormulaError::Category::Value)));
+}
+
+void TestParallelRecalculationRanges() {
+    // суммы дробных чисел чувствительны к порядку сложения, NaN - к тому,
+    // как его сворачивают минимум и максимум
+    auto fill = [](Sheet& sheet) {
+        for (int row = 0; row < 1000; ++row) {
+            std::ostringstream value;
+            value << std::setprecision(17) << (row % 3 == 0 ? (row + 1) * 1.1e16 : (row + 1) / 7.0);
+            sheet.SetCell(Position{row, 0}, value.str());
+            sheet.SetCell(Position{row, 1}, "=A" + std::to_string(row + 1) + "/3");
+        }
+        sheet.SetCell("C1"_pos, "nan");
+        sheet.SetCell("C2"_pos, "1");
+        sheet.SetCell("C3"_pos, "3");
+        sheet.SetCell("C5"_pos, "nan");
+        const std::vector<std::string> formulas = {
+            "=SUM(A1:A1000)", "=AVERAGE(A1:B1000)", "=SUM(A17:B999)", "=MIN(B1:B1000)", "=MAX(A1:B1500)",
+            "=SUM(A1:A1000)+0", "=MIN(C1:C3)", "=MAX(C1:C3)", "=MIN(C2:C5)", "=MAX(C2:C5)", "=MIN(C2:C3)",
+        };
+        for (size_t i = 0; i < formulas.size(); ++i) {
+            sheet.SetCell(Position{static_cast<int>(i), 3}, formulas[i]);
+        }
+        return formulas.size();
+    };
+
+    Sheet lazy_sheet;
+    const size_t formulas_count = fill(lazy_sheet);
+    Sheet serial_sheet;
+    fill(serial_sheet);
+    serial_sheet.RecalculateAll(1);
+    Sheet parallel_sheet;
+    fill(parallel_sheet);
+    parallel_sheet.RecalculateAll(4);
+
+    for (int row = 0; row < static_cast<int>(formulas_count); ++row) {
+        const Position pos{row, 3};
+        const CellInterface::Value value = lazy_sheet.GetCell(pos)->GetValue();
+        ASSERT_EQUAL(serial_sheet.GetCell(pos)->GetValue(), value);
+        ASSERT_EQUAL(parallel_sheet.GetCell(pos)->GetValue(), value);
+    }
+    // NaN где угодно в области - ошибка и у минимума, и у максимума
+    for (const std::string cell : {"D7", "D8", "D9", "D10"}) {
+        ASSERT_EQUAL(parallel_sheet.GetCell(Position::FromString(cell))->GetValue(),
+                     CellInterface::Value(FormulaError(FormulaError::Category::Arithmetic)));
+    }
+    ASSERT_EQUAL(parallel_sheet.GetCell("D11"_pos)->GetValue(), CellInterface::Value(1.0));
+
+    // после параллельного пересчёта деревья снова работают: изменение видно
+    parallel_sheet.SetCell("C1"_pos, "-5");
+    ASSERT_EQUAL(parallel_sheet.GetCell("D7"_pos)->GetValue(), CellInterface::Value(-5.0));
+}
+
+void TestSetCellsBatch() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "1");
+    sheet.SetCell("B1"_pos, "=A1+1");
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(), CellInterface::Value(2.0));
+
+    // ссылки вперёд внутри пакета и повтор позиции: действует последнее изменение
+    sheet.SetCells({
+        {"C1"_pos, "=D1*2"},
+        {"D1"_pos, "=B1+A2"},
+        {"A2"_pos, "5"},
+        {"A1"_pos, "7"},
+        {"A1"_pos, "10"},
+    });
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(), CellInterface::Value(11.0));
+    ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(32.0));
+    ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetText(), "10"s);
+    ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{2, 4}));
+
+    auto texts = [&sheet] {
+        std::ostringstream out;
+        sheet.PrintTexts(out);
+        return out.str();
+    };
+    const std::string texts_before = texts();
+
+    // цикл через несколько ячеек пакета - таблица не меняется
+    try {
+        sheet.SetCells({
+            {"E1"_pos, "=F1"},
+            {"A1"_pos, "=C1"},
+            {"F1"_pos, "3"},
+        });
+        ASSERT(false);
+    } catch (const CircularDependencyException&) {
+    }
+    ASSERT_EQUAL(texts(), texts_before);
+    ASSERT(sheet.GetCell("E1"_pos) == nullptr);
+
+    // ошибка разбора в конце пакета - таблица не меняется
+    try {
+        sheet.SetCells({
+            {"E1"_pos, "=A1"},
+            {"F1"_pos, "=A1+"},
+        });
+        ASSERT(false);
+    } catch (const FormulaException&) {
+    }
+    ASSERT_EQUAL(texts(), texts_before);
+
+    try {
+        sheet.SetCells({{"E1"_pos, "1"}, {Position{-1, 0}, "2"}});
+        ASSERT(false);
+    } catch (const InvalidPositionException&) {
+    }
+    ASSERT_EQUAL(texts(), texts_before);
+
+    // разрыв цикла в том же пакете допустим; пустая ячейка без ссылок удаляется
+    sheet.SetCells({
+        {"A2"_pos, "=C1"},
+        {"D1"_pos, "=A1"},
+    });
+    ASSERT_EQUAL(sheet.GetCell("A2"_pos)->GetValue(), CellInterface::Value(20.0));
+    sheet.SetCells({{"A2"_pos, "=E2"}});
+    sheet.SetCells({{"A2"_pos, "1"}});
+    ASSERT(sheet.GetCell("E2"_pos) == nullptr);
+
+    sheet.SetRecalculationMode(RecalculationMode::Eager);
+    sheet.SetCells({{"A1"_pos, "1"}, {"B1"_pos, "=A1*3"}});
+    ASSERT_EQUAL(sheet.GetLastRecalculationStats().recomputed_cells, 3u);
+    ASSERT(sheet.GetConcreteCell("C1"_pos)->HasCache());
+    ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(2.0));
+}
+
+void TestTopologicalOrderMaintained() {
+    const int size = 6;
+    Sheet sheet;
+
+    // формула, если бы в ячейке pos была ссылка на refs, замкнула бы цикл
+    auto closes_cycle = [&sheet](Position pos, const std::vector<Position>& refs) {
+        std::vector<Position> to_visit = refs;
+        std::set<std::pair<int, int>> visited;
+        while (!to_visit.empty()) {
+            Position cur = to_visit.back();
+            to_visit.pop_back();
+            if (cur == pos) {
+                return true;
+            }
+            if (!visited.insert({cur.row, cur.col}).second) {
+                continue;
+            }
+            if (const CellInterface* cell = sheet.GetCell(cur)) {
+                for (Position next : cell->GetReferencedCells()) {
+                    to_visit.push_back(next);
+                }
+            }
+        }
+        return false;
+    };
+
+    auto check_order = [&sheet] {
+        for (int row = 0; row < size; ++row) {
+            for (int col = 0; col < size; ++col) {
+                const Cell* cell = sheet.GetConcreteCell(Position{row, col});
+                if (cell == nullptr) {
+                    continue;
+                }
+                for (const Cell* input : cell->GetCellsContainedInThis()) {
+                    ASSERT(input->GetOrderIndex() < cell->GetOrderIndex());
+                }
+            }
+        }
+    };
+
+    // детерминированный генератор, чтобы тест был воспроизводимым
+    uint32_t seed = 12345;
+    auto next_random = [&seed](int bound) {
+        seed = seed * 1103515245 + 12345;
+        return static_cast<int>((seed >> 16) % bound);
+    };
+
+    int cycles_count = 0;
+    for (int step = 0; step < 2000; ++step) {
+        Position pos{next_random(size), next_random(size)};
+        std::vector<Position> refs;
+        std::string text = "=1";
+        for (int i = next_random(3); i > 0; --i) {
+            refs.push_back(Position{next_random(size), next_random(size)});
+            text += "+" + refs.back().ToString();
+        }
+
+        const bool expect_cycle = closes_cycle(pos, refs);
+        try {
+            sheet.SetCell(pos, text);
+            ASSERT(!expect_cycle);
+        } catch (const CircularDependencyException&) {
+            ASSERT(expect_cycle);
+            ++cycles_count;
+        }
+        check_order();
+    }
+    ASSERT(cycles_count > 0);
+}
+
+void TestCellLinks() {
+    Sheet sheet;
+    std::vector<std::unique_ptr<Cell>> cells;
+    for (int i = 0; i < 100; ++i) {
+        cells.push_back(std::make_unique<Cell>(sheet, Position{i, 0}));
+    }
+
+    auto contents = [](const CellLinks& links) {
+        std::set<const Cell*> result(links.begin(), links.end());
+        ASSERT_EQUAL(result.size(), links.size());
+        return result;
+    };
+
+    CellLinks links;
+    std::set<const Cell*> expected;
+    ASSERT(links.empty());
+
+    // внутри объекта, затем в векторе, затем с хеш-индексом
+    for (size_t count : {CellLinks::INLINE_CAPACITY, CellLinks::INLINE_CAPACITY + 1, CellLinks::INDEX_THRESHOLD + 10}) {
+        for (size_t i = 0; i < count; ++i) {
+            ASSERT_EQUAL(links.Insert(cells[i].get()), expected.insert(cells[i].get()).second);
+        }
+        ASSERT(contents(links) == expected);
+
+        for (size_t i = 0; i < count; i += 2) {
+            ASSERT(links.Erase(cells[i].get()));
+            ASSERT(!links.Erase(cells[i].get()));
+            expected.erase(cells[i].get());
+        }
+        ASSERT(contents(links) == expected);
+        ASSERT(!links.Contains(cells[0].get()));
+        ASSERT(links.Contains(cells[1].get()));
+    }
+
+    links.Clear();
+    ASSERT(links.empty());
+    ASSERT(links.Insert(cells[5].get()));
+    ASSERT_EQUAL(links.size(), 1u);
+}
+
+void TestLazyInvalidationByRevision() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "1");
+    sheet.SetCell("B1"_pos, "=A1+1");
+    sheet.SetCell("C1"_pos, "=B1*2");
+    sheet.SetCell("A2"_pos, "5");
+    sheet.SetCell("B2"_pos, "=A2*2");
+    ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(4.0));
+    ASSERT_EQUAL(sheet.GetCell("B2"_pos)->GetValue(), CellInterface::Value(10.0));
+
+    // изменение не обходит зависимые ячейки: их кеш проверяется при чтении
+    sheet.SetCell("A1"_pos, "10");
+    ASSERT(!sheet.GetConcreteCell("C1"_pos)->HasCache());
+    ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(22.0));
+    ASSERT(sheet.GetConcreteCell("B1"_pos)->HasCache());
+    ASSERT_EQUAL(sheet.GetCell("B2"_pos)->GetValue(), CellInterface::Value(10.0));
+
+    sheet.SetCell("B1"_pos, "=A1-1");
+    sheet.SetCell("A2"_pos, "text");
+    ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(18.0));
+    ASSERT_EQUAL(sheet.GetCell("B2"_pos)->GetValue(), CellInterface::Value(FormulaError(FormulaError::Category::Value)));
+
+    sheet.ClearCell("A1"_pos);
+    ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(-2.0));
+
+    // длинная цепочка проверяется и вычисляется без рекурсии
+    const int chain_length = 100'000;
+    auto chain_position = [](int index) {
+        return Position{index % Position::MAX_ROWS, 10 + index / Position::MAX_ROWS};
+    };
+    sheet.SetCell(chain_position(0), "1");
+    for (int i = 1; i < chain_length; ++i) {
+        sheet.SetCell(chain_position(i), "=" + chain_position(i - 1).ToString() + "+1");
+    }
+    ASSERT_EQUAL(sheet.GetCell(chain_position(chain_length - 1))->GetValue(), CellInterface::Value(double(chain_length)));
+    sheet.SetCell(chain_position(0), "2");
+    ASSERT_EQUAL(sheet.GetCell(chain_position(chain_length - 1))->GetValue(), CellInterface::Value(double(chain_length + 1)));
+}
+
+void TestEarlyCutoff() {
+    auto fill = [](Sheet& sheet) {
+        sheet.SetCell("A1"_pos, "1");
+        sheet.SetCell("B1"_pos, "=A1*0");
+        sheet.SetCell("C1"_pos, "=B1+1");
+        sheet.SetCell("D1"_pos, "=A1+1");
+    };
+
+    {
+        Sheet sheet;
+        fill(sheet);
+        sheet.SetRecalculationMode(RecalculationMode::Eager);
+
+        // B1 вычисляется, но его значение не меняется - C1 не вычисляется
+        sheet.SetCell("A1"_pos, "2");
+        ASSERT_EQUAL(sheet.GetLastRecalculationStats().recomputed_cells, 2u);
+        ASSERT_EQUAL(sheet.GetLastRecalculationStats().skipped_cells, 1u);
+        ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(3.0));
+
+        // тот же номер в другой записи - ничего не вычисляется,
+        // до C1 пересчёт даже не доходит
+        sheet.SetCell("A1"_pos, "2.0");
+        ASSERT_EQUAL(sheet.GetLastRecalculationStats().recomputed_cells, 0u);
+        ASSERT_EQUAL(sheet.GetLastRecalculationStats().skipped_cells, 2u);
+
+        // -0 печатается иначе, чем 0, поэтому считается изменением
+        sheet.SetCell("B1"_pos, "=-A1*0");
+        ASSERT_EQUAL(sheet.GetLastRecalculationStats().recomputed_cells, 2u);
+        ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(1.0));
+    }
+
+    {
+        Sheet sheet;
+        fill(sheet);
+        ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(1.0));
+
+        sheet.SetCell("A1"_pos, "1.0");
+        ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(1.0));
+        ASSERT_EQUAL(sheet.GetLastRecalculationStats().recomputed_cells, 0u);
+        ASSERT_EQUAL(sheet.GetLastRecalculationStats().skipped_cells, 2u);
+
+        sheet.SetCell("A1"_pos, "5");
+        ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(1.0));
+        ASSERT_EQUAL(sheet.GetLastRecalculationStats().recomputed_cells, 1u);
+        ASSERT_EQUAL(sheet.GetLastRecalculationStats().skipped_cells, 1u);
+        ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(6.0));
+
+        // другая формула с тем же значением
+        sheet.SetCells({{"B1"_pos, "=A1-A1"}});
+        ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(1.0));
+        ASSERT_EQUAL(sheet.GetLastRecalculationStats().recomputed_cells, 1u);
+        ASSERT_EQUAL(sheet.GetLastRecalculationStats().skipped_cells, 1u);
+
+        // формула заменена текстом с тем же значением
+        sheet.SetCell("B1"_pos, "0");
+        ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(1.0));
+        ASSERT_EQUAL(sheet.GetLastRecalculationStats().recomputed_cells, 0u);
+        ASSERT_EQUAL(sheet.GetLastRecalculationStats().skipped_cells, 1u);
+    }
+}
+
+void TestRangeFunctions() {
+    auto sheet = CreateSheet();
+    sheet->SetCell("A1"_pos, "1");
+    sheet->SetCell("A2"_pos, "2");
+    sheet->SetCell("A3"_pos, "text");
+    sheet->SetCell("B1"_pos, "'3");
+    sheet->SetCell("B2"_pos, "=A1+A2");
+
+    auto value = [&](std::string_view pos) {
+        return sheet->GetCell(Position::FromString(pos))->GetValue();
+    };
+
+    // пустые и нечисловые текстовые ячейки в областях не учитываются, текст-число - да
+    sheet->SetCell("C1"_pos, "=SUM(A1:B9)");
+    sheet->SetCell("C2"_pos, "=AVERAGE(A1:B9)");
+    sheet->SetCell("C3"_pos, "=MIN(A1:B9, 5)");
+    sheet->SetCell("C4"_pos, "=MAX(A1:A9)*2");
+    sheet->SetCell("C5"_pos, "=COUNT(A1:B9,A1)");
+    ASSERT_EQUAL(value("C1"), CellInterface::Value(9.0));
+    ASSERT_EQUAL(value("C2"), CellInterface::Value(2.25));
+    ASSERT_EQUAL(value("C3"), CellInterface::Value(1.0));
+    ASSERT_EQUAL(value("C4"), CellInterface::Value(4.0));
+    ASSERT_EQUAL(value("C5"), CellInterface::Value(5.0));
+    ASSERT_EQUAL(sheet->GetCell("C3"_pos)->GetText(), "=MIN(A1:B9,5)");
+
+    // область - одна связь: ячейки области не создаются и не попадают в ссылки
+    ASSERT(sheet->GetCell("B9"_pos) == nullptr);
+    ASSERT(sheet->GetCell("C1"_pos)->GetReferencedCells().empty());
+    ASSERT_EQUAL(sheet->GetCell("C5"_pos)->GetReferencedCells(), std::vector<Position>{"A1"_pos});
+    ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{5, 3}));
+
+    sheet->SetCell("B9"_pos, "10");
+    ASSERT_EQUAL(value("C1"), CellInterface::Value(19.0));
+    sheet->SetCell("A2"_pos, "-4");
+    ASSERT_EQUAL(value("C1"), CellInterface::Value(7.0));
+    ASSERT_EQUAL(value("C3"), CellInterface::Value(-4.0));
+    sheet->ClearCell("B9"_pos);
+    ASSERT_EQUAL(value("C1"), CellInterface::Value(-3.0));
+    ASSERT_EQUAL(value("C5"), CellInterface::Value(5.0));
+
+    // ошибки входов распространяются, среднее пустой области - ошибка
+    sheet->SetCell("D1"_pos, "=AVERAGE(E1:E5)");
+    ASSERT_EQUAL(value("D1"), CellInterface::Value(FormulaError(FormulaError::Category::Arithmetic)));
+    sheet->SetCell("E3"_pos, "=1/0");
+    ASSERT_EQUAL(value("C5"), CellInterface::Value(5.0));
+    sheet->SetCell("D2"_pos, "=COUNT(E1:E5)");
+    ASSERT_EQUAL(value("D2"), CellInterface::Value(FormulaError(FormulaError::Category::Arithmetic)));
+
+    // цикл через область
+    bool caught = false;
+    try {
+        sheet->SetCell("A4"_pos, "=C1");
+    } catch (const CircularDependencyException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+    ASSERT(sheet->GetCell("A4"_pos) == nullptr);
+    caught = false;
+    try {
+        dynamic_cast<Sheet&>(*sheet).SetCells({{"F1"_pos, "=SUM(F2:F3)"}, {"F3"_pos, "=F1"}});
+    } catch (const CircularDependencyException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+    ASSERT(sheet->GetCell("F1"_pos) == nullptr);
+
+    // вход области, созданный пустым по ссылке формулы: G3 создаётся, пока H1
+    // связана ещё не со всеми входами. Цикл G2 -> H1 -> G4 -> G2 идёт через область
+    sheet->SetCell("G4"_pos, "=SUM(G1:G3)");
+    sheet->SetCell("G2"_pos, "1");
+    sheet->SetCell("H1"_pos, "=G3+G4");
+    caught = false;
+    try {
+        sheet->SetCell("G2"_pos, "=H1");
+    } catch (const CircularDependencyException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+    sheet->SetCell("G1"_pos, "5");
+    ASSERT_EQUAL(value("H1"), CellInterface::Value(6.0));
+
+    // то же в режиме Eager
+    Sheet eager;
+    eager.SetRecalculationMode(RecalculationMode::Eager);
+    eager.SetCell("A1"_pos, "=SUM(B1:B3)");
+    eager.SetCell("A2"_pos, "=A1*2");
+    eager.SetCells({{"B1"_pos, "1"}, {"B2"_pos, "2"}});
+    ASSERT_EQUAL(eager.GetCell("A2"_pos)->GetValue(), CellInterface::Value(6.0));
+    eager.ClearCell("B1"_pos);
+    ASSERT_EQUAL(eager.GetLastRecalculationStats().recomputed_cells, 2u);
+    ASSERT_EQUAL(eager.GetCell("A2"_pos)->GetValue(), CellInterface::Value(4.0));
+    eager.SetCell("B2"_pos, "2.0");
+    ASSERT_EQUAL(eager.GetLastRecalculationStats().recomputed_cells, 0u);
+}
+
+void TestRangeDependentsIndex() {
+    Sheet sheet;
+    const int size = 40;
+    // формулы стоят правее областей, на которые ссылаются, - циклов нет
+    const int formulas_col = size + 8;
+
+    uint32_t seed = 54321;
+    auto next_random = [&seed](int bound) {
+        seed = seed * 1103515245 + 12345;
+        return static_cast<int>((seed >> 16) % bound);
+    };
+    auto random_range = [&] {
+        Position first{next_random(size), next_random(size)};
+        Position second{first.row + next_random(8), first.col + next_random(8)};
+        return Range::FromCorners(first, second);
+    };
+
+    for (int step = 0; step < 3000; ++step) {
+        Position pos{next_random(300), formulas_col};
+        if (next_random(4) == 0) {
+            sheet.ClearCell(pos);
+        } else {
+            std::string text = "=SUM(" + random_range().ToString();
+            for (int i = next_random(3); i > 0; --i) {
+                text += "," + random_range().ToString();
+            }
+            sheet.SetCell(pos, text + ")");
+        }
+
+        if (step % 100 != 0) {
+            continue;
+        }
+        // сверяем индекс с перебором всех формул
+        for (int row = 0; row < size + 8; ++row) {
+            for (int col = 0; col < size + 8; ++col) {
+                std::vector<Cell*> expected;
+                for (int formula_row = 0; formula_row < 300; ++formula_row) {
+                    Cell* formula = sheet.GetConcreteCell(Position{formula_row, formulas_col});
+                    if (formula == nullptr) {
+                        continue;
+                    }
+                    const std::vector<Range>& ranges = formula->GetReferencedRanges();
+                    if (std::any_of(ranges.begin(), ranges.end(), [row, col](Range range) {
+                            return range.Contains(Position{row, col});
+                        })) {
+                        expected.push_back(formula);
+                    }
+                }
+                std::sort(expected.begin(), expected.end());
+                ASSERT(sheet.GetRangeDependents(Position{row, col}) == expected);
+            }
+        }
+    }
+}
+
+void TestRangeAggregatesMatchCells() {
+    const int rows = 40;
+    const int cols = 4;
+    // в столбце E - формулы над областями столбцов A:D
+    const std::vector<std::pair<Range, std::string>> formulas = {
+        {Range::FromString("A1:A40"), "SUM"}, {Range::FromString("B5:D20"), "SUM"},
+        {Range::FromString("A1:D40"), "COUNT"}, {Range::FromString("C1:C7"), "MIN"},
+        {Range::FromString("A10:D12"), "MAX"}, {Range::FromString("B1:B40"), "AVERAGE"},
+    };
+
+    uint32_t seed = 777;
+    auto next_random = [&seed](int bound) {
+        seed = seed * 1103515245 + 12345;
+        return static_cast<int>((seed >> 16) % bound);
+    };
+
+    Sheet lazy;
+    Sheet eager;
+    eager.SetRecalculationMode(RecalculationMode::Eager);
+    std::map<std::pair<int, int>, int> numbers;  // числа в ячейках (и результаты формул)
+    for (size_t i = 0; i < formulas.size(); ++i) {
+        const std::string text = "=" + formulas[i].second + "(" + formulas[i].first.ToString() + ")";
+        lazy.SetCell(Position{static_cast<int>(i), cols}, text);
+        eager.SetCell(Position{static_cast<int>(i), cols}, text);
+    }
+
+    auto expected_value = [&](Range range, const std::string& function) -> CellInterface::Value {
+        double sum = 0;
+        double min = std::numeric_limits<double>::infinity();
+        double max = -min;
+        int count = 0;
+        for (const auto& [pos, number] : numbers) {
+            if (range.Contains(Position{pos.first, pos.second})) {
+                sum += number;
+                min = std::min<double>(min, number);
+                max = std::max<double>(max, number);
+                ++count;
+            }
+        }
+        if (function == "SUM") {
+            return sum;
+        } else if (function == "COUNT") {
+            return static_cast<double>(count);
+        } else if (function == "MIN") {
+            return count == 0 ? 0. : min;
+        } else if (function == "MAX") {
+            return count == 0 ? 0. : max;
+        }
+        if (count == 0) {
+            return FormulaError(FormulaError::Category::Arithmetic);
+        }
+        return sum / count;
+    };
+
+    for (int step = 0; step < 2000; ++step) {
+        Position pos{next_random(rows), next_random(cols)};
+        const int number = next_random(1000) - 500;
+        switch (next_random(5)) {
+            case 0:
+                lazy.ClearCell(pos);
+                eager.ClearCell(pos);
+                numbers.erase({pos.row, pos.col});
+                break;
+            case 1:
+                lazy.SetCell(pos, "text");
+                eager.SetCell(pos, "text");
+                numbers.erase({pos.row, pos.col});
+                break;
+            case 2:
+                lazy.SetCell(pos, "=" + std::to_string(number) + "+0");
+                eager.SetCell(pos, "=" + std::to_string(number) + "+0");
+                numbers[{pos.row, pos.col}] = number;
+                break;
+            default:
+                lazy.SetCell(pos, std::to_string(number));
+                eager.SetCell(pos, std::to_string(number));
+                numbers[{pos.row, pos.col}] = number;
+                break;
+        }
+        if (step % 500 == 499) {
+            lazy.RecalculateAll(4);
+        }
+
+        for (size_t i = 0; i < formulas.size(); ++i) {
+            const Position formula_pos{static_cast<int>(i), cols};
+            const CellInterface::Value expected = expected_value(formulas[i].first, formulas[i].second);
+            ASSERT_EQUAL(lazy.GetCell(formula_pos)->GetValue(), expected);
+            ASSERT_EQUAL(eager.GetCell(formula_pos)->GetValue(), expected);
+        }
+    }
+}
+
+void TestLookupFunctions() {
+    auto sheet = CreateSheet();
+    sheet->SetCell("A1"_pos, "10");
+    sheet->SetCell("A2"_pos, "20");
+    sheet->SetCell("A3"_pos, "'30");
+    sheet->SetCell("A4"_pos, "=A1*2");
+    sheet->SetCell("A5"_pos, "text");
+    sheet->SetCell("B1"_pos, "1");
+    sheet->SetCell("B2"_pos, "2");
+    sheet->SetCell("B3"_pos, "=1/0");
+    sheet->SetCell("B4"_pos, "4");
+
+    auto value = [&](std::string_view pos) {
+        return sheet->GetCell(Position::FromString(pos))->GetValue();
+    };
+    const CellInterface::Value not_available = FormulaError(FormulaError::Category::NotAvailable);
+
+    // находится первая ячейка с числом, текст-число - тоже число
+    sheet->SetCell("C1"_pos, "=MATCH(20,A1:A9)");
+    sheet->SetCell("C2"_pos, "=VLOOKUP(30,A1:B9,1+0)");
+    sheet->SetCell("C3"_pos, "=XLOOKUP(A4,A1:A9,B1:B9)");
+    sheet->SetCell("C4"_pos, "=MATCH(99,A1:A9)");
+    sheet->SetCell("C5"_pos, "=VLOOKUP(30,A1:B9,2)");
+    sheet->SetCell("C6"_pos, "=MATCH(20,A3:A9)*10");
+    sheet->SetCell("C7"_pos, "=MATCH(4,A4:B4)");
+    ASSERT_EQUAL(value("C1"), CellInterface::Value(2.0));
+    ASSERT_EQUAL(value("C2"), CellInterface::Value(30.0));
+    ASSERT_EQUAL(value("C3"), CellInterface::Value(2.0));
+    ASSERT_EQUAL(value("C4"), not_available);
+    ASSERT_EQUAL(value("C5"), CellInterface::Value(FormulaError(FormulaError::Category::Arithmetic)));
+    ASSERT_EQUAL(value("C6"), CellInterface::Value(20.0));
+    ASSERT_EQUAL(value("C7"), CellInterface::Value(2.0));
+    ASSERT_EQUAL(sheet->GetCell("C2"_pos)->GetText(), "=VLOOKUP(30,A1:B9,1+0)");
+    ASSERT(sheet->GetCell("C3"_pos)->GetReferencedCells() == std::vector<Position>{"A4"_pos});
+
+    // неподходящие области и номера столбцов
+    sheet->SetCell("D1"_pos, "=VLOOKUP(10,A1:B9,3)");
+    sheet->SetCell("D2"_pos, "=VLOOKUP(10,A1:B9,0.5)");
+    sheet->SetCell("D3"_pos, "=MATCH(10,A1:B9)");
+    sheet->SetCell("D4"_pos, "=XLOOKUP(10,A1:A9,B1:B5)");
+    ASSERT_EQUAL(value("D1"), CellInterface::Value(FormulaError(FormulaError::Category::Ref)));
+    ASSERT_EQUAL(value("D2"), CellInterface::Value(FormulaError(FormulaError::Category::Value)));
+    ASSERT_EQUAL(value("D3"), CellInterface::Value(FormulaError(FormulaError::Category::Value)));
+    ASSERT_EQUAL(value("D4"), CellInterface::Value(FormulaError(FormulaError::Category::Value)));
+    for (const std::string text : {"=MATCH(A1:A2,A1:A2)", "=MATCH(1,2)", "=VLOOKUP(1,A1:B2,C1:C2)",
+                                   "=XLOOKUP(1,A1:A2,3)", "=MATCH(1,A1:A2,0)"}) {
+        bool caught = false;
+        try {
+            sheet->SetCell("E1"_pos, text);
+        } catch (const FormulaException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+    }
+
+    // индекс столбца обновляется при изменении и очистке его ячеек
+    sheet->SetCell("A2"_pos, "25");
+    ASSERT_EQUAL(value("C1"), CellInterface::Value(4.0));
+    ASSERT_EQUAL(value("C3"), CellInterface::Value(4.0));
+    sheet->SetCell("A1"_pos, "12");
+    ASSERT_EQUAL(value("C1"), not_available);
+    ASSERT_EQUAL(value("C3"), CellInterface::Value(4.0));
+    sheet->SetCell("A2"_pos, "24");
+    ASSERT_EQUAL(value("C3"), CellInterface::Value(2.0));
+    sheet->ClearCell("A2"_pos);
+    ASSERT_EQUAL(value("C3"), CellInterface::Value(4.0));
+    sheet->SetCell("A9"_pos, "20");
+    ASSERT_EQUAL(value("C1"), CellInterface::Value(9.0));
+    ASSERT_EQUAL(value("C6"), CellInterface::Value(70.0));
+
+    // текст "nan" - число, не равное никакому ключу, в индекс не попадает;
+    // бесконечность находится, как и при переборе
+    sheet->SetCell("A8"_pos, "nan");
+    ASSERT_EQUAL(value("C1"), CellInterface::Value(9.0));
+    sheet->SetCell("A8"_pos, "20");
+    ASSERT_EQUAL(value("C1"), CellInterface::Value(8.0));
+    sheet->SetCell("A8"_pos, "inf");
+    sheet->SetCell("A7"_pos, "nan");
+    sheet->SetCell("D7"_pos, "=MATCH(A8,A1:A9)");
+    ASSERT_EQUAL(value("D7"), CellInterface::Value(8.0));
+    sheet->ClearCell("A7"_pos);
+    sheet->ClearCell("A8"_pos);
+    ASSERT_EQUAL(value("C1"), CellInterface::Value(9.0));
+
+    // случайные изменения столбца ключей: индекс совпадает с перебором ячеек
+    const int rows = 30;
+    const std::vector<Range> match_ranges = {
+        Range::FromString("A1:A30"), Range::FromString("A5:A12"), Range::FromString("A20:A40"),
+    };
+    uint32_t seed = 2024;
+    auto next_random = [&seed](int bound) {
+        seed = seed * 1103515245 + 12345;
+        return static_cast<int>((seed >> 16) % bound);
+    };
+
+    Sheet lazy;
+    Sheet eager;
+    eager.SetRecalculationMode(RecalculationMode::Eager);
+    std::map<int, int> keys;  // строка -> число в столбце A
+    for (Sheet* lookup_sheet : {&lazy, &eager}) {
+        for (int row = 0; row < rows; ++row) {
+            lookup_sheet->SetCell(Position{row, 1}, std::to_string(row + 100));
+        }
+        for (int key = 0; key < 10; ++key) {
+            for (size_t i = 0; i < match_ranges.size(); ++i) {
+                lookup_sheet->SetCell(Position{key, 2 + static_cast<int>(i)},
+                                      "=MATCH(" + std::to_string(key) + "," + match_ranges[i].ToString() + ")");
+            }
+            lookup_sheet->SetCell(Position{key, 5}, "=VLOOKUP(" + std::to_string(key) + ",A1:B30,2)");
+        }
+    }
+
+    auto first_row = [&keys](Range range, int key) -> std::optional<int> {
+        for (const auto& [row, row_key] : keys) {
+            if (range.Contains(Position{row, 0}) && row_key == key) {
+                return row;
+            }
+        }
+        return std::nullopt;
+    };
+
+    for (int step = 0; step < 1000; ++step) {
+        const Position pos{next_random(rows), 0};
+        const int key = next_random(10);
+        std::string text = std::to_string(key);
+        switch (next_random(4)) {
+            case 0:
+                lazy.ClearCell(pos);
+                eager.ClearCell(pos);
+                keys.erase(pos.row);
+                break;
+            case 1:
+                lazy.SetCell(pos, "text");
+                eager.SetCell(pos, "text");
+                keys.erase(pos.row);
+                break;
+            case 2:
+                text = "=" + text + "+0";
+                [[fallthrough]];
+            default:
+                lazy.SetCell(pos, text);
+                eager.SetCell(pos, text);
+                keys[pos.row] = key;
+                break;
+        }
+        if (step % 250 == 249) {
+            lazy.RecalculateAll(4);
+        }
+
+        const int checked_key = next_random(10);
+        for (size_t i = 0; i < match_ranges.size(); ++i) {
+            std::optional<int> row = first_row(match_ranges[i], checked_key);
+            const CellInterface::Value expected = row.has_value()
+                ? CellInterface::Value(static_cast<double>(*row - match_ranges[i].from.row + 1)) : not_available;
+            const Position formula_pos{checked_key, 2 + static_cast<int>(i)};
+            ASSERT_EQUAL(lazy.GetCell(formula_pos)->GetValue(), expected);
+            ASSERT_EQUAL(eager.GetCell(formula_pos)->GetValue(), expected);
+        }
+        std::optional<int> row = first_row(Range::FromString("A1:A30"), checked_key);
+        const CellInterface::Value expected = row.has_value() ? CellInterface::Value(*row + 100.) : not_available;
+        ASSERT_EQUAL(lazy.GetCell(Position{checked_key, 5})->GetValue(), expected);
+        ASSERT_EQUAL(eager.GetCell(Position{checked_key, 5})->GetValue(), expected);
+    }
+}
+
+void TestConditionalFunctions() {
+    auto sheet = CreateSheet();
+    auto value = [&](std::string_view pos) {
+        return sheet->GetCell(Position::FromString(pos))->GetValue();
+    };
+    auto text = [&](std::string_view pos) {
+        return sheet->GetCell(Position::FromString(pos))->GetText();
+    };
+
+    // сравнения - 1 или 0, связываются слабее арифметики
+    sheet->SetCell("A1"_pos, "=1+2<4");
+    sheet->SetCell("A2"_pos, "=(1<2)+(3>=3)*(2<=1)");
+    sheet->SetCell("A3"_pos, "=(2=2)+(2<>2)+(3>2)");
+    sheet->SetCell("A4"_pos, "=(1+2)<(3*4)");
+    sheet->SetCell("A5"_pos, "=1<(2<3)");
+    sheet->SetCell("A6"_pos, "=(1<2)<3");
+    sheet->SetCell("A7"_pos, "=IF((A1<1),-A2,(A3+1)*2)");
+    ASSERT_EQUAL(value("A1"), CellInterface::Value(1.0));
+    ASSERT_EQUAL(value("A2"), CellInterface::Value(1.0));
+    ASSERT_EQUAL(value("A3"), CellInterface::Value(2.0));
+    ASSERT_EQUAL(value("A5"), CellInterface::Value(0.0));
+    ASSERT_EQUAL(value("A7"), CellInterface::Value(6.0));
+    ASSERT_EQUAL(text("A4"), "=1+2<3*4");
+    ASSERT_EQUAL(text("A5"), "=1<(2<3)");
+    ASSERT_EQUAL(text("A6"), "=1<2<3");
+    ASSERT_EQUAL(text("A7"), "=IF(A1<1,-A2,(A3+1)*2)");
+
+    // невыбранная ветвь не вычисляется - её ошибки не видны
+    sheet->SetCell("B1"_pos, "=IF(1,2)+IF(0,1/0)");
+    sheet->SetCell("B2"_pos, "=AND(0,1/0)+OR(1,1/0)");
+    sheet->SetCell("B3"_pos, "=AND(1,1/0)");
+    sheet->SetCell("B4"_pos, "=IF(1/0,1,2)");
+    sheet->SetCell("B5"_pos, "=OR(0,A5)+AND(2,-1,A1)");
+    ASSERT_EQUAL(value("B1"), CellInterface::Value(2.0));
+    ASSERT_EQUAL(value("B2"), CellInterface::Value(1.0));
+    ASSERT_EQUAL(value("B3"), CellInterface::Value(FormulaError(FormulaError::Category::Arithmetic)));
+    ASSERT_EQUAL(value("B4"), CellInterface::Value(FormulaError(FormulaError::Category::Arithmetic)));
+    ASSERT_EQUAL(value("B5"), CellInterface::Value(1.0));
+    for (const std::string formula : {"=IF(1)", "=IF(1,2,3,4)", "=IF(A1:A2,1)", "=AND(A1:A2)", "=1<<2", "=1=>2"}) {
+        bool caught = false;
+        try {
+            sheet->SetCell("E1"_pos, formula);
+        } catch (const FormulaException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+    }
+
+    // в режиме Lazy формулы невыбранной ветви не вычисляются
+    Sheet lazy;
+    lazy.SetCell("A1"_pos, "1");
+    lazy.SetCell("D1"_pos, "5");
+    lazy.SetCell("B1"_pos, "=D1+1");
+    lazy.SetCell("C1"_pos, "=D1*2");
+    lazy.SetCell("E1"_pos, "=IF(A1>0,B1,C1)");
+    ASSERT(lazy.GetCell("E1"_pos)->GetReferencedCells() == (std::vector<Position>{"A1"_pos, "B1"_pos, "C1"_pos}));
+    ASSERT_EQUAL(lazy.GetCell("E1"_pos)->GetValue(), CellInterface::Value(6.0));
+    ASSERT_EQUAL(lazy.GetLastRecalculationStats().recomputed_cells, 2u);
+
+    lazy.SetCell("D1"_pos, "7");
+    ASSERT_EQUAL(lazy.GetCell("E1"_pos)->GetValue(), CellInterface::Value(8.0));
+    ASSERT_EQUAL(lazy.GetLastRecalculationStats().recomputed_cells, 2u);
+    ASSERT_EQUAL(lazy.GetLastRecalculationStats().skipped_cells, 0u);
+
+    // ветвь сменилась: C1 впервые вычисляется, B1 только проверяется
+    lazy.SetCell("A1"_pos, "0");
+    ASSERT_EQUAL(lazy.GetCell("E1"_pos)->GetValue(), CellInterface::Value(14.0));
+    ASSERT_EQUAL(lazy.GetLastRecalculationStats().recomputed_cells, 2u);
+    ASSERT_EQUAL(lazy.GetLastRecalculationStats().skipped_cells, 1u);
+
+    // изменение невыбранной ветви не заставляет вычислять E1
+    lazy.SetCell("B1"_pos, "=D1+100");
+    ASSERT_EQUAL(lazy.GetCell("E1"_pos)->GetValue(), CellInterface::Value(14.0));
+    ASSERT_EQUAL(lazy.GetLastRecalculationStats().recomputed_cells, 0u);
+    lazy.SetCell("A1"_pos, "2");
+    ASSERT_EQUAL(lazy.GetCell("E1"_pos)->GetValue(), CellInterface::Value(107.0));
+
+    // случайные формулы с ветвлениями: Lazy, Eager и обход дерева формулы совпадают
+    const int rows = 12;
+    uint32_t seed = 77;
+    auto next_random = [&seed](int bound) {
+        seed = seed * 1103515245 + 12345;
+        return static_cast<int>((seed >> 16) % bound);
+    };
+    auto number_cell = [&]() {
+        return "A" + std::to_string(next_random(rows) + 1);
+    };
+    // формула в строке row ссылается на столбец A и на столбец B выше себя
+    auto make_formula = [&](int row) {
+        auto input = [&]() {
+            return row > 0 && next_random(2) == 0 ? "B" + std::to_string(next_random(row) + 1) : number_cell();
+        };
+        switch (next_random(4)) {
+            case 0:
+                return "=IF(" + number_cell() + ">" + number_cell() + "," + input() + "+1," + input() + "-1)";
+            case 1:
+                return "=AND(" + number_cell() + "," + input() + ")+OR(" + number_cell() + "<2," + input() + ")";
+            case 2:
+                return "=IF(" + number_cell() + "<>0," + (row > 0 ? "SUM(B1:B" + std::to_string(row) + ")" : "SUM(A1:A3)"s)
+                    + "," + input() + "/" + number_cell() + ")";
+            default:
+                return "=" + input() + "*2-" + input();
+        }
+    };
+
+    Sheet lazy_random;
+    Sheet eager_random;
+    eager_random.SetRecalculationMode(RecalculationMode::Eager);
+    auto set_both = [&](Position pos, const std::string& cell_text) {
+        lazy_random.SetCell(pos, cell_text);
+        eager_random.SetCell(pos, cell_text);
+    };
+    for (int row = 0; row < rows; ++row) {
+        set_both(Position{row, 0}, std::to_string(next_random(4)));
+    }
+    for (int row = 0; row < rows; ++row) {
+        set_both(Position{row, 1}, make_formula(row));
+    }
+
+    for (int step = 0; step < 600; ++step) {
+        const int row = next_random(rows);
+        if (next_random(3) == 0) {
+            set_both(Position{row, 1}, make_formula(row));
+        } else {
+            set_both(Position{row, 0}, std::to_string(next_random(4)));
+        }
+        if (step % 200 == 199) {
+            lazy_random.RecalculateAll(4);
+        }
+
+        // в Lazy ячейки читаются в случайном порядке
+        const int first_row = next_random(rows);
+        for (int i = 0; i < rows; ++i) {
+            const Position pos{(first_row + i) % rows, 1};
+            const CellInterface::Value lazy_value = lazy_random.GetCell(pos)->GetValue();
+            ASSERT_EQUAL(lazy_value, eager_random.GetCell(pos)->GetValue());
+
+            FormulaAST ast = ParseFormulaAST(lazy_random.GetCell(pos)->GetText().substr(1));
+            Bytecode::FormulaResult tree = ast.ExecuteByTree(lazy_random);
+            if (tree.HasError()) {
+                ASSERT_EQUAL(lazy_value, CellInterface::Value(tree.GetError()));
+            } else {
+                ASSERT_EQUAL(lazy_value, CellInterface::Value(tree.GetValue()));
+            }
+        }
+    }
+}
+
+void TestFormulaTemplates() {
+    Sheet sheet;
+    auto pos = [](int row, int col) {
+        return Position{row, col};
+    };
+
+    // заполнение вниз: одна формула относительно своих ячеек - один шаблон.
+    // Первой задаётся нижняя ячейка, так что сдвиги бывают и отрицательными
+    constexpr int ROWS = 50;
+    for (int row = ROWS - 1; row >= 0; --row) {
+        const std::string r = std::to_string(row + 1);
+        sheet.SetCell(pos(row, 0), std::to_string(row));
+        sheet.SetCell(pos(row, 1), "2");
+        sheet.SetCell(pos(row, 2), "=  A" + r + " * B" + r);
+        sheet.SetCell(pos(row, 3), "=SUM(A" + r + ":C" + r + ")+IF(A" + r + "<10,VLOOKUP(A" + r + ",A" + r + ":C" + std::to_string(row + 2) + ",3),0)");
+    }
+    ASSERT_EQUAL(sheet.GetFormulaTemplates().GetTemplatesCount(), 2u);
+    for (int row = 0; row < ROWS; ++row) {
+        const std::string r = std::to_string(row + 1);
+        ASSERT_EQUAL(sheet.GetCell(pos(row, 2))->GetText(), "=A" + r + "*B" + r);
+        ASSERT_EQUAL(sheet.GetCell(pos(row, 2))->GetValue(), CellInterface::Value(2.0 * row));
+        ASSERT_EQUAL(sheet.GetCell(pos(row, 3))->GetValue(), CellInterface::Value(row < 10 ? 5.0 * row + 2 : 3.0 * row + 2));
+    }
+    ASSERT(sheet.GetCell(pos(7, 2))->GetReferencedCells() == (std::vector{pos(7, 0), pos(7, 1)}));
+
+    // у каждой ячейки свои зависимости, хотя дерево формулы общее
+    sheet.SetCell(pos(7, 1), "3");
+    ASSERT_EQUAL(sheet.GetCell(pos(7, 2))->GetValue(), CellInterface::Value(21.0));
+    ASSERT_EQUAL(sheet.GetCell(pos(7, 3))->GetValue(), CellInterface::Value(7.0 + 3 + 21 + 21));
+    ASSERT_EQUAL(sheet.GetCell(pos(8, 2))->GetValue(), CellInterface::Value(16.0));
+
+    // абсолютная по смыслу ссылка (A1) даёт разные шаблоны
+    sheet.SetCell(pos(0, 5), "=A1+1");
+    sheet.SetCell(pos(1, 5), "=A1+1");
+    ASSERT_EQUAL(sheet.GetFormulaTemplates().GetTemplatesCount(), 4u);
+    ASSERT_EQUAL(sheet.GetCell(pos(1, 5))->GetValue(), CellInterface::Value(1.0));
+
+    // ошибки разбора не зависят от шаблонов
+    for (const std::string formula : {"=A1+", "=ZZZZ1", "=A1 B1"}) {
+        bool caught = false;
+        try {
+            sheet.SetCell(pos(2, 5), formula);
+        } catch (const FormulaException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+    }
+
+    // неиспользуемые шаблоны освобождаются вместе с ячейками
+    for (int row = 0; row < ROWS; ++row) {
+        for (int col = 0; col < 6; ++col) {
+            sheet.ClearCell(pos(row, col));
+        }
+    }
+    ASSERT_EQUAL(sheet.GetFormulaTemplates().GetTemplatesCount(), 0u);
+}
+
+void TestBatchEvaluation() {
+    auto pos = [](int row, int col) {
+        return Position{row, col};
+    };
+
+    // Заполнение вниз: больше одной пачки, ошибки в отдельных строках
+    // и нарастающий итог, который читает формулу того же шаблона строкой выше.
+    // Пачками выполняются только длинные формулы - к каждой добавлен ноль
+    // из произведения скобок
+    constexpr int ROWS = 150;
+    auto fill = [&pos](Sheet& sheet) {
+        for (int row = 0; row < ROWS; ++row) {
+            const std::string r = std::to_string(row + 1);
+            std::string zero = "+0";
+            for (int i = 1; i <= 10; ++i) {
+                zero += "*(B" + r + "+" + std::to_string(i) + ")";
+            }
+            if (row % 37 == 5) {
+                sheet.SetCell(pos(row, 0), "text");
+            } else if (row == 100) {
+                sheet.SetCell(pos(row, 0), "1e308");
+            } else {
+                sheet.SetCell(pos(row, 0), std::to_string(row - 20));
+            }
+            sheet.SetCell(pos(row, 1), std::to_string(row % 7));
+            sheet.SetCell(pos(row, 2), "=-A" + r + "/B" + r + "*3+A" + r + "*B" + r + zero);
+            sheet.SetCell(pos(row, 3), "=(A" + r + ">=B" + r + ")+(A" + r + "<>0)*2-B" + r + zero);
+            sheet.SetCell(pos(row, 4), (row == 0 ? "=B1" : "=E" + std::to_string(row) + "+B" + r) + zero);
+        }
+    };
+    auto assert_same_values = [&pos](const Sheet& sheet, const Sheet& expected) {
+        for (int row = 0; row < ROWS; ++row) {
+            for (int col = 2; col < 5; ++col) {
+                ASSERT_EQUAL(sheet.GetCell(pos(row, col))->GetValue(), expected.GetCell(pos(row, col))->GetValue());
+            }
+        }
+    };
+
+    Sheet sheet;
+    Sheet expected;
+    fill(sheet);
+    fill(expected);
+    ASSERT(sheet.GetConcreteCell(pos(10, 2))->GetBatchTemplate() != nullptr);
+    ASSERT(sheet.GetConcreteCell(pos(10, 4))->GetBatchTemplate() != nullptr);
+    // короткая формула пачку не окупает
+    Sheet short_formulas;
+    short_formulas.SetCell(pos(0, 0), "=B1*2+1");
+    ASSERT(short_formulas.GetConcreteCell(pos(0, 0))->GetBatchTemplate() == nullptr);
+
+    const Range area{pos(0, 0), pos(ROWS - 1, 4)};
+    sheet.EvaluateRange(area);
+    ASSERT_EQUAL(sheet.GetLastRecalculationStats().recomputed_cells, static_cast<size_t>(3 * ROWS));
+    for (int row = 0; row < ROWS; ++row) {
+        for (int col = 2; col < 5; ++col) {
+            ASSERT(sheet.GetConcreteCell(pos(row, col))->HasCache());
+        }
+    }
+    assert_same_values(sheet, expected);
+    ASSERT_EQUAL(sheet.GetCell(pos(5, 2))->GetValue(), CellInterface::Value(FormulaError(FormulaError::Category::Value)));
+    ASSERT_EQUAL(sheet.GetCell(pos(7, 2))->GetValue(), CellInterface::Value(FormulaError(FormulaError::Category::Arithmetic)));
+    ASSERT_EQUAL(sheet.GetCell(pos(100, 2))->GetValue(), CellInterface::Value(FormulaError(FormulaError::Category::Arithmetic)));
+
+    // после изменения пересчитываются только зависимые формулы
+    sheet.SetCell(pos(60, 1), "5");
+    expected.SetCell(pos(60, 1), "5");
+    sheet.EvaluateRange(area);
+    ASSERT_EQUAL(sheet.GetLastRecalculationStats().recomputed_cells, static_cast<size_t>(3 + ROWS - 61));
+    assert_same_values(sheet, expected);
+
+    // пересчёт только части столбца: входы выше области проверяются заранее
+    sheet.SetCell(pos(0, 1), "9");
+    expected.SetCell(pos(0, 1), "9");
+    sheet.EvaluateRange(Range{pos(120, 4), pos(ROWS - 1, 4)});
+    ASSERT(!sheet.GetConcreteCell(pos(0, 2))->HasCache());
+    ASSERT(sheet.GetConcreteCell(pos(0, 4))->HasCache());
+    assert_same_values(sheet, expected);
+
+    // удалённая очисткой формула не учитывается: столбец без формул,
+    // вычисляемых пачкой, EvaluateRange пропускает
+    Sheet cleared;
+    cleared.SetCell(pos(0, 2), sheet.GetCell(pos(0, 2))->GetText());
+    cleared.SetCell(pos(0, 3), sheet.GetCell(pos(0, 3))->GetText());
+    cleared.SetCell(pos(1, 3), "=D1");
+    ASSERT(cleared.HasBatchFormulas(2) && cleared.HasBatchFormulas(3));
+    cleared.ClearCell(pos(0, 2));
+    ASSERT(cleared.GetConcreteCell(pos(0, 2)) == nullptr);
+    ASSERT(!cleared.HasBatchFormulas(2));
+    // на D1 ссылаются: ячейка остаётся пустой, формула тоже больше не учитывается
+    cleared.ClearCell(pos(0, 3));
+    ASSERT(cleared.GetConcreteCell(pos(0, 3)) != nullptr);
+    ASSERT(!cleared.HasBatchFormulas(3));
+}
+
+void TestSnapshot() {
+    auto print_texts = [](const Sheet& sheet) {
+        std::ostringstream out;
+        sheet.PrintTexts(out);
+        return out.str();
+    };
+    auto print_values = [](const Sheet& sheet) {
+        std::ostringstream out;
+        sheet.PrintValues(out);
+        return out.str();
+    };
+    auto load_throws = [](std::string_view data) {
+        try {
+            LoadSnapshot(data);
+        } catch (const SnapshotException&) {
+            return true;
+        }
+        return false;
+    };
+
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "10");
+    sheet.SetCell("A2"_pos, "'=escaped");
+    sheet.SetCell("A3"_pos, "text");
+    for (int row = 0; row < 20; ++row) {
+        const std::string r = std::to_string(row + 1);
+        sheet.SetCell(Position{row, 2}, std::to_string(row % 5));
+        sheet.SetCell(Position{row, 3}, "=C" + r + "*2");
+    }
+    sheet.SetCell("E1"_pos, "=SUM(D1:D20)");
+    sheet.SetCell("E2"_pos, "=IF(A1>5,E1,1/0)");
+    sheet.SetCell("E3"_pos, "=VLOOKUP(4,C1:D20,2)");
+    sheet.SetCell("E4"_pos, "=1/0");
+    sheet.SetCell("E5"_pos, "=Z100+A3");  // Z100 - пустая ячейка, созданная ссылкой
+    // ячейка, на которую ссылаются, после очистки остаётся пустой
+    sheet.SetCell("F1"_pos, "=G1");
+    sheet.SetCell("G1"_pos, "5");
+    sheet.ClearCell("G1"_pos);
+    for (Position pos : {"E1"_pos, "E2"_pos, "E3"_pos, "E4"_pos, "F1"_pos}) {
+        sheet.GetCell(pos)->GetValue();
+    }
+
+    std::ostringstream out;
+    SaveSnapshot(sheet, out);
+    const std::string data = out.str();
+    std::unique_ptr<Sheet> loaded = LoadSnapshot(data);
+
+    // формулы одного шаблона снова делят его, кеш прочитанных формул восстановлен
+    ASSERT_EQUAL(loaded->GetFormulaTemplates().GetTemplatesCount(), sheet.GetFormulaTemplates().GetTemplatesCount());
+    ASSERT(loaded->GetConcreteCell("E1"_pos)->HasCache());
+    ASSERT(!loaded->GetConcreteCell("E5"_pos)->HasCache());
+    ASSERT_EQUAL(loaded->GetCell("E2"_pos)->GetValue(), CellInterface::Value(80.));
+    ASSERT_EQUAL(loaded->GetLastRecalculationStats().recomputed_cells, 0u);
+    ASSERT(loaded->GetConcreteCell("Z100"_pos) != nullptr);
+    ASSERT(loaded->GetConcreteCell("G1"_pos)->IsEmptyCell());
+    ASSERT_EQUAL(loaded->GetPrintableSize(), sheet.GetPrintableSize());
+    ASSERT_EQUAL(print_texts(*loaded), print_texts(sheet));
+    ASSERT_EQUAL(print_values(*loaded), print_values(sheet));
+
+    // граф восстановлен: изменения доходят до зависимых, циклы обнаруживаются
+    loaded->SetCell("C5"_pos, "100");
+    sheet.SetCell("C5"_pos, "100");
+    ASSERT_EQUAL(print_values(*loaded), print_values(sheet));
+    bool caught = false;
+    try {
+        loaded->SetCell("C1"_pos, "=E1");
+    } catch (const CircularDependencyException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+
+    // загрузка из файла через mmap
+    const std::string path = "snapshot_test.bin";
+    {
+        std::ofstream file(path, std::ios::binary);
+        SaveSnapshot(*loaded, file);
+    }
+    std::unique_ptr<Sheet> from_file = LoadSnapshotFile(path);
+    std::remove(path.c_str());
+    ASSERT_EQUAL(print_texts(*from_file), print_texts(sheet));
+    ASSERT_EQUAL(print_values(*from_file), print_values(sheet));
+
+    // пустая таблица
+    std::ostringstream empty_out;
+    SaveSnapshot(Sheet(), empty_out);
+    ASSERT_EQUAL(LoadSnapshot(empty_out.str())->GetPrintableSize(), (Size{0, 0}));
+
+    // повреждённый или несовместимый снимок
+    ASSERT(load_throws(std::string_view(data).substr(0, data.size() - 1)));
+    ASSERT(load_throws(data + "x"));
+    std::string bad_signature = data;
+    bad_signature[0] = 'X';
+    ASSERT(load_throws(bad_signature));
+    std::string bad_version = data;
+    bad_version[8] = static_cast<char>(SNAPSHOT_VERSION + 1);
+    ASSERT(load_throws(bad_version));
+    ASSERT(load_throws(""));
+
+    // шаблон =SUM(D1:D20) с ячейкой в последней строке: в копии формулы в E1
+    // область оказывается за пределами таблицы
+    auto read_u64 = [&data](size_t offset) {
+        uint64_t value = 0;
+        std::memcpy(&value, data.data() + offset, sizeof(value));
+        return value;
+    };
+    const uint64_t templates_count = read_u64(24);
+    const uint64_t strings_offset = 48 + templates_count * 24 + read_u64(32) * 40;
+    std::string bad_template = data;
+    bool is_template_found = false;
+    for (uint64_t i = 0; i < templates_count; ++i) {
+        const size_t record = 48 + i * 24;
+        if (data.substr(strings_offset + read_u64(record + 8), read_u64(record + 16)) == "SUM(D1:D20)") {
+            const int32_t row = Position::MAX_ROWS - 1;
+            std::memcpy(bad_template.data() + record, &row, sizeof(row));
+            is_template_found = true;
+        }
+    }
+    ASSERT(is_template_found);
+    ASSERT(load_throws(bad_template));
+}
+
+void TestImportTable() {
+    auto print_texts = [](const Sheet& sheet) {
+        std::ostringstream out;
+        sheet.PrintTexts(out);
+        return out.str();
+    };
+    auto print_values = [](const Sheet& sheet) {
+        std::ostringstream out;
+        sheet.PrintValues(out);
+        return out.str();
+    };
+
+    // TSV в формате PrintTexts: маленькие блоки и несколько потоков,
+    // чтобы строки попадали на границы блоков и потоков
+    Sheet source;
+    for (int row = 0; row < 40; ++row) {
+        const std::string r = std::to_string(row + 1);
+        source.SetCell(Position{row, 0}, std::to_string(row * 3 % 11));
+        source.SetCell(Position{row, 1}, "=A" + r + "*2+1");
+        if (row % 4 == 0) {
+            source.SetCell(Position{row, 3}, "'=text " + r);
+        }
+    }
+    source.SetCell("E1"_pos, "=SUM(B1:B40)");
+    const std::string tsv = print_texts(source);
+
+    // маленькие блоки - строки на границах блоков; большой блок - строки одного
+    // блока разбираются несколькими потоками
+    for (auto [threads_count, chunk_size] : {std::pair<size_t, size_t>{1, 7}, {3, 7}, {4, 1 << 20}}) {
+        Sheet sheet;
+        ImportOptions options;
+        options.threads_count = threads_count;
+        options.chunk_size = chunk_size;
+        std::istringstream input(tsv);
+        const ImportStats stats = ImportTable(sheet, input, options);
+        ASSERT_EQUAL(stats.bytes, tsv.size());
+        ASSERT_EQUAL(stats.rows, 40u);
+        ASSERT_EQUAL(stats.cells, 91u);
+        ASSERT_EQUAL(print_texts(sheet), tsv);
+        ASSERT_EQUAL(print_values(sheet), print_values(source));
+        // шаблоны, разобранные разными потоками, слиты в таблицу листа,
+        // и формулы столбца, разобранные разными потоками, делят один шаблон
+        ASSERT_EQUAL(sheet.GetFormulaTemplates().GetTemplatesCount(), 2u);
+        std::set<const FormulaTemplate*> column_templates;
+        for (int row = 0; row < 40; ++row) {
+            column_templates.insert(sheet.GetConcreteCell(Position{row, 1})->GetFormula()->GetTemplate());
+        }
+        ASSERT_EQUAL(column_templates.size(), 1u);
+    }
+
+    // формула, которая уже есть в листе, и импортированные формулы того же шаблона
+    {
+        Sheet sheet;
+        sheet.SetCell("B50"_pos, "=A50*2+1");
+        ImportOptions options;
+        options.threads_count = 1;
+        std::istringstream input(tsv);
+        ImportTable(sheet, input, options);
+        const FormulaTemplate* formula_template = sheet.GetConcreteCell("B50"_pos)->GetFormula()->GetTemplate();
+        for (int row = 0; row < 40; ++row) {
+            ASSERT(sheet.GetConcreteCell(Position{row, 1})->GetFormula()->GetTemplate() == formula_template);
+        }
+        ASSERT_EQUAL(sheet.GetFormulaTemplates().GetTemplatesCount(), 2u);
+    }
+
+    // CSV: поля в кавычках, перевод строки \r\n
+    {
+        Sheet sheet;
+        ImportOptions options;
+        options.delimiter = ',';
+        options.quoted_fields = true;
+        options.chunk_size = 5;
+        std::istringstream input("1,\"a,b\",\"say \"\"hi\"\"\"\r\n\"two\nlines\",,=A1+1\r\n");
+        const ImportStats stats = ImportTable(sheet, input, options);
+        ASSERT_EQUAL(stats.rows, 2u);
+        ASSERT_EQUAL(stats.cells, 5u);
+        ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetText(), "a,b");
+        ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetText(), "say \"hi\"");
+        ASSERT_EQUAL(sheet.GetCell("A2"_pos)->GetText(), "two\nlines");
+        ASSERT(sheet.GetCell("B2"_pos) == nullptr);
+        ASSERT_EQUAL(sheet.GetCell("C2"_pos)->GetValue(), CellInterface::Value(2.));
+    }
+
+    // ошибка - таблица не меняется
+    auto import_fails = [&print_texts](const std::string& text) {
+        Sheet sheet;
+        sheet.SetCell("A1"_pos, "kept");
+        const std::string before = print_texts(sheet);
+        std::istringstream input(text);
+        bool caught = false;
+        try {
+            ImportTable(sheet, input);
+        } catch (const FormulaException&) {
+            caught = true;
+        } catch (const CircularDependencyException&) {
+            caught = true;
+        } catch (const InvalidPositionException&) {
+            caught = true;
+        }
+        return caught && print_texts(sheet) == before;
+    };
+    ASSERT(import_fails("1\t2\n=1+\n"));
+    ASSERT(import_fails("=B1\t=A1\n"));
+    ASSERT(import_fails(std::string(Position::MAX_COLS, '\t') + "x\n"));
+}
+
+void TestPrintMatchesCells() {
+    // как печатала таблица раньше: каждая позиция через GetCell и operator<<
+    auto print_each = [](const Sheet& sheet, std::ostream& out, bool print_values) {
+        const Size size = sheet.GetPrintableSize();
+        for (int row = 0; row < size.rows; ++row) {
+            for (int col = 0; col < size.cols; ++col) {
+                if (col > 0) {
+                    out << '\t';
+                }
+                if (const CellInterface* cell = sheet.GetCell(Position{row, col})) {
+                    if (print_values) {
+                        out << cell->GetValue();
+                    } else {
+                        out << cell->GetText();
+                    }
+                }
+            }
+            out << '\n';
+        }
+    };
+
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "=1/3");
+    sheet.SetCell("B1"_pos, "=1e20*3");
+    sheet.SetCell("C1"_pos, "-0.000012345");
+    sheet.SetCell("D1"_pos, "=C1*1000+123456789");
+    sheet.SetCell("F1"_pos, "'=escaped");
+    sheet.SetCell("A2"_pos, "=1/0");
+    sheet.SetCell("B2"_pos, "=A1+K9");  // K9 - пустая существующая ячейка
+    sheet.SetCell("C2"_pos, "=SUM(A1:B1)/(0.1+2.5e-7)");
+    sheet.SetCell("D2"_pos, "=-(C1)*-2");
+    sheet.SetCell("E2"_pos, "text");
+    sheet.SetCell("F2"_pos, "=0*-1");  // -0
+    sheet.SetCell("G2"_pos, "=1e15*3");
+    sheet.SetCell("H2"_pos, "=-999999");
+    sheet.SetCell("A3"_pos, std::string(TableWriter::BUFFER_SIZE + 100, 'x'));
+    // больше буфера, чтобы он сбрасывался посреди строк
+    for (int row = 4; row < 2000; ++row) {
+        const std::string r = std::to_string(row);
+        sheet.SetCell(Position{row, 0}, r);
+        sheet.SetCell(Position{row, 2}, "=A" + std::to_string(row + 1) + "/7");
+    }
+
+    auto check = [&](std::ios_base& (*manipulator)(std::ios_base&), int precision) {
+        for (bool print_values : {true, false}) {
+            std::ostringstream expected;
+            std::ostringstream printed;
+            for (std::ostringstream* out : {&expected, &printed}) {
+                if (manipulator != nullptr) {
+                    *out << manipulator;
+                }
+                if (precision >= 0) {
+                    *out << std::setprecision(precision);
+                }
+            }
+            print_each(sheet, expected, print_values);
+            if (print_values) {
+                sheet.PrintValues(printed);
+            } else {
+                sheet.PrintTexts(printed);
+            }
+            ASSERT(printed.str() == expected.str());
+        }
+    };
+    check(nullptr, -1);
+    check(nullptr, 0);
+    check(nullptr, 17);
+    check(std::fixed, 3);
+    check(std::scientific, -1);
+    check(std::showpos, -1);
+    check(std::uppercase, 10);
+    check(std::showpoint, -1);
+}
+
+void TestViewport() {
+    Sheet sheet;
+    for (int row = 0; row < 100; ++row) {
+        const std::string r = std::to_string(row + 1);
+        sheet.SetCell(Position{row, 0}, r);
+        sheet.SetCell(Position{row, 1}, "=A" + r + "*2");
+        if (row % 3 == 0) {
+            sheet.SetCell(Position{row, 3}, "'=note " + r);
+        }
+    }
+    sheet.SetCell("E50"_pos, "=1/0");
+    sheet.SetCell("F1"_pos, "=SUM(B1:B100)");
+
+    // как печать по одной позиции через GetCell и operator<<
+    auto print_each = [&sheet](Range range, bool print_values) {
+        std::ostringstream out;
+        for (int row = range.from.row; row <= range.to.row; ++row) {
+            for (int col = range.from.col; col <= range.to.col; ++col) {
+                if (col > range.from.col) {
+                    out << '\t';
+                }
+                if (const CellInterface* cell = sheet.GetCell(Position{row, col})) {
+                    if (print_values) {
+                        out << cell->GetValue();
+                    } else {
+                        out << cell->GetText();
+                    }
+                }
+            }
+            out << '\n';
+        }
+        return out.str();
+    };
+
+    const Range viewport = Range::FromString("B40:E52");
+    {
+        // печатаются только формулы области: остальные остаются невычисленными
+        std::ostringstream values;
+        sheet.PrintValues(values, viewport);
+        ASSERT(sheet.GetConcreteCell("B40"_pos)->HasCache());
+        ASSERT(sheet.GetConcreteCell("E50"_pos)->HasCache());
+        ASSERT(!sheet.GetConcreteCell("B39"_pos)->HasCache());
+        ASSERT(!sheet.GetConcreteCell("B53"_pos)->HasCache());
+        ASSERT(!sheet.GetConcreteCell("F1"_pos)->HasCache());
+        ASSERT_EQUAL(values.str(), print_each(viewport, true));
+    }
+    // в том числе области на краю и за пределами печатаемой области
+    for (Range range : {viewport, Range::FromString("A1:A1"), Range::FromString("C90:H120"), Range::FromString("Z1:AB3")}) {
+        for (bool print_values : {false, true}) {
+            std::ostringstream printed;
+            if (print_values) {
+                sheet.PrintValues(printed, range);
+            } else {
+                sheet.PrintTexts(printed, range);
+            }
+            ASSERT_EQUAL(printed.str(), print_each(range, print_values));
+        }
+    }
+
+    // значения области в буфер; повторная запись переиспользует строки
+    std::vector<CellInterface::Value> buffer(3 * 4, 7.);
+    sheet.GetValues(Range::FromString("B48:E50"), buffer.data());
+    ASSERT_EQUAL(buffer[0], CellInterface::Value(96.));
+    ASSERT_EQUAL(buffer[1], CellInterface::Value(""s));
+    ASSERT_EQUAL(buffer[2], CellInterface::Value(""s));
+    ASSERT_EQUAL(buffer[4], CellInterface::Value(98.));
+    ASSERT_EQUAL(buffer[6], CellInterface::Value("=note 49"s));
+    ASSERT_EQUAL(buffer[11], CellInterface::Value(FormulaError(FormulaError::Category::Arithmetic)));
+    sheet.GetValues(Range::FromString("C49:F51"), buffer.data());
+    ASSERT_EQUAL(buffer[0], CellInterface::Value(""s));
+    ASSERT_EQUAL(buffer[1], CellInterface::Value("=note 49"s));
+    ASSERT_EQUAL(buffer[6], CellInterface::Value(FormulaError(FormulaError::Category::Arithmetic)));
+    ASSERT_EQUAL(buffer[9], CellInterface::Value(""s));
+
+    bool caught = false;
+    try {
+        sheet.GetValues(Range{Position{5, 5}, Position{4, 5}}, buffer.data());
+    } catch (const InvalidPositionException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+    caught = false;
+    try {
+        std::ostringstream out;
+        sheet.PrintValues(out, Range{Position{0, 0}, Position{Position::MAX_ROWS, 0}});
+    } catch (const InvalidPositionException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+}
+
+void TestJournal() {
+    const std::string path = "journal_test.bin";
+    std::remove(path.c_str());
+    auto print_texts = [](const Sheet& sheet) {
+        std::ostringstream out;
+        sheet.PrintTexts(out);
+        return out.str();
+    };
+    auto read_file = [&path] {
+        std::ifstream input(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+    };
+
+    Sheet sheet;
+    {
+        // без фонового потока каждая операция сразу записывается на диск
+        SheetJournal journal(sheet, path, JournalOptions{std::chrono::milliseconds(0)});
+        for (int row = 0; row < 10; ++row) {
+            const std::string r = std::to_string(row + 1);
+            journal.SetCell(Position{row, 0}, r);
+            journal.SetCell(Position{row, 1}, "=A" + r + "*2");
+        }
+        journal.SetCell("C1"_pos, "'=text");
+        journal.ClearCell("A3"_pos);
+        journal.SetCell("A3"_pos, "30");
+        journal.ClearCell("B10"_pos);
+        // не применённая к таблице операция не записывается
+        bool caught = false;
+        try {
+            journal.SetCell("A1"_pos, "=B1");
+        } catch (const CircularDependencyException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+        const JournalStats stats = journal.GetStats();
+        ASSERT_EQUAL(stats.operations, 24u);
+        ASSERT_EQUAL(stats.groups, 24u);
+        ASSERT_EQUAL(stats.bytes, read_file().size());
+    }
+
+    Sheet replayed;
+    ReplayStats replay = ReplayJournalFile(replayed, path);
+    ASSERT_EQUAL(replay.operations, 24u);
+    ASSERT_EQUAL(replay.groups, 24u);
+    ASSERT(!replay.is_tail_dropped);
+    ASSERT_EQUAL(print_texts(replayed), print_texts(sheet));
+    ASSERT_EQUAL(replayed.GetCell("B3"_pos)->GetValue(), CellInterface::Value(60.));
+
+    {
+        // с интервалом группы операции доходят до файла при Sync или в деструкторе
+        SheetJournal journal(sheet, path, JournalOptions{std::chrono::hours(1)});
+        const size_t size = read_file().size();
+        journal.SetCell("D1"_pos, "=SUM(A1:A10)");
+        journal.SetCell("D2"_pos, "text");
+        ASSERT_EQUAL(read_file().size(), size);
+        journal.Sync();
+        ASSERT_EQUAL(journal.GetStats().groups, 1u);
+        ASSERT(read_file().size() > size);
+        journal.ClearCell("D2"_pos);
+        journal.SetCell("D3"_pos, "=D1+1");
+    }
+    Sheet grouped;
+    replay = ReplayJournalFile(grouped, path);
+    ASSERT_EQUAL(replay.operations, 28u);
+    ASSERT_EQUAL(replay.groups, 26u);
+    ASSERT_EQUAL(print_texts(grouped), print_texts(sheet));
+
+    // оборванная последняя группа отбрасывается при чтении и отрезается при открытии
+    const std::string data = read_file();
+    for (size_t cut : {size_t{1}, size_t{5}, size_t{9}}) {
+        Sheet partial;
+        replay = ReplayJournal(partial, std::string_view(data).substr(0, data.size() - cut));
+        ASSERT(replay.is_tail_dropped);
+        ASSERT_EQUAL(replay.groups, 25u);
+        ASSERT(partial.GetCell("D3"_pos) == nullptr);
+        ASSERT_EQUAL(partial.GetCell("D2"_pos)->GetText(), "text"s);
+    }
+    std::string damaged = data;
+    damaged.back() ^= 1;
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file << damaged;
+    }
+    {
+        Sheet reopened;
+        ReplayJournalFile(reopened, path);
+        SheetJournal journal(reopened, path);
+        ASSERT_EQUAL(journal.GetStats().bytes, replay.valid_size);
+        journal.SetCell("E1"_pos, "=D1*2");
+    }
+    Sheet appended;
+    replay = ReplayJournalFile(appended, path);
+    ASSERT(!replay.is_tail_dropped);
+    ASSERT_EQUAL(replay.groups, 26u);
+    ASSERT_EQUAL(appended.GetCell("E1"_pos)->GetValue(), CellInterface::Value(2. * (55 - 3 + 30)));
+
+    {
+        // после снимка журнал очищается
+        SheetJournal journal(appended, path);
+        journal.Truncate();
+        journal.SetCell("F1"_pos, "1");
+    }
+    Sheet truncated;
+    replay = ReplayJournalFile(truncated, path);
+    ASSERT_EQUAL(replay.operations, 1u);
+    ASSERT_EQUAL(print_texts(truncated), "\t\t\t\t\t1\n"s);
+
+    bool caught = false;
+    try {
+        Sheet other;
+        ReplayJournal(other, "NOTAWAL!"s + std::string(8, '\0'));
+    } catch (const JournalException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+    std::remove(path.c_str());
+    ASSERT_EQUAL(ReplayJournalFile(truncated, path).operations, 0u);
+}
+
+void TestJournalSyncDuringWrite() {
+    const std::string path = "journal_sync_test.bin";
+    std::remove(path.c_str());
+
+    Sheet sheet;
+    // каждая операция сразу будит фоновый поток, и Sync попадает то до,
+    // то во время записи группы с этой операцией (длинный текст пишется долго)
+    SheetJournal journal(sheet, path, JournalOptions{std::chrono::hours(1), 1});
+    const std::string text(1 << 20, 'x');
+    for (int row = 0; row < 50; ++row) {
+        journal.SetCell(Position{row, 0}, text);
+        const auto wait_until = std::chrono::steady_clock::now() + std::chrono::microseconds(row * 20);
+        while (std::chrono::steady_clock::now() < wait_until) {
+        }
+        journal.Sync();
+        // Sync дожидается fsync группы с операцией, даже если её запись уже шла
+        ASSERT_EQUAL(journal.GetStats().groups, static_cast<size_t>(row + 1));
+    }
+    std::remove(path.c_str());
+}
+
 }  // namespace
 
 int main() {
@@ -461,4 +2280,31 @@ int main() {
     RUN_TEST(tr, TestCellCircularReferences);
     RUN_TEST(tr, TestAlina);
     RUN_TEST(tr, TestSetGetCellFormulaValid);
+    RUN_TEST(tr, TestSparseFarCornerCell);
+    RUN_TEST(tr, TestFormulaBytecodeMatchesTree);
+    RUN_TEST(tr, TestFastParserMatchesAntlr);
+    RUN_TEST(tr, TestErrorPropagatesThroughDependents);
+    RUN_TEST(tr, TestFormulaBoundCells);
+    RUN_TEST(tr, TestTextCellNumericValue);
+    RUN_TEST(tr, TestEagerRecalculation);
+    RUN_TEST(tr, TestParallelRecalculation);
+    RUN_TEST(tr, TestParallelRecalculationRanges);
+    RUN_TEST(tr, TestSetCellsBatch);
+    RUN_TEST(tr, TestTopologicalOrderMaintained);
+    RUN_TEST(tr, TestCellLinks);
+    RUN_TEST(tr, TestLazyInvalidationByRevision);
+    RUN_TEST(tr, TestEarlyCutoff);
+    RUN_TEST(tr, TestRangeFunctions);
+    RUN_TEST(tr, TestRangeDependentsIndex);
+    RUN_TEST(tr, TestRangeAggregatesMatchCells);
+    RUN_TEST(tr, TestLookupFunctions);
+    RUN_TEST(tr, TestConditionalFunctions);
+    RUN_TEST(tr, TestFormulaTemplates);
+    RUN_TEST(tr, TestBatchEvaluation);
+    RUN_TEST(tr, TestSnapshot);
+    RUN_TEST(tr, TestImportTable);
+    RUN_TEST(tr, TestPrintMatchesCells);
+    RUN_TEST(tr, TestViewport);
+    RUN_TEST(tr, TestJournal);
+    RUN_TEST(tr, TestJournalSyncDuringWrite);
 }
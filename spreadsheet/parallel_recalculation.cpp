@@ -0,0 +1,200 @@
+#include "parallel_recalculation.h"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+
+namespace {
+
+// Очередь готовых ячеек одного потока. Владелец работает с концом очереди
+// (последняя добавленная ячейка ещё в кеше процессора), остальные потоки
+// перехватывают работу с начала. Выравнивание убирает ложное разделение
+// кеш-линий между очередями соседних потоков
+class alignas(64) WorkStealingQueue {
+public:
+    void Push(uint32_t task) {
+        std::lock_guard guard(mutex_);
+        tasks_.push_back(task);
+    }
+
+    std::optional<uint32_t> Pop() {
+        std::lock_guard guard(mutex_);
+        if (tasks_.empty()) {
+            return std::nullopt;
+        }
+        uint32_t task = tasks_.back();
+        tasks_.pop_back();
+        return task;
+    }
+
+    std::optional<uint32_t> Steal() {
+        std::lock_guard guard(mutex_);
+        if (tasks_.empty()) {
+            return std::nullopt;
+        }
+        uint32_t task = tasks_.front();
+        tasks_.pop_front();
+        return task;
+    }
+
+private:
+    std::mutex mutex_;
+    std::deque<uint32_t> tasks_;
+};
+
+
+class ParallelRecalculation {
+public:
+    ParallelRecalculation(const RecalculationGraph& graph, size_t threads_count)
+        : graph_(graph)
+        , queues_(threads_count)
+        , pending_inputs_(std::make_unique<std::atomic<uint32_t>[]>(graph.cells.size()))
+        , remaining_(graph.cells.size()) {
+
+        // ячейки без невычисленных входов раздаём потокам по кругу
+        size_t next_queue = 0;
+        for (size_t i = 0; i < graph_.cells.size(); ++i) {
+            pending_inputs_[i].store(graph_.inputs_count[i], std::memory_order_relaxed);
+            if (graph_.inputs_count[i] == 0) {
+                queues_[next_queue].Push(static_cast<uint32_t>(i));
+                next_queue = (next_queue + 1) % queues_.size();
+            }
+        }
+    }
+
+    size_t Run() {
+        std::vector<std::thread> threads;
+        threads.reserve(queues_.size() - 1);
+        for (size_t i = 1; i < queues_.size(); ++i) {
+            threads.emplace_back([this, i] {
+                Work(i);
+            });
+        }
+        Work(0);
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+        return recomputed_count_.load();
+    }
+
+private:
+    const RecalculationGraph& graph_;
+    std::vector<WorkStealingQueue> queues_;
+    std::unique_ptr<std::atomic<uint32_t>[]> pending_inputs_;
+    std::atomic<size_t> remaining_;  // сколько ячеек ещё не вычислено
+    std::atomic<size_t> recomputed_count_ = 0;
+
+    std::atomic<bool> failed_ = false;
+    std::mutex error_mutex_;
+    std::exception_ptr error_;
+
+    std::optional<uint32_t> TakeTask(size_t self) {
+        if (std::optional<uint32_t> task = queues_[self].Pop()) {
+            return task;
+        }
+        for (size_t i = 1; i < queues_.size(); ++i) {
+            if (std::optional<uint32_t> task = queues_[(self + i) % queues_.size()].Steal()) {
+                return task;
+            }
+        }
+        return std::nullopt;
+    }
+
+    void Work(size_t self) {
+        size_t recomputed_count = 0;
+        try {
+            while (remaining_.load(std::memory_order_acquire) > 0 && !failed_.load(std::memory_order_relaxed)) {
+                std::optional<uint32_t> task = TakeTask(self);
+                if (!task) {
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                // Первую ставшую готовой зависимую ячейку вычисляем сразу,
+                // не проходя через очередь: цепочка формул остаётся на одном потоке
+                uint32_t index = *task;
+                while (true) {
+                    if (graph_.cells[index]->RecalculateCache()) {
+                        ++recomputed_count;
+                    }
+
+                    // acq_rel: запись кеша выше видна потоку, который снимет
+                    // последний невычисленный вход зависимой ячейки
+                    bool has_next = false;
+                    uint32_t next = 0;
+                    for (uint32_t i = graph_.dependents_begin[index]; i < graph_.dependents_begin[index + 1]; ++i) {
+                        uint32_t dependent = graph_.dependents[i];
+                        if (pending_inputs_[dependent].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                            if (!has_next) {
+                                next = dependent;
+                                has_next = true;
+                            } else {
+                                queues_[self].Push(dependent);
+                            }
+                        }
+                    }
+                    remaining_.fetch_sub(1, std::memory_order_release);
+
+                    if (!has_next) {
+                        break;
+                    }
+                    index = next;
+                }
+            }
+        } catch (...) {
+            std::lock_guard guard(error_mutex_);
+            if (!error_) {
+                error_ = std::current_exception();
+            }
+            failed_.store(true, std::memory_order_relaxed);
+        }
+        recomputed_count_.fetch_add(recomputed_count, std::memory_order_relaxed);
+    }
+};
+
+}  // namespace
+
+
+RecalculationGraph BuildRecalculationGraph(const std::vector<Cell*>& cells) {
+    RecalculationGraph graph;
+    graph.cells = cells;
+
+    std::unordered_map<const Cell*, uint32_t> indexes;
+    indexes.reserve(cells.size());
+    for (size_t i = 0; i < cells.size(); ++i) {
+        indexes.emplace(cells[i], static_cast<uint32_t>(i));
+    }
+
+    graph.inputs_count.assign(cells.size(), 0);
+    graph.dependents_begin.reserve(cells.size() + 1);
+    for (const Cell* cell : cells) {
+        graph.dependents_begin.push_back(static_cast<uint32_t>(graph.dependents.size()));
+        cell->ForEachDependent([&](Cell* dependent) {
+            uint32_t dependent_index = indexes.at(dependent);
+            graph.dependents.push_back(dependent_index);
+            ++graph.inputs_count[dependent_index];
+        });
+    }
+    graph.dependents_begin.push_back(static_cast<uint32_t>(graph.dependents.size()));
+
+    return graph;
+}
+
+
+size_t RecalculateInParallel(const RecalculationGraph& graph, size_t threads_count) {
+    if (graph.cells.empty()) {
+        return 0;
+    }
+    ParallelRecalculation recalculation(graph, std::max<size_t>(threads_count, 1));
+    return recalculation.Run();
+}
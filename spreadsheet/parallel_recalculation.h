@@ -0,0 +1,32 @@
+#pragma once
+
+#include "cell.h"
+
+#include <cstdint>
+#include <vector>
+
+/*
+Параллельный пересчёт формул.
+Подграф зависимостей один раз переводится в компактный вид (ячейки пронумерованы,
+списки зависимых лежат подряд в одном массиве), после чего ячейки вычисляются
+на нескольких потоках. У каждого потока своя очередь готовых ячеек: поток берёт
+работу с конца своей очереди, а когда она пуста - перехватывает с начала чужой.
+Ячейка становится готовой, когда вычислены все её входы (атомарный счётчик).
+*/
+struct RecalculationGraph {
+    std::vector<Cell*> cells;
+    // зависимые ячейки cells[i]: dependents[dependents_begin[i] .. dependents_begin[i + 1])
+    std::vector<uint32_t> dependents_begin;
+    std::vector<uint32_t> dependents;
+    // сколько ячеек из cells являются входами cells[i]
+    std::vector<uint32_t> inputs_count;
+};
+
+// cells должен содержать вместе с каждой ячейкой все зависящие от неё
+RecalculationGraph BuildRecalculationGraph(const std::vector<Cell*>& cells);
+
+// Вычисляет формулы графа на threads_count потоках (включая вызывающий).
+// Значение ячейки записывается в её кеш до того, как ячейка отмечается
+// вычисленной, поэтому зависимые формулы всегда видят готовый кеш входов.
+// Возвращает количество вычисленных формул
+size_t RecalculateInParallel(const RecalculationGraph& graph, size_t threads_count);
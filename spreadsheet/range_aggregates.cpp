@@ -0,0 +1,192 @@
+#include "range_aggregates.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace {
+
+// наименьшее дерево, которое выделяется под столбец
+constexpr size_t MIN_CAPACITY = 64;
+
+}  // namespace
+
+
+std::vector<int> RangeAggregates::AddRange(Range range) {
+    assert(range.IsValid() && !is_suspended_);
+    if (static_cast<int>(columns_.size()) <= range.to.col) {
+        columns_.resize(range.to.col + 1);
+    }
+    std::vector<int> new_columns;
+    for (int col = range.from.col; col <= range.to.col; ++col) {
+        if (columns_[col].ranges_count++ == 0) {
+            new_columns.push_back(col);
+        }
+    }
+    return new_columns;
+}
+
+
+void RangeAggregates::RemoveRange(Range range) {
+    for (int col = range.from.col; col <= range.to.col; ++col) {
+        Column& column = columns_[col];
+        assert(column.ranges_count > 0);
+        if (--column.ranges_count == 0) {
+            column = Column{};
+        }
+    }
+}
+
+
+void RangeAggregates::Update(Position pos, std::optional<CellInterface::NumericValue> value, bool is_formula, uint64_t changed_at) {
+    if (!IsTracked(pos.col)) {
+        return;
+    }
+    Column& column = columns_[pos.col];
+    // пустая ячейка без изменений ничего не вносит: если и лист пуст (или ещё
+    // не выделен), узлы не меняются. Так начало учёта столбца, где много
+    // пустых ячеек (например, созданных пакетом, см. Sheet::SetContents), дёшево
+    const bool is_empty = !value.has_value() && !is_formula && changed_at == 0;
+    if (is_empty && (static_cast<size_t>(pos.row) >= column.capacity || IsEmpty(column.nodes[column.capacity + pos.row]))) {
+        return;
+    }
+    if (static_cast<size_t>(pos.row) >= column.capacity) {
+        Grow(column, pos.row);
+    }
+
+    size_t node = column.capacity + pos.row;
+    column.nodes[node] = MakeLeaf(value, is_formula, changed_at);
+    for (node /= 2; node > 0; node /= 2) {
+        column.nodes[node] = Combine(column.nodes[2 * node], column.nodes[2 * node + 1]);
+    }
+}
+
+
+bool RangeAggregates::Merge(Range range, Bytecode::Aggregate& aggregate) const {
+    if (!IsRangeTracked(range)) {
+        return false;
+    }
+    return MergeColumns(range, aggregate, [this, &range](int col) {
+        return Query(columns_[col], range.from.row, range.to.row);
+    });
+}
+
+
+std::optional<uint64_t> RangeAggregates::GetChangedAt(Range range) const {
+    if (!IsRangeTracked(range)) {
+        return std::nullopt;
+    }
+    uint64_t changed_at = 0;
+    for (int col = range.from.col; col <= range.to.col; ++col) {
+        changed_at = std::max(changed_at, Query(columns_[col], range.from.row, range.to.row).changed_at);
+    }
+    return changed_at;
+}
+
+
+void RangeAggregates::Suspend() {
+    is_suspended_ = true;
+}
+
+
+std::vector<int> RangeAggregates::Resume() {
+    is_suspended_ = false;
+    std::vector<int> tracked_columns;
+    for (int col = 0; col < static_cast<int>(columns_.size()); ++col) {
+        if (columns_[col].ranges_count > 0) {
+            const uint32_t ranges_count = columns_[col].ranges_count;
+            columns_[col] = Column{};
+            columns_[col].ranges_count = ranges_count;
+            tracked_columns.push_back(col);
+        }
+    }
+    return tracked_columns;
+}
+
+
+bool RangeAggregates::IsRangeTracked(Range range) const {
+    for (int col = range.from.col; col <= range.to.col; ++col) {
+        if (!IsTracked(col)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+RangeAggregates::Node RangeAggregates::MakeLeaf(std::optional<CellInterface::NumericValue> value, bool is_formula,
+                                                uint64_t changed_at) {
+    Node leaf;
+    leaf.formulas = is_formula ? 1 : 0;
+    leaf.changed_at = changed_at;
+    if (value.has_value()) {
+        if (const double* number = std::get_if<double>(&*value)) {
+            leaf.sum = leaf.min = leaf.max = *number;
+            leaf.count = 1;
+        } else {
+            leaf.errors = 1;
+        }
+    }
+    return leaf;
+}
+
+
+RangeAggregates::Node RangeAggregates::Combine(const Node& lhs, const Node& rhs) {
+    Node result;
+    result.sum = lhs.sum + rhs.sum;
+    result.count = lhs.count + rhs.count;
+    if (lhs.count == 0) {
+        result.min = rhs.min;
+        result.max = rhs.max;
+    } else if (rhs.count == 0) {
+        result.min = lhs.min;
+        result.max = lhs.max;
+    } else {
+        // NaN не теряется, в каком бы узле он ни был (std::min и std::max
+        // возвращают первый аргумент, если второй - NaN)
+        result.min = std::isnan(rhs.min) ? rhs.min : std::min(lhs.min, rhs.min);
+        result.max = std::isnan(rhs.max) ? rhs.max : std::max(lhs.max, rhs.max);
+    }
+    result.errors = lhs.errors + rhs.errors;
+    result.formulas = lhs.formulas + rhs.formulas;
+    result.changed_at = std::max(lhs.changed_at, rhs.changed_at);
+    return result;
+}
+
+
+RangeAggregates::Node RangeAggregates::Query(const Column& column, int from_row, int to_row) {
+    return QueryNodes(from_row, to_row, [&column](int first_row, int rows_count) {
+        return GetNode(column, first_row, rows_count);
+    });
+}
+
+
+RangeAggregates::Node RangeAggregates::GetNode(const Column& column, int first_row, int rows_count) {
+    const size_t size = static_cast<size_t>(rows_count);
+    if (static_cast<size_t>(first_row) >= column.capacity) {
+        return {};
+    }
+    if (size > column.capacity) {
+        // узел больше дерева: всё дерево и пустые строки за ним
+        return Combine(column.nodes[1], Node{});
+    }
+    return column.nodes[column.capacity / size + first_row / size];
+}
+
+
+void RangeAggregates::Grow(Column& column, int row) {
+    size_t capacity = std::max(column.capacity, MIN_CAPACITY);
+    while (capacity <= static_cast<size_t>(row)) {
+        capacity *= 2;
+    }
+
+    std::vector<Node> nodes(2 * capacity);
+    if (column.capacity > 0) {
+        std::copy(column.nodes.begin() + column.capacity, column.nodes.end(), nodes.begin() + capacity);
+    }
+    for (size_t node = capacity - 1; node > 0; --node) {
+        nodes[node] = Combine(nodes[2 * node], nodes[2 * node + 1]);
+    }
+    column.capacity = capacity;
+    column.nodes = std::move(nodes);
+}
@@ -0,0 +1,225 @@
+#pragma once
+
+#include "common.h"
+#include "FormulaBytecode.h"
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+/*
+Поддерживаемые свёртки значений ячеек для функций над областями.
+Для каждого столбца, в который попадает хотя бы одна область формулы,
+строится дерево отрезков по строкам. В узле - сумма, количество, минимум
+и максимум чисел, количество ошибок и формул, последнее изменение ячеек.
+Изменение ячейки обновляет O(log строк) узлов своего столбца, свёртка
+области собирается из O(log строк) узлов каждого столбца. Значение свёртки
+зависит только от значений ячеек области, но не от порядка изменений.
+*/
+class RangeAggregates {
+public:
+    // Начинает учёт столбцов области. Возвращает столбцы, учёт которых
+    // только начался: значения их ячеек нужно записать через Update
+    std::vector<int> AddRange(Range range);
+    // Заканчивает учёт столбцов области, добавленной AddRange
+    void RemoveRange(Range range);
+
+    bool IsTracked(int col) const {
+        return !is_suspended_ && col < static_cast<int>(columns_.size()) && columns_[col].ranges_count > 0;
+    }
+
+    // Записывает значение ячейки pos (nullopt - ячейка не учитывается функциями)
+    // и номер изменения таблицы, когда это значение изменилось
+    void Update(Position pos, std::optional<CellInterface::NumericValue> value, bool is_formula, uint64_t changed_at);
+
+    // Вливает в aggregate свёртку области. Возвращает false, если какой-то
+    // столбец области не учитывается или в области есть ошибки - тогда
+    // aggregate не меняется и область надо перебрать по ячейкам
+    bool Merge(Range range, Bytecode::Aggregate& aggregate) const;
+
+    // Последнее изменение ячеек области или nullopt, если область не учитывается
+    std::optional<uint64_t> GetChangedAt(Range range) const;
+
+    // Вызывает func(Position) для каждой формулы области. Возвращает false,
+    // если область не учитывается
+    template <typename Func>
+    bool ForEachFormula(Range range, Func&& func) const;
+
+    // Вливает в aggregate свёртку области, как Merge, но без деревьев: значения
+    // ячеек get_value(Position) складываются в те же узлы и в том же порядке,
+    // поэтому результат совпадает с Merge. Так области сворачиваются, пока
+    // деревья приостановлены. Возвращает false, если в области есть ошибки
+    template <typename GetValue>
+    static bool MergeValues(Range range, Bytecode::Aggregate& aggregate, GetValue&& get_value);
+
+    // На время параллельного пересчёта деревья не обновляются (это не потокобезопасно).
+    // После Resume значения ячеек всех учитываемых столбцов записываются заново
+    void Suspend();
+    // Возвращает учитываемые столбцы
+    std::vector<int> Resume();
+
+    bool IsSuspended() const {
+        return is_suspended_;
+    }
+
+private:
+    struct Node {
+        double sum = 0;
+        double min = 0;
+        double max = 0;
+        uint32_t count = 0;     // сколько чисел
+        uint32_t errors = 0;    // сколько ошибок
+        uint32_t formulas = 0;  // сколько формул
+        uint64_t changed_at = 0;
+    };
+
+    struct Column {
+        uint32_t ranges_count = 0;
+        // листья - nodes[capacity + row], корень - nodes[1]
+        size_t capacity = 0;
+        std::vector<Node> nodes;
+    };
+
+    // Область разбивается на узлы дерева из TREE_ROWS листьев, каким бы ни было
+    // дерево столбца: разбиение и порядок сложения не зависят от capacity
+    static constexpr int TREE_ROWS = Position::MAX_ROWS;
+    static_assert((TREE_ROWS & (TREE_ROWS - 1)) == 0);
+
+    std::vector<Column> columns_;
+    bool is_suspended_ = false;
+
+    bool IsRangeTracked(Range range) const;
+
+    static Node MakeLeaf(std::optional<CellInterface::NumericValue> value, bool is_formula, uint64_t changed_at);
+    static Node Combine(const Node& lhs, const Node& rhs);
+    // Лист без чисел, ошибок, формул и изменений (его суммы тоже нулевые)
+    static bool IsEmpty(const Node& leaf) {
+        return leaf.count == 0 && leaf.errors == 0 && leaf.formulas == 0 && leaf.changed_at == 0;
+    }
+    static Node Query(const Column& column, int from_row, int to_row);
+    // Узел дерева столбца над строками [first_row, first_row + rows_count).
+    // Строки за пределами дерева пусты
+    static Node GetNode(const Column& column, int first_row, int rows_count);
+    // Тот же узел, собранный из значений ячеек столбца col
+    template <typename GetValue>
+    static Node BuildNode(int col, int first_row, int rows_count, GetValue& get_value);
+    // Свёртка строк [from_row, to_row] из узлов get_node(first_row, rows_count)
+    template <typename NodeSource>
+    static Node QueryNodes(int from_row, int to_row, NodeSource&& get_node);
+    // Вливает в aggregate свёртки столбцов области get_column(col)
+    template <typename GetColumn>
+    static bool MergeColumns(Range range, Bytecode::Aggregate& aggregate, GetColumn&& get_column);
+    static void Grow(Column& column, int row);
+};
+
+
+template <typename GetValue>
+bool RangeAggregates::MergeValues(Range range, Bytecode::Aggregate& aggregate, GetValue&& get_value) {
+    return MergeColumns(range, aggregate, [&range, &get_value](int col) {
+        return QueryNodes(range.from.row, range.to.row, [col, &get_value](int first_row, int rows_count) {
+            return BuildNode(col, first_row, rows_count, get_value);
+        });
+    });
+}
+
+
+template <typename GetValue>
+RangeAggregates::Node RangeAggregates::BuildNode(int col, int first_row, int rows_count, GetValue& get_value) {
+    if (rows_count == 1) {
+        return MakeLeaf(get_value(Position{first_row, col}), false, 0);
+    }
+    const int half = rows_count / 2;
+    return Combine(BuildNode(col, first_row, half, get_value), BuildNode(col, first_row + half, half, get_value));
+}
+
+
+template <typename NodeSource>
+RangeAggregates::Node RangeAggregates::QueryNodes(int from_row, int to_row, NodeSource&& get_node) {
+    // узлы слева собираются по возрастанию строк, справа - по убыванию,
+    // так что набор и порядок сложения узлов зависят только от границ области
+    Node left;
+    Node right;
+    int rows_count = 1;
+    for (int lo = TREE_ROWS + from_row, hi = TREE_ROWS + to_row + 1; lo < hi; lo /= 2, hi /= 2, rows_count *= 2) {
+        // на этом уровне TREE_ROWS / rows_count узлов, первый - номер TREE_ROWS / rows_count
+        const int level_begin = TREE_ROWS / rows_count;
+        if (lo & 1) {
+            left = Combine(left, get_node((lo - level_begin) * rows_count, rows_count));
+            ++lo;
+        }
+        if (hi & 1) {
+            --hi;
+            right = Combine(get_node((hi - level_begin) * rows_count, rows_count), right);
+        }
+    }
+    return Combine(left, right);
+}
+
+
+template <typename GetColumn>
+bool RangeAggregates::MergeColumns(Range range, Bytecode::Aggregate& aggregate, GetColumn&& get_column) {
+    std::vector<Node> column_nodes;
+    column_nodes.reserve(range.to.col - range.from.col + 1);
+    for (int col = range.from.col; col <= range.to.col; ++col) {
+        column_nodes.push_back(get_column(col));
+        // первую по порядку ошибку проще найти перебором ячеек
+        if (column_nodes.back().errors > 0) {
+            return false;
+        }
+    }
+
+    for (const Node& node : column_nodes) {
+        if (node.count == 0) {
+            continue;
+        }
+        switch (aggregate.GetFunction()) {
+            case Bytecode::Function::Min:
+                aggregate.Merge(node.min, node.count);
+                break;
+            case Bytecode::Function::Max:
+                aggregate.Merge(node.max, node.count);
+                break;
+            default:
+                aggregate.Merge(node.sum, node.count);
+                break;
+        }
+    }
+    return true;
+}
+
+
+template <typename Func>
+bool RangeAggregates::ForEachFormula(Range range, Func&& func) const {
+    if (!IsRangeTracked(range)) {
+        return false;
+    }
+    for (int col = range.from.col; col <= range.to.col; ++col) {
+        const Column& column = columns_[col];
+        if (column.nodes.empty() || column.nodes[1].formulas == 0) {
+            continue;
+        }
+        // спускаемся только в узлы, где есть формулы: {узел, первая строка, размер}
+        struct Frame {
+            size_t node;
+            int first_row;
+            int rows_count;
+        };
+        std::vector<Frame> frames = {{1, 0, static_cast<int>(column.capacity)}};
+        while (!frames.empty()) {
+            const Frame frame = frames.back();
+            frames.pop_back();
+            const int last_row = frame.first_row + frame.rows_count - 1;
+            if (column.nodes[frame.node].formulas == 0 || last_row < range.from.row || range.to.row < frame.first_row) {
+                continue;
+            }
+            if (frame.rows_count == 1) {
+                func(Position{frame.first_row, col});
+                continue;
+            }
+            const int half = frame.rows_count / 2;
+            frames.push_back({2 * frame.node + 1, frame.first_row + half, half});
+            frames.push_back({2 * frame.node, frame.first_row, half});
+        }
+    }
+    return true;
+}
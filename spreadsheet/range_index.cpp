@@ -0,0 +1,277 @@
+#include "range_index.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <limits>
+
+namespace {
+
+// охватывающий прямоугольник пустого узла
+Range EmptyBounds() {
+    return {Position::NONE, Position::NONE};
+}
+
+bool IsEmptyBounds(Range bounds) {
+    return bounds.from == Position::NONE;
+}
+
+Range Union(Range lhs, Range rhs) {
+    if (IsEmptyBounds(lhs)) {
+        return rhs;
+    }
+    if (IsEmptyBounds(rhs)) {
+        return lhs;
+    }
+    return {Position{std::min(lhs.from.row, rhs.from.row), std::min(lhs.from.col, rhs.from.col)},
+            Position{std::max(lhs.to.row, rhs.to.row), std::max(lhs.to.col, rhs.to.col)}};
+}
+
+int64_t Area(Range range) {
+    if (IsEmptyBounds(range)) {
+        return 0;
+    }
+    return int64_t{range.to.row - range.from.row + 1} * (range.to.col - range.from.col + 1);
+}
+
+// На сколько вырастет площадь bounds, если добавить к нему range
+int64_t Enlargement(Range bounds, Range range) {
+    return Area(Union(bounds, range)) - Area(bounds);
+}
+
+bool Covers(Range outer, Range inner) {
+    return outer.from.row <= inner.from.row && inner.to.row <= outer.to.row
+        && outer.from.col <= inner.from.col && inner.to.col <= outer.to.col;
+}
+
+// Квадратичное разбиение Гуттмана: items делятся на две группы, каждая
+// не меньше min_size, так чтобы охватывающие прямоугольники групп были
+// поменьше. get_bounds(item) - прямоугольник элемента
+template <typename Item, typename GetBounds>
+void SplitItems(std::vector<Item>& items, std::vector<Item>& second, size_t min_size, GetBounds get_bounds) {
+    // затравки - пара, которая хуже всего смотрится в одной группе
+    size_t first_seed = 0;
+    size_t second_seed = 1;
+    int64_t worst_waste = std::numeric_limits<int64_t>::min();
+    for (size_t i = 0; i < items.size(); ++i) {
+        for (size_t j = i + 1; j < items.size(); ++j) {
+            const Range lhs = get_bounds(items[i]);
+            const Range rhs = get_bounds(items[j]);
+            const int64_t waste = Area(Union(lhs, rhs)) - Area(lhs) - Area(rhs);
+            if (waste > worst_waste) {
+                worst_waste = waste;
+                first_seed = i;
+                second_seed = j;
+            }
+        }
+    }
+
+    std::vector<Item> rest;
+    rest.reserve(items.size() - 2);
+    std::vector<Item> first;
+    for (size_t i = 0; i < items.size(); ++i) {
+        if (i == first_seed) {
+            first.push_back(std::move(items[i]));
+        } else if (i == second_seed) {
+            second.push_back(std::move(items[i]));
+        } else {
+            rest.push_back(std::move(items[i]));
+        }
+    }
+    Range first_bounds = get_bounds(first.front());
+    Range second_bounds = get_bounds(second.front());
+
+    while (!rest.empty()) {
+        // если одной из групп нужны все оставшиеся элементы - отдаём их ей
+        if (first.size() + rest.size() <= min_size || second.size() + rest.size() <= min_size) {
+            std::vector<Item>& group = first.size() + rest.size() <= min_size ? first : second;
+            for (Item& item : rest) {
+                group.push_back(std::move(item));
+            }
+            break;
+        }
+
+        // следующий - элемент, для которого выбор группы важнее всего
+        size_t next = 0;
+        int64_t max_difference = -1;
+        for (size_t i = 0; i < rest.size(); ++i) {
+            const Range bounds = get_bounds(rest[i]);
+            const int64_t difference = std::abs(Enlargement(first_bounds, bounds) - Enlargement(second_bounds, bounds));
+            if (difference > max_difference) {
+                max_difference = difference;
+                next = i;
+            }
+        }
+
+        const Range bounds = get_bounds(rest[next]);
+        const int64_t first_enlargement = Enlargement(first_bounds, bounds);
+        const int64_t second_enlargement = Enlargement(second_bounds, bounds);
+        bool to_first = first_enlargement != second_enlargement ? first_enlargement < second_enlargement
+                      : Area(first_bounds) != Area(second_bounds) ? Area(first_bounds) < Area(second_bounds)
+                      : first.size() <= second.size();
+        if (to_first) {
+            first.push_back(std::move(rest[next]));
+            first_bounds = Union(first_bounds, bounds);
+        } else {
+            second.push_back(std::move(rest[next]));
+            second_bounds = Union(second_bounds, bounds);
+        }
+        rest[next] = std::move(rest.back());
+        rest.pop_back();
+    }
+
+    items = std::move(first);
+}
+
+}  // namespace
+
+
+RangeIndex::RangeIndex()
+    : root_(std::make_unique<Node>()) {
+    root_->bounds = EmptyBounds();
+}
+
+RangeIndex::~RangeIndex() = default;
+
+
+void RangeIndex::Insert(Range range, Cell* dependent) {
+    assert(range.IsValid());
+    std::unique_ptr<Node> sibling = InsertInto(*root_, {range, dependent});
+    if (sibling) {
+        // корень разделился - дерево растёт на уровень
+        auto new_root = std::make_unique<Node>();
+        new_root->is_leaf = false;
+        new_root->children.push_back(std::move(root_));
+        new_root->children.push_back(std::move(sibling));
+        UpdateBounds(*new_root);
+        root_ = std::move(new_root);
+    }
+    ++size_;
+}
+
+
+bool RangeIndex::Erase(Range range, Cell* dependent) {
+    std::vector<Entry> orphans;
+    if (!EraseFrom(*root_, {range, dependent}, orphans)) {
+        return false;
+    }
+    --size_;
+
+    // корень с единственным потомком не нужен
+    while (!root_->is_leaf && root_->children.size() == 1) {
+        std::unique_ptr<Node> child = std::move(root_->children.front());
+        root_ = std::move(child);
+    }
+    if (!root_->is_leaf && root_->children.empty()) {
+        root_ = std::make_unique<Node>();
+        root_->bounds = EmptyBounds();
+    }
+
+    for (const Entry& entry : orphans) {
+        --size_;
+        Insert(entry.range, entry.dependent);
+    }
+    return true;
+}
+
+
+std::unique_ptr<RangeIndex::Node> RangeIndex::InsertInto(Node& node, const Entry& entry) {
+    node.bounds = Union(node.bounds, entry.range);
+    if (node.is_leaf) {
+        node.entries.push_back(entry);
+    } else {
+        // потомок, прямоугольник которого вырастет меньше всего
+        auto best = node.children.begin();
+        int64_t best_enlargement = std::numeric_limits<int64_t>::max();
+        for (auto it = node.children.begin(); it != node.children.end(); ++it) {
+            const int64_t enlargement = Enlargement((*it)->bounds, entry.range);
+            if (enlargement < best_enlargement
+                || (enlargement == best_enlargement && Area((*it)->bounds) < Area((*best)->bounds))) {
+                best = it;
+                best_enlargement = enlargement;
+            }
+        }
+        if (std::unique_ptr<Node> sibling = InsertInto(**best, entry)) {
+            node.children.push_back(std::move(sibling));
+        }
+    }
+
+    if (node.GetSize() <= MAX_ENTRIES) {
+        return nullptr;
+    }
+    return Split(node);
+}
+
+
+bool RangeIndex::EraseFrom(Node& node, const Entry& entry, std::vector<Entry>& orphans) {
+    if (node.is_leaf) {
+        auto it = std::find_if(node.entries.begin(), node.entries.end(), [&entry](const Entry& candidate) {
+            return candidate.dependent == entry.dependent && candidate.range == entry.range;
+        });
+        if (it == node.entries.end()) {
+            return false;
+        }
+        *it = node.entries.back();
+        node.entries.pop_back();
+        UpdateBounds(node);
+        return true;
+    }
+
+    for (auto it = node.children.begin(); it != node.children.end(); ++it) {
+        Node& child = **it;
+        if (!Covers(child.bounds, entry.range) || !EraseFrom(child, entry, orphans)) {
+            continue;
+        }
+        // недозаполненный узел убираем, его записи будут добавлены заново
+        if (child.GetSize() < MIN_ENTRIES) {
+            CollectEntries(child, orphans);
+            node.children.erase(it);
+        }
+        UpdateBounds(node);
+        return true;
+    }
+    return false;
+}
+
+
+std::unique_ptr<RangeIndex::Node> RangeIndex::Split(Node& node) {
+    auto sibling = std::make_unique<Node>();
+    sibling->is_leaf = node.is_leaf;
+    if (node.is_leaf) {
+        SplitItems(node.entries, sibling->entries, MIN_ENTRIES, [](const Entry& entry) {
+            return entry.range;
+        });
+    } else {
+        SplitItems(node.children, sibling->children, MIN_ENTRIES, [](const std::unique_ptr<Node>& child) {
+            return child->bounds;
+        });
+    }
+    UpdateBounds(node);
+    UpdateBounds(*sibling);
+    return sibling;
+}
+
+
+void RangeIndex::UpdateBounds(Node& node) {
+    node.bounds = EmptyBounds();
+    if (node.is_leaf) {
+        for (const Entry& entry : node.entries) {
+            node.bounds = Union(node.bounds, entry.range);
+        }
+    } else {
+        for (const auto& child : node.children) {
+            node.bounds = Union(node.bounds, child->bounds);
+        }
+    }
+}
+
+
+void RangeIndex::CollectEntries(Node& node, std::vector<Entry>& entries) {
+    if (node.is_leaf) {
+        entries.insert(entries.end(), node.entries.begin(), node.entries.end());
+        return;
+    }
+    for (const auto& child : node.children) {
+        CollectEntries(*child, entries);
+    }
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class Cell;
+
+/*
+Пространственный индекс областей, на которые ссылаются формулы (R-дерево).
+Каждая запись - прямоугольник области и формула. Листья и узлы хранят
+до MAX_ENTRIES прямоугольников, узел описан общим охватывающим прямоугольником,
+поэтому поиск формул, в области которых лежит ячейка, спускается только
+в узлы, содержащие эту ячейку. Память - O(количества записей), а не
+O(количества ячеек в областях).
+*/
+class RangeIndex {
+public:
+    RangeIndex();
+    ~RangeIndex();
+
+    void Insert(Range range, Cell* dependent);
+    // Удаляет запись, добавленную Insert с теми же аргументами.
+    // Возвращает false, если такой записи нет
+    bool Erase(Range range, Cell* dependent);
+
+    // Вызывает func(Cell*) для каждой записи, область которой содержит pos.
+    // Формула с несколькими такими областями встретится несколько раз
+    template <typename Func>
+    void ForEachContaining(Position pos, Func&& func) const;
+
+    size_t GetSize() const {
+        return size_;
+    }
+
+private:
+    static constexpr size_t MAX_ENTRIES = 16;
+    static constexpr size_t MIN_ENTRIES = MAX_ENTRIES * 2 / 5;
+
+    struct Entry {
+        Range range;
+        Cell* dependent;
+    };
+
+    struct Node {
+        Range bounds;
+        bool is_leaf = true;
+        std::vector<Entry> entries;                  // только у листа
+        std::vector<std::unique_ptr<Node>> children;  // только у внутреннего узла
+
+        size_t GetSize() const {
+            return is_leaf ? entries.size() : children.size();
+        }
+    };
+
+    std::unique_ptr<Node> root_;
+    size_t size_ = 0;
+
+    // Добавляет запись в поддерево node. Если узел переполнился, он делится
+    // пополам - возвращается вторая половина, которую надо добавить к родителю
+    std::unique_ptr<Node> InsertInto(Node& node, const Entry& entry);
+
+    // Удаляет запись из поддерева node. Записи узлов, в которых после этого
+    // осталось слишком мало элементов, переносятся в orphans (узлы удаляются)
+    bool EraseFrom(Node& node, const Entry& entry, std::vector<Entry>& orphans);
+
+    static std::unique_ptr<Node> Split(Node& node);
+    static void UpdateBounds(Node& node);
+    static void CollectEntries(Node& node, std::vector<Entry>& entries);
+};
+
+
+template <typename Func>
+void RangeIndex::ForEachContaining(Position pos, Func&& func) const {
+    if (root_->GetSize() == 0) {
+        return;
+    }
+    std::vector<const Node*> nodes_to_visit = {root_.get()};
+    while (!nodes_to_visit.empty()) {
+        const Node* node = nodes_to_visit.back();
+        nodes_to_visit.pop_back();
+        if (node->is_leaf) {
+            for (const Entry& entry : node->entries) {
+                if (entry.range.Contains(pos)) {
+                    func(entry.dependent);
+                }
+            }
+            continue;
+        }
+        for (const auto& child : node->children) {
+            if (child->bounds.Contains(pos)) {
+                nodes_to_visit.push_back(child.get());
+            }
+        }
+    }
+}
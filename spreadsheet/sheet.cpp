@@ -2,45 +2,45 @@
 
 #include "cell.h"
 #include "common.h"
+#include "parallel_recalculation.h"
+#include "table_writer.h"
 
 #include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <deque>
 #include <functional>
 #include <iostream>
 #include <optional>
 #include <queue>
+#include <thread>
+#include <unordered_set>
 
 using namespace std::literals;
 
-namespace detail {
+namespace {
 
-    struct ValuePrinter {
-        std::ostream& out;
-
-        void operator()(std::string cell_text) const {
-            out << cell_text;
-        }
-        void operator()(double cell_number) const {
-            out << cell_number;
-        }
-        void operator()(const FormulaError& err) const {
-            out << err;
+// Число ячейки для индекса поиска (nullopt - ячейка не совпадёт ни с одним ключом).
+// NaN (текст "nan") не равен ни одному ключу, в том числе себе: в индексе его
+// нельзя было бы найти и удалить
+std::optional<double> GetLookupKey(const Cell& cell) {
+    std::optional<CellInterface::NumericValue> value = cell.GetLastSeenRangeValue();
+    if (value.has_value()) {
+        if (const double* number = std::get_if<double>(&*value); number != nullptr && !std::isnan(*number)) {
+            return *number;
         }
-    };
+    }
+    return std::nullopt;
+}
 
+// Порядок позиций по строкам (Position::operator< упорядочивает не все пары)
+bool RowMajorLess(Position lhs, Position rhs) {
+    return lhs.row < rhs.row || (lhs.row == rhs.row && lhs.col < rhs.col);
+}
 
-}  // namespace detail
+}  // namespace
 
 
-bool Sheet::IsPositionInsidePrintableZone(Position pos) const {
-    if (!pos.IsValid()) {
-        throw InvalidPositionException("Err in IsPositionInsidePrintableZone: Position is out of acceptable table range\n"s);
-    }
-    if ((pos.row + 1) > printable_size_.rows || (pos.col + 1) > printable_size_.cols) {
-        return false;
-    }
-    return true;
-}
-
 // to do:
 Sheet::~Sheet() = default;  // так как используются умные указатели, то дефолтный деструктор должен подойти
 
@@ -51,35 +51,24 @@ void Sheet::SetCell(Position pos, std::string text) {
         throw InvalidPositionException("Err in SetCell: Position is out of acceptable table range\n"s);
     }
 
-    // Обновляем размер при необходимости
-    if (!IsPositionInsidePrintableZone(pos)) {
-        // обновляем кол-во строк
-        printable_size_.rows = std::max(pos.row + 1, printable_size_.rows);
-        sheet_.resize(printable_size_.rows);
-
-        printable_size_.cols = std::max(pos.col + 1, printable_size_.cols);
-        for (int i = 0; i < printable_size_.rows; i ++) {
-            sheet_[i].resize(printable_size_.cols);
-        }
-    }
-
+    const uint64_t revision_before_change = revision_;
 
     // получаем указатель на ячейку, с ним будем работать 
     Cell* cell = GetConcreteCell(pos);
 
     // Если данных нет, то просто записываем ячейку:
     if (cell == nullptr) {
-        // создаем новую ячейку
-        auto cell = std::make_unique<Cell>(*this);
-        cell->Set(text);
-
-        std::vector contained_cells = cell->GetReferencedCells();
-
-        if (std::find(contained_cells.begin(), contained_cells.end(), pos) != contained_cells.end()) {
-            throw CircularDependencyException("Found circular dependency");
+        // помещаем новую пустую ячейку в таблицу до задания текста, 
+        // чтобы ссылка формулы на саму себя обнаружилась как цикл.
+        // Пустая ячейка ни на что не ссылается - её место в начале порядка
+        cell = CreateCell(pos, text.empty() ? topological_order_.NextBottom() : topological_order_.NextTop());
+        try {
+            cell->Set(std::move(text));  // возможны исключения CircularDependency или FormulaException
+        } catch (...) {
+            // на новую ячейку еще никто не ссылается - просто убираем её
+            sheet_.Erase(pos);
+            throw;
         }
-        // помещаем указатель на созданную ячейку в таблицу
-        sheet_[pos.row][pos.col] = std::move(cell); 
     }
     else { 
         // Если текст ячейки не изменился - ничего делать не надо
@@ -99,25 +88,290 @@ void Sheet::SetCell(Position pos, std::string text) {
 
     }
 
-    // обновляем кол-во элементов по строкам и столбцам
+    // обновляем кол-во элементов по строкам и столбцам и размер печатаемой области
     rows_volume[pos.row] += 1;
     cols_volume[pos.col] += 1;
+    printable_size_.rows = std::max(pos.row + 1, printable_size_.rows);
+    printable_size_.cols = std::max(pos.col + 1, printable_size_.cols);
+
+    if (recalculation_mode_ == RecalculationMode::Eager) {
+        RecalculateAfterChange({cell}, revision_before_change);
+    } else {
+        last_recalculation_stats_ = {};
+    }
 
     return;
 }
 
+void Sheet::SetCells(std::vector<CellEdit> edits) {
+    // 1. Проверяем позиции и разбираем тексты. Таблица пока не меняется
+    std::unordered_map<Position, size_t, PositionHasher> last_edit;  // позиция -> индекс последнего изменения
+    for (size_t i = 0; i < edits.size(); ++i) {
+        const Position pos = edits[i].pos;
+        if (!pos.IsValid()) {
+            throw InvalidPositionException("Err in SetCells: Position is out of acceptable table range ["s + std::to_string(pos.row) + ", "s + std::to_string(pos.col) + "]"s);
+        }
+        last_edit[pos] = i;
+    }
+
+    std::vector<std::pair<Position, Cell::Content>> contents;
+    for (size_t i = 0; i < edits.size(); ++i) {
+        const Position pos = edits[i].pos;
+        if (last_edit.at(pos) != i) {
+            continue;
+        }
+        // Если текст ячейки не изменился - ничего делать не надо
+        if (const Cell* cell = sheet_.Get(pos); cell != nullptr && cell->GetText() == edits[i].text) {
+            continue;
+        }
+
+        Cell::Content content = Cell::ParseContent(std::move(edits[i].text), pos, formula_templates_);  // возможно исключение FormulaException
+        contents.emplace_back(pos, std::move(content));
+    }
+
+    SetContents(std::move(contents));
+}
+
+void Sheet::SetContents(std::vector<std::pair<Position, Cell::Content>> contents) {
+    if (contents.empty()) {
+        return;
+    }
+
+    // ячейки пакета, которых ещё нет, могут попасть в области других ячеек пакета.
+    // Упорядочены по строкам, чтобы область находила их двоичным поиском
+    // (импорт передаёт ячейки уже в этом порядке)
+    std::vector<Position> new_positions;
+    for (const auto& [pos, content] : contents) {
+        if (sheet_.Get(pos) == nullptr) {
+            new_positions.push_back(pos);
+        }
+    }
+    if (!std::is_sorted(new_positions.begin(), new_positions.end(), RowMajorLess)) {
+        std::sort(new_positions.begin(), new_positions.end(), RowMajorLess);
+    }
+
+    if (HasCircularDependency(contents, new_positions)) {
+        throw CircularDependencyException("Found circular dependency");
+    }
+
+    // 3. Записываем новые тексты. Зависимые ячейки заметят изменение по версиям.
+    // Сначала снимаем старые ссылки всех ячеек пакета: тогда граф на каждом шаге -
+    // часть итогового, в нём нет циклов, и топологический порядок можно
+    // поддерживать по одной ссылке
+    const uint64_t revision_before_change = revision_;
+    std::unordered_set<Position, PositionHasher> old_referenced_cells;
+    for (const auto& [pos, content] : contents) {
+        Cell* cell = sheet_.Get(pos);
+        if (cell != nullptr && (!cell->GetCellsContainedInThis().empty() || !cell->GetReferencedRanges().empty())) {
+            for (Position referenced : cell->GetReferencedCells()) {
+                old_referenced_cells.insert(referenced);
+            }
+            cell->DetachFromInputs();
+        }
+    }
+
+    // Новые ячейки создаются по очереди, как в SetCell: пока ячейка пакета
+    // не задана, её нет и в областях формул. Раньше своей очереди создаются
+    // только ячейки пакета, на которые ссылается уже заданная формула
+    std::vector<Cell*> changed_cells;
+    changed_cells.reserve(contents.size());
+    for (auto& [pos, content] : contents) {
+        Cell* cell = sheet_.Get(pos);
+        if (cell == nullptr) {
+            cell = CreateCell(pos, topological_order_.NextTop());
+        }
+        // Новая ячейка, которую не переставили формулы областей, стоит выше всех:
+        // ссылки на существующие ячейки порядок не нарушают (как в Cell::Set)
+        const bool is_on_top = topological_order_.IsTop(cell->GetOrderIndex());
+        for (Position referenced : content.GetReferencedCells()) {
+            Cell* input = sheet_.Get(referenced);
+            if (input == nullptr) {
+                // остальные недостающие ячейки SetContent создаст пустыми в начале порядка
+                if (!std::binary_search(new_positions.begin(), new_positions.end(), referenced, RowMajorLess)) {
+                    continue;
+                }
+                input = CreateCell(referenced, topological_order_.NextTop());
+            } else if (is_on_top) {
+                continue;
+            }
+            [[maybe_unused]] bool is_acyclic = topological_order_.AddDependency(input, cell);
+            assert(is_acyclic);
+        }
+        if (!is_on_top) {
+            // ещё не созданные ячейки областей свяжутся с формулой при создании (см. CreateCell)
+            for (const Range& range : content.GetReferencedRanges()) {
+                for (Cell* input : GetCellsInRange(range)) {
+                    [[maybe_unused]] bool is_acyclic = topological_order_.AddDependency(input, cell);
+                    assert(is_acyclic);
+                }
+            }
+        }
+        cell->SetContent(std::move(content));
+        changed_cells.push_back(cell);
+
+        // обновляем кол-во элементов по строкам и столбцам и размер печатаемой области
+        rows_volume[pos.row] += 1;
+        cols_volume[pos.col] += 1;
+        printable_size_.rows = std::max(pos.row + 1, printable_size_.rows);
+        printable_size_.cols = std::max(pos.col + 1, printable_size_.cols);
+    }
+
+    // Удаляем пустые ячейки, у которых не осталось связей после изменений.
+    // Ячейки, заданные в пакете, остаются - как после SetCell
+    for (const auto& [pos, content] : contents) {
+        if (old_referenced_cells.empty()) {
+            break;
+        }
+        old_referenced_cells.erase(pos);
+    }
+    DeleteEmptyUnconnectedCells(std::vector<Position>(old_referenced_cells.begin(), old_referenced_cells.end()));
+
+    if (recalculation_mode_ == RecalculationMode::Eager) {
+        RecalculateAfterChange(changed_cells, revision_before_change);
+    } else {
+        last_recalculation_stats_ = {};
+    }
+}
+
+
+bool Sheet::HasCircularDependency(const std::vector<std::pair<Position, Cell::Content>>& contents,
+                                  const std::vector<Position>& new_positions) const {
+    // Ячейки без ссылок (и отсутствующие) - стоки, в цикл они не входят
+    auto is_sink = [](const Cell* cell) {
+        return cell == nullptr || (cell->GetCellsContainedInThis().empty() && cell->GetReferencedRanges().empty());
+    };
+
+    // Частый случай (импорт, заполнение вниз): ячейки пакета ссылаются только
+    // на позиции раньше себя по строкам, а из существующих ячеек - только на стоки.
+    // Тогда путь по ссылкам от ячейки пакета идёт назад по строкам до стока,
+    // вернуться к ней нельзя - граф не нужен
+    const bool refers_backward = std::all_of(contents.begin(), contents.end(), [&](const auto& edited) {
+        const auto& [pos, content] = edited;
+        const std::vector<Position> referenced_cells = content.GetReferencedCells();
+        const std::vector<Range>& referenced_ranges = content.GetReferencedRanges();
+        return std::all_of(referenced_cells.begin(), referenced_cells.end(), [&](Position referenced) {
+                   return RowMajorLess(referenced, pos) && is_sink(sheet_.Get(referenced));
+               })
+            && std::all_of(referenced_ranges.begin(), referenced_ranges.end(), [&](const Range& range) {
+                   // правый нижний угол - последняя позиция области по строкам
+                   bool has_only_sinks = RowMajorLess(range.to, pos);
+                   if (has_only_sinks) {
+                       sheet_.ForEachInRange(range, [&](Position /* pos */, const Cell* cell) {
+                           has_only_sinks = has_only_sinks && is_sink(cell);
+                       });
+                   }
+                   return has_only_sinks;
+               });
+    });
+    if (refers_backward) {
+        return false;
+    }
+
+    // Цикл, если он появится, проходит через ячейку пакета. Поэтому достаточно
+    // подграфа, достижимого из ячеек пакета по ссылкам (обход в ширину).
+    // Новая ячейка пакета без ссылок (число, текст) при обходе неотличима
+    // от отсутствующей, остальные ячейки пакета - в edited_references.
+    // Ячейки подграфа нумеруются; ссылки ячеек пакета не копируются,
+    // ссылки остальных хранятся в other_references. Стоки в подграф не добавляются
+    std::unordered_map<Position, std::vector<Position>, PositionHasher> edited_references;
+    edited_references.reserve(contents.size());
+    for (const auto& [pos, content] : contents) {
+        std::vector<Position> references = content.GetReferencedCells();
+        AppendRangeReferences(content.GetReferencedRanges(), new_positions, references);
+        if (!references.empty() || sheet_.Get(pos) != nullptr) {
+            edited_references.emplace(pos, std::move(references));
+        }
+    }
+
+    std::unordered_map<Position, size_t, PositionHasher> indexes;
+    indexes.reserve(edited_references.size());
+    std::vector<const std::vector<Position>*> references;
+    references.reserve(edited_references.size());
+    for (const auto& [pos, refs] : edited_references) {
+        indexes.emplace(pos, references.size());
+        references.push_back(&refs);
+    }
+    std::deque<std::vector<Position>> other_references;
+    for (size_t index = 0; index < references.size(); ++index) {
+        for (Position referenced : *references[index]) {
+            const Cell* cell = sheet_.Get(referenced);
+            if (indexes.count(referenced) != 0 || is_sink(cell)) {
+                continue;
+            }
+            indexes.emplace(referenced, references.size());
+            std::vector<Position>& cell_references = other_references.emplace_back(cell->GetReferencedCells());
+            AppendRangeReferences(cell->GetReferencedRanges(), new_positions, cell_references);
+            references.push_back(&cell_references);
+        }
+    }
+
+    // Топологическая сортировка (алгоритм Кана): если упорядочить удалось
+    // не все ячейки подграфа, в нём есть цикл. Рёбра - в номерах ячеек
+    std::vector<std::vector<size_t>> referenced_indexes(references.size());
+    std::vector<int> referencing_count(references.size(), 0);
+    for (size_t index = 0; index < references.size(); ++index) {
+        referenced_indexes[index].reserve(references[index]->size());
+        for (Position referenced : *references[index]) {
+            const auto it = indexes.find(referenced);
+            if (it == indexes.end()) {
+                continue;
+            }
+            referenced_indexes[index].push_back(it->second);
+            ++referencing_count[it->second];
+        }
+    }
+
+    std::vector<size_t> ready_cells;
+    for (size_t index = 0; index < references.size(); ++index) {
+        if (referencing_count[index] == 0) {
+            ready_cells.push_back(index);
+        }
+    }
+    size_t sorted_count = 0;
+    while (!ready_cells.empty()) {
+        const size_t index = ready_cells.back();
+        ready_cells.pop_back();
+        ++sorted_count;
+        for (size_t referenced_index : referenced_indexes[index]) {
+            if (--referencing_count[referenced_index] == 0) {
+                ready_cells.push_back(referenced_index);
+            }
+        }
+    }
+
+    return sorted_count != references.size();
+}
+
+
+void Sheet::AppendRangeReferences(const std::vector<Range>& ranges, const std::vector<Position>& new_positions,
+                                  std::vector<Position>& references) const {
+    for (const Range& range : ranges) {
+        sheet_.ForEachInRange(range, [&references](Position pos, Cell* /* cell */) {
+            references.push_back(pos);
+        });
+        // Перебираются только новые позиции внутри области: вне её столбцов
+        // поиск перескакивает к началу области в той же или следующей строке
+        auto it = std::lower_bound(new_positions.begin(), new_positions.end(), range.from, RowMajorLess);
+        while (it != new_positions.end() && it->row <= range.to.row) {
+            if (it->col < range.from.col) {
+                it = std::lower_bound(it, new_positions.end(), Position{it->row, range.from.col}, RowMajorLess);
+            } else if (it->col > range.to.col) {
+                it = std::lower_bound(it, new_positions.end(), Position{it->row + 1, range.from.col}, RowMajorLess);
+            } else {
+                references.push_back(*it++);
+            }
+        }
+    }
+}
+
+
 const CellInterface* Sheet::GetCell(Position pos) const {
     // проверяем координаты ячейки
     if (!pos.IsValid()) {
         throw InvalidPositionException("Err in const GetCell: Position is out of acceptable table range ["s+ std::to_string(pos.row) + ", "s + std::to_string(pos.col) + "]"s);
     }
 
-    if (!IsPositionInsidePrintableZone(pos)) {
-        return nullptr;
-    }
-
-    const CellInterface* cell = sheet_.at(pos.row).at(pos.col).get();
-    return cell;
+    return sheet_.Get(pos);
 }
 
 CellInterface* Sheet::GetCell(Position pos) {
@@ -126,13 +380,7 @@ CellInterface* Sheet::GetCell(Position pos) {
         throw InvalidPositionException("Err in GetCell: Position is out of acceptable table range ["s + std::to_string(pos.row) + ", "s + std::to_string(pos.col) + "]"s);
     }
 
-    if (!IsPositionInsidePrintableZone(pos)) {
-        return nullptr;
-    }
-
-    CellInterface* cell = sheet_.at(pos.row).at(pos.col).get();
-    
-    return cell;
+    return sheet_.Get(pos);
 }
 
 
@@ -190,7 +438,14 @@ void Sheet::UpdatePrintableAreaAfterClearPosition(Position pos) {
 
 // Удаляет ячейку совсем. Позиция должна быть заранее проверена
 void Sheet::DeleteCell(Position pos) {
-    sheet_[pos.row][pos.col].reset(nullptr);
+    // удаляемая ячейка сама не вычитает свою формулу из счётчика столбца
+    // (при уничтожении листа считать уже нечего)
+    if (GetConcreteCell(pos)->GetBatchTemplate() != nullptr) {
+        CountBatchFormula(pos.col, false);
+    }
+    sheet_.Erase(pos);
+    range_aggregates_.Update(pos, std::nullopt, false, revision_);
+    lookup_index_.Update(pos, std::nullopt);
 
     // Обновляем размер при необходимости
     UpdatePrintableAreaAfterClearPosition(pos);
@@ -219,17 +474,44 @@ void Sheet::ClearCell(Position pos) {
         return;
     }
 
-    // получаем список ячеек, которые ссылались на удаляемую
-    std::unordered_set<Cell*> cells_dependent_on_cleared = cell_to_clear->GetCellsReferencingToThis();
-    
     // Случай 1 - на ячейку никто не ссылался 
-    if (cells_dependent_on_cleared.empty()) {
-        // совсем удаляем ячейку и обновляем печатаемую область
+    if (!cell_to_clear->HasAnyCellsReferencedToThis()) {
+        // Формулы, в области которых входит ячейка, на неё не ссылаются, но её
+        // значение читают. Пустая ячейка в области не учитывается - их не трогаем
+        std::vector<Cell*> range_dependents;
+        if (!cell_to_clear->IsEmptyCell()) {
+            range_dependents = GetRangeDependents(pos);
+        }
+        std::vector<Position> old_referenced_cells = cell_to_clear->GetReferencedCells();
+        const uint64_t revision_before_change = revision_;
+        if (!range_dependents.empty()) {
+            AdvanceRevision();
+        }
+
+        // совсем удаляем ячейку (вместе со связями) и обновляем печатаемую область
+        cell_to_clear->DetachFromInputs();
         DeleteCell(pos);
+        DeleteEmptyUnconnectedCells(old_referenced_cells);
+
+        for (Cell* dependent : range_dependents) {
+            dependent->InvalidateCache();
+        }
+        if (recalculation_mode_ == RecalculationMode::Eager && !range_dependents.empty()) {
+            RecalculateAfterChange(range_dependents, revision_before_change);
+        } else {
+            last_recalculation_stats_ = {};
+        }
     } else {
         // опустошаем ячейку и обновляем печатаемую область
+        const uint64_t revision_before_change = revision_;
         cell_to_clear->ClearContent();
         UpdatePrintableAreaAfterClearPosition(pos);
+
+        if (recalculation_mode_ == RecalculationMode::Eager) {
+            RecalculateAfterChange({cell_to_clear}, revision_before_change);
+        } else {
+            last_recalculation_stats_ = {};
+        }
     }
 
 }
@@ -239,38 +521,122 @@ Size Sheet::GetPrintableSize() const {
 }
 
 void Sheet::PrintValues(std::ostream& output) const {
-    bool is_first_in_row = true;
-    for (int i = 0; i < printable_size_.rows; i++) {
-        is_first_in_row = true;
-        for (int j = 0; j < printable_size_.cols; j++) {
-            if (!is_first_in_row) {
-                output << "\t";
-            }
-            is_first_in_row = false;
-            Position pos_tmp{i,j};
-            if (const CellInterface* cell = GetCell(pos_tmp)) {
-                std::visit(detail::ValuePrinter{output}, cell->GetValue());    
-            }
+    WriteValues(output, GetPrintableRange());
+}
+
+void Sheet::PrintTexts(std::ostream& output) const {
+    WriteTexts(output, GetPrintableRange());
+}
+
+void Sheet::PrintValues(std::ostream& output, Range range) const {
+    CheckRange(range, "PrintValues");
+    WriteValues(output, range);
+}
+
+void Sheet::PrintTexts(std::ostream& output, Range range) const {
+    CheckRange(range, "PrintTexts");
+    WriteTexts(output, range);
+}
+
+void Sheet::GetValues(Range range, CellInterface::Value* values) const {
+    CheckRange(range, "GetValues");
+
+    // пустая позиция - пустая строка; строка в буфере очищается, а не создаётся заново
+    auto set_empty = [](CellInterface::Value& value) {
+        if (std::string* text = std::get_if<std::string>(&value)) {
+            text->clear();
+        } else {
+            value = std::string();
+        }
+    };
+    const int width = range.to.col - range.from.col + 1;
+    for (int row = range.from.row; row <= range.to.row; ++row) {
+        CellInterface::Value* row_values = values + static_cast<size_t>(row - range.from.row) * width;
+        int filled_col = range.from.col;
+        sheet_.ForEachInRange(Range{Position{row, range.from.col}, Position{row, range.to.col}},
+                              [&](Position pos, const Cell* cell) {
+                                  for (; filled_col < pos.col; ++filled_col) {
+                                      set_empty(row_values[filled_col - range.from.col]);
+                                  }
+                                  CellInterface::Value& value = row_values[pos.col - range.from.col];
+                                  if (cell->IsFormulaInCell()) {
+                                      value = cell->GetValue();
+                                  } else {
+                                      std::string_view text = cell->GetStoredText();
+                                      if (!text.empty() && text.front() == ESCAPE_SIGN) {
+                                          text.remove_prefix(1);
+                                      }
+                                      if (std::string* old_text = std::get_if<std::string>(&value)) {
+                                          old_text->assign(text);
+                                      } else {
+                                          value = std::string(text);
+                                      }
+                                  }
+                                  filled_col = pos.col + 1;
+                              });
+        for (; filled_col <= range.to.col; ++filled_col) {
+            set_empty(row_values[filled_col - range.from.col]);
         }
-        output << "\n"s;
     }
 }
 
-void Sheet::PrintTexts(std::ostream& output) const {
-    bool is_first_in_row = true;
-    for (int i = 0; i < printable_size_.rows; i++) {
-        is_first_in_row = true;
-        for (int j = 0; j < printable_size_.cols; j++) {
-            if (!is_first_in_row) {
-                output << "\t";
-            }
-            is_first_in_row = false;
-            Position pos_tmp{i,j};
-            if (const CellInterface* cell = GetCell(pos_tmp)) {
-                output << cell->GetText();
-            } 
+Range Sheet::GetPrintableRange() const {
+    return Range{Position{0, 0}, Position{printable_size_.rows - 1, printable_size_.cols - 1}};
+}
+
+void Sheet::CheckRange(Range range, const char* method) {
+    if (!range.IsValid()) {
+        throw InvalidPositionException("Err in "s + method + ": Range is out of acceptable table range ["s
+                                       + std::to_string(range.from.row) + ", "s + std::to_string(range.from.col) + "] - ["s
+                                       + std::to_string(range.to.row) + ", "s + std::to_string(range.to.col) + "]"s);
+    }
+}
+
+void Sheet::WriteValues(std::ostream& output, Range range) const {
+    TableWriter writer(output);
+    PrintCells(writer, range, [&writer](const Cell& cell) {
+        if (cell.IsFormulaInCell()) {
+            // значение формулы - число или ошибка, строк не копирует
+            std::visit([&writer](const auto& value) {
+                writer.Write(value);
+            }, cell.GetValue());
+            return;
+        }
+        // значение текста - текст без экранирующего символа
+        std::string_view text = cell.GetStoredText();
+        if (!text.empty() && text.front() == ESCAPE_SIGN) {
+            text.remove_prefix(1);
+        }
+        writer.Write(text);
+    });
+    writer.Flush();
+}
+
+void Sheet::WriteTexts(std::ostream& output, Range range) const {
+    TableWriter writer(output);
+    PrintCells(writer, range, [&writer](const Cell& cell) {
+        if (const FormulaInterface* formula = cell.GetFormula()) {
+            writer.Write(FORMULA_SIGN);
+            writer.WriteExpression(*formula);
+            return;
         }
-        output << "\n"s;
+        writer.Write(cell.GetStoredText());
+    });
+    writer.Flush();
+}
+
+void Sheet::PrintCells(TableWriter& writer, Range range, const std::function<void(const Cell&)>& print_cell) const {
+    for (int row = range.from.row; row <= range.to.row; ++row) {
+        // перед ячейкой столбца col в строке стоят col - from.col табуляций
+        int written_col = range.from.col;
+        sheet_.ForEachInRange(Range{Position{row, range.from.col}, Position{row, range.to.col}},
+                              [&](Position pos, const Cell* cell) {
+                                  writer.Write('\t', static_cast<size_t>(pos.col - written_col));
+                                  written_col = pos.col;
+                                  print_cell(*cell);
+                              });
+        writer.Write('\t', static_cast<size_t>(std::max(range.to.col - written_col, 0)));
+        writer.Write('\n');
     }
 }
 
@@ -283,13 +649,7 @@ const Cell* Sheet::GetConcreteCell(Position pos) const {
         throw InvalidPositionException("Err in GetConcreteCell: Position is out of acceptable table range ["s + std::to_string(pos.row) + ", "s + std::to_string(pos.col) + "]"s);
     }
 
-    if (!IsPositionInsidePrintableZone(pos)) {
-        return nullptr;
-    }
-
-    const Cell* cell = sheet_.at(pos.row).at(pos.col).get();
-    
-    return cell;
+    return sheet_.Get(pos);
 }
 
 
@@ -299,13 +659,7 @@ Cell* Sheet::GetConcreteCell(Position pos) {
         throw InvalidPositionException("Err in GetConcreteCell: Position is out of acceptable table range ["s + std::to_string(pos.row) + ", "s + std::to_string(pos.col) + "]"s);
     }
 
-    if (!IsPositionInsidePrintableZone(pos)) {
-        return nullptr;
-    }
-
-    Cell* cell = sheet_.at(pos.row).at(pos.col).get();
-    
-    return cell;
+    return sheet_.Get(pos);
 }
 
 
@@ -324,12 +678,322 @@ void Sheet::DeleteEmptyUnconnectedCells(const std::vector<Position>& cells_to_ch
     return;
 }
 
+Cell* Sheet::CreateCell(Position pos, int64_t order_index) {
+    Cell* cell = sheet_.Put(pos, std::make_unique<Cell>(*this, pos));
+    // номер задаётся до связей с формулами областей: переставленные ими ячейки
+    // должны остаться на своих местах относительно нового номера
+    cell->SetOrderIndex(order_index);
+    for (Cell* dependent : GetRangeDependents(pos)) {
+        // у новой ячейки нет входов - цикла быть не может
+        [[maybe_unused]] bool is_acyclic = topological_order_.AddDependency(cell, dependent);
+        assert(is_acyclic);
+    }
+    return cell;
+}
+
+
+void Sheet::AddRangeDependent(Range range, Cell* dependent) {
+    range_dependents_.Insert(range, dependent);
+    WriteRangeAggregates(range_aggregates_.AddRange(range));
+}
+
+
+void Sheet::RemoveRangeDependent(Range range, Cell* dependent) {
+    [[maybe_unused]] bool is_erased = range_dependents_.Erase(range, dependent);
+    assert(is_erased);
+    range_aggregates_.RemoveRange(range);
+}
+
+
+void Sheet::WriteRangeAggregates(const std::vector<int>& columns) {
+    for (int col : columns) {
+        const Range column{Position{0, col}, Position{Position::MAX_ROWS - 1, col}};
+        sheet_.ForEachInRange(column, [this](Position /* pos */, Cell* cell) {
+            UpdateCellIndexes(*cell);
+        });
+    }
+}
+
+
+void Sheet::UpdateCellIndexes(const Cell& cell) {
+    const Position pos = cell.GetPosition();
+    if (range_aggregates_.IsTracked(pos.col)) {
+        range_aggregates_.Update(pos, cell.GetLastSeenRangeValue(), cell.IsFormulaInCell(), cell.GetChangedAt());
+    }
+    if (lookup_index_.IsIndexed(pos.col)) {
+        lookup_index_.Update(pos, GetLookupKey(cell));
+    }
+}
+
+
+bool Sheet::MergeRangeAggregate(Range range, Bytecode::Aggregate& aggregate) const {
+    if (range_aggregates_.IsSuspended()) {
+        // значения сворачиваются так же, как в деревьях: иначе сумма при параллельном
+        // пересчёте отличалась бы в последних разрядах от суммы при чтении
+        return RangeAggregates::MergeValues(range, aggregate, [this](Position pos) -> std::optional<CellInterface::NumericValue> {
+            const Cell* cell = sheet_.Get(pos);
+            return cell != nullptr ? cell->GetRangeValue() : std::nullopt;
+        });
+    }
+    return range_aggregates_.Merge(range, aggregate);
+}
+
+
+bool Sheet::FindInColumn(Range range, double key, std::optional<int>& row) const {
+    const int col = range.from.col;
+    if (!lookup_index_.IsIndexed(col)) {
+        if (lookup_index_.IsSuspended()) {
+            return false;
+        }
+        lookup_index_.AddColumn(col);
+        const Range column{Position{0, col}, Position{Position::MAX_ROWS - 1, col}};
+        sheet_.ForEachInRange(column, [this](Position pos, Cell* cell) {
+            lookup_index_.Update(pos, GetLookupKey(*cell));
+        });
+    }
+    row = lookup_index_.Find(col, range.from.row, range.to.row, key);
+    return true;
+}
+
+
+void Sheet::ForEachFormulaInRange(Range range, const std::function<void(Cell*)>& func) const {
+    const bool is_tracked = range_aggregates_.ForEachFormula(range, [this, &func](Position pos) {
+        func(sheet_.Get(pos));
+    });
+    if (!is_tracked) {
+        ForEachCellInRange(range, [&func](Cell* cell) {
+            if (cell->IsFormulaInCell()) {
+                func(cell);
+            }
+        });
+    }
+}
+
+
+uint64_t Sheet::GetRangeChangedAt(Range range) const {
+    if (std::optional<uint64_t> changed_at = range_aggregates_.GetChangedAt(range)) {
+        return *changed_at;
+    }
+    uint64_t changed_at = 0;
+    ForEachCellInRange(range, [&changed_at](Cell* cell) {
+        changed_at = std::max(changed_at, cell->GetChangedAt());
+    });
+    return changed_at;
+}
+
+
+std::vector<Cell*> Sheet::GetRangeDependents(Position pos) const {
+    std::vector<Cell*> dependents;
+    range_dependents_.ForEachContaining(pos, [&dependents](Cell* dependent) {
+        dependents.push_back(dependent);
+    });
+    // области одной формулы могут пересекаться
+    if (dependents.size() > 1) {
+        std::sort(dependents.begin(), dependents.end());
+        dependents.erase(std::unique(dependents.begin(), dependents.end()), dependents.end());
+    }
+    return dependents;
+}
+
+
+void Sheet::ForEachCellInRange(Range range, const std::function<void(Cell*)>& func) const {
+    sheet_.ForEachInRange(range, [&func](Position /* pos */, Cell* cell) {
+        func(cell);
+    });
+}
+
+
+std::vector<Cell*> Sheet::GetCellsInRange(Range range) const {
+    std::vector<Cell*> cells;
+    sheet_.ForEachInRange(range, [&cells](Position /* pos */, Cell* cell) {
+        cells.push_back(cell);
+    });
+    return cells;
+}
+
+
 // создает пустую ячейку в месте pos и возвращает указатель на неё
 Cell* Sheet::AddNewEmptyCell(Position pos) {
+    // Номер в начале порядка ячейка получает ещё в SetCell, до связей с формулами
+    // областей. Формула, создающая вход, в этот момент связана не со всеми входами,
+    // и переупорядочивание по номеру сверху могло бы поставить их после неё
     SetCell(pos, std::string());
     return GetConcreteCell(pos);
 }
 
+Cell* Sheet::RestoreCell(Position pos, Cell::Content content) {
+    assert(pos.IsValid() && sheet_.Get(pos) == nullptr);
+    // новая ячейка встаёт в конец топологического порядка - после своих входов
+    Cell* cell = sheet_.Put(pos, std::make_unique<Cell>(*this, pos));
+    cell->SetContent(std::move(content));
+    rows_volume[pos.row] += 1;
+    cols_volume[pos.col] += 1;
+    return cell;
+}
+
+
+void Sheet::RestorePrintableSize(Size size) {
+    printable_size_ = size;
+}
+
+
+void Sheet::SetRecalculationMode(RecalculationMode mode) {
+    recalculation_mode_ = mode;
+    // в режиме Eager у всех формул всегда есть кеш
+    if (mode == RecalculationMode::Eager) {
+        RecalculateAll();
+    }
+}
+
+
+size_t Sheet::RecalculateAll(size_t threads_count) {
+    if (threads_count == 0) {
+        threads_count = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    std::vector<Cell*> cells;
+    cells.reserve(sheet_.GetCellsCount());
+    sheet_.ForEach([&cells](Position /* pos */, Cell* cell) {
+        cells.push_back(cell);
+    });
+
+    last_recalculation_stats_ = {};
+    if (threads_count > 1) {
+        // Деревья свёрток и индексы поиска не потокобезопасны: пока формулы вычисляются
+        // параллельно, области перебираются по ячейкам (см. MergeRangeAggregate).
+        // Они возобновляются и тогда, когда пересчёт прерван исключением
+        class SuspendedIndexes {
+        public:
+            explicit SuspendedIndexes(Sheet& sheet)
+                : sheet_(sheet) {
+                sheet_.range_aggregates_.Suspend();
+                sheet_.lookup_index_.Suspend();
+            }
+            SuspendedIndexes(const SuspendedIndexes&) = delete;
+            SuspendedIndexes& operator=(const SuspendedIndexes&) = delete;
+            ~SuspendedIndexes() {
+                sheet_.WriteRangeAggregates(sheet_.range_aggregates_.Resume());
+                sheet_.lookup_index_.Resume();
+            }
+
+        private:
+            Sheet& sheet_;
+        };
+
+        SuspendedIndexes suspended_indexes(*this);
+        last_recalculation_stats_.recomputed_cells = RecalculateInParallel(BuildRecalculationGraph(cells), threads_count);
+    } else {
+        last_recalculation_stats_.recomputed_cells = RecalculateInTopologicalOrder(cells);
+    }
+    return last_recalculation_stats_.recomputed_cells;
+}
+
+
+void Sheet::EvaluateRange(Range range) const {
+    std::vector<const Cell*> batch;
+    const FormulaTemplate* batch_template = nullptr;
+    auto evaluate_batch = [&batch, &batch_template] {
+        Cell::UpdateCaches(batch);
+        batch.clear();
+        batch_template = nullptr;
+    };
+
+    // столбцы без формул, вычисляемых пачкой, не обходятся
+    std::vector<int> columns;
+    for (int col = range.from.col; col <= range.to.col; ++col) {
+        if (HasBatchFormulas(col)) {
+            columns.push_back(col);
+        }
+    }
+
+    // Область обходится полосами по строкам блоков хранилища: ячейки полосы
+    // помещаются в кеш процессора, пока вычисляются пачки её столбцов
+    for (int first_row = range.from.row; first_row <= range.to.row && !columns.empty();) {
+        const int last_row = std::min(range.to.row, (first_row | (CellStorage::TILE_SIZE - 1)));
+        for (int col : columns) {
+            const Range column{Position{first_row, col}, Position{last_row, col}};
+            // ячейки столбца обходятся сверху вниз
+            sheet_.ForEachInRange(column, [&](Position /* pos */, Cell* cell) {
+                // формулы с областями, ветвлениями и короткие пачкой не вычисляются;
+                // их вычислит чтение значения - так же, как без EvaluateRange
+                const FormulaTemplate* formula_template = cell->GetBatchTemplate();
+                if (formula_template == nullptr || cell->HasCache()) {
+                    return;
+                }
+                if (formula_template != batch_template) {
+                    evaluate_batch();
+                    batch_template = formula_template;
+                }
+                batch.push_back(cell);
+            });
+            evaluate_batch();
+        }
+        first_row = last_row + 1;
+    }
+}
+
+
+void Sheet::RecalculateAfterChange(const std::vector<Cell*>& changed_cells, uint64_t changed_after) {
+    // Ячейки обходятся в топологическом порядке таблицы (см. TopologicalOrder):
+    // к моменту вычисления формулы все её изменённые входы уже вычислены.
+    // Зависимые ячейки попадают в очередь, только если значение ячейки изменилось
+    auto is_later = [](const Cell* lhs, const Cell* rhs) {
+        return lhs->GetOrderIndex() > rhs->GetOrderIndex();
+    };
+    std::priority_queue<Cell*, std::vector<Cell*>, decltype(is_later)> ready_cells(is_later);
+    std::unordered_set<Cell*> queued_cells(changed_cells.begin(), changed_cells.end());
+    for (Cell* cell : changed_cells) {
+        ready_cells.push(cell);
+    }
+
+    // зависимые ячейки с неизменившимися входами, до которых пересчёт не дошёл
+    std::unordered_set<Cell*> skipped_cells;
+
+    last_recalculation_stats_ = {};
+    while (!ready_cells.empty()) {
+        Cell* cell = ready_cells.top();
+        ready_cells.pop();
+
+        if (cell->RevalidateCache() == Cell::RecalculationResult::Recalculated) {
+            ++last_recalculation_stats_.recomputed_cells;
+        }
+
+        const bool is_changed = cell->HasChangedSince(changed_after);
+        cell->ForEachDependent([&](Cell* dependent) {
+            if (queued_cells.count(dependent) != 0) {
+                return;
+            }
+            if (is_changed) {
+                queued_cells.insert(dependent);
+                skipped_cells.erase(dependent);
+                ready_cells.push(dependent);
+            } else {
+                skipped_cells.insert(dependent);
+            }
+        });
+    }
+    last_recalculation_stats_.skipped_cells = skipped_cells.size();
+}
+
+
+size_t Sheet::RecalculateInTopologicalOrder(const std::vector<Cell*>& cells) {
+    // Порядок уже поддерживается (см. TopologicalOrder), связи перебирать не нужно:
+    // через области их может быть намного больше, чем ячеек
+    std::vector<Cell*> ordered_cells = cells;
+    std::sort(ordered_cells.begin(), ordered_cells.end(), [](const Cell* lhs, const Cell* rhs) {
+        return lhs->GetOrderIndex() < rhs->GetOrderIndex();
+    });
+
+    size_t recomputed_count = 0;
+    for (Cell* cell : ordered_cells) {
+        if (cell->RecalculateCache()) {
+            ++recomputed_count;
+        }
+    }
+    return recomputed_count;
+}
+
+
 std::unique_ptr<SheetInterface> CreateSheet() {
     return std::make_unique<Sheet>();
 }
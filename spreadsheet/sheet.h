@@ -1,28 +1,69 @@
 #pragma once
 
 #include "cell.h"
+#include "cell_storage.h"
 #include "common.h"
+#include "lookup_index.h"
+#include "range_aggregates.h"
+#include "range_index.h"
+#include "topological_order.h"
 
 #include <functional>
 #include <unordered_map>
+#include <vector>
 
-class Sheet : public SheetInterface {
-public:
-    Sheet()
-    {   
-        try{
-            sheet_.reserve(Position::MAX_ROWS);
-
-        } catch (const std::exception & err) {
-            std::cout << "ERROR IN Sheet" << std::endl;
-            std::cout << err.what() << std::endl;
-        }
+class TableWriter;
+
+// Изменение одной ячейки в пакете Sheet::SetCells
+struct CellEdit {
+    Position pos;
+    std::string text;
+};
+
+struct PositionHasher {
+    size_t operator()(Position pos) const {
+        return std::hash<int>{}(pos.row * Position::MAX_COLS + pos.col);
     }
+};
+
+// Режим пересчёта формул
+enum class RecalculationMode {
+    Lazy,   // значение формулы вычисляется при первом чтении после изменения
+    Eager,  // после каждого изменения зависимые формулы сразу пересчитываются
+};
+
+// Статистика пересчёта после последнего изменения таблицы. В режиме Lazy
+// накапливается по мере чтения значений
+struct RecalculationStats {
+    size_t recomputed_cells = 0;  // сколько формул было вычислено заново
+    // сколько зависимых формул не вычислялись: значения их входов не изменились
+    // (ранний останов). В режиме Eager зависящие уже от них формулы не проверяются вовсе
+    size_t skipped_cells = 0;
+};
+
+class Sheet : public SheetInterface, public Bytecode::RangeAggregator {
+public:
+    Sheet() = default;
 
     ~Sheet();
 
     void SetCell(Position pos, std::string text) override;
 
+    /*
+    Пакетное изменение ячеек по принципу "всё или ничего". Все тексты сначала
+    разбираются, а циклические зависимости ищутся одной топологической
+    сортировкой затронутого подграфа - до изменения таблицы. При ошибке
+    (InvalidPositionException, FormulaException, CircularDependencyException)
+    таблица остаётся прежней. Затем граф обновляется один раз на весь пакет.
+    Если позиция встречается несколько раз, действует последнее изменение.
+    */
+    void SetCells(std::vector<CellEdit> edits);
+
+    // То же, что SetCells, для уже разобранных текстов (см. Cell::ParseContent) -
+    // например, разобранных параллельно при импорте (см. importer.h).
+    // Позиции должны быть корректны и не повторяться
+    void SetContents(std::vector<std::pair<Position, Cell::Content>> contents);
+
     const CellInterface* GetCell(Position pos) const override;
     CellInterface* GetCell(Position pos) override;
 
@@ -37,6 +78,19 @@ public:
     void PrintValues(std::ostream& output) const override;
     void PrintTexts(std::ostream& output) const override;
 
+    // Печать прямоугольной области range (например, видимой части таблицы) в том
+    // же формате: строка таблицы - строка вывода, включая пустые позиции области.
+    // Обходятся только блоки хранилища области, вычисляются только её формулы
+    void PrintValues(std::ostream& output, Range range) const;
+    void PrintTexts(std::ostream& output, Range range) const;
+
+    // Записывает значения ячеек области range в буфер values построчно: значение
+    // ячейки (row, col) - в values[(row - from.row) * ширина + (col - from.col)].
+    // В буфере должно быть место под все позиции области, пустые получают пустую
+    // строку. Строки буфера переиспользуются: при повторной записи в тот же буфер
+    // (прокрутка) память под тексты заново не выделяется
+    void GetValues(Range range, CellInterface::Value* values) const;
+
     // Эти методы нужны, чтобы иметь доступ к специфическим методам класса Cell,
     // которые не доступны через CellInterface
     const Cell* GetConcreteCell(Position pos) const;
@@ -45,23 +99,180 @@ public:
     // создает пустую ячейку в месте pos и возвращает указатель на неё
     Cell* AddNewEmptyCell(Position pos);
 
+    // Восстановление таблицы из снимка (см. snapshot.h). Ячейки добавляются
+    // в сохранённом топологическом порядке: входы формулы к этому моменту уже
+    // в таблице, поэтому циклы не ищутся. Позиция должна быть свободна
+    Cell* RestoreCell(Position pos, Cell::Content content);
+    void RestorePrintableSize(Size size);
+
+    // Регистрирует зависимость формулы dependent от области range.
+    // Ячейки области при этом не создаются и не связываются с формулой
+    void AddRangeDependent(Range range, Cell* dependent);
+    // Снимает зависимость, добавленную AddRangeDependent
+    void RemoveRangeDependent(Range range, Cell* dependent);
+    // Формулы, в области которых входит позиция pos (без повторов)
+    std::vector<Cell*> GetRangeDependents(Position pos) const;
+
+    // Существующие ячейки области
+    std::vector<Cell*> GetCellsInRange(Range range) const;
+    void ForEachCellInRange(Range range, const std::function<void(Cell*)>& func) const;
+    // Формулы области - без перебора остальных ячеек
+    void ForEachFormulaInRange(Range range, const std::function<void(Cell*)>& func) const;
+    // Последнее изменение значений ячеек области (см. Cell::GetChangedAt)
+    uint64_t GetRangeChangedAt(Range range) const;
+
+    // Вызывается ячейкой, значение которой для функций над областями могло измениться:
+    // обновляет свёртки областей и индексы поиска
+    void UpdateCellIndexes(const Cell& cell);
+    bool MergeRangeAggregate(Range range, Bytecode::Aggregate& aggregate) const override;
+    // Индекс столбца строится при первом поиске в нём
+    bool FindInColumn(Range range, double key, std::optional<int>& row) const override;
+
+    // Формулы ячеек разбираются через таблицу шаблонов (см. FormulaTemplates)
+    FormulaTemplates& GetFormulaTemplates() {
+        return formula_templates_;
+    }
+    const FormulaTemplates& GetFormulaTemplates() const {
+        return formula_templates_;
+    }
+
+    TopologicalOrder& GetTopologicalOrder() {
+        return topological_order_;
+    }
+
+    // Номер последнего изменения таблицы. Растёт с каждым изменением ячейки
+    uint64_t GetRevision() const {
+        return revision_;
+    }
+    // Вызывается ячейкой при изменении, возвращает номер этого изменения
+    uint64_t AdvanceRevision() {
+        return ++revision_;
+    }
+
+    // При переключении в Eager сразу вычисляются все формулы таблицы
+    void SetRecalculationMode(RecalculationMode mode);
+    RecalculationMode GetRecalculationMode() const {
+        return recalculation_mode_;
+    }
+
+    // Заново вычисляет все формулы таблицы в топологическом порядке.
+    // threads_count > 1 - независимые части графа вычисляются параллельно
+    // на threads_count потоках, 0 - по числу ядер процессора.
+    // Возвращает количество вычисленных формул
+    size_t RecalculateAll(size_t threads_count = 1);
+
+    // Проверяет кеш формул области так же, как чтение их значений в режиме Lazy.
+    // Идущие в столбце подряд формулы одного шаблона (столбец, заполненный
+    // протяжкой) вычисляются пачками (см. Cell::UpdateCaches). Формулы, которые
+    // пачкой не выполняются (см. Bytecode::Program::IsBatchable), остаются
+    // до чтения: вычислять их заранее по одной не быстрее
+    void EvaluateRange(Range range) const;
+
+    const RecalculationStats& GetLastRecalculationStats() const {
+        return last_recalculation_stats_;
+    }
+
+    // Вызывается ячейкой, в которой появилась или исчезла формула,
+    // вычисляемая пачкой (см. Cell::GetBatchTemplate)
+    void CountBatchFormula(int col, bool is_added) {
+        batch_formulas_in_cols_[col] += is_added ? 1 : -1;
+    }
+
+    // Есть ли в столбце формулы, вычисляемые пачкой: остальные столбцы EvaluateRange пропускает
+    bool HasBatchFormulas(int col) const {
+        const auto count = batch_formulas_in_cols_.find(col);
+        return count != batch_formulas_in_cols_.end() && count->second > 0;
+    }
+
+    // Вызывается ячейкой, проверившей свой кеш при чтении в режиме Lazy
+    void CountLazyRecalculation(bool recomputed) {
+        if (recomputed) {
+            ++last_recalculation_stats_.recomputed_cells;
+        } else {
+            ++last_recalculation_stats_.skipped_cells;
+        }
+    }
+
 private:
 
     Size printable_size_;
     std::unordered_map<int, int> rows_volume;  // кол-во ячеек в строке
     std::unordered_map<int, int> cols_volume;  // кол-во ячеек в столбце
+    // кол-во формул, вычисляемых пачкой, в столбце: остальные столбцы EvaluateRange пропускает
+    std::unordered_map<int, int> batch_formulas_in_cols_;
+
+    // топологический порядок ячеек: проверка циклов за O(затронутой области)
+    TopologicalOrder topological_order_;
 
-    using Table = std::vector<std::vector<std::unique_ptr<Cell>>>;
-    Table sheet_; 
+    // общие разобранные формулы ячеек; объявлены до ячеек и переживают их
+    FormulaTemplates formula_templates_;
 
-    bool IsPositionInsidePrintableZone(Position pos) const;
+    // ячейки хранятся разреженно, блоками 64x64 (см. CellStorage)
+    CellStorage sheet_;
+
+    // Зависимости формул от областей: одна запись на область формулы,
+    // формулы, зависящие от ячейки, ищутся по R-дереву (см. RangeIndex)
+    RangeIndex range_dependents_;
+    // свёртки столбцов, на которые ссылаются области
+    RangeAggregates range_aggregates_;
+    // индексы столбцов, в которых искали функции поиска. Строятся лениво
+    // при вычислении формулы, поэтому mutable
+    mutable LookupIndex lookup_index_;
+
+    // Записывает в range_aggregates_ значения ячеек столбцов columns
+    void WriteRangeAggregates(const std::vector<int>& columns);
+
+    // Создаёт пустую ячейку на позиции pos с номером order_index в топологическом
+    // порядке. Формулы, в области которых попала ячейка, переставляются после неё
+    Cell* CreateCell(Position pos, int64_t order_index);
 
     void DeleteCell(Position pos);
 
+    // Вся печатаемая область (при пустой таблице - область без позиций)
+    Range GetPrintableRange() const;
+
+    // Проверяет область, переданную в методы печати и чтения
+    static void CheckRange(Range range, const char* method);
+
+    void WriteValues(std::ostream& output, Range range) const;
+    void WriteTexts(std::ostream& output, Range range) const;
+
+    // Пишет область построчно: ячейки - через print_cell, пустые позиции
+    // пропускаются, между столбцами - табуляции. Обходит хранилище по блокам,
+    // а не каждую позицию
+    void PrintCells(TableWriter& writer, Range range, const std::function<void(const Cell&)>& print_cell) const;
+
     // Определяет новый размер печатаемой области после удаления ячейки из pos
     // Также обновляет данные по кол-ву ячеек в строках и столбцах
     void UpdatePrintableAreaAfterClearPosition(Position pos);
 
     void DeleteEmptyUnconnectedCells(const std::vector<Position>& cells_to_check);
 
+    uint64_t revision_ = 0;
+
+    RecalculationMode recalculation_mode_ = RecalculationMode::Lazy;
+    RecalculationStats last_recalculation_stats_;
+
+    // Есть ли цикл в графе, если ячейки пакета contents получат новое содержимое
+    // (а остальные останутся как сейчас). new_positions - ещё не созданные
+    // ячейки пакета, см. AppendRangeReferences
+    bool HasCircularDependency(const std::vector<std::pair<Position, Cell::Content>>& contents,
+                               const std::vector<Position>& new_positions) const;
+
+    // Дописывает в references позиции ячеек областей ranges: существующих
+    // и тех из new_positions, что попали в области (они будут созданы).
+    // new_positions упорядочены по строкам, затем по столбцам
+    void AppendRangeReferences(const std::vector<Range>& ranges, const std::vector<Position>& new_positions,
+                               std::vector<Position>& references) const;
+
+    // В режиме Eager пересчитывает изменённые ячейки и зависящие от них.
+    // changed_after - номер изменения таблицы перед правкой changed_cells.
+    // Дальше ячейки, значение которой не изменилось, пересчёт не идёт (ранний останов)
+    void RecalculateAfterChange(const std::vector<Cell*>& changed_cells, uint64_t changed_after);
+
+    // Вычисляет формулы из cells в топологическом порядке таблицы (без рекурсии).
+    // cells должен содержать вместе с каждой ячейкой все зависящие от неё.
+    // Возвращает количество вычисленных формул
+    size_t RecalculateInTopologicalOrder(const std::vector<Cell*>& cells);
+
 };
\ No newline at end of file
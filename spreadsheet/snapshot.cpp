@@ -0,0 +1,412 @@
+#include "snapshot.h"
+
+#include "file_header.h"
+#include "sheet.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std::literals;
+
+namespace {
+
+constexpr FileFormat SNAPSHOT_FORMAT{"SHEETSNP"sv, SNAPSHOT_VERSION, "snapshot"sv};
+
+struct Header {
+    FileHeader file;
+    int32_t printable_rows;
+    int32_t printable_cols;
+    uint64_t templates_count;
+    uint64_t cells_count;
+    uint64_t strings_size;
+};
+
+// Отрезок блока строк
+struct StringRef {
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct TemplateRecord {
+    int32_t row;
+    int32_t col;
+    StringRef expression;  // без знака =
+};
+
+enum class CellKind : uint8_t {
+    Empty,
+    Text,
+    Formula,
+};
+
+enum class ValueKind : uint8_t {
+    None,  // кеша нет - формула вычислится при чтении
+    Number,
+    Error,
+};
+
+struct CellRecord {
+    int32_t row;
+    int32_t col;
+    CellKind kind;
+    ValueKind value_kind;
+    uint8_t error_category;  // FormulaError::Category, если value_kind == Error
+    uint8_t reserved;
+    uint32_t template_index;  // для формулы
+    StringRef text;           // для текста
+    double number;            // если value_kind == Number
+};
+
+// записи читаются прямо из отображённого файла: размер и выравнивание
+// полей не должны зависеть от компилятора
+static_assert(sizeof(Header) == 48 && sizeof(TemplateRecord) == 24 && sizeof(CellRecord) == 40);
+static_assert(std::is_trivially_copyable_v<Header> && std::is_trivially_copyable_v<TemplateRecord>
+              && std::is_trivially_copyable_v<CellRecord>);
+
+template <typename Record>
+void WriteRecords(std::ostream& output, const std::vector<Record>& records) {
+    output.write(reinterpret_cast<const char*>(records.data()), static_cast<std::streamsize>(records.size() * sizeof(Record)));
+}
+
+
+// Читает снимок, проверяя каждую запись: повреждённый файл не должен
+// привести к некорректной таблице
+class SnapshotReader {
+public:
+    explicit SnapshotReader(std::string_view data)
+        : data_(data) {
+    }
+
+    std::unique_ptr<Sheet> Read() {
+        if (data_.size() < sizeof(Header)) {
+            throw SnapshotException("Snapshot is truncated"s);
+        }
+        const Header header = ReadRecord<Header>(0);
+        if (std::string error = CheckFileHeader(header.file, SNAPSHOT_FORMAT); !error.empty()) {
+            throw SnapshotException(error);
+        }
+        CheckSections(header);
+        if (header.printable_rows < 0 || header.printable_rows > Position::MAX_ROWS || header.printable_cols < 0
+            || header.printable_cols > Position::MAX_COLS) {
+            throw SnapshotException("Snapshot has invalid printable size"s);
+        }
+
+        auto sheet = std::make_unique<Sheet>();
+        FormulaTemplates& templates = sheet->GetFormulaTemplates();
+
+        // формула в ячейке, где записан шаблон; формулы остальных ячеек шаблона - её копии
+        std::vector<std::unique_ptr<FormulaInterface>> prototypes;
+        prototypes.reserve(header.templates_count);
+        for (uint64_t i = 0; i < header.templates_count; ++i) {
+            const TemplateRecord record = ReadRecord<TemplateRecord>(templates_offset_ + i * sizeof(TemplateRecord));
+            const Position home = CheckPosition(record.row, record.col);
+            try {
+                prototypes.push_back(templates.ParseFormula(GetString(record.expression), home));
+            } catch (const FormulaException&) {
+                throw SnapshotException("Snapshot contains an invalid formula"s);
+            }
+        }
+
+        // кеш записывается после всех ячеек: его версия - последняя версия таблицы
+        std::vector<std::pair<Cell*, CellInterface::Value>> cached_values;
+        for (uint64_t i = 0; i < header.cells_count; ++i) {
+            const CellRecord record = ReadRecord<CellRecord>(cells_offset_ + i * sizeof(CellRecord));
+            const Position pos = CheckPosition(record.row, record.col);
+            if (sheet->GetConcreteCell(pos) != nullptr) {
+                throw SnapshotException("Snapshot contains cell "s + pos.ToString() + " twice"s);
+            }
+            // формулы, в области которых ячейка, идут в порядке после неё
+            if (!sheet->GetRangeDependents(pos).empty()) {
+                throw SnapshotException("Snapshot cells are not in topological order"s);
+            }
+
+            Cell* cell = sheet->RestoreCell(pos, ReadContent(record, pos, prototypes, templates, *sheet));
+            if (record.value_kind != ValueKind::None) {
+                if (record.kind != CellKind::Formula) {
+                    throw SnapshotException("Snapshot contains a value of a non-formula cell"s);
+                }
+                cached_values.emplace_back(cell, ReadValue(record));
+            }
+        }
+        for (auto& [cell, value] : cached_values) {
+            cell->RestoreCache(std::move(value));
+        }
+
+        sheet->RestorePrintableSize(Size{header.printable_rows, header.printable_cols});
+        return sheet;
+    }
+
+private:
+    std::string_view data_;
+    uint64_t templates_offset_ = 0;
+    uint64_t cells_offset_ = 0;
+    uint64_t strings_offset_ = 0;
+    uint64_t strings_size_ = 0;
+
+    // Запись копируется: в буфере она может быть не выровнена
+    template <typename Record>
+    Record ReadRecord(uint64_t offset) const {
+        Record record;
+        std::memcpy(&record, data_.data() + offset, sizeof(Record));
+        return record;
+    }
+
+    // Размеры разделов должны в точности складываться в размер снимка
+    void CheckSections(const Header& header) {
+        const uint64_t size = data_.size();
+        if (header.templates_count > size / sizeof(TemplateRecord) || header.cells_count > size / sizeof(CellRecord)
+            || header.strings_size > size) {
+            throw SnapshotException("Snapshot is truncated"s);
+        }
+        templates_offset_ = sizeof(Header);
+        cells_offset_ = templates_offset_ + header.templates_count * sizeof(TemplateRecord);
+        strings_offset_ = cells_offset_ + header.cells_count * sizeof(CellRecord);
+        strings_size_ = header.strings_size;
+        if (strings_offset_ + strings_size_ != size) {
+            throw SnapshotException("Snapshot is truncated"s);
+        }
+    }
+
+    std::string_view GetString(StringRef ref) const {
+        if (ref.offset > strings_size_ || ref.size > strings_size_ - ref.offset) {
+            throw SnapshotException("Snapshot contains an invalid string reference"s);
+        }
+        return data_.substr(strings_offset_ + ref.offset, ref.size);
+    }
+
+    static Position CheckPosition(int32_t row, int32_t col) {
+        const Position pos{row, col};
+        if (!pos.IsValid()) {
+            throw SnapshotException("Snapshot contains an invalid position"s);
+        }
+        return pos;
+    }
+
+    Cell::Content ReadContent(const CellRecord& record, Position pos,
+                              const std::vector<std::unique_ptr<FormulaInterface>>& prototypes,
+                              FormulaTemplates& templates, const Sheet& sheet) const {
+        switch (record.kind) {
+            case CellKind::Empty:
+                return Cell::ParseContent(std::string(), pos, templates);
+
+            case CellKind::Text: {
+                const std::string_view text = GetString(record.text);
+                // такой текст разобрался бы как пустая ячейка или формула
+                if (text.empty() || (text.size() > 1 && text.front() == FORMULA_SIGN)) {
+                    throw SnapshotException("Snapshot contains an invalid text cell"s);
+                }
+                return Cell::ParseContent(std::string(text), pos, templates);
+            }
+
+            case CellKind::Formula: {
+                if (record.template_index >= prototypes.size()) {
+                    throw SnapshotException("Snapshot contains an invalid formula reference"s);
+                }
+                std::unique_ptr<FormulaInterface> formula = prototypes[record.template_index]->CopyTo(pos);
+                // входы формулы восстановлены раньше неё - значит, циклов нет
+                for (Position input : formula->GetReferencedCells()) {
+                    if (!input.IsValid() || sheet.GetConcreteCell(input) == nullptr) {
+                        throw SnapshotException("Snapshot cells are not in topological order"s);
+                    }
+                }
+                for (const Range& range : formula->GetReferencedRanges()) {
+                    // область сдвигается вместе с формулой и может выйти за таблицу,
+                    // если ячейка шаблона повреждена
+                    if (!range.IsValid()) {
+                        throw SnapshotException("Snapshot contains an invalid position"s);
+                    }
+                    if (range.Contains(pos)) {
+                        throw SnapshotException("Snapshot contains a circular dependency"s);
+                    }
+                }
+                return Cell::MakeFormulaContent(std::move(formula));
+            }
+        }
+        throw SnapshotException("Snapshot contains a cell of unknown kind"s);
+    }
+
+    static CellInterface::Value ReadValue(const CellRecord& record) {
+        switch (record.value_kind) {
+            case ValueKind::Number:
+                return record.number;
+            case ValueKind::Error:
+                if (record.error_category > static_cast<uint8_t>(FormulaError::Category::NotAvailable)) {
+                    break;
+                }
+                return FormulaError(static_cast<FormulaError::Category>(record.error_category));
+            case ValueKind::None:
+                break;
+        }
+        throw SnapshotException("Snapshot contains an invalid value"s);
+    }
+};
+
+
+#if defined(__linux__) || defined(__APPLE__)
+
+// Файл, отображённый в память только для чтения
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw SnapshotException("Can't open snapshot file "s + path);
+        }
+        struct stat file_stat {};
+        if (fstat(fd, &file_stat) != 0) {
+            close(fd);
+            throw SnapshotException("Can't open snapshot file "s + path);
+        }
+        size_ = static_cast<size_t>(file_stat.st_size);
+        if (size_ > 0) {
+            void* address = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address == MAP_FAILED) {
+                close(fd);
+                throw SnapshotException("Can't map snapshot file "s + path);
+            }
+            address_ = address;
+            // снимок читается от начала до конца
+            madvise(address_, size_, MADV_SEQUENTIAL);
+        }
+        // отображение остаётся действительным и после закрытия файла
+        close(fd);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (address_ != nullptr) {
+            munmap(address_, size_);
+        }
+    }
+
+    std::string_view GetData() const {
+        return {static_cast<const char*>(address_), size_};
+    }
+
+private:
+    void* address_ = nullptr;
+    size_t size_ = 0;
+};
+
+#else
+
+// Без mmap файл читается в буфер целиком
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+        std::ifstream input(path, std::ios::binary);
+        if (!input) {
+            throw SnapshotException("Can't open snapshot file "s + path);
+        }
+        data_.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+    }
+
+    std::string_view GetData() const {
+        return data_;
+    }
+
+private:
+    std::string data_;
+};
+
+#endif
+
+}  // namespace
+
+
+void SaveSnapshot(const Sheet& sheet, std::ostream& output) {
+    // ячейки записываются в топологическом порядке: при загрузке входы
+    // формулы создаются раньше неё
+    std::vector<const Cell*> cells;
+    const Range all_cells{Position{0, 0}, Position{Position::MAX_ROWS - 1, Position::MAX_COLS - 1}};
+    sheet.ForEachCellInRange(all_cells, [&cells](const Cell* cell) {
+        cells.push_back(cell);
+    });
+    std::sort(cells.begin(), cells.end(), [](const Cell* lhs, const Cell* rhs) {
+        return lhs->GetOrderIndex() < rhs->GetOrderIndex();
+    });
+
+    std::string strings;
+    auto add_string = [&strings](std::string_view str) {
+        const StringRef ref{strings.size(), str.size()};
+        strings.append(str);
+        return ref;
+    };
+
+    std::vector<TemplateRecord> templates;
+    std::unordered_map<const FormulaTemplate*, uint32_t> template_indexes;
+    std::vector<CellRecord> records;
+    records.reserve(cells.size());
+    for (const Cell* cell : cells) {
+        const Position pos = cell->GetPosition();
+        CellRecord record{};
+        record.row = pos.row;
+        record.col = pos.col;
+        if (const FormulaInterface* formula = cell->GetFormula()) {
+            record.kind = CellKind::Formula;
+            const auto [it, is_new] = template_indexes.emplace(formula->GetTemplate(), static_cast<uint32_t>(templates.size()));
+            if (is_new) {
+                templates.push_back({pos.row, pos.col, add_string(formula->GetExpression())});
+            }
+            record.template_index = it->second;
+            // сохраняется только проверенный кеш: чтение его не вычисляет
+            if (cell->HasCache()) {
+                const CellInterface::Value value = cell->GetValue();
+                if (const double* number = std::get_if<double>(&value)) {
+                    record.value_kind = ValueKind::Number;
+                    record.number = *number;
+                } else {
+                    record.value_kind = ValueKind::Error;
+                    record.error_category = static_cast<uint8_t>(std::get<FormulaError>(value).GetCategory());
+                }
+            }
+        } else if (cell->IsEmptyCell()) {
+            record.kind = CellKind::Empty;
+        } else {
+            record.kind = CellKind::Text;
+            record.text = add_string(cell->GetText());
+        }
+        records.push_back(record);
+    }
+
+    const Size printable_size = sheet.GetPrintableSize();
+    Header header{};
+    header.file = MakeFileHeader(SNAPSHOT_FORMAT);
+    header.printable_rows = printable_size.rows;
+    header.printable_cols = printable_size.cols;
+    header.templates_count = templates.size();
+    header.cells_count = records.size();
+    header.strings_size = strings.size();
+
+    output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    WriteRecords(output, templates);
+    WriteRecords(output, records);
+    output.write(strings.data(), static_cast<std::streamsize>(strings.size()));
+}
+
+
+std::unique_ptr<Sheet> LoadSnapshot(std::string_view data) {
+    return SnapshotReader(data).Read();
+}
+
+
+std::unique_ptr<Sheet> LoadSnapshotFile(const std::string& path) {
+    const MappedFile file(path);
+    return LoadSnapshot(file.GetData());
+}
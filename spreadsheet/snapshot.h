@@ -0,0 +1,49 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+class Sheet;
+
+/*
+Двоичный снимок таблицы - быстрое сохранение и загрузка без повторного
+задания ячеек через SetCell.
+
+Формат (версия SNAPSHOT_VERSION, числа в порядке байтов машины, которая
+записала снимок - при другом порядке загрузка отказывает):
+  заголовок: сигнатура, версия, размер печатаемой области, размеры разделов;
+  шаблоны формул: выражение и ячейка, в которой оно записано. Заполненный
+    протяжкой столбец - один шаблон (см. FormulaTemplates);
+  ячейки: записи фиксированного размера в топологическом порядке таблицы -
+    входы формулы всегда раньше неё. Формула - номер шаблона, текст - ссылка
+    в блок строк. Для формул с проверенным кешем сохраняется значение;
+  строки: тексты ячеек и выражения шаблонов подряд.
+
+При загрузке каждый шаблон разбирается один раз, формулы ячеек - его копии
+(см. FormulaInterface::CopyTo). Граф строится по сохранённому порядку без
+поиска циклов, кеш формул восстанавливается без вычисления.
+*/
+
+inline constexpr uint32_t SNAPSHOT_VERSION = 1;
+
+// Исключение, выбрасываемое при загрузке повреждённого или несовместимого снимка
+class SnapshotException : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Записывает снимок таблицы в output (поток должен быть открыт в двоичном режиме)
+void SaveSnapshot(const Sheet& sheet, std::ostream& output);
+
+// Восстанавливает таблицу из снимка, лежащего в памяти. Бросает SnapshotException
+std::unique_ptr<Sheet> LoadSnapshot(std::string_view data);
+
+// Восстанавливает таблицу из файла снимка. Файл отображается в память (mmap)
+// и читается на месте, без копирования в буфер. Бросает SnapshotException
+std::unique_ptr<Sheet> LoadSnapshotFile(const std::string& path);
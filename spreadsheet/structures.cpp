@@ -213,6 +213,43 @@ Position Position::FromString(std::string_view str) {
 
 }
 
+bool Range::operator==(Range rhs) const {
+    return from == rhs.from && to == rhs.to;
+}
+
+bool Range::IsValid() const {
+    return from.IsValid() && to.IsValid() && from.row <= to.row && from.col <= to.col;
+}
+
+bool Range::Contains(Position pos) const {
+    return from.row <= pos.row && pos.row <= to.row && from.col <= pos.col && pos.col <= to.col;
+}
+
+std::string Range::ToString() const {
+    if (!IsValid()) {
+        return ""s;
+    }
+    return from.ToString() + ':' + to.ToString();
+}
+
+Range Range::FromCorners(Position first, Position second) {
+    return {Position{std::min(first.row, second.row), std::min(first.col, second.col)},
+            Position{std::max(first.row, second.row), std::max(first.col, second.col)}};
+}
+
+Range Range::FromString(std::string_view str) {
+    const size_t colon = str.find(':');
+    if (colon == std::string_view::npos) {
+        return {Position::NONE, Position::NONE};
+    }
+    Position first = Position::FromString(str.substr(0, colon));
+    Position second = Position::FromString(str.substr(colon + 1));
+    if (!first.IsValid() || !second.IsValid()) {
+        return {Position::NONE, Position::NONE};
+    }
+    return FromCorners(first, second);
+}
+
 bool Size::operator==(Size rhs) const {
     return cols == rhs.cols && rows == rhs.rows;
 }
\ No newline at end of file
@@ -0,0 +1,117 @@
+#include "table_writer.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <locale>
+
+namespace {
+
+// Запас буфера под число: с точностью до MAX_FAST_PRECISION знаков
+// to_chars в формате general пишет не больше precision + 10 символов
+constexpr int MAX_FAST_PRECISION = 64;
+constexpr size_t MAX_NUMBER_SIZE = MAX_FAST_PRECISION + 16;
+
+}  // namespace
+
+
+TableWriter::TableWriter(std::ostream& output)
+    : output_(output)
+    , buffer_(std::make_unique<char[]>(BUFFER_SIZE))
+    , expression_out_(this)
+    , number_out_(this) {
+    setp(buffer_.get(), buffer_.get() + BUFFER_SIZE);
+
+    // числа без floatfield, showpoint, showpos и uppercase в локали "C"
+    // operator<< печатает как printf("%.*g") - так же печатает to_chars
+    const std::ios_base::fmtflags number_flags =
+        std::ios_base::floatfield | std::ios_base::showpoint | std::ios_base::showpos | std::ios_base::uppercase;
+    precision_ = static_cast<int>(output.precision());
+    is_default_number_format_ = (output.flags() & number_flags) == 0 && precision_ >= 0
+                                && precision_ <= MAX_FAST_PRECISION && output.getloc() == std::locale::classic();
+    // точность 0 в %g означает 1; больше 18 цифр в int64_t не помещается
+    integer_limit_ = std::pow(10., std::clamp(precision_, 1, 18));
+    if (!is_default_number_format_) {
+        number_out_.copyfmt(output);
+        number_out_.exceptions(std::ios_base::goodbit);
+        number_out_.tie(nullptr);
+        number_out_.width(0);
+    }
+}
+
+
+void TableWriter::Write(char c, size_t count) {
+    while (count > 0) {
+        if (pptr() == epptr()) {
+            Flush();
+        }
+        const size_t part = std::min(count, GetFreeSize());
+        std::memset(pptr(), c, part);
+        pbump(static_cast<int>(part));
+        count -= part;
+    }
+}
+
+
+void TableWriter::Write(std::string_view text) {
+    if (text.empty()) {
+        return;
+    }
+    if (text.size() > GetFreeSize()) {
+        Flush();
+        // длинный текст не копируется в буфер
+        if (text.size() >= BUFFER_SIZE) {
+            output_.write(text.data(), static_cast<std::streamsize>(text.size()));
+            return;
+        }
+    }
+    std::memcpy(pptr(), text.data(), text.size());
+    pbump(static_cast<int>(text.size()));
+}
+
+
+void TableWriter::Write(double number) {
+    if (!is_default_number_format_) {
+        number_out_ << number;
+        return;
+    }
+    if (GetFreeSize() < MAX_NUMBER_SIZE) {
+        Flush();
+    }
+    // целое, в котором не больше precision цифр, %g печатает без точки и
+    // экспоненты - так же, как целочисленный to_chars, но тот заметно быстрее
+    // (-0 печатается со знаком, поэтому идёт общим путём)
+    std::to_chars_result result;
+    if (std::abs(number) < integer_limit_ && number == std::trunc(number) && !(number == 0 && std::signbit(number))) {
+        result = std::to_chars(pptr(), epptr(), static_cast<int64_t>(number));
+    } else {
+        result = std::to_chars(pptr(), epptr(), number, std::chars_format::general, precision_);
+    }
+    pbump(static_cast<int>(result.ptr - pptr()));
+}
+
+
+void TableWriter::WriteExpression(const FormulaInterface& formula) {
+    formula.PrintExpression(expression_out_);
+}
+
+
+void TableWriter::Flush() {
+    if (pptr() != pbase()) {
+        output_.write(pbase(), pptr() - pbase());
+        setp(buffer_.get(), buffer_.get() + BUFFER_SIZE);
+    }
+}
+
+
+int TableWriter::overflow(int c) {
+    Flush();
+    if (traits_type::eq_int_type(c, traits_type::eof())) {
+        return traits_type::not_eof(c);
+    }
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+    return c;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "common.h"
+#include "formula.h"
+
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <string_view>
+
+/*
+Буферизованная запись таблицы в поток для Sheet::PrintValues и Sheet::PrintTexts.
+Всё пишется в буфер BUFFER_SIZE байт, который уходит в поток одним write.
+Числа форматируются std::to_chars прямо в буфер - побайтно так же, как
+operator<< с форматом потока по умолчанию. Если формат у потока свой
+(fixed, showpos, другая локаль и т.п.), число печатается через num_put
+с настройками потока, тоже в буфер.
+TableWriter сам является streambuf: выражения формул печатаются в буфер
+без промежуточной строки (см. FormulaInterface::PrintExpression)
+*/
+class TableWriter final : private std::streambuf {
+public:
+    static constexpr size_t BUFFER_SIZE = 1 << 16;
+
+    explicit TableWriter(std::ostream& output);
+    TableWriter(const TableWriter&) = delete;
+    TableWriter& operator=(const TableWriter&) = delete;
+
+    void Write(char c, size_t count = 1);
+    void Write(std::string_view text);
+    void Write(double number);
+    void Write(FormulaError error) {
+        Write(error.ToString());
+    }
+
+    // Выражение формулы, как его возвращает FormulaInterface::GetExpression
+    void WriteExpression(const FormulaInterface& formula);
+
+    // Отдаёт буфер в поток. Вызывается в конце записи: деструктор не пишет в поток
+    void Flush();
+
+private:
+    std::ostream& output_;
+    std::unique_ptr<char[]> buffer_;
+    // поток над буфером с форматом по умолчанию - для выражений формул
+    std::ostream expression_out_;
+    // поток над буфером с форматом output_ - для чисел, если формат не по умолчанию
+    std::ostream number_out_;
+    bool is_default_number_format_ = true;
+    int precision_ = 6;
+    // целые числа по модулю меньше этого печатаются без to_chars для double
+    double integer_limit_ = 1e6;
+
+    size_t GetFreeSize() const {
+        return static_cast<size_t>(epptr() - pptr());
+    }
+
+    int overflow(int c) override;
+};
@@ -0,0 +1,80 @@
+#include "topological_order.h"
+
+#include "cell.h"
+
+#include <algorithm>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+bool OrderLess(const Cell* lhs, const Cell* rhs) {
+    return lhs->GetOrderIndex() < rhs->GetOrderIndex();
+}
+
+}  // namespace
+
+
+bool TopologicalOrder::AddDependency(Cell* input, Cell* dependent) {
+    if (input == dependent) {
+        return false;
+    }
+    const int64_t lower_bound = dependent->GetOrderIndex();
+    const int64_t upper_bound = input->GetOrderIndex();
+    if (upper_bound < lower_bound) {
+        return true;
+    }
+
+    // Ячейки из области [lower_bound, upper_bound], зависящие от dependent.
+    // Если среди них есть input - получился бы цикл
+    std::vector<Cell*> forward = {dependent};
+    std::unordered_set<Cell*> visited = {dependent};
+    bool is_cycle = false;
+    for (size_t i = 0; i < forward.size() && !is_cycle; ++i) {
+        forward[i]->ForEachDependent([&](Cell* next) {
+            if (next == input) {
+                is_cycle = true;
+            } else if (next->GetOrderIndex() < upper_bound && visited.insert(next).second) {
+                forward.push_back(next);
+            }
+        });
+    }
+    if (is_cycle) {
+        return false;
+    }
+
+    // Ячейки из той же области, от которых зависит input
+    std::vector<Cell*> backward = {input};
+    visited.insert(input);
+    for (size_t i = 0; i < backward.size(); ++i) {
+        backward[i]->ForEachInput([&](Cell* next) {
+            if (next->GetOrderIndex() > lower_bound && visited.insert(next).second) {
+                backward.push_back(next);
+            }
+        });
+    }
+
+    // Занятые найденными ячейками номера раздаём заново: сначала входам,
+    // затем зависимым, сохраняя взаимный порядок внутри каждой группы
+    std::sort(forward.begin(), forward.end(), OrderLess);
+    std::sort(backward.begin(), backward.end(), OrderLess);
+
+    std::vector<int64_t> indexes;
+    indexes.reserve(forward.size() + backward.size());
+    for (const Cell* cell : backward) {
+        indexes.push_back(cell->GetOrderIndex());
+    }
+    for (const Cell* cell : forward) {
+        indexes.push_back(cell->GetOrderIndex());
+    }
+    std::sort(indexes.begin(), indexes.end());
+
+    size_t next_index = 0;
+    for (Cell* cell : backward) {
+        cell->SetOrderIndex(indexes[next_index++]);
+    }
+    for (Cell* cell : forward) {
+        cell->SetOrderIndex(indexes[next_index++]);
+    }
+    return true;
+}
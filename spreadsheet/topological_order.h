@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+class Cell;
+
+/*
+Динамический топологический порядок ячеек (алгоритм Пирса-Келли).
+У каждой ячейки есть номер GetOrderIndex(): ячейка, на которую ссылается формула,
+всегда стоит раньше формулы. Ссылка, не нарушающая порядок, добавляется за O(1).
+Иначе переупорядочивается только область между номерами концов ссылки:
+ячейки, достижимые из формулы по зависимым, и ячейки, из которых достижим
+вход, по ссылкам. Если формула достижима из самого входа - ссылка замкнёт цикл.
+*/
+class TopologicalOrder {
+public:
+    // Номер для новой ячейки, которая пока ни на что не ссылается и на которую
+    // никто не ссылается. Сверху - для ячеек, которые затем начнут ссылаться
+    // на другие, снизу - для ячеек, создаваемых как вход формулы
+    int64_t NextTop() {
+        return next_top_++;
+    }
+    int64_t NextBottom() {
+        return next_bottom_--;
+    }
+    // Выше ли номер всех остальных (последний из выданных NextTop)
+    bool IsTop(int64_t index) const {
+        return index == next_top_ - 1;
+    }
+
+    // Учитывает в порядке ссылку dependent -> input (input - вход формулы dependent).
+    // Возвращает false, если ссылка замкнёт цикл; порядок при этом не меняется.
+    // Порядок, полученный после успешного вызова, верен и без этой ссылки,
+    // поэтому саму ссылку можно добавить в граф позже
+    bool AddDependency(Cell* input, Cell* dependent);
+
+private:
+    int64_t next_top_ = 0;
+    int64_t next_bottom_ = -1;
+};